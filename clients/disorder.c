@@ -327,6 +327,17 @@ static void cf_random_enable(char attribute((unused)) **argv) {
   if(disorder_random_enable(getclient())) exit(EXIT_FAILURE);
 }
 
+static void cf_speaker_stats(char attribute((unused)) **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_speaker_stats(getclient(), &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
 static void cf_stats(char attribute((unused)) **argv) {
   char **vec;
   int nvec;
@@ -447,6 +458,17 @@ static void cf_new(char **argv) {
     xprintf("%s\n", nullcheck(utf82mb(*vec++)));
 }
 
+static void cf_metrics(char **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_metrics(getclient(), argv[0], &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
 static void cf_rtp_address(char attribute((unused)) **argv) {
   char *address, *port;
 
@@ -761,6 +783,8 @@ static const struct client_command {
                       "Get the length of TRACK in seconds" },
   { "log",            0, 0, cf_log, 0, "",
                       "Copy event log to stdout" },
+  { "metrics",        0, 1, cf_metrics, 0, "[prometheus]",
+                      "Display server metrics" },
   { "move",           2, 2, cf_move, 0, "TRACK DELTA",
                       "Move a track in the queue" },
   { "new",            0, 1, cf_new, isarg_integer, "[MAX]",
@@ -830,6 +854,8 @@ static const struct client_command {
                       "Create the guest login" },
   { "shutdown",       0, 0, cf_shutdown, 0, "",
                       "Shut down the daemon" },
+  { "speaker-stats",  0, 0, cf_speaker_stats, 0, "",
+                      "Display speaker health information" },
   { "stats",          0, 0, cf_stats, 0, "",
                       "Display server statistics" },
   { "tags",           0, 0, cf_tags, 0, "",
@@ -24,66 +24,77 @@
 #include <pthread.h>
 
 #include "mem.h"
-#include "vector.h"
-#include "heap.h"
 #include "playrtp.h"
 
+/** @brief Packets returned by the player
+ *
+ * playrtp_free_packet() pushes packets onto this list without taking a lock;
+ * playrtp_new_packet() takes the whole list at once when it needs more.
+ * Since only one thread ever removes packets from the list, and it only does
+ * so by emptying it, there is no ABA problem.
+ */
+static struct packet *returned_packets;
+
 /** @brief Linked list of free packets
  *
  * This is a linked list of formerly used packets.  For preference we re-use
  * packets that have already been used rather than unused ones, to limit the
  * size of the program's working set.  If there are no free packets in the list
- * we try @ref next_free_packet instead.
+ * we try @ref returned_packets and then @ref next_free_packet instead.
  *
- * Must hold @ref lock when accessing this.
+ * Only accessed by the receiving thread.
  */
-static union free_packet *free_packets;
+static struct packet *free_packets;
 
 /** @brief Array of new free packets 
  *
  * There are @ref count_free_packets ready to use at this address.  If there
  * are none left we allocate more memory.
  *
- * Must hold @ref lock when accessing this.
+ * Only accessed by the receiving thread.
  */
-static union free_packet *next_free_packet;
+static struct packet *next_free_packet;
 
 /** @brief Count of new free packets at @ref next_free_packet
  *
- * Must hold @ref lock when accessing this.
+ * Only accessed by the receiving thread.
  */
 static size_t count_free_packets;
 
-/** @brief Lock protecting packet allocator */
-static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/** @brief Return a new packet */
+/** @brief Return a new packet
+ *
+ * Must only be called from the receiving thread.
+ */
 struct packet *playrtp_new_packet(void) {
   struct packet *p;
-  
-  pthread_mutex_lock(&mem_lock);
+
+  if(!free_packets)
+    free_packets = __atomic_exchange_n(&returned_packets, NULL,
+                                       __ATOMIC_ACQUIRE);
   if(free_packets) {
-    p = &free_packets->p;
-    free_packets = free_packets->next;
+    p = free_packets;
+    free_packets = p->next;
   } else {
     if(!count_free_packets) {
-      next_free_packet = xcalloc(1024, sizeof (union free_packet));
+      next_free_packet = xcalloc(1024, sizeof (struct packet));
       count_free_packets = 1024;
     }
-    p = &(next_free_packet++)->p;
+    p = next_free_packet++;
     --count_free_packets;
   }
-  pthread_mutex_unlock(&mem_lock);
   return p;
 }
 
-/** @brief Free a packet */
+/** @brief Free a packet
+ *
+ * May be called from any thread.
+ */
 void playrtp_free_packet(struct packet *p) {
-  union free_packet *u = (union free_packet *)p;
-  pthread_mutex_lock(&mem_lock);
-  u->next = free_packets;
-  free_packets = u;
-  pthread_mutex_unlock(&mem_lock);
+  p->next = __atomic_load_n(&returned_packets, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&returned_packets, &p->next, p,
+                                     1/*weak*/,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
 }
 
 
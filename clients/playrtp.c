@@ -24,20 +24,18 @@
  * systems.  There is no support for Microsoft Windows yet, and that will in
  * fact probably an entirely separate program.
  *
- * The program runs (at least) three threads:
+ * The program runs (at least) two threads:
  *
- * listen_thread() is responsible for reading RTP packets off the wire and
- * adding them to the linked list @ref received_packets, assuming they are
- * basically sound.
- *
- * queue_thread() takes packets off this linked list and adds them to @ref
- * packets (an operation which might be much slower due to contention for @ref
- * lock).
+ * listen_thread() is responsible for reading RTP packets off the wire, in
+ * batches where the platform allows, and adding them to the reorder buffer
+ * @ref reorder, assuming they are basically sound.
  *
  * control_thread() accepts commands from Disobedience (or anything else).
  *
  * The main thread activates and deactivates audio playing via the @ref
  * lib/uaudio.h API (which probably implies at least one further thread).
+ * playrtp_callback() takes packets directly from @ref reorder; it does not
+ * contend with listen_thread() for any lock.
  *
  * Sometimes it happens that there is no audio available to play.  This may
  * because the server went away, or a packet was dropped, or the server
@@ -68,6 +66,9 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#if HAVE_OPUS
+#include <opus.h>
+#endif
 
 #include "log.h"
 #include "mem.h"
@@ -78,13 +79,14 @@
 #include "rtp.h"
 #include "defs.h"
 #include "vector.h"
-#include "heap.h"
 #include "timeval.h"
 #include "client.h"
 #include "playrtp.h"
 #include "inputline.h"
 #include "version.h"
 #include "uaudio.h"
+#include "varispeed.h"
+#include "byte-order.h"
 
 /** @brief Obsolete synonym */
 #ifndef IPV6_JOIN_GROUP
@@ -108,42 +110,32 @@ unsigned minbuffer;
  */
 static unsigned maxbuffer;
 
-/** @brief Received packets
- * Protected by @ref receive_lock
+/** @brief Reorder buffer
  *
- * Received packets are added to this list, and queue_thread() picks them off
- * it and adds them to @ref packets.  Whenever a packet is added to it, @ref
- * receive_cond is signalled.
- */
-struct packet *received_packets;
-
-/** @brief Tail of @ref received_packets
- * Protected by @ref receive_lock
- */
-struct packet **received_tail = &received_packets;
-
-/** @brief Lock protecting @ref received_packets 
+ * Each received packet is stored in the slot given by its sequence number
+ * modulo @ref REORDER_SLOTS, so packets that arrive out of order are
+ * nevertheless played in order.
  *
- * Only listen_thread() and queue_thread() ever hold this lock.  It is vital
- * that queue_thread() not hold it any longer than it strictly has to. */
-pthread_mutex_t receive_lock = PTHREAD_MUTEX_INITIALIZER;
+ * This is a single-producer, single-consumer structure and needs no lock.
+ * listen_thread() only ever fills empty slots; the player (the audio
+ * callback, or the main thread while re-buffering, serialized by @ref
+ * play_lock) only ever empties full ones.  A packet whose slot is still
+ * occupied is dropped.
+ */
+struct packet *reorder[REORDER_SLOTS];
 
-/** @brief Condition variable signalled when @ref received_packets is updated
+/** @brief Highest sequence number received
  *
- * Used by listen_thread() to notify queue_thread() that it has added another
- * packet to @ref received_packets. */
-pthread_cond_t receive_cond = PTHREAD_COND_INITIALIZER;
-
-/** @brief Length of @ref received_packets */
-uint32_t nreceived;
-
-/** @brief Binary heap of received packets */
-struct pheap packets;
+ * Written by listen_thread(), read by the player.  If the stream jumps then
+ * this follows it, even backwards.
+ */
+static uint16_t latest_seq;
 
 /** @brief Total number of samples available
  *
  * We make this volatile because we inspect it without a protecting lock,
- * so the usual pthread_* guarantees aren't available.
+ * so the usual pthread_* guarantees aren't available.  It is only modified
+ * with atomic operations.
  */
 volatile uint32_t nsamples;
 
@@ -154,22 +146,217 @@ volatile uint32_t nsamples;
  */
 uint32_t next_timestamp;
 
+/** @brief Sequence number of next packet to play
+ *
+ * Only valid if @ref active is nonzero.
+ */
+uint16_t next_seq;
+
 /** @brief True if actively playing
  *
  * This is true when playing and false when just buffering. */
 int active;
 
-/** @brief Lock protecting @ref packets */
+/** @brief Set when the player has run out of packets to play */
+static int underrun;
+
+/** @brief Set while listen_thread() is waiting for space in the buffer */
+static int receiver_waiting;
+
+/** @brief Lock used to wait for changes in buffer occupancy
+ *
+ * The audio callback never waits for this lock.
+ */
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
-/** @brief Condition variable signalled whenever @ref packets is changed */
+/** @brief Condition variable signalled when buffer occupancy changes */
 pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 
+/** @brief Lock serializing the consuming side of @ref reorder
+ *
+ * This is held by the audio callback and by playrtp_fill_buffer().  Since the
+ * latter is only called while playing is deactivated, the callback never has
+ * to wait for it in practice.
+ */
+pthread_mutex_t play_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Packet counters, reported by @c --monitor
+ *
+ * Only modified by listen_thread(), except for @c concealed which is only
+ * modified by the audio callback.
+ */
+static struct {
+  /** @brief Packets added to @ref reorder */
+  uint32_t received;
+
+  /** @brief Packets discarded because they arrived too late */
+  uint32_t late;
+
+  /** @brief Packets discarded because they had already been received */
+  uint32_t duplicates;
+
+  /** @brief Packets discarded because their slot was occupied */
+  uint32_t collided;
+
+  /** @brief Lost packets reconstructed from FEC packets */
+  uint32_t recovered;
+
+  /** @brief Gaps filled by loss concealment */
+  uint32_t concealed;
+} stats;
+
+/** @brief Target buffer occupancy in samples
+ *
+ * This starts at @ref minbuffer and then follows the jitter estimate, unless
+ * @c --fixed-buffer was given.  Modified with @ref play_lock held.
+ */
+static volatile uint32_t target_buffer;
+
+/** @brief Sample rate of the stream being received
+ *
+ * Written by listen_thread().  Sample counts and timestamps in @ref reorder
+ * are at this rate; the rate adjuster converts to @ref uaudio_rate.
+ */
+static uint32_t stream_rate = 44100;
+
+/** @brief Set to keep @ref target_buffer fixed */
+static int fixed_buffer;
+
+/** @brief Estimated interarrival jitter in microseconds
+ *
+ * Written by listen_thread(); see note_arrival().
+ */
+static int32_t jitter_us;
+
+/** @brief Estimated rate error of the sender's clock in parts per billion
+ *
+ * Positive if the sender is fast.  Written by listen_thread(); see
+ * note_arrival().
+ */
+static int32_t skew_ppb;
+
+/** @brief Current playback rate adjustment in parts per billion
+ *
+ * Positive if we're playing faster than nominal.  Only used for reporting.
+ */
+static int32_t adjust_ppb;
+
+/** @brief Loss concealment state
+ *
+ * Protected by @ref play_lock.  See conceal_start().
+ */
+static struct {
+  /** @brief Most recent samples played, oldest first */
+  int16_t history[CONCEAL_HISTORY];
+
+  /** @brief Number of samples in @c history */
+  size_t nhistory;
+
+  /** @brief Waveform being repeated */
+  int16_t pattern[CONCEAL_MAX_PERIOD * 2];
+
+  /** @brief Length of @c pattern in samples, or 0 if not concealing */
+  size_t period;
+
+  /** @brief Index of next sample of @c pattern */
+  size_t position;
+
+  /** @brief Samples generated since the gap started */
+  size_t generated;
+
+  /** @brief Samples left to crossfade into real audio */
+  size_t ramp;
+} conceal;
+
+/** @brief State of the playback rate controller
+ *
+ * Protected by @ref play_lock.  See playrtp_adjust().
+ */
+static struct {
+  /** @brief Smoothed buffer occupancy in samples */
+  double fill;
+
+  /** @brief Target buffer occupancy in samples
+   *
+   * @ref target_buffer is this, truncated.
+   */
+  double target;
+
+  /** @brief Integral term in controller */
+  double integral;
+
+  /** @brief Ratio of output to input samples */
+  double ratio;
+
+  /** @brief Size of most recent packet played */
+  uint32_t packet_samples;
+} control;
+
+/** @brief Rate adjuster for playback
+ *
+ * Protected by @ref play_lock.
+ */
+static struct varispeed drift;
+
+#if HAVE_OPUS
+/** @brief Opus decoder state
+ *
+ * Protected by @ref play_lock.  See opus_play_packet().
+ */
+static struct {
+  /** @brief Decoder, or a null pointer if not created yet */
+  OpusDecoder *decoder;
+
+  /** @brief SSRC of the last packet decoded, in network byte order */
+  uint32_t ssrc;
+
+  /** @brief Size of the last packet decoded in samples
+   *
+   * 0 if nothing has been decoded since the decoder was reset, in which case
+   * it has nothing to base loss concealment on.
+   */
+  size_t frame_samples;
+
+  /** @brief Loss concealment output, see opus_play_conceal() */
+  int16_t pcm[MAXSAMPLES];
+
+  /** @brief Timestamp of the first sample in @c pcm */
+  uint32_t pcm_timestamp;
+
+  /** @brief Number of samples in @c pcm, or 0 if it's empty */
+  size_t pcm_samples;
+} opus_play;
+
+/** @brief Forget the Opus decoder's state
+ *
+ * Used when play (re)starts, since the next packet played need not follow
+ * the last one decoded.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void opus_play_reset(void) {
+  if(opus_play.decoder)
+    opus_decoder_ctl(opus_play.decoder, OPUS_RESET_STATE);
+  opus_play.frame_samples = 0;
+  opus_play.pcm_samples = 0;
+}
+#endif
+
+/** @brief Samples fetched from @ref reorder but not yet played
+ *
+ * Protected by @ref play_lock.
+ */
+static int16_t staged[STAGED_SAMPLES];
+
+/** @brief Start of unplayed samples in @ref staged */
+static size_t staged_start;
+
+/** @brief End of unplayed samples in @ref staged */
+static size_t staged_end;
+
 /** @brief Backend to play with */
 static const struct uaudio *backend;
 
-HEAP_DEFINE(pheap, struct packet *, lt_packet);
-
 /** @brief Control socket or NULL */
 const char *control_socket;
 
@@ -219,6 +406,7 @@ static const struct option options[] = {
   { "config", required_argument, 0, 'C' },
   { "user-config", required_argument, 0, 'u' },
   { "monitor", no_argument, 0, 'M' },
+  { "fixed-buffer", no_argument, 0, 'F' },
   { 0, 0, 0, 0 }
 };
 
@@ -301,90 +489,441 @@ static void *control_thread(void attribute((unused)) *arg) {
   }
 }
 
-/** @brief Drop the first packet
+/** @brief Wait on @ref cond for at most a given time
+ * @param us Maximum time to wait in microseconds
  *
- * Assumes that @ref lock is held. 
+ * Must be called with @ref lock held.  Used where the thread that would
+ * signal @ref cond might not be able to.
  */
-static void drop_first_packet(void) {
-  if(pheap_count(&packets)) {
-    struct packet *const p = pheap_remove(&packets);
-    nsamples -= p->nsamples;
-    playrtp_free_packet(p);
+static void timed_wait(long us) {
+  struct timeval now;
+  struct timespec ts;
+
+  xgettimeofday(&now, NULL);
+  now = tvadd(now, (struct timeval){ us / 1000000, us % 1000000 });
+  ts.tv_sec = now.tv_sec;
+  ts.tv_nsec = now.tv_usec * 1000;
+  pthread_cond_timedwait(&cond, &lock, &ts);
+}
+
+/** @brief Wake up threads waiting on @ref cond, if it can be done at once
+ *
+ * Used from the audio callback, which must not wait for @ref lock.  If the
+ * lock is busy then the waiter will notice the change next time it wakes up.
+ */
+static void wake_nowait(void) {
+  if(!pthread_mutex_trylock(&lock)) {
     pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
   }
 }
 
-/** @brief Background thread adding packets to heap
+/** @brief Return the packet with a given sequence number, if present
+ * @param seq Sequence number
+ * @return Packet or NULL
  *
- * This just transfers packets from @ref received_packets to @ref packets.  It
- * is important that it holds @ref receive_lock for as little time as possible,
- * in order to minimize the interval between calls to read() in
- * listen_thread().
+ * The packet remains in @ref reorder.  Any older packet found in the slot (one
+ * that arrived after the player had gone past it) is discarded.
+ *
+ * Must be called with @ref play_lock held.
  */
-static void *queue_thread(void attribute((unused)) *arg) {
-  struct packet *p;
+static struct packet *reorder_peek(uint16_t seq) {
+  struct packet **const slot = &reorder[seq % REORDER_SLOTS];
+  struct packet *const p = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
 
-  for(;;) {
-    /* Get the next packet */
-    pthread_mutex_lock(&receive_lock);
-    while(!received_packets) {
-      pthread_cond_wait(&receive_cond, &receive_lock);
+  if(!p || p->seq == seq)
+    return p;
+  if(lt16(p->seq, seq)) {
+    __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&nsamples, p->nsamples, __ATOMIC_RELAXED);
+    playrtp_free_packet(p);
+  }
+  return NULL;
+}
+
+/** @brief Remove a packet from @ref reorder and free it
+ * @param p Packet, as returned by reorder_peek()
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void reorder_drop(struct packet *p) {
+  __atomic_store_n(&reorder[p->seq % REORDER_SLOTS], NULL, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&nsamples, p->nsamples, __ATOMIC_RELAXED);
+  playrtp_free_packet(p);
+  if(__atomic_load_n(&receiver_waiting, __ATOMIC_RELAXED))
+    wake_nowait();
+}
+
+/** @brief Add a packet to @ref reorder
+ * @param p Packet
+ * @return 0 on success, -1 if the slot is occupied
+ *
+ * Only called from listen_thread().
+ */
+static int reorder_insert(struct packet *p) {
+  struct packet **const slot = &reorder[p->seq % REORDER_SLOTS];
+  const struct packet *occupant;
+
+  if((occupant = __atomic_load_n(slot, __ATOMIC_ACQUIRE))) {
+    /* It's safe to look at the occupant even if the player is freeing it,
+     * since only this thread ever reuses packets */
+    if(occupant->seq == p->seq)
+      ++stats.duplicates;
+    else {
+      disorder_info("dropping packet, sequence %u: slot occupied", p->seq);
+      ++stats.collided;
+    }
+    return -1;
+  }
+  /* Count the samples before publishing the packet, so the player can never
+   * subtract them first */
+  __atomic_add_fetch(&nsamples, p->nsamples, __ATOMIC_RELAXED);
+  __atomic_store_n(slot, p, __ATOMIC_RELEASE);
+  if(lt16(latest_seq, p->seq)
+     || (uint16_t)(latest_seq - p->seq) >= REORDER_SLOTS)
+    __atomic_store_n(&latest_seq, p->seq, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/** @brief Start playing from the oldest packet in @ref reorder
+ *
+ * Used when (re)starting play and if the stream jumps to a sequence number
+ * too far from the one we were expecting.  Packets too old to be reachable
+ * are discarded.  Sets @ref next_seq and @ref next_timestamp.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void reorder_resync(void) {
+  const uint16_t latest = __atomic_load_n(&latest_seq, __ATOMIC_ACQUIRE);
+  const struct packet *oldest = NULL;
+  uint16_t age, oldest_age = 0;
+  size_t n;
+
+  for(n = 0; n < REORDER_SLOTS; ++n) {
+    struct packet *const p = __atomic_load_n(&reorder[n], __ATOMIC_ACQUIRE);
+    if(!p)
+      continue;
+    age = latest - p->seq;
+    if(age >= REORDER_SLOTS)
+      reorder_drop(p);
+    else if(!oldest || age > oldest_age) {
+      oldest = p;
+      oldest_age = age;
+    }
+  }
+  if(oldest) {
+    next_seq = oldest->seq;
+    next_timestamp = oldest->timestamp;
+  }
+}
+
+/** @brief Update arrival statistics for a packet
+ * @param timestamp RTP timestamp of packet
+ * @param when Arrival time
+ *
+ * The jitter estimate follows RFC 3550 s6.4.1.
+ *
+ * The skew estimate compares the minimum transit time (arrival time less the
+ * time implied by the RTP timestamp) over successive windows of @ref
+ * SKEW_WINDOW seconds.  Taking the minimum means that jitter mostly cancels
+ * out.
+ *
+ * Only called from listen_thread().
+ */
+static void note_arrival(uint32_t timestamp, const struct timeval *when) {
+  static int started, have_window, have_previous, have_skew;
+  static uint32_t last_timestamp;
+  static double stream_time, last_transit, jitter, skew;
+  static double window_start, window_min, previous_start, previous_min;
+  const double now = tvdouble(*when);
+  const double rate = (double)__atomic_load_n(&stream_rate, __ATOMIC_RELAXED)
+    * uaudio_channels;
+  const int32_t delta = timestamp - last_timestamp;
+
+  if(started && delta <= 0)
+    return;                             /* reordered or duplicate */
+  if(!started || delta > SKEW_WINDOW * rate) {
+    /* First packet, or the stream has jumped */
+    started = 1;
+    have_window = have_previous = 0;
+    stream_time = 0;
+    last_transit = now;
+  } else
+    stream_time += delta / rate;
+  last_timestamp = timestamp;
+  const double transit = now - stream_time;
+  jitter += (fabs(transit - last_transit) - jitter) / 16;
+  last_transit = transit;
+  __atomic_store_n(&jitter_us, (int32_t)(jitter * 1000000), __ATOMIC_RELAXED);
+  if(!have_window) {
+    window_start = now;
+    window_min = transit;
+    have_window = 1;
+  } else if(transit < window_min)
+    window_min = transit;
+  if(now - window_start >= SKEW_WINDOW) {
+    if(have_previous) {
+      /* If the sender is fast then transit times shrink */
+      const double s = (previous_min - window_min)
+        / (window_start - previous_start);
+      skew = have_skew ? skew + (s - skew) / 4 : s;
+      have_skew = 1;
+      if(fabs(skew) < 0.01)
+        __atomic_store_n(&skew_ppb, (int32_t)(skew * 1e9), __ATOMIC_RELAXED);
     }
-    p = received_packets;
-    received_packets = p->next;
-    if(!received_packets)
-      received_tail = &received_packets;
-    --nreceived;
-    pthread_mutex_unlock(&receive_lock);
-    /* Add it to the heap */
+    previous_start = window_start;
+    previous_min = window_min;
+    have_previous = 1;
+    have_window = 0;
+  }
+}
+
+/** @brief Check and store a received packet
+ * @param p Packet, with @c samples_raw filled in
+ * @param header RTP header
+ * @param n Total size of packet including header
+ * @param when Arrival time, or a null pointer for a reconstructed packet
+ * @return 1 if @p p was consumed, 0 if it may be reused
+ *
+ * Reconstructed packets don't contribute to the jitter estimate, since
+ * their arrival time is that of the FEC packet.
+ */
+static int receive_packet(struct packet *p, const struct rtp_header *header,
+                          size_t n, const struct timeval *when) {
+  uint16_t seq;
+  uint32_t timestamp, rate;
+
+  /* Ignore too-short packets */
+  if(n <= sizeof (struct rtp_header)) {
+    disorder_info("ignored a short packet");
+    return 0;
+  }
+  timestamp = htonl(header->timestamp);
+  seq = htons(header->seq);
+  switch(header->mpt & 0x7F) {
+  case 10:                              /* L16 */
+    rate = 44100;
+    break;
+  case RTP_PAYLOAD_OPUS:
+#if HAVE_OPUS
+    /* Opus timestamps count frames but we count samples */
+    timestamp *= 2;
+    rate = RTP_OPUS_RATE;
+    break;
+#else
+    disorder_fatal(0, "received Opus packets but Opus is not supported");
+#endif
+    /* TODO support other RFC3551 media types (when the speaker does) */
+  default:
+    disorder_fatal(0, "unsupported RTP payload type %d", header->mpt & 0x7F);
+  }
+  /* Ignore packets in the past */
+  if(active && lt(timestamp, next_timestamp)) {
+    disorder_info("dropping old packet, timestamp=%"PRIx32" < %"PRIx32,
+         timestamp, next_timestamp);
+    ++stats.late;
+    return 0;
+  }
+  p->next = 0;
+  p->flags = 0;
+  p->timestamp = timestamp;
+  p->seq = seq;
+  /* Convert to target format */
+  if(header->mpt & 0x80)
+    p->flags |= IDLE;
+#if HAVE_OPUS
+  if(rate == RTP_OPUS_RATE) {
+    /* Opus data is decoded when it's played, since the decoder must see
+     * packets in order.  All we need now is its duration. */
+    const int frames
+      = opus_packet_get_nb_samples((const unsigned char *)p->samples_raw,
+                                   n - sizeof *header, RTP_OPUS_RATE);
+    if(frames <= 0 || frames > MAXSAMPLES / 2) {
+      disorder_info("ignored an invalid Opus packet");
+      return 0;
+    }
+    p->nsamples = 2 * frames;
+    p->nbytes = n - sizeof *header;
+    p->ssrc = header->ssrc;
+    p->flags |= OPUS;
+  } else
+#endif
+    p->nsamples = (n - sizeof *header) / sizeof(uint16_t);
+  __atomic_store_n(&stream_rate, rate, __ATOMIC_RELAXED);
+  if(when)
+    note_arrival(timestamp, when);
+  /* See if packet is silent */
+  if(!(p->flags & OPUS) && zero16_buffer(p->samples_raw, p->nsamples))
+    p->flags |= SILENT;
+  if(logfp)
+    fprintf(logfp, "sequence %u timestamp %"PRIx32" length %"PRIx32" end %"PRIx32"\n",
+            seq, timestamp, p->nsamples, timestamp + p->nsamples);
+  /* Stop reading if we've reached the maximum.
+   *
+   * This is rather unsatisfactory: it means that if packets get heavily
+   * out of order then we guarantee dropouts.  But for now...
+   *
+   * The player wakes us when it frees a packet, but it won't wait for the lock
+   * to do so, so we don't rely on it. */
+  if(nsamples >= maxbuffer) {
     pthread_mutex_lock(&lock);
-    pheap_insert(&packets, p);
-    nsamples += p->nsamples;
-    pthread_cond_broadcast(&cond);
+    __atomic_store_n(&receiver_waiting, 1, __ATOMIC_RELAXED);
+    while(nsamples >= maxbuffer)
+      timed_wait(20000);
+    __atomic_store_n(&receiver_waiting, 0, __ATOMIC_RELAXED);
     pthread_mutex_unlock(&lock);
   }
-#if HAVE_STUPID_GCC44
-  return NULL;
-#endif
+  if(reorder_insert(p))
+    return 0;
+  ++stats.received;
+  return 1;
 }
 
-/** @brief Background thread collecting samples
+/** @brief Use an FEC packet to reconstruct a lost packet
+ * @param p Packet, with FEC data in @c samples_raw
+ * @param header RTP header
+ * @param n Total size of packet including header
+ * @return 1 if @p p was consumed, 0 if it may be reused
  *
- * This function collects samples, perhaps converts them to the target format,
- * and adds them to the packet list.
+ * If exactly one packet of the group protected by @p p is missing from @ref
+ * reorder then it is reconstructed in @p p and stored as if it had just
+ * arrived, except that it is not used to estimate jitter.  Packets that
+ * arrive after their FEC packet don't benefit from it.
  *
- * It is crucial that the gap between successive calls to read() is as small as
- * possible: otherwise packets will be dropped.
+ * It's safe to look at the other packets of the group even if the player is
+ * freeing them, since only this thread ever reuses packets.
  *
- * We use a binary heap to ensure that the unavoidable effort is at worst
- * logarithmic in the total number of packets - in fact if packets are mostly
- * received in order then we will largely do constant work per packet since the
- * newest packet will always be last.
+ * Packets with other kinds of header extension are ignored.
  *
- * Of more concern is that we must acquire the lock on the heap to add a packet
- * to it.  If this proves a problem in practice then the answer would be
- * (probably doubly) linked list with new packets added the end and a second
- * thread which reads packets off the list and adds them to the heap.
+ * Only called from listen_thread().
+ */
+static int receive_fec(struct packet *p, const struct rtp_header *header,
+                       size_t n) {
+  const struct rtp_extension *extension = (const void *)p->samples_raw;
+  const struct rtp_fec *fec = (const void *)(extension + 1);
+  uint8_t *const data = (uint8_t *)p->samples_raw;
+  const struct packet *group[RTP_FEC_MAX_GROUP];
+  struct rtp_header recovered;
+  uint16_t base, seq, missing = 0, length;
+  uint32_t timestamp;
+  uint8_t mpt;
+  size_t size, bytes, i;
+  int count, k, nmissing = 0;
+
+  if(n < sizeof *header + RTP_FEC_OVERHEAD
+     || ntohs(extension->type) != RTP_EXTENSION_FEC
+     || ntohs(extension->length) != sizeof *fec / 4
+     || (header->mpt & 0x7F) != 10)
+    return 0;
+  size = n - sizeof *header - RTP_FEC_OVERHEAD;
+  base = ntohs(fec->seq);
+  count = fec->count;
+  if(count < 1 || count > RTP_FEC_MAX_GROUP)
+    return 0;
+  /* Find the missing packet */
+  for(k = 0; k < count; ++k) {
+    seq = base + k;
+    group[k] = __atomic_load_n(&reorder[seq % REORDER_SLOTS],
+                               __ATOMIC_ACQUIRE);
+    if(!group[k] || group[k]->seq != seq) {
+      missing = seq;
+      if(++nmissing > 1)
+        return 0;
+    }
+  }
+  if(!nmissing)
+    return 0;
+  /* XOR the others into the FEC payload */
+  mpt = fec->mpt;
+  timestamp = fec->timestamp;
+  length = fec->length;
+  memmove(data, fec + 1, size);
+  for(k = 0; k < count; ++k) {
+    const struct packet *const q = group[k];
+    if((uint16_t)(base + k) == missing)
+      continue;
+    bytes = q->nsamples * sizeof (uint16_t);
+    if(bytes > size)
+      return 0;
+    mpt ^= 10 | (q->flags & IDLE ? 0x80 : 0);
+    timestamp ^= htonl(q->timestamp);
+    length ^= htons(bytes);
+    for(i = 0; i < bytes; ++i)
+      data[i] ^= ((const uint8_t *)q->samples_raw)[i];
+  }
+  length = ntohs(length);
+  if((mpt & 0x7F) != 10 || length > size)
+    return 0;
+  /* Don't bother if it's too late to play it */
+  if(active && lt(ntohl(timestamp), next_timestamp))
+    return 0;
+  recovered.vpxcc = 2 << 6;
+  recovered.mpt = mpt;
+  recovered.seq = htons(missing);
+  recovered.timestamp = timestamp;
+  recovered.ssrc = header->ssrc;
+  if(!receive_packet(p, &recovered, sizeof recovered + length, NULL))
+    return 0;
+  ++stats.recovered;
+  return 1;
+}
+
+#if HAVE_RECVMMSG
+/** @brief One message for recvmmsg() */
+typedef struct mmsghdr receive_message;
+#else
+/** @brief One message for the readv() fallback */
+typedef struct {
+  struct msghdr msg_hdr;
+  unsigned msg_len;
+} receive_message;
+#endif
+
+/** @brief Background thread collecting samples
+ *
+ * This function collects samples, perhaps converts them to the target format,
+ * and adds them to the reorder buffer.
+ *
+ * It is crucial that the gap between successive reads is as small as
+ * possible: otherwise packets will be dropped.  So where recvmmsg() is
+ * available we read up to @ref RECEIVE_BATCH packets per system call, directly
+ * into preallocated packets, and adding a packet to the reorder buffer never
+ * involves a lock.
  *
  * We keep memory allocation (mostly) very fast by keeping pre-allocated
  * packets around; see @ref playrtp_new_packet().
  */
 static void *listen_thread(void attribute((unused)) *arg) {
-  struct packet *p = 0;
-  int n;
-  struct rtp_header header;
-  uint16_t seq;
-  uint32_t timestamp;
-  struct iovec iov[2];
+  struct packet *batch[RECEIVE_BATCH];
+  struct rtp_header headers[RECEIVE_BATCH];
+  struct iovec iov[RECEIVE_BATCH][2];
+  receive_message msgs[RECEIVE_BATCH];
+  struct timeval when;
+  int n, i;
 
+  memset(batch, 0, sizeof batch);
+  memset(msgs, 0, sizeof msgs);
   for(;;) {
-    if(!p)
-      p = playrtp_new_packet();
-    iov[0].iov_base = &header;
-    iov[0].iov_len = sizeof header;
-    iov[1].iov_base = p->samples_raw;
-    iov[1].iov_len = sizeof p->samples_raw / sizeof *p->samples_raw;
-    n = readv(rtpfd, iov, 2);
+    for(i = 0; i < RECEIVE_BATCH; ++i) {
+      if(!batch[i]) {
+        batch[i] = playrtp_new_packet();
+        iov[i][0].iov_base = &headers[i];
+        iov[i][0].iov_len = sizeof headers[i];
+        iov[i][1].iov_base = batch[i]->samples_raw;
+        iov[i][1].iov_len = sizeof batch[i]->samples_raw;
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+      }
+    }
+#if HAVE_RECVMMSG
+    n = recvmmsg(rtpfd, msgs, RECEIVE_BATCH, MSG_WAITFORONE, NULL);
+#else
+    n = readv(rtpfd, iov[0], 2);
+    if(n >= 0) {
+      msgs[0].msg_len = n;
+      n = 1;
+    }
+#endif
     if(n < 0) {
       switch(errno) {
       case EINTR:
@@ -393,89 +932,57 @@ static void *listen_thread(void attribute((unused)) *arg) {
         disorder_fatal(errno, "error reading from socket");
       }
     }
-    /* Ignore too-short packets */
-    if((size_t)n <= sizeof (struct rtp_header)) {
-      disorder_info("ignored a short packet");
-      continue;
-    }
-    timestamp = htonl(header.timestamp);
-    seq = htons(header.seq);
-    /* Ignore packets in the past */
-    if(active && lt(timestamp, next_timestamp)) {
-      disorder_info("dropping old packet, timestamp=%"PRIx32" < %"PRIx32,
-           timestamp, next_timestamp);
-      continue;
-    }
-    /* Ignore packets with the extension bit set. */
-    if(header.vpxcc & 0x10)
-      continue;
-    p->next = 0;
-    p->flags = 0;
-    p->timestamp = timestamp;
-    /* Convert to target format */
-    if(header.mpt & 0x80)
-      p->flags |= IDLE;
-    switch(header.mpt & 0x7F) {
-    case 10:                            /* L16 */
-      p->nsamples = (n - sizeof header) / sizeof(uint16_t);
-      break;
-      /* TODO support other RFC3551 media types (when the speaker does) */
-    default:
-      disorder_fatal(0, "unsupported RTP payload type %d", header.mpt & 0x7F);
-    }
-    /* See if packet is silent */
-    const uint16_t *s = p->samples_raw;
-    n = p->nsamples;
-    for(; n > 0; --n)
-      if(*s++)
-        break;
-    if(!n)
-      p->flags |= SILENT;
-    if(logfp)
-      fprintf(logfp, "sequence %u timestamp %"PRIx32" length %"PRIx32" end %"PRIx32"\n",
-              seq, timestamp, p->nsamples, timestamp + p->nsamples);
-    /* Stop reading if we've reached the maximum.
-     *
-     * This is rather unsatisfactory: it means that if packets get heavily
-     * out of order then we guarantee dropouts.  But for now... */
-    if(nsamples >= maxbuffer) {
-      pthread_mutex_lock(&lock);
-      while(nsamples >= maxbuffer) {
-        pthread_cond_wait(&cond, &lock);
-      }
-      pthread_mutex_unlock(&lock);
-    }
-    /* Add the packet to the receive queue */
-    pthread_mutex_lock(&receive_lock);
-    *received_tail = p;
-    received_tail = &p->next;
-    ++nreceived;
-    pthread_cond_signal(&receive_cond);
-    pthread_mutex_unlock(&receive_lock);
-    /* We'll need a new packet */
-    p = 0;
+    xgettimeofday(&when, NULL);
+    for(i = 0; i < n; ++i)
+      if(headers[i].vpxcc & 0x10
+         ? receive_fec(batch[i], &headers[i], msgs[i].msg_len)
+         : receive_packet(batch[i], &headers[i], msgs[i].msg_len, &when))
+        batch[i] = NULL;
+    /* Let the main thread know there's more data */
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
   }
 }
 
 /** @brief Wait until the buffer is adequately full
  *
- * Must be called with @ref lock held.
+ * Must be called with @ref lock held, and with playing deactivated.
  */
 void playrtp_fill_buffer(void) {
+  size_t n;
+
   /* Discard current buffer contents */
-  while(nsamples) {
-    //fprintf(stderr, "%8u/%u (%u) DROPPING\n", nsamples, maxbuffer, minbuffer);
-    drop_first_packet();
+  pthread_mutex_lock(&play_lock);
+  for(n = 0; n < REORDER_SLOTS; ++n) {
+    struct packet *const p = __atomic_load_n(&reorder[n], __ATOMIC_ACQUIRE);
+    if(p)
+      reorder_drop(p);
   }
+  staged_start = staged_end = 0;
+  pthread_mutex_unlock(&play_lock);
   disorder_info("Buffering...");
-  /* Wait until there's at least minbuffer samples available */
-  while(nsamples < minbuffer) {
-    //fprintf(stderr, "%8u/%u (%u) FILLING\n", nsamples, maxbuffer, minbuffer);
-    pthread_cond_wait(&cond, &lock);
+  /* Wait until there's at least target_buffer samples available */
+  while(nsamples < target_buffer) {
+    //fprintf(stderr, "%8u/%u (%u) FILLING\n", nsamples, maxbuffer, target_buffer);
+    timed_wait(1000000);
   }
   /* Start from whatever is earliest */
-  next_timestamp = pheap_first(&packets)->timestamp;
+  pthread_mutex_lock(&play_lock);
+  reorder_resync();
+#if HAVE_OPUS
+  opus_play_reset();
+#endif
+  __atomic_store_n(&underrun, 0, __ATOMIC_RELAXED);
   active = 1;
+  /* Start the rate controller off with our best guess at the clock skew */
+  varispeed_init(&drift, uaudio_channels);
+  control.fill = nsamples;
+  control.integral = __atomic_load_n(&skew_ppb, __ATOMIC_RELAXED) * 1e-9;
+  control.ratio = ((double)uaudio_rate
+                   / __atomic_load_n(&stream_rate, __ATOMIC_RELAXED)
+                   / (1 + control.integral));
+  pthread_mutex_unlock(&play_lock);
 }
 
 /** @brief Find next packet
@@ -483,20 +990,41 @@ void playrtp_fill_buffer(void) {
  *
  * The return packet is merely guaranteed not to be in the past: it might be
  * the first packet in the future rather than one that is actually suitable to
- * play.
+ * play.  Missing packets are skipped once a later packet becomes due.
  *
- * Must be called with @ref lock held.
+ * Must be called with @ref play_lock held.
  */
 struct packet *playrtp_next_packet(void) {
-  while(pheap_count(&packets)) {
-    struct packet *const p = pheap_first(&packets);
+  uint16_t latest = __atomic_load_n(&latest_seq, __ATOMIC_ACQUIRE), seq;
+  struct packet *p;
+
+  /* Nothing received since the last packet we played */
+  if(lt16(latest, next_seq))
+    return 0;
+  /* The stream has jumped too far to follow; start again from whatever is
+   * earliest */
+  if((uint16_t)(latest - next_seq) >= REORDER_SLOTS) {
+    if(!nsamples)
+      return 0;
+    reorder_resync();
+    latest = __atomic_load_n(&latest_seq, __ATOMIC_ACQUIRE);
+  }
+  for(seq = next_seq; !lt16(latest, seq); ++seq) {
+    if(!(p = reorder_peek(seq)))
+      /* This packet hasn't arrived (yet) */
+      continue;
     if(le(p->timestamp + p->nsamples, next_timestamp)) {
-      /* This packet is in the past.  Drop it and try another one. */
-      drop_first_packet();
-    } else
-      /* This packet is NOT in the past.  (It might be in the future
-       * however.) */
-      return p;
+      /* This packet is in the past, and so is anything missing before it.
+       * Drop it and try another one. */
+      reorder_drop(p);
+      next_seq = seq + 1;
+      continue;
+    }
+    /* This packet is NOT in the past.  (It might be in the future however.)
+     * If it's due then anything missing before it is too late. */
+    if(ge(next_timestamp, p->timestamp))
+      next_seq = seq;
+    return p;
   }
   return 0;
 }
@@ -507,8 +1035,9 @@ static void attribute((noreturn)) help(void) {
 	  "  disorder-playrtp [OPTIONS] [[ADDRESS] PORT]\n"
 	  "Options:\n"
           "  --device, -D DEVICE     Output device\n"
-          "  --min, -m FRAMES        Buffer low water mark\n"
+          "  --min, -m FRAMES        Initial buffer target\n"
           "  --max, -x FRAMES        Buffer maximum size\n"
+          "  --fixed-buffer, -F      Don't adapt buffer target to jitter\n"
           "  --rcvbuf, -R BYTES      Socket receive buffer size\n"
           "  --config, -C PATH       Set system configuration file\n"
           "  --user-config, -u PATH  Set user configuration file\n"
@@ -535,18 +1064,227 @@ static void attribute((noreturn)) help(void) {
   exit(0);
 }
 
-static size_t playrtp_callback(void *buffer,
-                               size_t max_samples,
-                               void attribute((unused)) *userdata) {
+/** @brief Remember samples played, for loss concealment
+ * @param samples Samples
+ * @param n Number of samples
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void conceal_remember(const int16_t *samples, size_t n) {
+  size_t discard;
+
+  if(n >= CONCEAL_HISTORY) {
+    memcpy(conceal.history, samples + n - CONCEAL_HISTORY,
+           sizeof conceal.history);
+    conceal.nhistory = CONCEAL_HISTORY;
+    return;
+  }
+  if(conceal.nhistory + n > CONCEAL_HISTORY) {
+    discard = conceal.nhistory + n - CONCEAL_HISTORY;
+    memmove(conceal.history, conceal.history + discard,
+            (conceal.nhistory - discard) * sizeof (int16_t));
+    conceal.nhistory -= discard;
+  }
+  memcpy(conceal.history + conceal.nhistory, samples, n * sizeof (int16_t));
+  conceal.nhistory += n;
+}
+
+/** @brief Start concealing a gap
+ * @return 0 on success, -1 if there's not enough history
+ *
+ * This is a simple form of waveform substitution, after ITU-T G.711 Appendix
+ * I.  The most recent audio is compared with itself at a range of lags to
+ * estimate its pitch period, and its last period is then repeated, fading out
+ * over @ref CONCEAL_FADE_MS.  Only the first channel, and only every other
+ * frame, is used for the estimate.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static int conceal_start(void) {
+  const size_t channels = uaudio_channels;
+  const size_t frames = conceal.nhistory / channels;
+  const int16_t *const h = conceal.history;
+  size_t lag, best = CONCEAL_MAX_PERIOD, i;
+  double score, best_score = 0;
+  int64_t xy, yy;
+
+  if(conceal.nhistory < CONCEAL_HISTORY)
+    return -1;
+  for(lag = CONCEAL_MIN_PERIOD; lag <= CONCEAL_MAX_PERIOD; ++lag) {
+    xy = yy = 0;
+    for(i = CONCEAL_MAX_PERIOD; i < frames; i += 2) {
+      const int32_t x = h[i * channels], y = h[(i - lag) * channels];
+      xy += x * y;
+      yy += y * y;
+    }
+    if(yy > 0 && (score = xy / sqrt((double)yy)) > best_score) {
+      best_score = score;
+      best = lag;
+    }
+  }
+  conceal.period = best * channels;
+  memcpy(conceal.pattern, h + conceal.nhistory - conceal.period,
+         conceal.period * sizeof (int16_t));
+  conceal.position = 0;
+  conceal.generated = 0;
+  conceal.ramp = 0;
+  ++stats.concealed;
+  return 0;
+}
+
+/** @brief Generate concealment samples
+ * @param buffer Where to put samples
+ * @param n Number of samples to generate
+ *
+ * Must be called with @ref play_lock held, after conceal_start().
+ */
+static void conceal_generate(int16_t *buffer, size_t n) {
+  const int64_t fade = (int64_t)__atomic_load_n(&stream_rate, __ATOMIC_RELAXED)
+    * uaudio_channels * CONCEAL_FADE_MS / 1000;
+  size_t i;
+
+  for(i = 0; i < n; ++i) {
+    if((int64_t)conceal.generated < fade)
+      buffer[i] = conceal.pattern[conceal.position]
+        * (fade - (int64_t)conceal.generated) / fade;
+    else
+      buffer[i] = 0;
+    ++conceal.generated;
+    if(++conceal.position == conceal.period)
+      conceal.position = 0;
+  }
+}
+
+/** @brief Crossfade from concealment back into real audio
+ * @param buffer Real samples, modified in place
+ * @param n Number of samples
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void conceal_resume(int16_t *buffer, size_t n) {
+  const int32_t total = CONCEAL_RAMP * uaudio_channels;
+  int16_t generated;
+  size_t i;
+
+  if(!conceal.ramp)
+    conceal.ramp = total;
+  for(i = 0; i < n && conceal.ramp > 0; ++i, --conceal.ramp) {
+    conceal_generate(&generated, 1);
+    buffer[i] = ((int32_t)generated * (int32_t)conceal.ramp
+                 + (int32_t)buffer[i] * (total - (int32_t)conceal.ramp))
+      / total;
+  }
+  if(!conceal.ramp)
+    conceal.period = 0;
+}
+
+#if HAVE_OPUS
+/** @brief Decode an Opus packet in place
+ * @param p Packet, with @ref OPUS set
+ *
+ * The decoder is created on first use.  Output is always stereo.  Packets
+ * must be decoded in the order they are played, since each one's decoding
+ * depends on the decoder's state after the previous one; this is why
+ * decoding is left until the packet is played rather than done when it
+ * arrives.
+ *
+ * The decoder's state only makes sense for a continuous stream, so it is
+ * reset when the sender changes (a new SSRC) and when the marker bit says
+ * that the stream has resumed after a pause.  If the packet can't be decoded
+ * then the decoder's loss concealment is played instead.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void opus_play_packet(struct packet *p) {
+  const int frames = p->nsamples / 2;
+  int err, decoded;
+
+  if(!opus_play.decoder) {
+    if(!(opus_play.decoder = opus_decoder_create(RTP_OPUS_RATE, 2, &err)))
+      disorder_fatal(0, "error creating Opus decoder: %s", opus_strerror(err));
+  } else if(p->ssrc != opus_play.ssrc || (p->flags & IDLE))
+    opus_play_reset();
+  opus_play.ssrc = p->ssrc;
+  decoded = opus_decode(opus_play.decoder,
+                        (const unsigned char *)p->samples_raw, p->nbytes,
+                        opus_play.pcm, frames, 0);
+  if(decoded < 0) {
+    disorder_error(0, "error decoding Opus packet: %s",
+                   opus_strerror(decoded));
+    decoded = opus_decode(opus_play.decoder, NULL, 0, opus_play.pcm, frames,
+                          0);
+  }
+  if(decoded < 0)
+    decoded = 0;
+  memset(opus_play.pcm + 2 * decoded, 0,
+         (p->nsamples - 2 * decoded) * sizeof (int16_t));
+  net16_from_native_copy(p->samples_raw, opus_play.pcm, p->nsamples);
+  p->flags &= ~OPUS;
+  if(zero16_buffer(p->samples_raw, p->nsamples))
+    p->flags |= SILENT;
+  opus_play.frame_samples = p->nsamples;
+  opus_play.pcm_samples = 0;
+}
+
+/** @brief Conceal a gap in an Opus stream
+ * @param buffer Where to put samples
+ * @param n Maximum number of samples to generate
+ * @return Number of samples generated, or 0 if concealment isn't possible
+ *
+ * The decoder generates concealment one packet at a time, continuing from
+ * the last packet decoded, so that the next real packet follows on
+ * smoothly.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static size_t opus_play_conceal(int16_t *buffer, size_t n) {
+  size_t offset;
+  int decoded;
+
+  if(!opus_play.frame_samples)
+    return 0;
+  offset = next_timestamp - opus_play.pcm_timestamp;
+  if(!opus_play.pcm_samples || offset >= opus_play.pcm_samples) {
+    if(!opus_play.pcm_samples)
+      ++stats.concealed;
+    decoded = opus_decode(opus_play.decoder, NULL, 0, opus_play.pcm,
+                          opus_play.frame_samples / 2, 0);
+    if(decoded <= 0)
+      return 0;
+    opus_play.pcm_timestamp = next_timestamp;
+    opus_play.pcm_samples = 2 * decoded;
+    offset = 0;
+  }
+  if(n > opus_play.pcm_samples - offset)
+    n = opus_play.pcm_samples - offset;
+  memcpy(buffer, opus_play.pcm + offset, n * sizeof (int16_t));
+  return n;
+}
+#endif
+
+/** @brief Fetch samples from the reorder buffer
+ * @param buffer Where to put samples
+ * @param max_samples Maximum number of samples to fetch
+ * @return Number of samples fetched
+ *
+ * Must be called with @ref play_lock held.
+ */
+static size_t playrtp_fetch(int16_t *buffer, size_t max_samples) {
   size_t samples;
+#if HAVE_OPUS
+  size_t concealed;
+#endif
   int silent = 0;
 
-  pthread_mutex_lock(&lock);
   /* Get the next packet, junking any that are now in the past */
-  const struct packet *p = playrtp_next_packet();
+  struct packet *p = playrtp_next_packet();
   if(p && contains(p, next_timestamp)) {
     /* This packet is ready to play; the desired next timestamp points
      * somewhere into it. */
+#if HAVE_OPUS
+    if(p->flags & OPUS)
+      opus_play_packet(p);
+#endif
 
     /* Timestamp of end of packet */
     const uint32_t packet_end = p->timestamp + p->nsamples;
@@ -554,8 +1292,6 @@ static size_t playrtp_callback(void *buffer,
     /* Offset of desired next timestamp into current packet */
     const uint32_t offset = next_timestamp - p->timestamp;
 
-    /* Pointer to audio data */
-    const uint16_t *ptr = (void *)(p->samples_raw + offset);
 
     /* Compute number of samples left in packet, limited to output buffer
      * size */
@@ -564,76 +1300,159 @@ static size_t playrtp_callback(void *buffer,
       samples = max_samples;
 
     /* Copy into buffer, converting to native endianness */
-    size_t i = samples;
-    int16_t *bufptr = buffer;
-    while(i > 0) {
-      *bufptr++ = (int16_t)ntohs(*ptr++);
-      --i;
-    }
+    native_from_net16_copy(buffer, p->samples_raw + offset, samples);
     silent = !!(p->flags & SILENT);
+    control.packet_samples = p->nsamples;
+    if(conceal.period)
+      conceal_resume(buffer, samples);
   } else {
-    /* There is no suitable packet.  We introduce 0s up to the next packet, or
-     * to fill the buffer if there's no next packet or that's too many.  The
+    /* There is no suitable packet.  We infill up to the next packet, or to
+     * fill the buffer if there's no next packet or that's too many.  The
      * comparison with max_samples deals with the otherwise troubling overflow
      * case. */
     samples = p ? p->timestamp - next_timestamp : max_samples;
     if(samples > max_samples)
       samples = max_samples;
     //info("infill by %zu", samples);
-    memset(buffer, 0, samples * uaudio_sample_size);
-    silent = 1;
-  }
-  /* Debug dump */
-  if(dump_buffer) {
-    for(size_t i = 0; i < samples; ++i) {
-      dump_buffer[dump_index++] = ((int16_t *)buffer)[i];
-      dump_index %= dump_size;
+    /* If there's a later packet then something has been lost, so we conceal
+     * the gap.  Otherwise (or after a pause) we just insert 0s.  Opus streams
+     * use the decoder's own concealment. */
+#if HAVE_OPUS
+    if(p && (p->flags & (IDLE|OPUS)) == OPUS
+       && (concealed = opus_play_conceal(buffer, samples))) {
+      samples = concealed;
+      conceal.period = 0;
+    } else
+#endif
+    if(p && !(p->flags & IDLE)
+       && ((conceal.period && !conceal.ramp) || !conceal_start()))
+      conceal_generate(buffer, samples);
+    else {
+      memset(buffer, 0, samples * uaudio_sample_size);
+      conceal.period = 0;
+      silent = 1;
     }
   }
   /* Advance timestamp */
   next_timestamp += samples;
-  /* If we're getting behind then try to drop just silent packets
+  /* If we're far behind then drop silent packets
    *
    * In theory this shouldn't be necessary.  The server is supposed to send
-   * packets at the right rate and compares the number of samples sent with the
-   * time in order to ensure this.
+   * packets at the right rate, and any remaining difference between its clock
+   * and ours is taken up by adjusting the playback rate (see
+   * playrtp_adjust()).
    *
-   * However, various things could throw this off:
+   * However, the rate adjustment is deliberately limited, so it takes a long
+   * time to drain a lot of excess buffered data, for instance after the target
+   * buffer occupancy has been reduced or after a burst of delayed packets.
    *
-   * - the server's clock could advance at the wrong rate.  This would cause it
-   *   to mis-estimate the right number of samples to have sent and
-   *   inappropriately throttle or speed up.
-   *
-   * - playback could happen at the wrong rate.  If the playback host's sound
-   *   card has a slightly incorrect clock then eventually it will get out
-   *   of step.
-   *
-   * So if we play back slightly slower than the server sends for either of
-   * these reasons then eventually our buffer, and the socket's buffer, will
-   * fill, and the kernel will start dropping packets.  The result is audible
-   * and not very nice.
-   *
-   * Therefore if we're getting behind, we pre-emptively drop silent packets,
-   * since a change in the duration of a silence is less noticeable than a
-   * dropped packet from the middle of continuous music.
-   *
-   * (If things go wrong the other way then eventually we run out of packets to
-   * play and are forced to play silence.  This doesn't seem to happen in
-   * practice but if it does then in the same way we can artificially extend
-   * silent packets to compensate.)
+   * In that case we pre-emptively drop silent packets, since a change in the
+   * duration of a silence is not noticeable at all.
    *
    * Dropped packets are always logged; use 'disorder-playrtp --monitor' to
    * track how close to target buffer occupancy we are on a once-a-minute
    * basis.
    */
-  if(nsamples > minbuffer && silent) {
-    disorder_info("dropping %zu samples (%"PRIu32" > %"PRIu32")",
-                  samples, nsamples, minbuffer);
+  if(nsamples > 2 * target_buffer && silent) {
+    disorder_info("dropping %zu samples (%"PRIu32" > 2 * %"PRIu32")",
+                  samples, nsamples, target_buffer);
     samples = 0;
   }
-  /* Junk obsolete packets */
-  playrtp_next_packet();
-  pthread_mutex_unlock(&lock);
+  conceal_remember(buffer, samples);
+  return samples;
+}
+
+/** @brief Update the target buffer occupancy and the playback rate
+ * @param samples Number of samples just played
+ *
+ * The target buffer occupancy is a multiple of the jitter estimate, with a
+ * margin for packet size.  It increases immediately but decreases slowly.
+ *
+ * The playback rate is adjusted to bring the actual buffer occupancy towards
+ * the target, by a PI controller.  In the steady state the integral term
+ * matches the difference between the sender's clock and our output device's.
+ *
+ * Must be called with @ref play_lock held.
+ */
+static void playrtp_adjust(size_t samples) {
+  /* The buffer is at the stream rate, which might not be the output rate */
+  const uint32_t srate = __atomic_load_n(&stream_rate, __ATOMIC_RELAXED);
+  const double nominal = (double)uaudio_rate / srate;
+  const double rate = (double)srate * uaudio_channels;
+  const double dt = samples / (rate * nominal);
+  const double fill = nsamples + (staged_end - staged_start);
+  double error, adjust;
+
+  if(!fixed_buffer) {
+    double desired = (JITTER_MULTIPLE
+                      * __atomic_load_n(&jitter_us, __ATOMIC_RELAXED)
+                      * rate / 1000000
+                      + 2 * control.packet_samples);
+    const double floor = rate * MIN_TARGET_MS / 1000;
+    const double ceiling = maxbuffer * 3.0 / 4;
+    if(desired < floor)
+      desired = floor;
+    if(desired > ceiling)
+      desired = ceiling;
+    if(desired > control.target)
+      control.target = desired;
+    else
+      control.target -= (control.target - desired) * dt / TARGET_DECAY;
+    target_buffer = control.target;
+  }
+  control.fill += (fill - control.fill) * (dt < FILL_SMOOTHING
+                                           ? dt / FILL_SMOOTHING : 1);
+  error = (control.fill - control.target) / rate;
+  control.integral += RATE_KI * error * dt;
+  if(control.integral > RATE_MAX_ADJUST)
+    control.integral = RATE_MAX_ADJUST;
+  if(control.integral < -RATE_MAX_ADJUST)
+    control.integral = -RATE_MAX_ADJUST;
+  adjust = RATE_KP * error + control.integral;
+  if(adjust > RATE_MAX_ADJUST)
+    adjust = RATE_MAX_ADJUST;
+  if(adjust < -RATE_MAX_ADJUST)
+    adjust = -RATE_MAX_ADJUST;
+  /* A positive adjustment means consuming input faster */
+  control.ratio = nominal / (1 + adjust);
+  __atomic_store_n(&adjust_ppb, (int32_t)(adjust * 1e9), __ATOMIC_RELAXED);
+}
+
+static size_t playrtp_callback(void *buffer,
+                               size_t max_samples,
+                               void attribute((unused)) *userdata) {
+  size_t samples, frames, nin;
+
+  pthread_mutex_lock(&play_lock);
+  if(staged_start == staged_end) {
+    staged_start = 0;
+    staged_end = playrtp_fetch(staged, (max_samples < STAGED_SAMPLES
+                                        ? max_samples : STAGED_SAMPLES));
+  }
+  /* Play at the adjusted rate */
+  nin = (staged_end - staged_start) / uaudio_channels;
+  frames = varispeed_convert(&drift, control.ratio,
+                             staged + staged_start, &nin,
+                             buffer, max_samples / uaudio_channels);
+  staged_start += nin * uaudio_channels;
+  samples = frames * uaudio_channels;
+  /* Debug dump */
+  if(dump_buffer) {
+    for(size_t i = 0; i < samples; ++i) {
+      dump_buffer[dump_index++] = ((int16_t *)buffer)[i];
+      dump_index %= dump_size;
+    }
+  }
+  playrtp_adjust(samples);
+  /* Junk obsolete packets, and tell the main thread if there's nothing to
+   * play next */
+  const struct packet *p = playrtp_next_packet();
+  if(staged_start == staged_end && !(p && contains(p, next_timestamp))) {
+    if(!__atomic_exchange_n(&underrun, 1, __ATOMIC_RELAXED))
+      wake_nowait();
+  } else
+    __atomic_store_n(&underrun, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&play_lock);
   return samples;
 }
 
@@ -672,7 +1491,7 @@ int main(int argc, char **argv) {
   logdate = 1;
   mem_init();
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "hVdD:m:x:L:R:aocC:u:re:P:MA:", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "hVdD:m:x:L:R:aocC:u:re:P:MA:F", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'V': version("disorder-playrtp");
@@ -707,6 +1526,7 @@ int main(int argc, char **argv) {
     case 'e': backend = &uaudio_command; uaudio_set("command", optarg); break;
     case 'P': uaudio_set("pause-mode", optarg); break;
     case 'M': monitor = 1; break;
+    case 'F': fixed_buffer = 1; break;
     default: disorder_fatal(0, "invalid option");
     }
   }
@@ -733,6 +1553,8 @@ int main(int argc, char **argv) {
     maxbuffer = config->rtp_maxbuffer;
     if(!maxbuffer) maxbuffer = 2 * minbuffer;
   }
+  target_buffer = minbuffer;
+  control.target = minbuffer;
   if(target_rcvbuf < 0) target_rcvbuf = config->rtp_rcvbuf;
   argc -= optind;
   argv += optind;
@@ -998,6 +1820,8 @@ int main(int argc, char **argv) {
    * the format before we know what it is! */
   uaudio_set_format(44100/*Hz*/, 2/*channels*/,
                     16/*bits/channel*/, 1/*signed*/);
+  varispeed_init(&drift, uaudio_channels);
+  control.ratio = 1;
   uaudio_set("application", "disorder-playrtp");
   backend->configure();
   backend->start(playrtp_callback, NULL);
@@ -1005,9 +1829,6 @@ int main(int argc, char **argv) {
   /* We receive and convert audio data in a background thread */
   if((err = pthread_create(&ltid, 0, listen_thread, 0)))
     disorder_fatal(err, "pthread_create listen_thread");
-  /* We have a second thread to add received packets to the queue */
-  if((err = pthread_create(&ltid, 0, queue_thread, 0)))
-    disorder_fatal(err, "pthread_create queue_thread");
   pthread_mutex_lock(&lock);
   time_t lastlog = 0;
   for(;;) {
@@ -1015,52 +1836,74 @@ int main(int argc, char **argv) {
     playrtp_fill_buffer();
     /* Start playing now */
     disorder_info("Playing...");
-    next_timestamp = pheap_first(&packets)->timestamp;
-    active = 1;
     pthread_mutex_unlock(&lock);
     backend->activate();
     pthread_mutex_lock(&lock);
     /* Wait until the buffer empties out
      *
-     * If there's a packet that we can play right now then we definitely
-     * continue.
+     * If there's a packet that we can play right now (i.e. the player hasn't
+     * run out) then we definitely continue.
      *
-     * Also if there's at least minbuffer samples we carry on regardless and
+     * Also if there's at least target_buffer samples we carry on regardless and
      * insert silence.  The assumption is there's been a pause but more data
      * is now available.
      */
-    while(nsamples >= minbuffer
+    while(nsamples >= target_buffer
 	  || (nsamples > 0
-	      && contains(pheap_first(&packets), next_timestamp))) {
+	      && !__atomic_load_n(&underrun, __ATOMIC_RELAXED))) {
       if(monitor) {
         time_t now = xtime(0);
 
         if(now >= lastlog + 60) {
-          int offset = nsamples - minbuffer;
-          double offtime = (double)offset / (uaudio_rate * uaudio_channels);
-          disorder_info("%+d samples off (%d.%02ds, %d bytes)",
+          const uint32_t target = target_buffer;
+          int offset = nsamples - target;
+          double offtime = (double)offset
+            / (__atomic_load_n(&stream_rate, __ATOMIC_RELAXED)
+               * uaudio_channels);
+          disorder_info("%+d samples off (%d.%02ds, %d bytes)"
+                        " target %"PRIu32" jitter %"PRId32"us"
+                        " skew %+"PRId32"ppm adjust %+"PRId32"ppm"
+                        " %"PRIu32" packets, %"PRIu32" late,"
+                        " %"PRIu32" duplicates, %"PRIu32" dropped,"
+                        " %"PRIu32" recovered, %"PRIu32" concealed",
                         offset,
                         (int)fabs(offtime) * (offtime < 0 ? -1 : 1),
                         (int)(fabs(offtime) * 100) % 100,
-                        offset * uaudio_bits / CHAR_BIT);
+                        offset * uaudio_bits / CHAR_BIT,
+                        target,
+                        __atomic_load_n(&jitter_us, __ATOMIC_RELAXED),
+                        __atomic_load_n(&skew_ppb, __ATOMIC_RELAXED) / 1000,
+                        __atomic_load_n(&adjust_ppb, __ATOMIC_RELAXED) / 1000,
+                        stats.received, stats.late, stats.duplicates,
+                        stats.collided, stats.recovered, stats.concealed);
           lastlog = now;
         }
       }
-      //fprintf(stderr, "%8u/%u (%u) PLAYING\n", nsamples, maxbuffer, minbuffer);
-      pthread_cond_wait(&cond, &lock);
+      //fprintf(stderr, "%8u/%u (%u) PLAYING\n", nsamples, maxbuffer, target_buffer);
+      timed_wait(1000000);
     }
 #if 0
-    if(nsamples) {
-      struct packet *p = pheap_first(&packets);
-      fprintf(stderr, "nsamples=%u (%u) next_timestamp=%"PRIx32", first packet is [%"PRIx32",%"PRIx32")\n",
-              nsamples, minbuffer, next_timestamp,p->timestamp,p->timestamp+p->nsamples);
-    }
+    if(nsamples)
+      fprintf(stderr, "nsamples=%u (%u) next_timestamp=%"PRIx32" next_seq=%u\n",
+              nsamples, target_buffer, next_timestamp, next_seq);
 #endif
     /* Stop playing for a bit until the buffer re-fills */
     pthread_mutex_unlock(&lock);
     backend->deactivate();
     pthread_mutex_lock(&lock);
     active = 0;
+    /* If we ran out while there was still data buffered then some packet was
+     * later than we allowed for, so buffer more from now on */
+    if(!fixed_buffer && nsamples > 0) {
+      pthread_mutex_lock(&play_lock);
+      control.target = control.target * 3 / 2;
+      if(control.target > maxbuffer * 3.0 / 4)
+        control.target = maxbuffer * 3.0 / 4;
+      target_buffer = control.target;
+      disorder_info("increased buffer target to %"PRIu32" samples",
+                    target_buffer);
+      pthread_mutex_unlock(&play_lock);
+    }
     /* Go back round */
   }
   return 0;
@@ -35,18 +35,87 @@
  */
 #define INFILL_SAMPLES (44100 * 2)      /* 1s */
 
+/** @brief Number of slots in the reorder buffer
+ *
+ * Must be a power of 2 and no more than 65536.  See @ref reorder.
+ */
+#define REORDER_SLOTS 4096
+
+/** @brief Maximum number of packets to read in one go */
+#define RECEIVE_BATCH 32
+
+/** @brief Number of samples the audio callback fetches at once */
+#define STAGED_SAMPLES 4096
+
+/** @brief Length of the windows used to estimate clock skew, in seconds */
+#define SKEW_WINDOW 10
+
+/** @brief Target buffer occupancy as a multiple of the jitter estimate */
+#define JITTER_MULTIPLE 4
+
+/** @brief Minimum target buffer occupancy in milliseconds */
+#define MIN_TARGET_MS 100
+
+/** @brief Time constant for reducing the target buffer occupancy in seconds
+ *
+ * Increases take effect immediately.
+ */
+#define TARGET_DECAY 30
+
+/** @brief Time constant for smoothing buffer occupancy in seconds */
+#define FILL_SMOOTHING 2
+
+/** @brief Proportional gain of the playback rate controller
+ *
+ * This is the rate adjustment per second of difference between the actual and
+ * target buffer occupancy.
+ */
+#define RATE_KP 0.05
+
+/** @brief Integral gain of the playback rate controller */
+#define RATE_KI 0.001
+
+/** @brief Largest playback rate adjustment
+ *
+ * 0.5% is under 9 cents.  This much is only used briefly, when the target
+ * buffer occupancy changes; in the steady state the adjustment is just the
+ * difference between the sender's and receiver's clocks.
+ */
+#define RATE_MAX_ADJUST 0.005
+
+/** @brief Samples of recent output kept for loss concealment
+ *
+ * Must be at least twice @ref CONCEAL_MAX_PERIOD frames.
+ */
+#define CONCEAL_HISTORY 4096
+
+/** @brief Shortest waveform repeated by loss concealment, in frames */
+#define CONCEAL_MIN_PERIOD 100
+
+/** @brief Longest waveform repeated by loss concealment, in frames */
+#define CONCEAL_MAX_PERIOD 640
+
+/** @brief Time for concealment to fade to silence in milliseconds */
+#define CONCEAL_FADE_MS 30
+
+/** @brief Frames over which concealment is crossfaded back into real audio */
+#define CONCEAL_RAMP 64
+
 /** @brief Received packet
  *
- * Received packets are kept in a binary heap (see @ref pheap) ordered by
- * timestamp.
+ * Received packets are kept in the reorder buffer @ref reorder, indexed by
+ * sequence number.
  */
 struct packet {
-  /** @brief Next packet in @ref next_free_packet or @ref received_packets */
+  /** @brief Next packet in the free list */
   struct packet *next;
   
   /** @brief Number of samples in this packet */
   uint32_t nsamples;
 
+  /** @brief Sequence number from RTP packet */
+  uint16_t seq;
+
   /** @brief Timestamp from RTP packet
    *
    * NB that "timestamps" are really sample counters.  Use lt() or lt_packet()
@@ -59,6 +128,7 @@ struct packet {
    * Valid values are:
    * - @ref IDLE - the idle bit was set in the RTP packet
    * - @ref SILENT - packet is entirely silent
+   * - @ref OPUS - packet holds Opus data that has not been decoded yet
    */
   unsigned flags;
 /** @brief idle bit set in RTP packet*/
@@ -67,20 +137,27 @@ struct packet {
 /** @brief RTP packet is entirely silent */
 #define SILENT 0x0002
 
+/** @brief RTP packet holds undecoded Opus data */
+#define OPUS 0x0004
+
+  /** @brief Size of undecoded Opus data in bytes
+   *
+   * Only meaningful if @ref OPUS is set.
+   */
+  uint32_t nbytes;
+
+  /** @brief SSRC from RTP packet, in network byte order */
+  uint32_t ssrc;
+
   /** @brief Raw sample data
    *
    * Only the first @p nsamples samples are defined; the rest is uninitialized
-   * data.
+   * data.  If @ref OPUS is set then this holds @c nbytes bytes of Opus data
+   * instead, which is decoded into @p nsamples samples when it is played.
    */
   uint16_t samples_raw[MAXSAMPLES];
 };
 
-/** @brief Structure of free packet list */
-union free_packet {
-  struct packet p;
-  union free_packet *next;
-};
-
 /** @brief Return true iff \f$a < b\f$ in sequence-space arithmetic
  *
  * Specifically it returns true if \f$(a-b) mod 2^{32} < 2^{31}\f$.
@@ -106,9 +183,9 @@ static inline int le(uint32_t a, uint32_t b) {
   return !lt(b, a);
 }
 
-/** @brief Ordering for packets, used by @ref pheap */
-static inline int lt_packet(const struct packet *a, const struct packet *b) {
-  return lt(a->timestamp, b->timestamp);
+/** @brief Return true iff \f$a < b\f$ in 16-bit sequence-space arithmetic */
+static inline int lt16(uint16_t a, uint16_t b) {
+  return (uint16_t)(a - b) & 0x8000;
 }
 
 /** @brief Return true if @p p contains @p timestamp
@@ -123,26 +200,19 @@ static inline int contains(const struct packet *p, uint32_t timestamp) {
           && lt(timestamp, packet_end));
 }
 
-/** @struct pheap 
- * @brief Binary heap of packets ordered by timestamp */
-HEAP_TYPE(pheap, struct packet *, lt_packet);
-
 struct packet *playrtp_new_packet(void);
 void playrtp_free_packet(struct packet *p);
 void playrtp_fill_buffer(void);
 struct packet *playrtp_next_packet(void);
 
-extern struct packet *received_packets;
-extern struct packet **received_tail;
-extern pthread_mutex_t receive_lock;
-extern pthread_cond_t receive_cond;
-extern uint32_t nreceived;
-extern struct pheap packets;
+extern struct packet *reorder[REORDER_SLOTS];
 extern volatile uint32_t nsamples;
 extern uint32_t next_timestamp;
+extern uint16_t next_seq;
 extern int active;
 extern pthread_mutex_t lock;
 extern pthread_cond_t cond;
+extern pthread_mutex_t play_lock;
 extern unsigned minbuffer;
 
 extern int16_t *dump_buffer;
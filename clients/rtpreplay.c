@@ -0,0 +1,522 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file clients/rtpreplay.c
+ * @brief RTP replay tool
+ *
+ * This program sends an RTP stream to a listener such as disorder-playrtp, at
+ * a configurable multiple of real time and optionally with packets dropped,
+ * duplicated or reordered.  It is intended for stress-testing only.
+ *
+ * It can also add FEC packets, as sent by the server if @c rtp_fec is set.
+ *
+ * The stream is either read from a packet capture (classic pcap format, as
+ * written by e.g. tcpdump -w) or synthesized as a tone.  Captures are looped
+ * with sequence numbers and timestamps adjusted so that the stream appears
+ * continuous.
+ */
+#include "common.h"
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <locale.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "syscalls.h"
+#include "timeval.h"
+#include "mem.h"
+#include "log.h"
+#include "version.h"
+#include "addr.h"
+#include "configuration.h"
+#include "rtp.h"
+
+/** @brief One RTP packet to send */
+struct replay_packet {
+  /** @brief Packet contents, starting with the RTP header */
+  unsigned char *data;
+
+  /** @brief Length of packet */
+  size_t len;
+};
+
+/** @brief Packets to send */
+static struct replay_packet *packets;
+
+/** @brief Number of packets */
+static size_t npackets;
+
+/** @brief Size of @ref packets */
+static size_t nslots;
+
+/** @brief Sample rate (per channel) of the stream */
+static unsigned rate = 44100;
+
+/** @brief Number of channels in the stream */
+static unsigned channels = 2;
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "capture", required_argument, 0, 'c' },
+  { "port", required_argument, 0, 'p' },
+  { "seconds", required_argument, 0, 'S' },
+  { "samples", required_argument, 0, 'n' },
+  { "speed", required_argument, 0, 's' },
+  { "loops", required_argument, 0, 'l' },
+  { "drop", required_argument, 0, 'd' },
+  { "duplicate", required_argument, 0, 'D' },
+  { "reorder", required_argument, 0, 'r' },
+  { "seed", required_argument, 0, 'R' },
+  { "fec", required_argument, 0, 'f' },
+  { 0, 0, 0, 0 }
+};
+
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+	  "  rtpreplay [OPTIONS] [ADDRESS] PORT\n"
+	  "Options:\n"
+          "  --capture, -c PATH      Replay RTP packets from a pcap file\n"
+          "  --port, -p PORT         Only use packets to this UDP port\n"
+          "  --seconds, -S SECONDS   Length of synthesized stream (default 10)\n"
+          "  --samples, -n SAMPLES   Samples/packet when synthesizing (720)\n"
+          "  --speed, -s FACTOR      Multiple of real time (default 1, 0=max)\n"
+          "  --loops, -l COUNT       Repeat the stream (default 1, 0=forever)\n"
+          "  --drop, -d PERCENT      Drop packets at random\n"
+          "  --duplicate, -D PERCENT Send packets twice at random\n"
+          "  --reorder, -r PERCENT   Delay packets by one at random\n"
+          "  --seed, -R SEED         Random number seed\n"
+          "  --fec, -f PACKETS       Send an FEC packet every PACKETS packets\n"
+	  "  --help, -h              Display usage message\n"
+	  "  --version, -V           Display version number\n"
+          );
+  xfclose(stdout);
+  exit(0);
+}
+
+/** @brief Add a packet to @ref packets
+ * @param data Packet contents (copied)
+ * @param len Length of packet
+ */
+static void add_packet(const void *data, size_t len) {
+  if(npackets >= nslots) {
+    nslots = nslots ? 2 * nslots : 1024;
+    packets = xrealloc(packets, nslots * sizeof *packets);
+  }
+  packets[npackets].data = xmalloc_noptr(len);
+  memcpy(packets[npackets].data, data, len);
+  packets[npackets].len = len;
+  ++npackets;
+}
+
+/** @brief Read a 16-bit big-endian value */
+static inline unsigned get16(const unsigned char *ptr) {
+  return (ptr[0] << 8) + ptr[1];
+}
+
+/** @brief Read a 32-bit value from a pcap file
+ * @param ptr Pointer to value
+ * @param swap Nonzero if the file's byte order is not ours
+ */
+static inline uint32_t get32(const unsigned char *ptr, int swap) {
+  uint32_t v;
+
+  memcpy(&v, ptr, sizeof v);
+  if(swap)
+    v = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+  return v;
+}
+
+/** @brief Extract an RTP packet from a captured frame
+ * @param frame Captured frame
+ * @param len Captured length
+ * @param linktype Link type from pcap header
+ * @param port UDP port to match or 0
+ */
+static void capture_frame(const unsigned char *frame, size_t len,
+                          uint32_t linktype, unsigned port) {
+  unsigned ethertype, proto;
+  size_t hl;
+
+  /* Link layer */
+  switch(linktype) {
+  case 1:                               /* Ethernet */
+    if(len < 14)
+      return;
+    ethertype = get16(frame + 12);
+    frame += 14;
+    len -= 14;
+    if(ethertype == 0x8100 && len >= 4) { /* 802.1Q */
+      ethertype = get16(frame + 2);
+      frame += 4;
+      len -= 4;
+    }
+    break;
+  case 113:                             /* Linux cooked */
+    if(len < 16)
+      return;
+    ethertype = get16(frame + 14);
+    frame += 16;
+    len -= 16;
+    break;
+  case 12:                              /* Raw IP */
+  case 101:
+    if(len < 1)
+      return;
+    ethertype = (frame[0] >> 4) == 6 ? 0x86DD : 0x0800;
+    break;
+  default:
+    disorder_fatal(0, "unsupported capture link type %lu",
+                   (unsigned long)linktype);
+  }
+  /* Network layer */
+  switch(ethertype) {
+  case 0x0800:
+    if(len < 20)
+      return;
+    hl = (frame[0] & 15) * 4;
+    proto = frame[9];
+    /* Ignore fragments */
+    if(get16(frame + 6) & 0x3FFF)
+      return;
+    break;
+  case 0x86DD:
+    if(len < 40)
+      return;
+    hl = 40;
+    proto = frame[6];
+    break;
+  default:
+    return;
+  }
+  if(proto != 17 || len < hl + 8)
+    return;
+  frame += hl;
+  len -= hl;
+  /* Transport layer */
+  if(port && get16(frame + 2) != port)
+    return;
+  frame += 8;
+  len -= 8;
+  /* Must look like RTP */
+  if(len <= sizeof (struct rtp_header) || (frame[0] & 0xC0) != 0x80)
+    return;
+  add_packet(frame, len);
+}
+
+/** @brief Read RTP packets from a pcap file
+ * @param path Capture file
+ * @param port UDP port to match or 0
+ */
+static void read_capture(const char *path, unsigned port) {
+  FILE *fp;
+  unsigned char header[24], *frame = NULL;
+  uint32_t magic, linktype, caplen;
+  size_t framesize = 0;
+  int swap;
+
+  if(!(fp = fopen(path, "rb")))
+    disorder_fatal(errno, "opening %s", path);
+  if(fread(header, 1, sizeof header, fp) != sizeof header)
+    disorder_fatal(errno, "reading %s", path);
+  memcpy(&magic, header, sizeof magic);
+  if(magic == 0xA1B2C3D4 || magic == 0xA1B23C4D)
+    swap = 0;
+  else if(magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+    swap = 1;
+  else
+    disorder_fatal(0, "%s: not a pcap file", path);
+  linktype = get32(header + 20, swap);
+  while(fread(header, 1, 16, fp) == 16) {
+    caplen = get32(header + 8, swap);
+    if(caplen > framesize) {
+      framesize = caplen;
+      frame = xrealloc_noptr(frame, framesize);
+    }
+    if(fread(frame, 1, caplen, fp) != caplen)
+      break;                            /* truncated capture */
+    capture_frame(frame, caplen, linktype, port);
+  }
+  if(ferror(fp))
+    disorder_fatal(errno, "reading %s", path);
+  fclose(fp);
+  xfree(frame);
+  if(!npackets)
+    disorder_fatal(0, "%s: no RTP packets found", path);
+}
+
+/** @brief Synthesize a stream
+ * @param seconds Length of stream
+ * @param samples Samples per packet
+ *
+ * The stream is a 440Hz L16 tone with a second of silence at the end, so that
+ * listeners' silence handling is exercised too.
+ */
+static void synthesize(double seconds, unsigned samples) {
+  const uint32_t total = seconds * rate * channels;
+  unsigned char *packet = xmalloc_noptr(sizeof (struct rtp_header)
+                                        + samples * sizeof (int16_t));
+  struct rtp_header header;
+  uint32_t timestamp = 0, n;
+  uint16_t seq = 0;
+
+  memset(&header, 0, sizeof header);
+  header.vpxcc = 2 << 6;
+  header.mpt = 10;                      /* L16 */
+  while(timestamp < total) {
+    header.seq = htons(seq++);
+    header.timestamp = htonl(timestamp);
+    memcpy(packet, &header, sizeof header);
+    for(n = 0; n < samples; ++n) {
+      const uint32_t frame = (timestamp + n) / channels;
+      int16_t s = 0;
+      if(frame < total / channels - rate)
+        s = 8192 * sin(2 * M_PI * 440 * frame / rate);
+      packet[sizeof header + 2 * n] = (uint16_t)s >> 8;
+      packet[sizeof header + 2 * n + 1] = (uint16_t)s & 0xFF;
+    }
+    add_packet(packet, sizeof header + samples * sizeof (int16_t));
+    timestamp += samples;
+  }
+  xfree(packet);
+}
+
+/** @brief Add a packet to an FEC group
+ * @param fec FEC packet under construction
+ * @param size Current length of @p fec
+ * @param count Number of packets already in the group
+ * @param packet Packet to add, starting with the RTP header
+ * @param len Length of @p packet
+ * @return New length of @p fec
+ *
+ * See @ref rtp_fec.  The FEC packet's header is that of the latest packet
+ * added, with the extension bit set.
+ */
+static size_t fec_add(unsigned char *fec, size_t size, int count,
+                      const unsigned char *packet, size_t len) {
+  struct rtp_header *const h = (void *)fec;
+  struct rtp_extension *const e = (void *)(h + 1);
+  struct rtp_fec *const f = (void *)(e + 1);
+  unsigned char *const parity = (unsigned char *)(f + 1);
+  const struct rtp_header *const ph = (const void *)packet;
+  const size_t payload = len - sizeof *ph;
+  size_t n;
+
+  if(!count) {
+    memset(fec, 0, sizeof *h + RTP_FEC_OVERHEAD);
+    e->type = htons(RTP_EXTENSION_FEC);
+    e->length = htons(sizeof *f / 4);
+    f->seq = ph->seq;
+    size = sizeof *h + RTP_FEC_OVERHEAD;
+  }
+  *h = *ph;
+  h->vpxcc |= 0x10;
+  h->mpt &= 0x7F;
+  f->count = count + 1;
+  f->mpt ^= ph->mpt;
+  f->timestamp ^= ph->timestamp;
+  f->length ^= htons(payload);
+  if(sizeof *h + RTP_FEC_OVERHEAD + payload > size) {
+    memset(fec + size, 0, sizeof *h + RTP_FEC_OVERHEAD + payload - size);
+    size = sizeof *h + RTP_FEC_OVERHEAD + payload;
+  }
+  for(n = 0; n < payload; ++n)
+    parity[n] ^= packet[sizeof *ph + n];
+  return size;
+}
+
+/** @brief Return nonzero with probability @p percent / 100 */
+static int chance(double percent) {
+  return percent > 0 && random() < percent / 100 * RAND_MAX;
+}
+
+int main(int argc, char **argv) {
+  int n, fd, fec = 0, fec_count = 0;
+  struct addrinfo *res;
+  struct stringlist sl;
+  char *sockname;
+  const char *capture = NULL;
+  unsigned port = 0, samples = 720;
+  double seconds = 10, speed = 1, drop = 0, duplicate = 0, reorder = 0;
+  long loops = 1, loop;
+  size_t i;
+  struct timeval started, now;
+  uint32_t first_ts, ts_span, ts_base;
+  uint16_t first_seq, seq_span, seq_base;
+  unsigned long sent = 0, dropped = 0, duplicated = 0, reordered = 0;
+  struct replay_packet *held = NULL;
+  unsigned char buffer[65536];
+  unsigned char fec_buffer[sizeof buffer + RTP_FEC_OVERHEAD];
+  size_t fec_len = 0;
+
+  static const struct addrinfo prefs = {
+    .ai_flags = 0,
+    .ai_family = PF_UNSPEC,
+    .ai_socktype = SOCK_DGRAM,
+    .ai_protocol = IPPROTO_UDP
+  };
+
+  mem_init();
+  if(!setlocale(LC_CTYPE, ""))
+    disorder_fatal(errno, "error calling setlocale");
+  while((n = getopt_long(argc, argv, "hVc:p:S:n:s:l:d:D:r:R:f:",
+                         options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version("rtpreplay");
+    case 'c': capture = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'S': seconds = atof(optarg); break;
+    case 'n': samples = atoi(optarg); break;
+    case 's': speed = atof(optarg); break;
+    case 'l': loops = atol(optarg); break;
+    case 'd': drop = atof(optarg); break;
+    case 'D': duplicate = atof(optarg); break;
+    case 'r': reorder = atof(optarg); break;
+    case 'R': srandom(atol(optarg)); break;
+    case 'f': fec = atoi(optarg); break;
+    default: disorder_fatal(0, "invalid option");
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  switch(argc) {
+  case 1:
+  case 2:
+    sl.n = argc;
+    sl.s = argv;
+    break;
+  default:
+    disorder_fatal(0, "usage: rtpreplay [OPTIONS] [ADDRESS] PORT");
+  }
+  if(fec < 0 || fec > RTP_FEC_MAX_GROUP)
+    disorder_fatal(0, "invalid --fec value");
+  if(!samples || samples * sizeof (int16_t) + sizeof (struct rtp_header)
+     > sizeof buffer)
+    disorder_fatal(0, "invalid --samples value");
+  if(capture)
+    read_capture(capture, port);
+  else
+    synthesize(seconds, samples);
+  if(!(res = get_address(&sl, &prefs, &sockname)))
+    exit(1);
+  if((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0)
+    disorder_fatal(errno, "error creating socket");
+  /* Work out how far to advance sequence numbers and timestamps on each
+   * loop */
+  const struct rtp_header *first = (void *)packets[0].data;
+  const struct rtp_header *last = (void *)packets[npackets - 1].data;
+  first_seq = ntohs(first->seq);
+  first_ts = ntohl(first->timestamp);
+  seq_span = ntohs(last->seq) - first_seq + 1;
+  ts_span = ntohl(last->timestamp) - first_ts
+    + (packets[npackets - 1].len - sizeof (struct rtp_header)) / 2;
+  disorder_info("sending %zu packets (%lu samples) to %s",
+                npackets, (unsigned long)ts_span, sockname);
+  xgettimeofday(&started, NULL);
+  for(loop = 0; !loops || loop < loops; ++loop) {
+    seq_base = loop * seq_span;
+    ts_base = loop * ts_span;
+    for(i = 0; i < npackets; ++i) {
+      struct replay_packet *const p = &packets[i];
+      struct rtp_header *const h = (void *)buffer;
+      /* Pace the stream according to its timestamps */
+      memcpy(buffer, p->data, p->len);
+      const uint32_t offset = ntohl(h->timestamp) - first_ts + ts_base;
+      h->seq = htons(ntohs(h->seq) + seq_base);
+      h->timestamp = htonl(offset);
+      if(speed > 0) {
+        const double due = offset / (speed * rate * channels);
+        xgettimeofday(&now, NULL);
+        const double late = tvdouble(tvsub(now, started)) - due;
+        if(late < 0)
+          usleep(-late * 1000000);
+      }
+      /* Send the FEC packet for the previous group */
+      if(fec && fec_count == fec) {
+        if(chance(drop))
+          ++dropped;
+        else if(sendto(fd, fec_buffer, fec_len, 0,
+                       res->ai_addr, res->ai_addrlen) < 0)
+          disorder_error(errno, "error sending packet");
+        else
+          ++sent;
+        fec_count = 0;
+      }
+      if(fec)
+        fec_len = fec_add(fec_buffer, fec_len, fec_count++, buffer, p->len);
+      /* Impair the stream */
+      if(chance(drop)) {
+        ++dropped;
+        continue;
+      }
+      if(!held && i + 1 < npackets && chance(reorder)) {
+        /* Send this packet after the next one */
+        held = xmalloc(sizeof *held);
+        held->data = xmalloc_noptr(p->len);
+        memcpy(held->data, buffer, p->len);
+        held->len = p->len;
+        ++reordered;
+        continue;
+      }
+      for(n = chance(duplicate) ? 2 : 1; n > 0; --n) {
+        if(sendto(fd, buffer, p->len, 0, res->ai_addr, res->ai_addrlen) < 0)
+          disorder_error(errno, "error sending packet");
+        else
+          ++sent;
+        if(n > 1)
+          ++duplicated;
+      }
+      if(held) {
+        if(sendto(fd, held->data, held->len, 0,
+                  res->ai_addr, res->ai_addrlen) < 0)
+          disorder_error(errno, "error sending packet");
+        else
+          ++sent;
+        xfree(held->data);
+        xfree(held);
+        held = NULL;
+      }
+    }
+  }
+  xgettimeofday(&now, NULL);
+  const double elapsed = tvdouble(tvsub(now, started));
+  if(printf("%lu packets sent in %.2fs (%.0f packets/s)\n"
+            "%lu dropped, %lu duplicated, %lu reordered\n",
+            sent, elapsed, elapsed > 0 ? sent / elapsed : 0.0,
+            dropped, duplicated, reordered) < 0
+     || fflush(stdout) < 0)
+    disorder_fatal(errno, "stdout");
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
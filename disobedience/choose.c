@@ -26,6 +26,17 @@
  * TRACK_COLUMN="" and ISFILE_COLUMN=FALSE (so that they don't get check boxes,
  * lengths, etc).
  *
+ * Track state, lengths and search-result highlighting are not stored in the
+ * tree.  They are computed by cell data functions when a row is drawn, and the
+ * view is in fixed-height mode so that GTK+ doesn't measure (and therefore
+ * compute) rows that aren't visible.  So expanding a large directory only
+ * issues length lookups for the rows that are on screen, and changes to the
+ * queue only cause a redraw rather than a walk over the whole tree.
+ *
+ * Directory listings are sorted and merged into the tree a chunk at a time
+ * from an idle callback (see @ref choose_fill), so that opening a very large
+ * directory doesn't freeze the interface.
+ *
  * TODO:
  * - sweep up contracted nodes, replacing their content with a placeholder
  */
@@ -133,109 +144,208 @@ static gboolean choose_remove_node(GtkTreeIter *it) {
   return gtk_tree_store_remove(choose_store, it);
 }
 
-/** @brief Update length and state fields */
-static gboolean choose_set_state_callback(GtkTreeModel attribute((unused)) *model,
-                                          GtkTreePath attribute((unused)) *path,
-                                          GtkTreeIter *it,
-                                          gpointer attribute((unused)) data) {
+/** @brief Compute the Queued column for a row */
+static void choose_state_data(GtkTreeViewColumn attribute((unused)) *column,
+                              GtkCellRenderer *r,
+                              GtkTreeModel attribute((unused)) *model,
+                              GtkTreeIter *it,
+                              gpointer attribute((unused)) data) {
+  const int isfile = choose_is_file(it);
+
+  g_object_set(r,
+               "visible", isfile,
+               "active", isfile && queued(choose_get_track(it)),
+               (char *)0);
+}
+
+/** @brief Compute the Length column for a row
+ *
+ * We expect this to kick off a length lookup rather than necessarily get the
+ * right value the first time round; choose_set_state() will redraw the row
+ * when the answer arrives.
+ */
+static void choose_length_data(GtkTreeViewColumn attribute((unused)) *column,
+                               GtkCellRenderer *r,
+                               GtkTreeModel attribute((unused)) *model,
+                               GtkTreeIter *it,
+                               gpointer attribute((unused)) data) {
+  char length[64];
+
+  length[0] = 0;
   if(choose_is_file(it)) {
-    const char *track = choose_get_track(it);
-    const long l = namepart_length(track);
-    char length[64];
+    const long l = namepart_length(choose_get_track(it));
     if(l > 0)
       byte_snprintf(length, sizeof length, "%ld:%02ld", l / 60, l % 60);
-    else
-      length[0] = 0;
-    gtk_tree_store_set(choose_store, it,
-                       LENGTH_COLUMN, length,
-                       STATE_COLUMN, queued(track),
-                       -1);
-    if(choose_is_search_result(track))
-      gtk_tree_store_set(choose_store, it,
-                         BG_COLUMN, SEARCH_RESULT_BG,
-                         FG_COLUMN, SEARCH_RESULT_FG,
-                         -1);
-    else
-      gtk_tree_store_set(choose_store, it,
-                         BG_COLUMN, (char *)0,
-                         FG_COLUMN, (char *)0,
-                         -1);
   }
-  return FALSE;                         /* continue walking */
+  g_object_set(r, "text", length, (char *)0);
+}
+
+/** @brief Compute the colors of the Track column for a row */
+static void choose_name_data(GtkTreeViewColumn attribute((unused)) *column,
+                             GtkCellRenderer *r,
+                             GtkTreeModel attribute((unused)) *model,
+                             GtkTreeIter *it,
+                             gpointer attribute((unused)) data) {
+  if(choose_is_file(it) && choose_is_search_result(choose_get_track(it)))
+    g_object_set(r,
+                 "background", SEARCH_RESULT_BG,
+                 "foreground", SEARCH_RESULT_FG,
+                 (char *)0);
+  else
+    g_object_set(r,
+                 "background", (char *)0,
+                 "foreground", (char *)0,
+                 (char *)0);
 }
 
-/** @brief Called when the queue or playing track change */
+/** @brief Called when the queue, playing track or lookups change
+ *
+ * The cell data functions above pick up the new state when the visible rows
+ * are redrawn.
+ */
 static void choose_set_state(const char attribute((unused)) *event,
                              void attribute((unused)) *eventdata,
                              void attribute((unused)) *callbackdata) {
-  gtk_tree_model_foreach(GTK_TREE_MODEL(choose_store),
-                         choose_set_state_callback,
-                         NULL);
+  gtk_widget_queue_draw(choose_view);
 }
 
-/** @brief (Re-)populate a node
+/** @brief Number of rows dealt with by each call to choose_fill_idle()
+ *
+ * This bounds how long the interface is unresponsive for while a large
+ * directory is filled in.
+ */
+#define CHOOSE_FILL_CHUNK 256
+
+/** @brief A pending (re-)population of a node
+ *
+ * Large directories are filled in a chunk at a time from an idle callback
+ * rather than all at once.  The sort keys are computed first, and then the
+ * sorted list is merged into the existing children.
+ *
+ * Fills are done strictly one after another, so nothing else modifies the
+ * store between the chunks of a fill; the iterators can be kept from one
+ * chunk to the next because GtkTreeStore iterators persist.
+ */
+struct choose_fill {
+  /** @brief Next fill in @ref choose_fills */
+  struct choose_fill *next;
+
+  /** @brief Node to populate or NULL for the root */
+  GtkTreeRowReference *parent_ref;
+
+  /** @brief Number of children */
+  int nvec;
+
+  /** @brief Children */
+  char **vec;
+
+  /** @brief 1 if children are files, 0 if directories */
+  int isfile;
+
+  /** @brief Sort data for children */
+  struct tracksort_data *td;
+
+  /** @brief Number of entries of @c td prepared so far */
+  int prepared;
+
+  /** @brief Number of entries of @c td merged so far */
+  int merged;
+
+  /** @brief Set once merging has started */
+  int merging;
+
+  /** @brief Next existing row to consider, if @c itv */
+  GtkTreeIter it[1];
+
+  /** @brief Row before @c it, if @c prevv */
+  GtkTreeIter prev[1];
+
+  /** @brief Whether @c it is valid */
+  gboolean itv;
+
+  /** @brief Whether @c prev is valid */
+  gboolean prevv;
+
+  /** @brief Set if the placeholder has been deleted */
+  int deleted_placeholder;
+};
+
+/** @brief Pending fills, in the order they arrived */
+static struct choose_fill *choose_fills;
+
+/** @brief Where to add the next fill */
+static struct choose_fill **choose_fills_tail = &choose_fills;
+
+/** @brief Idle source for choose_fill_idle(), or 0 */
+static guint choose_fill_source;
+
+static gboolean choose_fill_idle(gpointer data);
+
+/** @brief Queue (re-)population of a node
  * @param parent_ref Node to populate or NULL to fill root
  * @param nvec Number of children to add
  * @param vec Children
  * @param isfile 1 if children are files, 0 if directories
  *
  * Adjusts the set of files (or directories) below @p parent_ref to match those
- * listed in @p nvec and @p vec.
+ * listed in @p nvec and @p vec, in chunks from an idle callback.
  *
  * @p parent_ref will be destroyed.
  */
 static void choose_populate(GtkTreeRowReference *parent_ref,
                             int nvec, char **vec,
                             int isfile) {
-  const char *type = isfile ? "track" : "dir";
-  //fprintf(stderr, "%d new children of type %s\n", nvec, type);
-  if(!nvec)
-    goto skip;
-  /* Compute parent_* */
-  GtkTreeIter pit[1], *parent_it;
-  GtkTreePath *parent_path;
-  if(parent_ref) {
-    parent_path = gtk_tree_row_reference_get_path(parent_ref);
-    parent_it = pit;
-    gboolean pitv = gtk_tree_model_get_iter(GTK_TREE_MODEL(choose_store),
-                                            pit, parent_path);
-    assert(pitv);
-    /*fprintf(stderr, "choose_populate %s: parent path is [%s]\n",
-            type,
-            gtk_tree_path_to_string(parent_path));*/
-  } else {
-    parent_path = 0;
-    parent_it = 0;
-    /*fprintf(stderr, "choose_populate %s: populating the root\n",
-            type);*/
+  struct choose_fill *f = xmalloc(sizeof *f);
+
+  f->parent_ref = parent_ref;
+  f->nvec = nvec;
+  f->vec = vec;
+  f->isfile = isfile;
+  f->td = nvec ? xcalloc(nvec, sizeof *f->td) : 0;
+  *choose_fills_tail = f;
+  choose_fills_tail = &f->next;
+  if(!choose_fill_source)
+    choose_fill_source = g_idle_add(choose_fill_idle, 0);
+}
+
+/** @brief Merge some sorted children into the tree
+ * @param f Fill
+ * @param parent_it Parent row or NULL for the root
+ * @return Nonzero when the merge is complete
+ *
+ * Both td[] and the current node set are sorted so we can do a single linear
+ * pass to insert new nodes and remove unwanted ones.
+ */
+static int choose_fill_merge(struct choose_fill *f, GtkTreeIter *parent_it) {
+  const int isfile = f->isfile;
+  int budget = CHOOSE_FILL_CHUNK;
+
+  if(!f->merging) {
+    f->itv = gtk_tree_model_iter_children(GTK_TREE_MODEL(choose_store),
+                                          f->it,
+                                          parent_it);
+    f->prevv = FALSE;
+    f->merging = 1;
   }
-  /* Both td[] and the current node set are sorted so we can do a single linear
-   * pass to insert new nodes and remove unwanted ones.  The total performance
-   * may be worse than linear depending on the performance of GTK+'s insert and
-   * delete operations. */
-  //fprintf(stderr, "sorting tracks\n");
-  struct tracksort_data *td = tracksort_init(nvec, vec, type);
-  GtkTreeIter it[1];
-  gboolean itv = gtk_tree_model_iter_children(GTK_TREE_MODEL(choose_store),
-                                              it,
-                                              parent_it);
-  int inserted = 0, deleted_placeholder = 0;
-  //fprintf(stderr, "inserting tracks type=%s\n", type);
-  while(nvec > 0 || itv) {
+  while(f->merged < f->nvec || f->itv) {
+    if(!budget--)
+      return 0;
+    const struct tracksort_data *const td = &f->td[f->merged];
+    const int nvec = f->nvec - f->merged;
     /*fprintf(stderr, "td[] = %s, it=%s [%s]\n",
             nvec > 0 ? td->track : "(none)",
-            itv ? choose_get_track(it) : "(!itv)",
-            itv ? (choose_is_file(it) ? "file" : "dir") : "");*/
+            f->itv ? choose_get_track(f->it) : "(!itv)",
+            f->itv ? (choose_is_file(f->it) ? "file" : "dir") : "");*/
     enum { INSERT, DELETE, SKIP_TREE, SKIP_BOTH } action;
-    const char *track = itv ? choose_get_track(it) : 0;
-    if(itv && !track) {
+    const char *track = f->itv ? choose_get_track(f->it) : 0;
+    if(f->itv && !track) {
       //fprintf(stderr, " placeholder\n");
       action = DELETE;
-      ++deleted_placeholder;
-    } else if(nvec > 0 && itv) {
+      ++f->deleted_placeholder;
+    } else if(nvec > 0 && f->itv) {
       /* There's both a tree row and a td[] entry */
-      const int cmp = compare_tracks(td->sort, choose_get_sort(it),
-                                     td->display, choose_get_display(it),
+      const int cmp = compare_tracks(td->sort, choose_get_sort(f->it),
+                                     td->display, choose_get_display(f->it),
                                      td->track, track);
       //fprintf(stderr, " cmp=%d\n", cmp);
       if(cmp < 0)
@@ -243,7 +353,7 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
         action = INSERT;
       else if(cmp > 0) {
         /* td > it, so we must either delete it (if the same type) or skip it */
-        if(choose_is_file(it) == isfile)
+        if(choose_is_file(f->it) == isfile)
           action = DELETE;
         else
           action = SKIP_TREE;
@@ -259,7 +369,7 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
       /* We've reached the end of the new tracks from td[], but there are
        * further tracks in the tree */
       //fprintf(stderr, " deleting\n");
-      if(choose_is_file(it) == isfile)
+      if(choose_is_file(f->it) == isfile)
         action = DELETE;
       else
         action = SKIP_TREE;
@@ -269,12 +379,19 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
     case INSERT: {
       //fprintf(stderr, " INSERT %s\n", td->track);
       /* Insert a new row from td[] before it, or at the end if it is no longer
-       * valid */
+       * valid.  Inserting after the previous row rather than before a null
+       * successor avoids a walk along the whole list for each appended row. */
       GtkTreeIter child[1];
-      gtk_tree_store_insert_before(choose_store,
-                                   child, /* new row */
-                                   parent_it, /* parent */
-                                   itv ? it : NULL); /* successor */
+      if(f->itv)
+        gtk_tree_store_insert_before(choose_store,
+                                     child, /* new row */
+                                     parent_it, /* parent */
+                                     f->it); /* successor */
+      else
+        gtk_tree_store_insert_after(choose_store,
+                                    child, /* new row */
+                                    parent_it, /* parent */
+                                    f->prevv ? f->prev : NULL); /* predecessor */
       gtk_tree_store_set(choose_store, child,
                          NAME_COLUMN, td->display,
                          ISFILE_COLUMN, isfile,
@@ -282,9 +399,8 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
                          SORT_COLUMN, td->sort,
                          AUTOCOLLAPSE_COLUMN, FALSE,
                          -1);
-      /* Update length and state; we expect this to kick off length lookups
-       * rather than necessarily get the right value the first time round. */
-      choose_set_state_callback(0, 0, child, 0);
+      *f->prev = *child;
+      f->prevv = TRUE;
       /* If we inserted a directory, insert a placeholder too, so it appears to
        * have children; it will be deleted when we expand the directory. */
       if(!isfile) {
@@ -298,49 +414,104 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
                            ISFILE_COLUMN, FALSE,
                            -1);
       }
-      ++inserted;
-      ++td;
-      --nvec;
+      ++f->merged;
       break;
     }
     case SKIP_BOTH:
       //fprintf(stderr, " SKIP_BOTH\n");
-      ++td;
-      --nvec;
+      ++f->merged;
       /* fall thru */
     case SKIP_TREE:
       //fprintf(stderr, " SKIP_TREE\n");
-      itv = gtk_tree_model_iter_next(GTK_TREE_MODEL(choose_store), it);
+      *f->prev = *f->it;
+      f->prevv = TRUE;
+      f->itv = gtk_tree_model_iter_next(GTK_TREE_MODEL(choose_store), f->it);
       break;
     case DELETE:
       //fprintf(stderr, " DELETE\n");
-      itv = choose_remove_node(it);
+      f->itv = choose_remove_node(f->it);
       break;
     }
   }
-  /*fprintf(stderr, "inserted=%d deleted_placeholder=%d\n\n",
-          inserted, deleted_placeholder);*/
-  if(parent_ref) {
-    /* If we deleted a placeholder then we must re-expand the row */
-    if(deleted_placeholder) {
-      ++choose_suppress_set_autocollapse;
-      gtk_tree_view_expand_row(GTK_TREE_VIEW(choose_view), parent_path, FALSE);
-      --choose_suppress_set_autocollapse;
+  return 1;
+}
+
+/** @brief Do one chunk of a fill
+ * @param f Fill
+ * @return Nonzero when the fill is complete
+ */
+static int choose_fill_step(struct choose_fill *f) {
+  GtkTreeIter pit[1], *parent_it = 0;
+  GtkTreePath *parent_path = 0;
+  int done, budget = CHOOSE_FILL_CHUNK;
+
+  if(!f->nvec)
+    return 1;
+  /* Compute sort keys, which is most of the work of sorting */
+  if(f->prepared < f->nvec) {
+    while(f->prepared < f->nvec && budget--) {
+      tracksort_prepare(&f->td[f->prepared], f->vec[f->prepared],
+                        f->isfile ? "track" : "dir");
+      ++f->prepared;
     }
-    gtk_tree_row_reference_free(parent_ref);
-    gtk_tree_path_free(parent_path);
+    if(f->prepared < f->nvec)
+      return 0;
+    tracksort_sort(f->td, f->nvec);
+    return 0;
   }
-skip:
-  /* We only notify others that we've inserted tracks when there are no more
-   * insertions pending, so that they don't have to keep track of how many
-   * requests they've made.  */
-  if(--choose_list_in_flight == 0) {
-    /* Notify interested parties that we inserted some tracks, AFTER making
-     * sure that the row is properly expanded */
-    //fprintf(stderr, "raising choose-more-tracks\n");
-    event_raise("choose-more-tracks", 0);
+  /* Find the parent.  If it has gone away then so has the need to fill it. */
+  if(f->parent_ref) {
+    if(!gtk_tree_row_reference_valid(f->parent_ref))
+      return 1;
+    parent_path = gtk_tree_row_reference_get_path(f->parent_ref);
+    parent_it = pit;
+    gboolean pitv = gtk_tree_model_get_iter(GTK_TREE_MODEL(choose_store),
+                                            pit, parent_path);
+    assert(pitv);
+  }
+  done = choose_fill_merge(f, parent_it);
+  /* Deleting the placeholder collapses the row, so re-expand it as soon as
+   * it has some real children */
+  if(f->deleted_placeholder == 1 && parent_path) {
+    ++choose_suppress_set_autocollapse;
+    gtk_tree_view_expand_row(GTK_TREE_VIEW(choose_view), parent_path, FALSE);
+    --choose_suppress_set_autocollapse;
+    ++f->deleted_placeholder;
   }
-  //fprintf(stderr, "choose_list_in_flight -> %d-\n", choose_list_in_flight);
+  if(parent_path)
+    gtk_tree_path_free(parent_path);
+  return done;
+}
+
+/** @brief Fill in the next chunk of the oldest pending fill
+ * @param data Not used
+ * @return TRUE if there is more to do
+ */
+static gboolean choose_fill_idle(gpointer attribute((unused)) data) {
+  struct choose_fill *f = choose_fills;
+
+  if(choose_fill_step(f)) {
+    if(!(choose_fills = f->next))
+      choose_fills_tail = &choose_fills;
+    if(f->parent_ref)
+      gtk_tree_row_reference_free(f->parent_ref);
+    xfree(f->td);
+    xfree(f);
+    /* We only notify others that we've inserted tracks when there are no
+     * more insertions pending, so that they don't have to keep track of how
+     * many requests they've made.  */
+    if(--choose_list_in_flight == 0) {
+      /* Notify interested parties that we inserted some tracks, AFTER making
+       * sure that the row is properly expanded */
+      //fprintf(stderr, "raising choose-more-tracks\n");
+      event_raise("choose-more-tracks", 0);
+    }
+    //fprintf(stderr, "choose_list_in_flight -> %d-\n", choose_list_in_flight);
+  }
+  if(choose_fills)
+    return TRUE;
+  choose_fill_source = 0;
+  return FALSE;
 }
 
 static void choose_dirs_completed(void *v,
@@ -611,14 +782,10 @@ static void choose_drag_data_get(GtkWidget *w,
 GtkWidget *choose_widget(void) {
   /* Create the tree store. */
   choose_store = gtk_tree_store_new(CHOOSE_COLUMNS,
-                                    G_TYPE_BOOLEAN,
-                                    G_TYPE_STRING,
                                     G_TYPE_STRING,
                                     G_TYPE_BOOLEAN,
                                     G_TYPE_STRING,
                                     G_TYPE_STRING,
-                                    G_TYPE_STRING,
-                                    G_TYPE_STRING,
                                     G_TYPE_BOOLEAN);
 
   /* Create the view */
@@ -626,6 +793,9 @@ GtkWidget *choose_widget(void) {
   gtk_tree_view_set_rules_hint(GTK_TREE_VIEW(choose_view), TRUE);
   /* Suppress built-in typeahead find, we do our own search support. */
   gtk_tree_view_set_enable_search(GTK_TREE_VIEW(choose_view), FALSE);
+  /* All rows are the same height, so GTK+ need not measure every row.  This
+   * requires all the columns to be fixed-size. */
+  gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(choose_view), TRUE);
 
   /* Create cell renderers and columns */
   /* TODO use a table */
@@ -634,9 +804,10 @@ GtkWidget *choose_widget(void) {
     GtkTreeViewColumn *c = gtk_tree_view_column_new_with_attributes
       ("Queued",
        r,
-       "active", STATE_COLUMN,
-       "visible", ISFILE_COLUMN,
        (char *)0);
+    gtk_tree_view_column_set_cell_data_func(c, r, choose_state_data, 0, 0);
+    gtk_tree_view_column_set_sizing(c, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(c, 64);
     gtk_tree_view_column_set_resizable(c, TRUE);
     gtk_tree_view_column_set_reorderable(c, TRUE);
     gtk_tree_view_append_column(GTK_TREE_VIEW(choose_view), c);
@@ -648,8 +819,10 @@ GtkWidget *choose_widget(void) {
     GtkTreeViewColumn *c = gtk_tree_view_column_new_with_attributes
       ("Length",
        r,
-       "text", LENGTH_COLUMN,
        (char *)0);
+    gtk_tree_view_column_set_cell_data_func(c, r, choose_length_data, 0, 0);
+    gtk_tree_view_column_set_sizing(c, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(c, 64);
     gtk_tree_view_column_set_resizable(c, TRUE);
     gtk_tree_view_column_set_reorderable(c, TRUE);
     g_object_set(r, "xalign", (gfloat)1.0, (char *)0);
@@ -661,9 +834,10 @@ GtkWidget *choose_widget(void) {
       ("Track",
        r,
        "text", NAME_COLUMN,
-       "background", BG_COLUMN,
-       "foreground", FG_COLUMN,
        (char *)0);
+    gtk_tree_view_column_set_cell_data_func(c, r, choose_name_data, 0, 0);
+    gtk_tree_view_column_set_sizing(c, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(c, 400);
     gtk_tree_view_column_set_resizable(c, TRUE);
     gtk_tree_view_column_set_reorderable(c, TRUE);
     g_object_set(c, "expand", TRUE, (char *)0);
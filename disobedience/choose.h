@@ -24,15 +24,11 @@
 /** @brief Column numbers */
 enum {
   /* Visible columns */
-  STATE_COLUMN,                 /* Track state */
   NAME_COLUMN,                  /* Track name (display context) */
-  LENGTH_COLUMN,                /* Track length */
   /* Hidden columns */
   ISFILE_COLUMN,                /* TRUE for a track, FALSE for a directory */
   TRACK_COLUMN,                 /* Full track name, "" for placeholder */
   SORT_COLUMN,                  /* Sort key */
-  BG_COLUMN,                    /* Background color */
-  FG_COLUMN,                    /* Foreground color */
   AUTOCOLLAPSE_COLUMN,          /* TRUE if row should be auto-collapsed */
 
   CHOOSE_COLUMNS                /* column count */
@@ -121,6 +121,7 @@ static gboolean delete_event(GtkWidget attribute((unused)) *widget,
                              GdkEvent attribute((unused)) *event,
                              gpointer attribute((unused)) data) {
   D(("delete_event"));
+  namepart_save();
   exit(0);                              /* die immediately */
 }
 
@@ -349,6 +350,8 @@ static gboolean periodic_slow(gpointer attribute((unused)) data) {
   D(("periodic_slow"));
   /* Expire cached data */
   cache_expire();
+  /* Save lookup results in case we don't get to exit cleanly */
+  namepart_save();
   /* Update everything to be sure that the connection to the server hasn't
    * mysteriously gone stale on us. */
   all_update();
@@ -573,6 +576,7 @@ int main(int argc, char **argv) {
   D(("create main loop"));
   mainloop = g_main_loop_new(0, 0);
   if(config_read(0, NULL)) disorder_fatal(0, "cannot read configuration");
+  namepart_init();
   /* create the clients */
   if(!(client = gtkclient())
      || !(logclient = gtkclient()))
@@ -81,6 +81,28 @@ struct tabtype {
   void *extra;
 };
 
+/** @brief An incremental change to the queue
+ *
+ * Passed with the @c queue-diff event.
+ */
+struct queue_diff {
+  /** @brief What happened */
+  enum {
+    QUEUE_DIFF_INSERT,                  /**< @brief @ref q was added */
+    QUEUE_DIFF_MOVE,                    /**< @brief @ref id was moved */
+    QUEUE_DIFF_REMOVE                   /**< @brief @ref id was removed */
+  } op;
+
+  /** @brief ID of the entry now preceding the changed one, or "" for none */
+  const char *after;
+
+  /** @brief ID of the moved or removed entry */
+  const char *id;
+
+  /** @brief The new entry */
+  struct queue_entry *q;
+};
+
 /** @brief Button definitions */
 struct button {
   const gchar *stock;
@@ -101,6 +123,7 @@ extern GtkWidget *toplevel;             /* top level window */
 extern GtkWidget *report_label;         /* label for progress indicator */
 extern GtkWidget *tabs;                 /* main tabs */
 extern disorder_eclient *client;        /* main client */
+extern disorder_eclient *logclient;     /* client for log */
 
 extern unsigned long last_state;        /* last reported state */
 extern rights_type last_rights;         /* last reported rights bitmap */
@@ -211,6 +234,12 @@ void namepart_update(const char *track,
                      const char *part);
 /* Called when a namepart might have changed */
 
+void namepart_init(void);
+/* Load lookup results saved by a previous session */
+
+void namepart_save(void);
+/* Save lookup results for the next session */
+
 /* Choose */
 
 GtkWidget *choose_widget(void);
@@ -50,6 +50,21 @@ static void log_playlist_deleted(void *v,
                                  const char *playlist);
 static void log_global_pref(void *v,
                             const char *name, const char *value);
+static void log_track_changed(void *v,
+                              const char *track, const char *pref);
+static void log_queue_insert(void *v,
+                             const char *after, struct queue_entry *q);
+static void log_queue_move(void *v,
+                           const char *after, const char *id);
+static void log_queue_remove(void *v, const char *id);
+static void log_queue_reset(void *v);
+
+/** @brief True if the server reports queue changes incrementally
+ *
+ * If so then the @c queue, @c moved, @c removed and @c adopted events are
+ * ignored.
+ */
+static int queue_diffs;
 
 /** @brief Callbacks for server state monitoring */
 const disorder_eclient_log_callbacks log_callbacks = {
@@ -72,6 +87,11 @@ const disorder_eclient_log_callbacks log_callbacks = {
   .playlist_modified = log_playlist_modified,
   .playlist_deleted = log_playlist_deleted,
   .global_pref = log_global_pref,
+  .track_changed = log_track_changed,
+  .queue_insert = log_queue_insert,
+  .queue_move = log_queue_move,
+  .queue_remove = log_queue_remove,
+  .queue_reset = log_queue_reset,
 };
 
 /** @brief Update everything */
@@ -91,10 +111,20 @@ void all_update(void) {
  * is called whenever it connects.
  */
 static void log_connected(void attribute((unused)) *v) {
-  /* Don't know what we might have missed while disconnected so update
-   * everything.  We get this at startup too and this is how we do the initial
-   * state fetch. */
-  all_update();
+  /* If we're resuming then the server will tell us what happened to the
+   * queue while we were disconnected (or tell us to fetch it again). */
+  queue_diffs = disorder_eclient_log_resuming(logclient);
+  if(queue_diffs) {
+    ++suppress_actions;
+    event_raise("recent-changed", 0);
+    event_raise("volume-changed", 0);
+    event_raise("rescan-complete", 0);
+    --suppress_actions;
+  } else
+    /* Don't know what we might have missed while disconnected so update
+     * everything.  We get this at startup too and this is how we do the
+     * initial state fetch. */
+    all_update();
   event_raise("log-connected", 0);
 }
 
@@ -112,7 +142,8 @@ static void log_failed(void attribute((unused)) *v,
 /** @brief Called when some track is moved within the queue */
 static void log_moved(void attribute((unused)) *v,
                       const char attribute((unused)) *user) {
-  event_raise("queue-changed", 0);
+  if(!queue_diffs)
+    event_raise("queue-changed", 0);
 }
 
 static void log_playing(void attribute((unused)) *v,
@@ -124,7 +155,8 @@ static void log_playing(void attribute((unused)) *v,
 /** @brief Called when a track is added to the queue */
 static void log_queue(void attribute((unused)) *v,
                       struct queue_entry attribute((unused)) *q) {
-  event_raise("queue-changed", 0);
+  if(!queue_diffs)
+    event_raise("queue-changed", 0);
 }
 
 /** @brief Called when a track is added to the recently-played list */
@@ -146,7 +178,8 @@ static void log_recent_removed(void attribute((unused)) *v,
 static void log_removed(void attribute((unused)) *v,
                         const char attribute((unused)) *id,
                         const char attribute((unused)) *user) {
-  event_raise("queue-changed", 0);
+  if(!queue_diffs)
+    event_raise("queue-changed", 0);
 }
 
 /** @brief Called when the current track is scratched */
@@ -221,7 +254,8 @@ static void log_rights_changed(void attribute((unused)) *v,
 static void log_adopted(void attribute((unused)) *v,
                         const char attribute((unused)) *id,
                         const char attribute((unused)) *who) {
-  event_raise("queue-changed", 0);
+  if(!queue_diffs)
+    event_raise("queue-changed", 0);
 }
 
 static void log_playlist_created(void attribute((unused)) *v,
@@ -247,6 +281,47 @@ static void log_global_pref(void attribute((unused)) *v,
   event_raise("global-pref", (void *)name);
 }
 
+/** @brief Called when a track's preferences change */
+static void log_track_changed(void attribute((unused)) *v,
+                              const char *track,
+                              const char attribute((unused)) *pref) {
+  event_raise("track-changed", (void *)track);
+}
+
+/** @brief Called when a track is inserted into the queue */
+static void log_queue_insert(void attribute((unused)) *v,
+                             const char *after,
+                             struct queue_entry *q) {
+  struct queue_diff d = { .op = QUEUE_DIFF_INSERT, .after = after, .q = q };
+
+  event_raise("queue-diff", &d);
+}
+
+/** @brief Called when a track is moved within the queue */
+static void log_queue_move(void attribute((unused)) *v,
+                           const char *after,
+                           const char *id) {
+  struct queue_diff d = { .op = QUEUE_DIFF_MOVE, .after = after, .id = id };
+
+  event_raise("queue-diff", &d);
+}
+
+/** @brief Called when a track is removed from the queue */
+static void log_queue_remove(void attribute((unused)) *v,
+                             const char *id) {
+  struct queue_diff d = { .op = QUEUE_DIFF_REMOVE, .id = id };
+
+  event_raise("queue-diff", &d);
+}
+
+/** @brief Called when the server can't tell us what changed in the queue */
+static void log_queue_reset(void attribute((unused)) *v) {
+  /* If we weren't resuming then log_connected() already fetched the queue */
+  if(queue_diffs)
+    event_raise("queue-changed", 0);
+  queue_diffs = 1;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
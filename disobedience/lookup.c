@@ -19,10 +19,195 @@
  * @brief Disobedience server lookups and caching
  */
 #include "disobedience.h"
+#include <sys/stat.h>
 
 static int namepart_lookups_outstanding;
-static const struct cache_type cachetype_string = { 3600 };
-static const struct cache_type cachetype_integer = { 3600 };
+static const struct cache_type cachetype_string = { 3600, 0 };
+static const struct cache_type cachetype_integer = { 3600, 0 };
+
+/** @brief How long a saved lookup result remains usable
+ *
+ * The server tells us about changes while we are connected, but not about
+ * changes made while Disobedience was not running, so saved results are not
+ * trusted forever.  Nor does it tell us about lengths found by a rescan,
+ * which happens in a separate process; this only matters if a track is
+ * replaced by a file of a different length.
+ */
+#define SAVED_LIFETIME 86400
+
+/** @brief A lookup result to be saved between sessions */
+struct saved_lookup {
+  /** @brief Value as a string */
+  char *value;
+
+  /** @brief When the value was fetched from the server */
+  time_t when;
+};
+
+/** @brief Lookup results to save, keyed by cache key
+ *
+ * Values are @ref saved_lookup structures.
+ */
+static hash *saved_lookups;
+
+/** @brief Set when @ref saved_lookups has changed since it was last saved */
+static int saved_lookups_dirty;
+
+/** @brief Server that @ref saved_lookups came from */
+static char *saved_lookups_server;
+
+static void namepart_track_changed(const char *event,
+                                   void *eventdata,
+                                   void *callbackdata);
+
+/** @brief Remember a lookup result so it can be saved */
+static void namepart_remember(const char *key, const char *value,
+                              time_t when) {
+  struct saved_lookup sl;
+
+  sl.value = xstrdup(value);
+  sl.when = when;
+  hash_add(saved_lookups, key, &sl, HASH_INSERT_OR_REPLACE);
+  saved_lookups_dirty = 1;
+}
+
+/** @brief Return a string identifying the server we connect to */
+static char *namepart_server(void) {
+  struct dynstr d[1];
+  char **vec;
+  int nvec, n;
+
+  if(config->connect.af == -1)
+    return xstrdup("local");
+  netaddress_format(&config->connect, &nvec, &vec);
+  dynstr_init(d);
+  for(n = 0; n < nvec; ++n) {
+    if(n)
+      dynstr_append(d, ' ');
+    dynstr_append_string(d, quoteutf8(vec[n]));
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Load saved lookup results
+ *
+ * Results saved by a previous session against the same server are put
+ * straight into the cache, so that a freshly started Disobedience need not
+ * ask the server about every track it displays.
+ */
+void namepart_init(void) {
+  char *path, *line, *server = 0;
+  FILE *fp;
+  char **vec;
+  int nvec, n;
+  const time_t now = xtime(0);
+  long when, *length;
+  struct dynstr d[1];
+
+  saved_lookups = hash_new(sizeof (struct saved_lookup));
+  saved_lookups_server = namepart_server();
+  event_register("track-changed", namepart_track_changed, 0);
+  if(!(path = profile_filename("lookups")))
+    return;
+  if(!(fp = fopen(path, "r"))) {
+    if(errno != ENOENT)
+      disorder_error(errno, "error opening %s", path);
+    return;
+  }
+  while(!inputline(path, fp, &line, '\n')) {
+    if(!(vec = split(line, &nvec, SPLIT_QUOTES, 0, 0))
+       || !nvec)
+      continue;
+    if(!strcmp(vec[0], "server")) {
+      dynstr_init(d);
+      for(n = 1; n < nvec; ++n) {
+        if(n > 1)
+          dynstr_append(d, ' ');
+        dynstr_append_string(d, quoteutf8(vec[n]));
+      }
+      dynstr_terminate(d);
+      server = d->vec;
+    } else if(!strcmp(vec[0], "lookup")) {
+      /* Results from some other server are no use */
+      if(!server || strcmp(server, saved_lookups_server))
+        break;
+      if(nvec != 4 || xstrtol(&when, vec[3], 0, 10)) {
+        disorder_error(0, "%s: malformed '%s' command", path, vec[0]);
+        continue;
+      }
+      if(when > now || now - when > SAVED_LIFETIME)
+        continue;
+      if(!strncmp(vec[1], "length ", 7)) {
+        length = xmalloc(sizeof *length);
+        if(xstrtol(length, vec[2], 0, 10))
+          continue;
+        cache_put(&cachetype_integer, vec[1], length);
+      } else
+        cache_put(&cachetype_string, vec[1], xstrdup(vec[2]));
+      namepart_remember(vec[1], vec[2], when);
+    }
+  }
+  if(ferror(fp))
+    disorder_error(errno, "error reading %s", path);
+  fclose(fp);
+  saved_lookups_dirty = 0;
+}
+
+/** @brief Callback for namepart_save() */
+static int namepart_save_callback(const char *key, void *value, void *u) {
+  const struct saved_lookup *sl = value;
+  FILE *fp = u;
+
+  if(fprintf(fp, "lookup %s %s %ld\n",
+             quoteutf8(key), quoteutf8(sl->value), (long)sl->when) < 0)
+    return -1;
+  return 0;
+}
+
+/** @brief Save lookup results for the next session
+ *
+ * Does nothing if nothing has changed since the last save.
+ */
+void namepart_save(void) {
+  const char *dir;
+  char *path, *tmp;
+  FILE *fp;
+
+  if(!saved_lookups || !saved_lookups_dirty)
+    return;
+  /* If we've been pointed at another server since we started then we don't
+   * know which server the results came from */
+  if(strcmp(namepart_server(), saved_lookups_server))
+    return;
+  if(!(dir = profile_directory()))
+    return;
+  byte_xasprintf(&path, "%s/lookups", dir);
+  byte_xasprintf(&tmp, "%s.tmp", path);
+  mkdir(dir, 02700);                    /* make sure directory exists */
+  if(!(fp = fopen(tmp, "w"))) {
+    disorder_error(errno, "error opening %s", tmp);
+    return;
+  }
+  if(fprintf(fp, "# automatically generated!\nserver %s\n",
+             saved_lookups_server) < 0
+     || hash_foreach(saved_lookups, namepart_save_callback, fp)) {
+    disorder_error(errno, "error writing to %s", tmp);
+    fclose(fp);
+    unlink(tmp);
+    return;
+  }
+  if(fclose(fp) < 0) {
+    disorder_error(errno, "error writing to %s", tmp);
+    unlink(tmp);
+    return;
+  }
+  if(rename(tmp, path) < 0) {
+    disorder_error(errno, "error renaming %s to %s", tmp, path);
+    return;
+  }
+  saved_lookups_dirty = 0;
+}
 
 /** @brief Called when a namepart lookup has completed or failed
  *
@@ -46,6 +231,8 @@ static void namepart_completed(void *v, const char *err, const char *value) {
   const char *key = v;
   
   cache_put(&cachetype_string, key, value);
+  if(!err)
+    namepart_remember(key, value, xtime(0));
   namepart_completed_or_failed();
 }
 
@@ -63,6 +250,12 @@ static void length_completed(void *v, const char *err, long l) {
   value = xmalloc(sizeof *value);
   *value = l;
   cache_put(&cachetype_integer, key, value);
+  if(l > 0) {
+    char buffer[32];
+
+    snprintf(buffer, sizeof buffer, "%ld", l);
+    namepart_remember(key, buffer, xtime(0));
+  }
   namepart_completed_or_failed();
 }
 
@@ -116,6 +309,46 @@ void namepart_update(const char *track,
     namepart_fill(track, context, part, key);
 }
 
+/** @brief Callback for namepart_track_changed() */
+static int namepart_track_changed_callback(const char *key,
+                                           void attribute((unused)) *value,
+                                           void *u) {
+  const char *track = u;
+  const char *t = strstr(key, " track=");
+  char *k, *context, *part;
+
+  /* Lengths don't depend on preferences */
+  if(!t || strcmp(t + 7, track) || !strncmp(key, "length ", 7))
+    return 0;
+  k = xstrdup(key);
+  hash_remove(saved_lookups, key);
+  saved_lookups_dirty = 1;
+  if(!strncmp(k, "namepart ", 9)) {
+    /* "namepart context=CONTEXT part=PART track=TRACK" */
+    context = xstrdup(k + 17);
+    part = strchr(context, ' ');
+    *part = 0;
+    part += 6;
+    *strchr(part, ' ') = 0;
+    namepart_fill(track, context, part, k);
+  } else if(!strncmp(k, "resolve ", 8)) {
+    ++namepart_lookups_outstanding;
+    disorder_eclient_resolve(client, namepart_completed, track, k);
+  }
+  return 0;
+}
+
+/** @brief Called when the server says a track's preferences changed
+ *
+ * Anything we know about the track that might depend on its preferences is
+ * fetched again.
+ */
+static void namepart_track_changed(const char attribute((unused)) *event,
+                                   void *eventdata,
+                                   void attribute((unused)) *callbackdata) {
+  hash_foreach(saved_lookups, namepart_track_changed_callback, eventdata);
+}
+
 /** @brief Look up a track length
  *
  * If it is in the cache then just return its value.  If not then look it up
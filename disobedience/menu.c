@@ -50,6 +50,7 @@ static void quit_program(gpointer attribute((unused)) callback_data,
                          guint attribute((unused)) callback_action,
                          GtkWidget attribute((unused)) *menu_item) {
   D(("quit_program"));
+  namepart_save();
   exit(0);
 }
 
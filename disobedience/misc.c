@@ -100,7 +100,7 @@ GtkWidget *frame_widget(GtkWidget *w, const char *label) {
  * Images are searched for in @c pkgdatadir/static.
  */
 GdkPixbuf *find_image(const char *name) {
-  static const struct cache_type image_cache_type = { INT_MAX };
+  static const struct cache_type image_cache_type = { INT_MAX, 0 };
 
   GdkPixbuf *pb;
   char *path;
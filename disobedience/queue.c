@@ -35,12 +35,43 @@ struct queue_entry *playing_track;
  */
 time_t last_playing;
 
+/** @brief A queue change received while the queue was being fetched */
+struct pending_diff {
+  struct pending_diff *next;
+  struct queue_diff d;
+};
+
+/** @brief Number of @c queue commands awaiting a response */
+static int queue_fetches;
+
+/** @brief Queue changes to apply when the fetch completes
+ *
+ * The fetch uses a different connection to the log, so the response may
+ * predate changes that we have already been told about.
+ */
+static struct pending_diff *pending_diffs;
+
+/** @brief Where to add the next pending change */
+static struct pending_diff **pending_diffs_tail = &pending_diffs;
+
+/** @brief True if start times are out of date because lengths were unknown */
+static int queue_lengths_pending;
+
 static void queue_completed(void *v,
                             const char *err,
                             struct queue_entry *q);
 static void playing_completed(void *v,
                               const char *err,
                               struct queue_entry *q);
+static int queue_apply_diff(const struct queue_diff *d);
+static time_t queue_playing_ends(void);
+static void queue_set_times(struct queue_entry *head, time_t when);
+
+/** @brief Fetch the whole queue */
+static void queue_fetch(void) {
+  ++queue_fetches;
+  disorder_eclient_queue(client, queue_completed, 0);
+}
 
 /** @brief Called when either the actual queue or the playing track change */
 static void queue_playing_changed(void) {
@@ -55,7 +86,7 @@ static void queue_playing_changed(void) {
         break;
     if(q) {
       disorder_eclient_playing(client, playing_completed, 0);
-      disorder_eclient_queue(client, queue_completed, 0);
+      queue_fetch();
       return;
     }
   }
@@ -79,12 +110,27 @@ static void queue_playing_changed(void) {
 static void queue_completed(void attribute((unused)) *v,
                             const char *err,
                             struct queue_entry *q) {
+  struct pending_diff *p;
+
+  --queue_fetches;
   if(err) {
     popup_protocol_error(0, err);
     return;
   }
   actual_queue = q;
-  queue_playing_changed();
+  queue_lengths_pending = 0;
+  if(queue_fetches)
+    return;                             /* a later response is coming */
+  /* Bring the queue up to date with changes received while we waited */
+  for(p = pending_diffs; p; p = p->next)
+    if(queue_apply_diff(&p->d))
+      break;
+  pending_diffs = 0;
+  pending_diffs_tail = &pending_diffs;
+  if(p)
+    queue_fetch();
+  else
+    queue_playing_changed();
 }
 
 /** @brief Update the playing track */
@@ -96,6 +142,12 @@ static void playing_completed(void attribute((unused)) *v,
     return;
   }
   actual_playing_track = q;
+  /* If the queue's start times were lost because the first track has just
+   * started playing, we can now work them out from the playing track.  All
+   * the start times are 0 in that case, so no lengths are known from
+   * elsewhere. */
+  if(actual_queue && !actual_queue->expected)
+    queue_set_times(actual_queue, queue_playing_ends());
   queue_playing_changed();
   xtime(&last_playing);
 }
@@ -109,7 +161,172 @@ static void queue_changed(const char attribute((unused)) *event,
                            void  attribute((unused)) *callbackdata) {
   D(("queue_changed"));
   gtk_label_set_text(GTK_LABEL(report_label), "updating queue");
-  disorder_eclient_queue(client, queue_completed, 0);
+  queue_fetch();
+}
+
+/** @brief Return when the playing track is expected to finish
+ * @return Expected finish time, or 0 if not known
+ *
+ * This is also when the first track in the queue is expected to start.
+ */
+static time_t queue_playing_ends(void) {
+  long length;
+
+  if(!actual_playing_track || !actual_playing_track->played
+     || (last_state & DISORDER_TRACK_PAUSED)
+     || !(last_state & DISORDER_PLAYING_ENABLED))
+    return 0;
+  if((length = namepart_length(actual_playing_track->track)) < 0)
+    queue_lengths_pending = 1;
+  return length > 0 ? actual_playing_track->played + length : 0;
+}
+
+/** @brief Fill in expected start times
+ * @param head First entry in queue
+ * @param when Start time of @p head, or 0 if not known
+ *
+ * On entry each entry's @c expected field holds its length if known from
+ * elsewhere, or 0.  Lengths from namepart_length() take precedence.
+ */
+static void queue_set_times(struct queue_entry *head, time_t when) {
+  struct queue_entry *q;
+  long length;
+
+  for(q = head; q; q = q->next) {
+    length = q->expected;
+    q->expected = when;
+    if(when) {
+      const long known = namepart_length(q->track);
+
+      if(known >= 0)
+        length = known;
+      else
+        queue_lengths_pending = 1;
+      when = length > 0 ? when + length : 0;
+    }
+  }
+}
+
+/** @brief Apply an incremental change to the queue
+ * @param d Change to apply
+ * @return 0 on success, -1 if the change doesn't make sense against our queue
+ *
+ * The change is applied to a copy of the queue, since ql_new_queue() needs
+ * distinct old and new entries.  Changes are applied idempotently because the
+ * log and the @c queue command use different connections, so a change may
+ * already be reflected in the queue we have.
+ *
+ * If a track's length isn't known yet then its length as implied by the old
+ * start times is used instead, so that start times don't vanish while lookups
+ * are in progress.
+ */
+static int queue_apply_diff(const struct queue_diff *d) {
+  const char *id = d->op == QUEUE_DIFF_INSERT ? d->q->id : d->id;
+  struct queue_entry *head = 0, **tail = &head, *q, *nq, *moved = 0, *prev;
+  time_t when;
+
+  /* Copy the queue, leaving out the changed entry.  Until the start times are
+   * fixed up below, each copy's @c expected field holds its length according
+   * to the old queue, or 0 if that isn't known. */
+  for(q = actual_queue; q; q = q->next) {
+    nq = xmalloc(sizeof *nq);
+    *nq = *q;
+    nq->expected = (q->next && q->expected && q->next->expected
+                    ? q->next->expected - q->expected : 0);
+    if(!strcmp(q->id, id))
+      moved = nq;
+    else {
+      *tail = nq;
+      tail = &nq->next;
+    }
+  }
+  *tail = 0;
+  switch(d->op) {
+  case QUEUE_DIFF_INSERT:
+    moved = d->q;
+    moved->expected = 0;
+    break;
+  case QUEUE_DIFF_MOVE:
+    if(!moved)
+      return -1;
+    break;
+  case QUEUE_DIFF_REMOVE:
+    moved = 0;
+    break;
+  }
+  /* Put the new or moved entry in place */
+  if(moved) {
+    if(!*d->after) {
+      moved->next = head;
+      head = moved;
+    } else {
+      for(q = head; q && strcmp(q->id, d->after); q = q->next)
+        ;
+      if(!q)
+        return -1;
+      moved->next = q->next;
+      q->next = moved;
+    }
+  }
+  /* Fix up back pointers and expected start times.  The first track starts
+   * when the playing track finishes.  We know when that is if the first track
+   * hasn't changed, or if it has only just become the playing track. */
+  if(!head || !actual_queue)
+    when = 0;
+  else if(!strcmp(head->id, actual_queue->id))
+    when = actual_queue->expected;
+  else if(actual_playing_track
+          && !strcmp(actual_playing_track->id, actual_queue->id))
+    when = queue_playing_ends();
+  else
+    when = 0;
+  for(prev = 0, q = head; q; prev = q, q = q->next)
+    q->prev = prev;
+  queue_set_times(head, when);
+  actual_queue = head;
+  return 0;
+}
+
+/** @brief Called when the server tells us about a change to the queue
+ *
+ * If a fetch of the whole queue is in progress then the change is kept until
+ * it completes.  If the change doesn't make sense against our queue then we
+ * fetch the whole thing again.
+ */
+static void queue_diff(const char attribute((unused)) *event,
+                       void *eventdata,
+                       void attribute((unused)) *callbackdata) {
+  const struct queue_diff *d = eventdata;
+  struct pending_diff *p;
+
+  D(("queue_diff"));
+  if(queue_fetches) {
+    p = xmalloc(sizeof *p);
+    p->d = *d;
+    p->d.after = d->after ? xstrdup(d->after) : 0;
+    p->d.id = d->id ? xstrdup(d->id) : 0;
+    *pending_diffs_tail = p;
+    pending_diffs_tail = &p->next;
+    return;
+  }
+  if(queue_apply_diff(d))
+    queue_changed(0, 0, 0);
+  else
+    queue_playing_changed();
+}
+
+/** @brief Called when outstanding lookups complete
+ *
+ * If start times were computed without some track lengths then fetch the
+ * queue again to get correct ones.
+ */
+static void queue_lengths_completed(const char attribute((unused)) *event,
+                                    void attribute((unused)) *eventdata,
+                                    void attribute((unused)) *callbackdata) {
+  if(queue_lengths_pending && !queue_fetches) {
+    queue_lengths_pending = 0;
+    queue_fetch();
+  }
 }
 
 /** @brief Schedule an update to the playing track
@@ -164,6 +381,9 @@ static void queue_init(struct queuelike attribute((unused)) *ql) {
   event_register("pause-changed", queue_changed, 0);
   /* Reget the queue whenever it changes */
   event_register("queue-changed", queue_changed, 0);
+  /* ...or apply the change directly if the server tells us what it was */
+  event_register("queue-diff", queue_diff, 0);
+  event_register("lookups-completed", queue_lengths_completed, 0);
   /* ...and once a second anyway */
   g_timeout_add(1000/*ms*/, playing_periodic, 0);
 }
@@ -0,0 +1,213 @@
+/*
+ * This file is part of DisOrder
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/arena.c
+ * @brief Region allocation
+ *
+ * An arena hands out memory from large chunks and gives it all back at once
+ * in arena_release().  It suits the many small temporary objects made while
+ * handling one command or visiting one database record: they cost a pointer
+ * increment to allocate, the collector never has to find them, and without
+ * the collector they are actually freed.
+ *
+ * Nothing allocated from an arena may be used after the arena is released.
+ * In particular it must not be stored anywhere that outlives the arena;
+ * copy it with xstrdup() etc if it needs to be kept.
+ *
+ * Arena memory is scanned by the collector, so it may contain pointers to
+ * ordinary allocations.
+ */
+#include "common.h"
+
+#include "mem.h"
+#include "arena.h"
+
+/** @brief Alignment for arena allocations */
+union arena_align {
+  void *p;
+  long l;
+  long long ll;
+  double d;
+  long double ld;
+};
+
+/** @brief Alignment granularity in bytes */
+#define ALIGN (sizeof (union arena_align))
+
+/** @brief Default chunk size in bytes
+ *
+ * Requests larger than a quarter of this get a chunk to themselves.
+ */
+#define CHUNK_SIZE 65536
+
+/** @brief One chunk of arena memory */
+struct arena_chunk {
+  /** @brief Next (older) chunk */
+  struct arena_chunk *next;
+
+  /** @brief Bytes available in @c data */
+  size_t size;
+
+  /** @brief Start of memory */
+  union arena_align data[1];
+};
+
+/** @brief An arena */
+struct arena {
+  /** @brief Current chunk, followed by older ones */
+  struct arena_chunk *chunks;
+
+  /** @brief Next free byte in the current chunk */
+  char *next;
+
+  /** @brief End of the current chunk */
+  char *limit;
+
+  /** @brief Total bytes handed out since the last release */
+  size_t used;
+};
+
+/** @brief Create a new arena
+ * @return New, empty arena
+ *
+ * No memory is allocated for the arena's contents until it is first used.
+ */
+struct arena *arena_new(void) {
+  return xmalloc(sizeof (struct arena));
+}
+
+/** @brief Allocate a new chunk
+ * @param size Bytes available in the chunk
+ * @return New chunk
+ */
+static struct arena_chunk *new_chunk(size_t size) {
+  struct arena_chunk *c = xmalloc(offsetof(struct arena_chunk, data) + size);
+
+  c->size = size;
+  return c;
+}
+
+/** @brief Allocate uninitialized memory from an arena
+ * @param a Arena
+ * @param n Bytes to allocate
+ * @return Pointer to memory, suitably aligned for any type
+ */
+static void *arena_raw(struct arena *a, size_t n) {
+  struct arena_chunk *c;
+  void *ptr;
+
+  n = (n + ALIGN - 1) & ~(ALIGN - 1);
+  a->used += n;
+  if(n > CHUNK_SIZE / 4) {
+    /* Large allocations get a chunk to themselves, linked in behind the
+     * current one so that it stays current */
+    c = new_chunk(n);
+    if(a->chunks) {
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      c->next = 0;
+      a->chunks = c;
+      a->next = a->limit = (char *)c->data + n;
+    }
+    return c->data;
+  }
+  if((size_t)(a->limit - a->next) < n) {
+    c = new_chunk(CHUNK_SIZE);
+    c->next = a->chunks;
+    a->chunks = c;
+    a->next = (char *)c->data;
+    a->limit = a->next + CHUNK_SIZE;
+  }
+  ptr = a->next;
+  a->next += n;
+  return ptr;
+}
+
+/** @brief Allocate memory from an arena
+ * @param a Arena
+ * @param n Bytes to allocate
+ * @return Pointer to 0-filled memory, suitably aligned for any type
+ */
+void *arena_alloc(struct arena *a, size_t n) {
+  void *ptr = arena_raw(a, n);
+
+  memset(ptr, 0, n);
+  return ptr;
+}
+
+/** @brief Copy a string into an arena
+ * @param a Arena
+ * @param s String to copy
+ * @return Copy of @p s
+ */
+char *arena_strdup(struct arena *a, const char *s) {
+  return arena_strndup(a, s, strlen(s));
+}
+
+/** @brief Copy a prefix of a string into an arena
+ * @param a Arena
+ * @param s String to copy
+ * @param n Length of prefix
+ * @return Copy of first @p n bytes of @p s, 0-terminated
+ */
+char *arena_strndup(struct arena *a, const char *s, size_t n) {
+  char *t = arena_raw(a, n + 1);
+
+  memcpy(t, s, n);
+  t[n] = 0;
+  return t;
+}
+
+/** @brief Release everything allocated from an arena
+ * @param a Arena
+ *
+ * The arena may be used again afterwards.  One chunk is kept for reuse; the
+ * rest are freed immediately.
+ */
+void arena_release(struct arena *a) {
+  struct arena_chunk *c, *next;
+
+  if(!a->chunks)
+    return;
+  for(c = a->chunks->next; c; c = next) {
+    next = c->next;
+    xfree(c);
+  }
+  c = a->chunks;
+  c->next = 0;
+  a->next = (char *)c->data;
+  a->limit = a->next + c->size;
+  a->used = 0;
+}
+
+/** @brief Report how much of an arena is in use
+ * @param a Arena
+ * @return Bytes allocated since creation or the last release
+ */
+size_t arena_used(const struct arena *a) {
+  return a->used;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,158 @@
+/*
+ * This file is part of DisOrder
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/byte-order.c
+ * @brief Byte order conversion and silence detection for 16-bit samples
+ *
+ * These are on the RTP player's (and sender's) per-packet path.  Where the
+ * compiler is targeting SSE2 or NEON they work 16 bytes at a time; otherwise,
+ * and for any leftover words, they work 8 bytes at a time.  The portable
+ * versions are always available, so that the tests can compare the two.
+ */
+#include "common.h"
+
+#if __SSE2__
+# include <emmintrin.h>
+#elif __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+#include "byte-order.h"
+
+/** @brief Copy 16-bit words, swapping the bytes of each
+ * @param dst Destination
+ * @param src Source
+ * @param n Number of 16-bit words
+ *
+ * Portable version of swap16_copy().
+ */
+void swap16_copy_portable(void *dst, const void *src, size_t n) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  uint64_t w;
+  uint16_t h;
+
+  for(; n >= 4; n -= 4, d += 8, s += 8) {
+    memcpy(&w, s, 8);
+    w = ((w & 0x00FF00FF00FF00FFULL) << 8) | ((w >> 8) & 0x00FF00FF00FF00FFULL);
+    memcpy(d, &w, 8);
+  }
+  for(; n > 0; --n, d += 2, s += 2) {
+    memcpy(&h, s, 2);
+    h = (uint16_t)((h << 8) | (h >> 8));
+    memcpy(d, &h, 2);
+  }
+}
+
+/** @brief Test whether 16-bit words are all 0
+ * @param buffer Words to test
+ * @param n Number of 16-bit words
+ * @return Nonzero if all the words are 0
+ *
+ * Portable version of zero16_buffer().
+ */
+int zero16_buffer_portable(const void *buffer, size_t n) {
+  const unsigned char *p = buffer;
+  uint64_t w;
+  uint16_t h;
+
+  for(; n >= 4; n -= 4, p += 8) {
+    memcpy(&w, p, 8);
+    if(w)
+      return 0;
+  }
+  for(; n > 0; --n, p += 2) {
+    memcpy(&h, p, 2);
+    if(h)
+      return 0;
+  }
+  return 1;
+}
+
+/** @brief Copy 16-bit words, swapping the bytes of each
+ * @param dst Destination
+ * @param src Source
+ * @param n Number of 16-bit words
+ *
+ * @p dst and @p src may be equal but must not otherwise overlap.  Neither
+ * need be aligned beyond 2 bytes.
+ */
+void swap16_copy(void *dst, const void *src, size_t n) {
+#if __SSE2__
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+
+  for(; n >= 8; n -= 8, d += 16, s += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)s);
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+  }
+  swap16_copy_portable(d, s, n);
+#elif __ARM_NEON
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+
+  for(; n >= 8; n -= 8, d += 16, s += 16)
+    vst1q_u8(d, vrev16q_u8(vld1q_u8(s)));
+  swap16_copy_portable(d, s, n);
+#else
+  swap16_copy_portable(dst, src, n);
+#endif
+}
+
+/** @brief Test whether 16-bit words are all 0
+ * @param buffer Words to test
+ * @param n Number of 16-bit words
+ * @return Nonzero if all the words are 0
+ *
+ * @p buffer need not be aligned beyond 2 bytes.
+ */
+int zero16_buffer(const void *buffer, size_t n) {
+#if __SSE2__
+  const unsigned char *p = buffer;
+  const __m128i zero = _mm_setzero_si128();
+
+  for(; n >= 16; n -= 16, p += 32) {
+    const __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)p),
+                                   _mm_loadu_si128((const __m128i *)(p + 16)));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF)
+      return 0;
+  }
+  return zero16_buffer_portable(p, n);
+#elif __ARM_NEON
+  const uint8_t *p = buffer;
+
+  for(; n >= 16; n -= 16, p += 32) {
+    const uint64x2_t v = vreinterpretq_u64_u8(vorrq_u8(vld1q_u8(p),
+                                                       vld1q_u8(p + 16)));
+    if(vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1))
+      return 0;
+  }
+  return zero16_buffer_portable(p, n);
+#else
+  return zero16_buffer_portable(buffer, n);
+#endif
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -34,6 +34,68 @@
 # define ENDIAN_NATIVE ENDIAN_LITTLE
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+void swap16_copy(void *dst, const void *src, size_t n);
+int zero16_buffer(const void *buffer, size_t n);
+
+void swap16_copy_portable(void *dst, const void *src, size_t n);
+int zero16_buffer_portable(const void *buffer, size_t n);
+
+/** @brief Swap the bytes of each 16-bit word in a buffer
+ * @param buffer Buffer to modify
+ * @param n Number of 16-bit words
+ *
+ * @p buffer need not be aligned beyond 2 bytes.
+ */
+static inline void swap16_buffer(void *buffer, size_t n) {
+  swap16_copy(buffer, buffer, n);
+}
+
+/** @brief Convert 16-bit words in a buffer from native to network byte order
+ * @param buffer Buffer to modify
+ * @param n Number of 16-bit words
+ */
+static inline void net16_from_native(void *buffer, size_t n) {
+#if ENDIAN_NATIVE == ENDIAN_LITTLE
+  swap16_buffer(buffer, n);
+#else
+  (void)buffer;
+  (void)n;
+#endif
+}
+
+/** @brief Copy 16-bit words, converting from native to network byte order
+ * @param dst Destination
+ * @param src Source
+ * @param n Number of 16-bit words
+ *
+ * @p dst and @p src may be equal but must not otherwise overlap.
+ */
+static inline void net16_from_native_copy(void *dst, const void *src,
+                                          size_t n) {
+#if ENDIAN_NATIVE == ENDIAN_LITTLE
+  swap16_copy(dst, src, n);
+#else
+  if(dst != src)
+    memcpy(dst, src, n * 2);
+#endif
+}
+
+/** @brief Copy 16-bit words, converting from network to native byte order
+ * @param dst Destination
+ * @param src Source
+ * @param n Number of 16-bit words
+ *
+ * @p dst and @p src may be equal but must not otherwise overlap.
+ */
+static inline void native_from_net16_copy(void *dst, const void *src,
+                                          size_t n) {
+  net16_from_native_copy(dst, src, n);
+}
+
 #endif /* BYTE_ORDER_H */
 
 /*
@@ -20,6 +20,7 @@
 #include "common.h"
 
 #include <time.h>
+#include <stddef.h>
 
 #include "hash.h"
 #include "mem.h"
@@ -27,42 +28,170 @@
 #include "syscalls.h"
 #include "cache.h"
 
-/** @brief The global cache */
-static hash *h;
+/** @brief Doubly linked list link
+ *
+ * Each list has a header link; an empty list's header points to itself.
+ */
+struct cache_link {
+  struct cache_link *prev, *next;
+};
 
 /** @brief One cache entry */
 struct cache_entry {
-  /** @brief What type of object this is */
-  const struct cache_type *type;
+  /** @brief Link in the type's list ordered by insertion time
+   *
+   * Every object of a type has the same lifetime, so this is also the order
+   * in which they expire.
+   */
+  struct cache_link birth_link;
+
+  /** @brief Link in the type's list ordered by last use */
+  struct cache_link use_link;
+
+  /** @brief Per-type state for this object */
+  struct cache_state *state;
+
+  /** @brief Key */
+  char *key;
 
   /** @brief Pointer to object value */
   const void *value;
 
   /** @brief Time that object was inserted into cache */
   time_t birth;
+
+  /** @brief Approximate size of this entry in bytes */
+  size_t size;
+};
+
+/** @brief Per-type cache state */
+struct cache_state {
+  /** @brief Next type */
+  struct cache_state *next;
+
+  /** @brief Type that this state belongs to */
+  const struct cache_type *type;
+
+  /** @brief Objects in insertion (and therefore expiry) order, oldest first */
+  struct cache_link births;
+
+  /** @brief Objects in order of last use, least recently used first */
+  struct cache_link uses;
+
+  /** @brief Memory budget in bytes, or 0 for no limit */
+  size_t limit;
+
+  /** @brief Statistics */
+  struct cache_stats stats;
 };
 
+/** @brief The global cache
+ *
+ * Values are pointers to @ref cache_entry structures.
+ */
+static hash *h;
+
+/** @brief List of per-type states */
+static struct cache_state *states;
+
+/** @brief Convert a list link back to its entry */
+#define LINK_ENTRY(L, MEMBER) \
+  ((struct cache_entry *)((char *)(L) - offsetof(struct cache_entry, MEMBER)))
+
+/** @brief Initialize an empty list */
+static void link_init(struct cache_link *head) {
+  head->prev = head->next = head;
+}
+
+/** @brief Append @p l to the list with header @p head */
+static void link_append(struct cache_link *head, struct cache_link *l) {
+  l->next = head;
+  l->prev = head->prev;
+  head->prev->next = l;
+  head->prev = l;
+}
+
+/** @brief Remove @p l from its list */
+static void link_remove(struct cache_link *l) {
+  l->prev->next = l->next;
+  l->next->prev = l->prev;
+}
+
+/** @brief Find (or create) the state for @p type
+ *
+ * There are only ever a handful of types, so a list is adequate.
+ */
+static struct cache_state *find_state(const struct cache_type *type) {
+  struct cache_state *s;
+
+  for(s = states; s; s = s->next)
+    if(s->type == type)
+      return s;
+  s = xmalloc(sizeof *s);
+  s->type = type;
+  link_init(&s->births);
+  link_init(&s->uses);
+  s->next = states;
+  states = s;
+  return s;
+}
+
 /** @brief Return true if object @p c has expired */
 static int expired(const struct cache_entry *c, time_t now) {
-  return now - c->birth > c->type->lifetime;
+  return now - c->birth > c->state->type->lifetime;
+}
+
+/** @brief Remove @p c from the cache */
+static void remove_entry(struct cache_entry *c) {
+  struct cache_state *s = c->state;
+
+  link_remove(&c->birth_link);
+  link_remove(&c->use_link);
+  s->stats.count--;
+  s->stats.bytes -= c->size;
+  hash_remove(h, c->key);
+}
+
+/** @brief Evict least recently used objects until @p s is within budget */
+static void shrink(struct cache_state *s) {
+  while(s->limit
+        && s->stats.bytes > s->limit
+        && s->uses.next != &s->uses) {
+    remove_entry(LINK_ENTRY(s->uses.next, use_link));
+    s->stats.evictions++;
+  }
 }
 
 /** @brief Insert an object into the cache
  * @param type Pointer to object type
  * @param key Unique key
  * @param value Pointer to value
+ *
+ * If this takes the type over its memory budget then the least recently used
+ * objects of that type are evicted (possibly including this one, if it is
+ * larger than the whole budget).
  */
 void cache_put(const struct cache_type *type,
                const char *key, const void *value) {
-  struct cache_entry *c;
-  
+  struct cache_entry *c, **old;
+  struct cache_state *s = find_state(type);
+
   if(!h)
-    h = hash_new(sizeof (struct cache_entry));
+    h = hash_new(sizeof (struct cache_entry *));
+  if((old = hash_find(h, key)))
+    remove_entry(*old);
   c = xmalloc(sizeof *c);
-  c->type = type;
+  c->state = s;
+  c->key = xstrdup(key);
   c->value = value;
   xtime(&c->birth);
-  hash_add(h, key, c,  HASH_INSERT_OR_REPLACE);
+  c->size = sizeof *c + strlen(key) + 1 + (type->size ? type->size(value) : 0);
+  hash_add(h, key, &c, HASH_INSERT_OR_REPLACE);
+  link_append(&s->births, &c->birth_link);
+  link_append(&s->uses, &c->use_link);
+  s->stats.count++;
+  s->stats.bytes += c->size;
+  shrink(s);
 }
 
 /** @brief Look up an object in the cache
@@ -71,57 +200,67 @@ void cache_put(const struct cache_type *type,
  * @return Pointer to object value or NULL if not found
  */
 const void *cache_get(const struct cache_type *type, const char *key) {
-  const struct cache_entry *c;
-  
-  if(h
-     && (c = hash_find(h, key))
-     && c->type == type
-     && !expired(c, xtime(0)))
-    return c->value;
-  else
-    return 0;
-}
+  struct cache_state *s = find_state(type);
+  struct cache_entry **cp, *c;
 
-/** @brief Call used by from cache_expire() */
-static int expiry_callback(const char *key, void *value, void *u) {
-  const struct cache_entry *c = value;
-  const time_t *now = u;
-  
-  if(expired(c, *now))
-    hash_remove(h, key);
-  return 0;
+  if(!h
+     || !(cp = hash_find(h, key))
+     || (c = *cp)->state != s) {
+    s->stats.misses++;
+    return 0;
+  }
+  if(expired(c, xtime(0))) {
+    remove_entry(c);
+    s->stats.expiries++;
+    s->stats.misses++;
+    return 0;
+  }
+  /* Move to the most recently used end */
+  link_remove(&c->use_link);
+  link_append(&s->uses, &c->use_link);
+  s->stats.hits++;
+  return c->value;
 }
 
 /** @brief Expire the cache
  *
- * Called from time to time to expire cache entries. */
+ * Called from time to time to expire cache entries.  Only the expired objects
+ * (and the oldest unexpired one of each type) are visited.
+ */
 void cache_expire(void) {
+  struct cache_state *s;
+  struct cache_entry *c;
   time_t now;
 
   if(h) {
     xtime(&now);
-    hash_foreach(h, expiry_callback, &now);
+    for(s = states; s; s = s->next) {
+      while(s->births.next != &s->births) {
+        c = LINK_ENTRY(s->births.next, birth_link);
+        if(!expired(c, now))
+          break;
+        remove_entry(c);
+        s->stats.expiries++;
+      }
+    }
   }
 }
 
-/** @brief Callback used by cache_clean() */
-static int clean_callback(const char *key, void *value, void *u) {
-  const struct cache_entry *c = value;
-  const struct cache_type *type = u;
-
-  if(!type || c->type == type)
-    hash_remove(h, key);
-  return 0;
-}
-
 /** @brief Clean the cache
  * @param type Pointer to type to clean
  *
- * Removes all entries of type @p type from the cache.
+ * Removes all entries of type @p type from the cache, or all entries if @p
+ * type is a null pointer.
  */
 void cache_clean(const struct cache_type *type) {
-  if(h)
-    hash_foreach(h, clean_callback, (void *)type);
+  struct cache_state *s;
+
+  if(h) {
+    for(s = states; s; s = s->next)
+      if(!type || s->type == type)
+        while(s->births.next != &s->births)
+          remove_entry(LINK_ENTRY(s->births.next, birth_link));
+  }
 }
 
 /** @brief Report cache size
@@ -132,6 +271,28 @@ size_t cache_count(void) {
   return h ? hash_count(h) : 0;
 }
 
+/** @brief Set the memory budget for a type
+ * @param type Pointer to object type
+ * @param limit Maximum approximate bytes, or 0 for no limit
+ *
+ * If the type is already over the new budget then objects are evicted
+ * immediately.
+ */
+void cache_limit(const struct cache_type *type, size_t limit) {
+  struct cache_state *s = find_state(type);
+
+  s->limit = limit;
+  shrink(s);
+}
+
+/** @brief Get statistics for a type
+ * @param type Pointer to object type
+ * @param stats Where to store statistics
+ */
+void cache_stats(const struct cache_type *type, struct cache_stats *stats) {
+  *stats = find_state(type)->stats;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
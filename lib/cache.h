@@ -19,7 +19,9 @@
  * @brief Object caching
  *
  * There is a single cache for the whole process.  Objects of different types
- * are distinguished.  Objects might be thrown out of the cache at any point.
+ * are distinguished.  Objects might be thrown out of the cache at any point:
+ * when they are older than their type's lifetime, or when their type's memory
+ * budget (see cache_limit()) is exceeded.
  */
 
 #ifndef CACHE_H
@@ -31,6 +33,34 @@
 struct cache_type {
   /** @brief Lifetime for objects of this type (seconds) */
   int lifetime;
+
+  /** @brief Return the approximate size of a value in bytes
+   *
+   * May be NULL, in which case only the key and bookkeeping count towards
+   * the type's memory budget.
+   */
+  size_t (*size)(const void *value);
+};
+
+/** @brief Statistics for one type of cache object */
+struct cache_stats {
+  /** @brief Number of successful lookups */
+  unsigned long hits;
+
+  /** @brief Number of failed lookups */
+  unsigned long misses;
+
+  /** @brief Number of objects discarded because they were too old */
+  unsigned long expiries;
+
+  /** @brief Number of objects discarded to stay within the memory budget */
+  unsigned long evictions;
+
+  /** @brief Number of objects currently cached */
+  size_t count;
+
+  /** @brief Approximate bytes currently used */
+  size_t bytes;
 };
 
 void cache_put(const struct cache_type *type,
@@ -50,6 +80,12 @@ void cache_clean(const struct cache_type *type);
 size_t cache_count(void);
 /* Return the size of the cache */
 
+void cache_limit(const struct cache_type *type, size_t limit);
+/* Set the memory budget for TYPE in bytes; 0 means no limit */
+
+void cache_stats(const struct cache_type *type, struct cache_stats *stats);
+/* Get statistics for TYPE */
+
 #endif /* CACHE_H */
 
 /*
@@ -162,6 +162,15 @@ int disorder_make_cookie(disorder_client *c, char **cookiep) {
   return 0;
 }
 
+int disorder_metrics(disorder_client *c, const char *format, char ***metricsp, int *nmetricsp) {
+  int rc = disorder_simple(c, NULL, "metrics", format, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, metricsp, nmetricsp))
+    return -1;
+  return 0;
+}
+
 int disorder_move(disorder_client *c, const char *track, long delta) {
   return disorder_simple(c, NULL, "move", track, disorder__integer, delta, (char *)NULL);
 }
@@ -414,6 +423,15 @@ int disorder_shutdown(disorder_client *c) {
   return disorder_simple(c, NULL, "shutdown", (char *)NULL);
 }
 
+int disorder_speaker_stats(disorder_client *c, char ***statsp, int *nstatsp) {
+  int rc = disorder_simple(c, NULL, "speaker-stats", (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, statsp, nstatsp))
+    return -1;
+  return 0;
+}
+
 int disorder_stats(disorder_client *c, char ***statsp, int *nstatsp) {
   int rc = disorder_simple(c, NULL, "stats", (char *)NULL);
   if(rc)
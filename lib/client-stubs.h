@@ -214,6 +214,18 @@ int disorder_length(disorder_client *c, const char *track, long *lengthp);
  */
 int disorder_make_cookie(disorder_client *c, char **cookiep);
 
+/** @brief Get server metrics
+ *
+ * Requires the 'admin' right.  Each string is a sample in Prometheus text format.  If format is 'prometheus' then HELP and TYPE lines are included too.
+ *
+ * @param c Client
+ * @param format Output format (optional)
+ * @param metricsp List of metric samples
+ * @param nmetricsp Number of elements in metricsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_metrics(disorder_client *c, const char *format, char ***metricsp, int *nmetricsp);
+
 /** @brief Move a track
  *
  * Requires one of the 'move mine', 'move random' or 'move any' rights depending on how the track came to be added to the queue.
@@ -692,6 +704,17 @@ int disorder_set_global(disorder_client *c, const char *pref, const char *value)
  */
 int disorder_shutdown(disorder_client *c);
 
+/** @brief Get speaker health information
+ *
+ * The returned strings are intended to be printed out one to a line.  See disorder_protocol(5) for their format.
+ *
+ * @param c Client
+ * @param statsp List of speaker health information strings.
+ * @param nstatsp Number of elements in statsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_speaker_stats(disorder_client *c, char ***statsp, int *nstatsp);
+
 /** @brief Get server statistics
  *
  * The details of what the server reports are not really defined.  The returned strings are intended to be printed out one to a line.
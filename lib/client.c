@@ -356,7 +356,7 @@ static int disorder_simple(disorder_client *c,
  * @param c Client
  * @param vecp Where to store results
  * @param nvecp Where to store count of results
- * @param expected Expected count (or -1 to not check)
+ * @param expected Minimum expected count (or -1 to not check)
  * @param cmd Command
  * @return 0 on success, non-0 on error
  *
@@ -388,7 +388,8 @@ static int disorder_simple_split(disorder_client *c,
   if(!ret) {
     vec = split(r, &nvec, SPLIT_QUOTES, 0, 0);
     xfree(r);
-    if(expected < 0 || nvec == expected) {
+    /* Extra fields are tolerated so that responses can be extended */
+    if(expected < 0 || nvec >= expected) {
       *vecp = vec;
       *nvecp = nvec;
     } else {
@@ -59,6 +59,7 @@
 #if !_WIN32
 #include "uaudio.h"
 #endif
+#include "rtp.h"
 
 /** @brief Path to config file 
  *
@@ -1006,6 +1007,59 @@ static int validate_mtu_discovery(const struct config_state attribute((unused))
   return -1;
 }
 
+/** @brief Validate an RTP payload format
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_rtp_payload(const struct config_state *cs,
+				int nvec,
+				char **vec) {
+  if(nvec == 1 &&
+     (!strcmp(vec[0], "l16") ||
+      !strcmp(vec[0], "opus")))
+    return 0;
+  disorder_error(0, "%s:%d: invalid RTP payload format", cs->path, cs->line);
+  return -1;
+}
+
+/** @brief Validate an RTP FEC group size
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_rtp_fec(const struct config_state *cs,
+			    int nvec, char **vec) {
+  long n;
+  if(common_validate_integer(cs, nvec, vec, &n)) return -1;
+  if(n < 0 || n > RTP_FEC_MAX_GROUP) {
+    disorder_error(0, "%s:%d: FEC group size must be between 0 and %d",
+                   cs->path, cs->line, RTP_FEC_MAX_GROUP);
+    return -1;
+  }
+  return 0;
+}
+
+/** @brief Validate a target loudness
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_loudness_target(const struct config_state *cs,
+                                    int nvec, char **vec) {
+  long n;
+  if(common_validate_integer(cs, nvec, vec, &n)) return -1;
+  if(n < -70 || n > 0) {
+    disorder_error(0, "%s:%d: target loudness must be between -70 and 0",
+                   cs->path, cs->line);
+    return -1;
+  }
+  return 0;
+}
+
 /** @brief Validate a destination network address
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -1066,6 +1120,9 @@ static int validate_inetaddr(const struct config_state *cs,
 /** @brief All configuration items */
 static const struct conf conf[] = {
   { C(alias),            &type_string,           validate_alias },
+  { C(alsa_buffer),      &type_integer,          validate_non_negative },
+  { C(alsa_mmap),        &type_boolean,          validate_any },
+  { C(alsa_period),      &type_integer,          validate_non_negative },
 #if !_WIN32
   { C(api),              &type_string,           validate_backend },
 #endif
@@ -1086,7 +1143,11 @@ static const struct conf conf[] = {
 #if !_WIN32
   { C(home),             &type_string,           validate_isabspath },
 #endif
+  { C(list_cache_size),  &type_integer,          validate_non_negative },
   { C(listen),           &type_netaddress,       validate_any },
+  { C(lookahead),        &type_integer,          validate_positive },
+  { C(loudness),         &type_boolean,          validate_any },
+  { C(loudness_target),  &type_integer,          validate_loudness_target },
   { C(mail_sender),      &type_string,           validate_any },
   { C(mixer),            &type_string,           validate_any },
   { C(mount_rescan),     &type_boolean,          validate_any },
@@ -1103,6 +1164,8 @@ static const struct conf conf[] = {
   { C(noticed_history),  &type_integer,          validate_positive },
   { C(password),         &type_string,           validate_any },
   { C(pause_mode),       &type_string,           validate_pausemode },
+  { C(pcm_cache),        &type_string,           validate_isabspath },
+  { C(pcm_cache_size),   &type_integer,          validate_positive },
   { C(player),           &type_stringlist_accum, validate_player },
   { C(playlist_lock_timeout), &type_integer,     validate_positive },
   { C(playlist_max) ,    &type_integer,          validate_positive },
@@ -1115,12 +1178,15 @@ static const struct conf conf[] = {
   { C(replay_min),       &type_integer,          validate_non_negative },
   { C(rtp_always_request), &type_boolean,	 validate_any },
   { C(rtp_delay_threshold), &type_integer,       validate_positive },
+  { C(rtp_fec),          &type_integer,          validate_rtp_fec },
   { C(rtp_instance_name), &type_string,		 validate_any },
   { C(rtp_max_payload),	 &type_integer,		 validate_positive },
   { C(rtp_maxbuffer),	 &type_integer,		 validate_non_negative },
   { C(rtp_minbuffer),	 &type_integer,		 validate_non_negative },
   { C(rtp_mode),         &type_string,           validate_any },
   { C(rtp_mtu_discovery), &type_string,		 validate_mtu_discovery },
+  { C(rtp_opus_bitrate), &type_integer,		 validate_positive },
+  { C(rtp_payload),      &type_string,           validate_rtp_payload },
   { C(rtp_rcvbuf),	 &type_integer,		 validate_non_negative },
   { C(rtp_request_address), &type_netaddress,	 validate_inetaddr },
   { C(rtp_verbose),      &type_boolean,          validate_any },
@@ -1136,6 +1202,7 @@ static const struct conf conf[] = {
 #if !_WIN32
   { C2(speaker_backend, api),  &type_string,     validate_backend },
 #endif
+  { C(speaker_buffer),   &type_integer,          validate_positive },
   { C(speaker_command),  &type_string,           validate_any },
   { C(stopword),         &type_string_accum,     validate_any },
   { C(templates),        &type_string_accum,     validate_isdir },
@@ -1392,6 +1459,11 @@ static struct config *config_default(void) {
   c->sample_format.channels = 2;
   c->sample_format.endian = ENDIAN_NATIVE;
   c->queue_pad = 10;
+  c->lookahead = 1;
+  c->list_cache_size = 16 * 1048576;
+  c->speaker_buffer = 4 * 1048576;
+  c->pcm_cache_size = 1024L * 1048576;
+  c->loudness_target = -18;
   c->replay_min = 8 * 3600;
   c->api = NULL;
   c->multicast_ttl = 1;
@@ -1436,6 +1508,8 @@ static struct config *config_default(void) {
   c->rtp_mode = xstrdup("auto");
   c->rtp_max_payload = -1;
   c->rtp_mtu_discovery = xstrdup("default");
+  c->rtp_payload = xstrdup("l16");
+  c->rtp_opus_bitrate = 96000;
   return c;
 }
 
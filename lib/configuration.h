@@ -147,6 +147,9 @@ struct config {
   /** @brief Mixer channel to use */
   char *channel;
 
+  /** @brief Memory budget for cached listing results in bytes, or 0 */
+  long list_cache_size;
+
   /** @brief Secondary listen address */
   struct netaddress listen;
 
@@ -212,6 +215,24 @@ struct config {
   /** @brief Target queue length */
   long queue_pad;
 
+  /** @brief Number of tracks to prepare in advance */
+  long lookahead;
+
+  /** @brief Maximum bytes the speaker buffers for tracks not yet playing */
+  long speaker_buffer;
+
+  /** @brief Directory for cached decoded audio, or NULL */
+  const char *pcm_cache;
+
+  /** @brief Maximum size of @ref pcm_cache in bytes */
+  long pcm_cache_size;
+
+  /** @brief Whether to measure and normalize track loudness */
+  int loudness;
+
+  /** @brief Target loudness in LUFS */
+  long loudness_target;
+
   /** @brief Minimum time between a track being played again */
   long replay_min;
   
@@ -223,6 +244,15 @@ struct config {
   /** @brief ALSA output device */
   const char *device;
 
+  /** @brief Use mmap transfer for ALSA output */
+  int alsa_mmap;
+
+  /** @brief ALSA period size in frames, or 0 for the driver's choice */
+  long alsa_period;
+
+  /** @brief ALSA buffer size in frames, or 0 for the driver's choice */
+  long alsa_buffer;
+
   struct transformlist transform;	/* path name transformations */
 
   /** @brief Address to send audio data to */
@@ -281,6 +311,18 @@ struct config {
    */
   char *rtp_mtu_discovery;
 
+  /** @brief RTP payload format
+   *
+   * This is `l16' for uncompressed audio or `opus' for Opus.
+   */
+  char *rtp_payload;
+
+  /** @brief Opus bit rate in bits/second */
+  long rtp_opus_bitrate;
+
+  /** @brief Number of L16 packets protected by each FEC packet, or 0 */
+  long rtp_fec;
+
   /** @brief Login lifetime in seconds */
   long cookie_login_lifetime;
 
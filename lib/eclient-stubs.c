@@ -84,6 +84,10 @@ int disorder_eclient_make_cookie(disorder_eclient *c, disorder_eclient_string_re
   return simple(c, string_response_opcallback, (void (*)())completed, v, "make-cookie", (char *)0);
 }
 
+int disorder_eclient_metrics(disorder_eclient *c, disorder_eclient_list_response *completed, const char *format, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "metrics", format, (char *)0);
+}
+
 int disorder_eclient_move(disorder_eclient *c, disorder_eclient_no_response *completed, const char *track, long delta, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "move", track, disorder__integer, delta, (char *)0);
 }
@@ -252,6 +256,10 @@ int disorder_eclient_shutdown(disorder_eclient *c, disorder_eclient_no_response
   return simple(c, no_response_opcallback, (void (*)())completed, v, "shutdown", (char *)0);
 }
 
+int disorder_eclient_speaker_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "speaker-stats", (char *)0);
+}
+
 int disorder_eclient_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
   return simple(c, list_response_opcallback, (void (*)())completed, v, "stats", (char *)0);
 }
@@ -212,6 +212,18 @@ int disorder_eclient_length(disorder_eclient *c, disorder_eclient_integer_respon
  */
 int disorder_eclient_make_cookie(disorder_eclient *c, disorder_eclient_string_response *completed, void *v);
 
+/** @brief Get server metrics
+ *
+ * Requires the 'admin' right.  Each string is a sample in Prometheus text format.  If format is 'prometheus' then HELP and TYPE lines are included too.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param format Output format (optional)
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_metrics(disorder_eclient *c, disorder_eclient_list_response *completed, const char *format, void *v);
+
 /** @brief Move a track
  *
  * Requires one of the 'move mine', 'move random' or 'move any' rights depending on how the track came to be added to the queue.
@@ -722,6 +734,17 @@ int disorder_eclient_set_global(disorder_eclient *c, disorder_eclient_no_respons
  */
 int disorder_eclient_shutdown(disorder_eclient *c, disorder_eclient_no_response *completed, void *v);
 
+/** @brief Get speaker health information
+ *
+ * The returned strings are intended to be printed out one to a line.  See disorder_protocol(5) for their format.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_speaker_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
+
 /** @brief Get server statistics
  *
  * The details of what the server reports are not really defined.  The returned strings are intended to be printed out one to a line.
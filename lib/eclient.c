@@ -133,6 +133,19 @@ struct disorder_eclient {
   void *log_v;                          /**< @brief user data */
   unsigned long statebits;              /**< @brief latest state */
 
+  /** @brief Queue generation from the server, or NULL
+   *
+   * Together with @ref queue_serial this forms the resume token sent with the
+   * @c log command when we reconnect.
+   */
+  char *queue_generation;
+
+  /** @brief Serial number of the last queue change seen */
+  char *queue_serial;
+
+  /** @brief True if the current @c log command asked to resume */
+  int log_resuming;
+
   time_t last_prod;
   /**< @brief last time we sent a prod
    *
@@ -171,17 +184,23 @@ static void stash_command(disorder_eclient *c,
                           const char *cmd,
                           ...);
 static void log_opcallback(disorder_eclient *c, struct operation *op);
+static void stash_log(disorder_eclient *c);
 static void logline(disorder_eclient *c, const char *line);
 static void logentry_completed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_failed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_moved(disorder_eclient *c, int nvec, char **vec);
 static void logentry_playing(disorder_eclient *c, int nvec, char **vec);
 static void logentry_queue(disorder_eclient *c, int nvec, char **vec);
+static void logentry_queue_insert(disorder_eclient *c, int nvec, char **vec);
+static void logentry_queue_move(disorder_eclient *c, int nvec, char **vec);
+static void logentry_queue_remove(disorder_eclient *c, int nvec, char **vec);
+static void logentry_queue_reset(disorder_eclient *c, int nvec, char **vec);
 static void logentry_recent_added(disorder_eclient *c, int nvec, char **vec);
 static void logentry_recent_removed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_removed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_scratched(disorder_eclient *c, int nvec, char **vec);
 static void logentry_state(disorder_eclient *c, int nvec, char **vec);
+static void logentry_track_changed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_volume(disorder_eclient *c, int nvec, char **vec);
 static void logentry_rescanned(disorder_eclient *c, int nvec, char **vec);
 static void logentry_user_add(disorder_eclient *c, int nvec, char **vec);
@@ -220,6 +239,10 @@ static const struct logentry_handler logentry_handlers[] = {
   LE(playlist_deleted, 1, 1),
   LE(playlist_modified, 2, 2),
   LE(queue, 2, INT_MAX),
+  LE(queue_insert, 4, INT_MAX),
+  LE(queue_move, 3, 3),
+  LE(queue_remove, 2, 2),
+  LE(queue_reset, 2, 2),
   LE(recent_added, 2, INT_MAX),
   LE(recent_removed, 1, 1),
   LE(removed, 1, 2),
@@ -227,6 +250,7 @@ static const struct logentry_handler logentry_handlers[] = {
   LE(rights_changed, 1, 1),
   LE(scratched, 2, 2),
   LE(state, 1, 1),
+  LE(track_changed, 2, 2),
   LE(user_add, 1, 1),
   LE(user_confirm, 1, 1),
   LE(user_delete, 1, 1),
@@ -650,9 +674,7 @@ static void authuser_opcallback(disorder_eclient *c,
   c->callbacks->report(c->u, r);
   if(c->log_callbacks && !(c->ops && c->ops->opcallback == log_opcallback))
     /* We are a log client, switch to logging mode */
-    stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
-                  -1/*nbody*/, 0/*body*/,
-                  "log", (char *)0);
+    stash_log(c);
 }
 
 /* Output ********************************************************************/
@@ -1178,16 +1200,51 @@ int disorder_eclient_log(disorder_eclient *c,
   /* Repoort initial state */
   if(c->log_callbacks->state)
     c->log_callbacks->state(c->log_v, c->statebits);
-  stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, v,
-                -1, 0, "log", (char *)0);
+  stash_log(c);
   disorder_eclient_polled(c, 0);
   return 0;
 }
 
+/** @brief Issue a @c log command
+ * @param c Client
+ *
+ * If we know where we were in the server's queue changes then we ask to
+ * resume from there.
+ */
+static void stash_log(disorder_eclient *c) {
+  c->log_resuming = !!c->queue_generation;
+  if(c->log_resuming)
+    stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
+                  -1/*nbody*/, 0/*body*/,
+                  "log", c->queue_generation, c->queue_serial, (char *)0);
+  else
+    stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
+                  -1/*nbody*/, 0/*body*/,
+                  "log", (char *)0);
+}
+
+/** @brief Return true if the current @c log command asked to resume
+ *
+ * If this is true when the @c connected log callback is called then queue
+ * changes since the previous connection will be reported by the @c
+ * queue_insert, @c queue_move and @c queue_remove callbacks, or if that's not
+ * possible the @c queue_reset callback will be called.
+ */
+int disorder_eclient_log_resuming(disorder_eclient *c) {
+  return c->log_resuming;
+}
+
 /* If we get here we've stopped being a log client */
 static void log_opcallback(disorder_eclient *c,
                            struct operation attribute((unused)) *op) {
   D(("log_opcallback"));
+  if(c->log_resuming && c->rc / 100 == 5) {
+    /* The server didn't understand the resume token (perhaps it's been
+     * replaced by an older version).  Try again without it. */
+    c->queue_generation = 0;
+    stash_log(c);
+    return;
+  }
   c->log_callbacks = 0;
   c->log_v = 0;
 }
@@ -1275,6 +1332,40 @@ static void logentry_queue(disorder_eclient *c,
   c->log_callbacks->queue(c->log_v, q);
 }
 
+static void logentry_queue_insert(disorder_eclient *c,
+                                  int nvec, char **vec) {
+  struct queue_entry *q;
+
+  c->queue_serial = vec[0];
+  if(!c->log_callbacks->queue_insert) return;
+  q = xmalloc(sizeof *q);
+  if(queue_unmarshall_vec(q, nvec - 2, vec + 2, eclient_queue_error, c))
+    return;                             /* bogus */
+  c->log_callbacks->queue_insert(c->log_v, vec[1], q);
+}
+
+static void logentry_queue_move(disorder_eclient *c,
+                                int attribute((unused)) nvec, char **vec) {
+  c->queue_serial = vec[0];
+  if(c->log_callbacks->queue_move)
+    c->log_callbacks->queue_move(c->log_v, vec[1], vec[2]);
+}
+
+static void logentry_queue_remove(disorder_eclient *c,
+                                  int attribute((unused)) nvec, char **vec) {
+  c->queue_serial = vec[0];
+  if(c->log_callbacks->queue_remove)
+    c->log_callbacks->queue_remove(c->log_v, vec[1]);
+}
+
+static void logentry_queue_reset(disorder_eclient *c,
+                                 int attribute((unused)) nvec, char **vec) {
+  c->queue_generation = vec[0];
+  c->queue_serial = vec[1];
+  if(c->log_callbacks->queue_reset)
+    c->log_callbacks->queue_reset(c->log_v);
+}
+
 static void logentry_recent_added(disorder_eclient *c,
                                   int attribute((unused)) nvec, char **vec) {
   struct queue_entry *q;
@@ -1314,6 +1405,12 @@ static void logentry_scratched(disorder_eclient *c,
     c->log_callbacks->state(c->log_v, c->statebits | DISORDER_CONNECTED);
 }
 
+static void logentry_track_changed(disorder_eclient *c,
+                                   int attribute((unused)) nvec, char **vec) {
+  if(c->log_callbacks->track_changed)
+    c->log_callbacks->track_changed(c->log_v, vec[0], vec[1]);
+}
+
 static void logentry_user_add(disorder_eclient *c,
                               int attribute((unused)) nvec, char **vec) {
   if(c->log_callbacks->user_add)
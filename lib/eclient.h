@@ -182,6 +182,41 @@ typedef struct disorder_eclient_log_callbacks {
 
   /** @brief Called when a global pref is changed or delete */
   void (*global_pref)(void *v, const char *pref, const char *value/*or NULL*/);
+
+  /** @brief Called when a track's preferences change
+   *
+   * @p pref is the preference that changed.  Anything derived from the
+   * track's preferences (name parts, its alias) may have changed too.
+   */
+  void (*track_changed)(void *v, const char *track, const char *pref);
+
+  /** @brief Called when @p q is inserted into the queue after @p after
+   *
+   * @p after is "" if @p q is now at the head of the queue.
+   *
+   * This and the other @c queue_* callbacks below describe the queue
+   * incrementally.  They are only used if the server supports them, in which
+   * case @c queue_reset is called after @c connected.  The @c queue, @c moved
+   * and @c removed callbacks are still called too.
+   */
+  void (*queue_insert)(void *v, const char *after, struct queue_entry *q);
+
+  /** @brief Called when queue entry @p id is moved to just after @p after
+   *
+   * @p after is "" if @p id is now at the head of the queue.
+   */
+  void (*queue_move)(void *v, const char *after, const char *id);
+
+  /** @brief Called when queue entry @p id is removed from the queue */
+  void (*queue_remove)(void *v, const char *id);
+
+  /** @brief Called when the whole queue must be fetched again
+   *
+   * This happens on the first connection to a server that supports
+   * incremental queue changes, and on reconnection if the server could not
+   * supply the changes that were missed.
+   */
+  void (*queue_reset)(void *v);
 } disorder_eclient_log_callbacks;
 
 /* State bits */
@@ -332,6 +367,9 @@ int disorder_eclient_log(disorder_eclient *c,
 /* Make this a log client (forever - it automatically becomes one again upon
  * reconnection) */
 
+int disorder_eclient_log_resuming(disorder_eclient *c);
+/* Return true if the current log command asked to resume queue changes */
+
 int disorder_eclient_rtp_address(disorder_eclient *c,
                                  disorder_eclient_list_response *completed,
                                  void *v);
@@ -141,6 +141,9 @@ struct ev_source {
 
   /** @brief Array of child processes */
   struct child *children;
+
+  /** @brief Statistics */
+  struct ev_stats stats;
 };
 
 /** @brief Names of file descriptor modes */
@@ -166,6 +169,18 @@ ev_source *ev_new(void) {
 
 /* event loop *****************************************************************/
 
+/** @brief Get event loop statistics
+ * @param ev Event loop
+ * @param stats Where to store statistics
+ *
+ * The lag of a timeout is how long after its trigger time its callback was
+ * called.  Consistently large lag means that something is blocking the event
+ * loop.
+ */
+void ev_stats(ev_source *ev, struct ev_stats *stats) {
+  *stats = ev->stats;
+}
+
 /** @brief Run the event loop
  * @return -1 on error, non-0 if any callback returned non-0
  */
@@ -202,9 +217,16 @@ int ev_run(ev_source *ev) {
      * timeouts that are already in the past but they won't trigger until the
      * next time round the event loop. */
     for(t = timeouts; t; t = t->next) {
+      const double lag = (now.tv_sec - t->when.tv_sec)
+        + (now.tv_usec - t->when.tv_usec) / 1000000.0;
+
       D(("calling timeout for %ld.%ld callback %p %p",
 	 (long)t->when.tv_sec, (long)t->when.tv_usec,
 	 (void *)t->callback, t->u));
+      ++ev->stats.timeouts;
+      ev->stats.lag += lag;
+      if(lag > ev->stats.max_lag)
+        ev->stats.max_lag = lag;
       ret = t->callback(ev, &now, t->u);
       if(ret)
 	return ret;
@@ -949,6 +971,9 @@ struct ev_writer {
 
   /** @brief Set when abandoned */
   int abandoned;
+
+  /** @brief Bytes written to @p fd so far */
+  unsigned long long written;
 };
 
 /** @brief State structure for a buffered reader */
@@ -1049,6 +1074,7 @@ static int writer_callback(ev_source *ev, int fd, void *u) {
   if(n >= 0) {
     /* Consume bytes from the buffer */
     w->b.start += n;
+    w->written += n;
     /* Suppress any outstanding timeout */
     ev_timeout_cancel(ev, w->timeout);
     w->timeout = 0;
@@ -1248,6 +1274,16 @@ int ev_writer_flush(ev_writer *w) {
   return writer_callback(w->ev, w->fd, w);
 }
 
+/** @brief Report how much a writer has written
+ * @param w Writer
+ * @return Bytes written to the file descriptor so far
+ *
+ * Bytes still in the writer's buffer are not included.
+ */
+unsigned long long ev_writer_written(const ev_writer *w) {
+  return w->written;
+}
+
 /* buffered reader ************************************************************/
 
 /** @brief Shut down a reader
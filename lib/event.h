@@ -36,6 +36,21 @@ int ev_run(ev_source *ev);
  * is returned.  If an error occurs then -1 is returned and @error@ is
  * called. */
 
+/** @brief Event loop statistics */
+struct ev_stats {
+  /** @brief Number of timeouts called */
+  unsigned long timeouts;
+
+  /** @brief Total lag of timeouts (seconds) */
+  double lag;
+
+  /** @brief Greatest lag of a single timeout (seconds) */
+  double max_lag;
+};
+
+void ev_stats(ev_source *ev, struct ev_stats *stats);
+/* get event loop statistics */
+
 /* file descriptors ***********************************************************/
 
 typedef enum {
@@ -205,6 +220,9 @@ int ev_writer_cancel(ev_writer *w);
 int ev_writer_flush(ev_writer *w);
 /* attempt to flush the buffer */
 
+unsigned long long ev_writer_written(const ev_writer *w);
+/* return the number of bytes written so far */
+
 struct sink *ev_writer_sink(ev_writer *w) attribute((const));
 /* return a sink for the writer - use this to actually write to it */
 
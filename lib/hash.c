@@ -25,54 +25,141 @@
 #include "log.h"
 #include "kvp.h"
 
-/** @brief One entry in a hash table */
-struct entry {
-  struct entry *next;                   /* next entry same key */
-  size_t h;                             /* hash of KEY */
-  const char *key;                      /* key of this entry */
-  void *value;                          /* value of this entry */
+/** @brief One slot in a hash table
+ *
+ * The table uses open addressing with linear probing, so a lookup normally
+ * touches one or two adjacent slots and only dereferences @c entry when the
+ * full hash code matches.
+ *
+ * Each entry is a single allocation holding the value (first, so that it is
+ * suitably aligned) followed by the key.  Values therefore stay at the same
+ * address for as long as they are in the table, as they always have.
+ */
+struct slot {
+  size_t h;                             /* hash of key */
+  char *entry;                          /* value then key, or EMPTY/DELETED */
 };
 
+/** @brief Marker for a slot that has never been used */
+#define EMPTY ((char *)0)
+
+/** @brief Storage behind @ref DELETED */
+static char deleted_marker[1];
+
+/** @brief Marker for a slot whose entry was removed
+ *
+ * Lookups continue past deleted slots; insertions may reuse them.  Removal
+ * never moves other entries, which is what makes it safe from inside
+ * hash_foreach().
+ */
+#define DELETED (deleted_marker)
+
 /** @brief A hash table */
 struct hash {
-  size_t nslots;                        /* number of slots */
+  size_t nslots;                        /* number of slots (power of 2) */
   size_t nitems;                        /* total number of entries */
-  struct entry **slots;                 /* table of slots */
+  size_t ndeleted;                      /* number of DELETED slots */
+  struct slot *slots;                   /* table of slots */
   size_t valuesize;                     /* size of a value */
 };
 
+/** @brief Initial number of slots */
+#define INITIAL_SLOTS 32
+
+/** @brief Return the key of slot @p s */
+#define KEY(h, s) ((s)->entry + (h)->valuesize)
+
+/** @brief Return true if slot @p s holds an entry */
+#define LIVE(s) ((s)->entry != EMPTY && (s)->entry != DELETED)
+
+/** @brief Multiply-and-mix step of hashfn() */
+static inline uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
 /** @brief Hash function
  * @param key Key to hash
+ * @param len Length of @p key
  * @return Hash code
+ *
+ * Consumes the key eight bytes at a time with a 64-bit multiply, and
+ * finishes with the MurmurHash3 avalanche so that the low bits, which choose
+ * the slot, depend on the whole key.
  */
-static size_t hashfn(const char *key) {
-  size_t i = 0;
+static size_t hashfn(const char *key, size_t len) {
+  const uint64_t m = 0x9e3779b97f4a7c15ULL;
+  uint64_t i = len * m, w;
 
-  while(*key)
-    i = 33 * i + (unsigned char)*key++;
-  return i;
+  while(len >= 8) {
+    memcpy(&w, key, 8);
+    i = (i ^ w) * m;
+    i ^= i >> 29;
+    key += 8;
+    len -= 8;
+  }
+  w = 0;
+  memcpy(&w, key, len);
+  i = (i ^ w) * m;
+  return (size_t)mix(i);
 }
 
-/** @brief Expand a hash table
- * @param h Hash table to expand
+/** @brief Find the slot for a key
+ * @param h Hash table
+ * @param key Key to find
+ * @param n Hash of @p key
+ * @param availp Where to store first reusable slot, or NULL
+ * @return Slot containing @p key, or NULL if not found
+ *
+ * If @p availp is not NULL and the key is not found then the first EMPTY or
+ * DELETED slot on the probe sequence is stored there.
  */
-static void grow(hash *h) {
-  size_t n, newnslots;
-  struct entry **newslots, *e, *f;
-
-  /* Allocate a new, larger array */
-  newnslots = 2 * h->nslots;
-  newslots = xcalloc(newnslots, sizeof (struct entry *));
-  /* Copy everything to it */
-  for(n = 0; n < h->nslots; ++n) {
-    for(e = h->slots[n]; e; e = f) {
-      f = e->next;
-      e->next = newslots[e->h & (newnslots - 1)];
-      newslots[e->h & (newnslots - 1)] = e;
-    }
+static struct slot *find_slot(const hash *h, const char *key, size_t n,
+                              struct slot **availp) {
+  const size_t mask = h->nslots - 1;
+  struct slot *s, *avail = 0;
+  size_t i;
+
+  for(i = n & mask;; i = (i + 1) & mask) {
+    s = &h->slots[i];
+    if(s->entry == EMPTY)
+      break;
+    if(s->entry == DELETED) {
+      if(!avail)
+        avail = s;
+    } else if(s->h == n && !strcmp(KEY(h, s), key))
+      return s;
   }
-  h->slots = newslots;
+  if(availp)
+    *availp = avail ? avail : s;
+  return 0;
+}
+
+/** @brief Resize a hash table
+ * @param h Hash table to resize
+ * @param newnslots New number of slots (power of 2)
+ *
+ * Also discards DELETED slots.
+ */
+static void rehash(hash *h, size_t newnslots) {
+  struct slot *oldslots = h->slots;
+  size_t n, i, oldnslots = h->nslots;
+
+  h->slots = xcalloc(newnslots, sizeof (struct slot));
   h->nslots = newnslots;
+  h->ndeleted = 0;
+  for(n = 0; n < oldnslots; ++n)
+    if(LIVE(&oldslots[n])) {
+      for(i = oldslots[n].h & (newnslots - 1);
+          h->slots[i].entry != EMPTY;
+          i = (i + 1) & (newnslots - 1))
+        ;
+      h->slots[i] = oldslots[n];
+    }
 }
 
 /** @brief Create a new hash table
@@ -82,8 +169,10 @@ static void grow(hash *h) {
 hash *hash_new(size_t valuesize) {
   hash *h = xmalloc(sizeof *h);
 
-  h->nslots = 256;
-  h->slots = xcalloc(h->nslots, sizeof (struct slot *));
+  h->nslots = INITIAL_SLOTS;
+  h->nitems = 0;
+  h->ndeleted = 0;
+  h->slots = xcalloc(h->nslots, sizeof (struct slot));
   h->valuesize = valuesize;
   return h;
 }
@@ -101,29 +190,32 @@ hash *hash_new(size_t valuesize) {
  * - @ref HASH_INSERT_OR_REPLACE - key may or may not exist
  */
 int hash_add(hash *h, const char *key, const void *value, int mode) {
-  size_t n = hashfn(key);
-  struct entry *e;
+  const size_t len = strlen(key);
+  size_t n = hashfn(key, len);
+  struct slot *s, *avail;
   
-  for(e = h->slots[n & (h->nslots - 1)]; e; e = e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      break;
-  if(e) {
+  if((s = find_slot(h, key, n, &avail))) {
     /* This key is already present. */
     if(mode == HASH_INSERT) return -1;
-    if(value) memcpy(e->value, value, h->valuesize);
+    if(value) memcpy(s->entry, value, h->valuesize);
     return 0;
   } else {
     /* This key is absent. */
     if(mode == HASH_REPLACE) return -1;
-    if(h->nitems >= h->nslots)          /* bound mean chain length */
-      grow(h);
-    e = xmalloc(sizeof *e);
-    e->next = h->slots[n & (h->nslots - 1)];
-    e->h = n;
-    e->key = xstrdup(key);
-    e->value = xmalloc(h->valuesize);
-    if(value) memcpy(e->value, value, h->valuesize);
-    h->slots[n & (h->nslots - 1)] = e;
+    /* Keep at least a quarter of the slots EMPTY so that probe sequences stay
+     * short.  If most of the used slots are DELETED then just clean them
+     * out. */
+    if(avail->entry == EMPTY
+       && 4 * (h->nitems + h->ndeleted + 1) > 3 * h->nslots) {
+      rehash(h, 2 * h->nitems >= h->nslots ? 2 * h->nslots : h->nslots);
+      find_slot(h, key, n, &avail);
+    }
+    if(avail->entry == DELETED)
+      --h->ndeleted;
+    avail->h = n;
+    avail->entry = xmalloc(h->valuesize + len + 1);
+    if(value) memcpy(avail->entry, value, h->valuesize);
+    memcpy(avail->entry + h->valuesize, key, len + 1);
     ++h->nitems;
     return 0;
   }
@@ -135,15 +227,12 @@ int hash_add(hash *h, const char *key, const void *value, int mode) {
  * @return 0 on success, -1 if the key wasn't found
  */
 int hash_remove(hash *h, const char *key) {
-  size_t n = hashfn(key);
-  struct entry *e, **ee;
+  struct slot *s;
   
-  for(ee = &h->slots[n & (h->nslots - 1)]; (e = *ee); ee = &e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      break;
-  if(e) {
-    *ee = e->next;
+  if((s = find_slot(h, key, hashfn(key, strlen(key)), 0))) {
+    s->entry = DELETED;
     --h->nitems;
+    ++h->ndeleted;
     return 0;
   } else
     return -1;
@@ -157,12 +246,10 @@ int hash_remove(hash *h, const char *key) {
  * The return value points inside the hash table and should not be modified.
  */
 void *hash_find(hash *h, const char *key) {
-  size_t n = hashfn(key);
-  struct entry *e;
+  struct slot *s;
 
-  for(e = h->slots[n & (h->nslots - 1)]; e; e = e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      return e->value;
+  if((s = find_slot(h, key, hashfn(key, strlen(key)), 0)))
+    return s->entry;
   return 0;
 }
 
@@ -186,14 +273,13 @@ int hash_foreach(hash *h,
                  void *u) {
   size_t n;
   int ret;
-  struct entry *e, *f;
+  struct slot *s;
 
-  for(n = 0; n < h->nslots; ++n)
-    for(e = h->slots[n]; e; e = f) {
-      f = e->next;
-      if((ret = callback(e->key, e->value, u)))
-        return ret;
-    }
+  for(n = 0; n < h->nslots; ++n) {
+    s = &h->slots[n];
+    if(LIVE(s) && (ret = callback(KEY(h, s), s->entry, u)))
+      return ret;
+  }
   return 0;
 }
 
@@ -216,11 +302,10 @@ size_t hash_count(hash *h) {
 char **hash_keys(hash *h) {
   size_t n;
   char **vec = xcalloc(h->nitems + 1, sizeof (char *)), **vp = vec;
-  struct entry *e;
 
   for(n = 0; n < h->nslots; ++n)
-    for(e = h->slots[n]; e; e = e->next)
-      *vp++ = (char *)e->key;
+    if(LIVE(&h->slots[n]))
+      *vp++ = KEY(h, &h->slots[n]);
   *vp = 0;
   return vec;
 }
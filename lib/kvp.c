@@ -31,6 +31,7 @@
 #include "vector.h"
 #include "hex.h"
 #include "sink.h"
+#include "arena.h"
 
 /** @brief Decode a URL-encoded string to a ink
  * @param sink Where to store result
@@ -64,47 +65,64 @@ int urldecode(struct sink *sink, const char *ptr, size_t n) {
 }
 
 /** @brief URL-decode a string
+ * @param a Arena to allocate from, or NULL
  * @param ptr Start of URL-encoded string
  * @param n Length of @p ptr
- * @return Decoded string (0-terminated)
+ * @return Decoded string (0-terminated), or NULL if it could not be decoded
+ *
+ * Decodes directly into a buffer of the input's size, which is always big
+ * enough.
  */
-static char *decode(const char *ptr, size_t n) {
-  struct dynstr d;
-  struct sink *s;
+static char *decode(struct arena *a, const char *ptr, size_t n) {
+  char *const s = a ? arena_alloc(a, n + 1) : xmalloc_noptr(n + 1);
+  char *q = s;
+  int c, d1, d2;
 
-  dynstr_init(&d);
-  s = sink_dynstr(&d);
-  if(urldecode(s, ptr, n))
-    return 0;
-  dynstr_terminate(&d);
-  return d.vec;
+  while(n-- > 0) {
+    switch(c = *ptr++) {
+    case '%':
+      if(n < 2
+         || (d1 = unhexdigit(ptr[0])) == -1
+	 || (d2 = unhexdigit(ptr[1])) == -1)
+	return 0;
+      c  = d1 * 16 + d2;
+      ptr += 2;
+      n -= 2;
+      break;
+    case '+':
+      c = ' ';
+      break;
+    default:
+      break;
+    }
+    *q++ = c;
+  }
+  *q = 0;
+  return s;
 }
 
 /** @brief Decode a URL-decoded key-value pair list
+ * @param a Arena to allocate from, or NULL
  * @param ptr Start of input string
  * @param n Length of input string
  * @return @ref kvp of values from input
- *
- * The KVP is in the same order as the original input.
- *
- * If the original input contains duplicates names, so will the KVP.
  */
-struct kvp *kvp_urldecode(const char *ptr, size_t n) {
+static struct kvp *urldecode_kvp(struct arena *a, const char *ptr, size_t n) {
   struct kvp *kvp, **kk = &kvp, *k;
   const char *q, *r, *top = ptr + n, *next;
 
   while(ptr < top) {
-    *kk = k = xmalloc(sizeof *k);
+    *kk = k = a ? arena_alloc(a, sizeof *k) : xmalloc(sizeof *k);
     if(!(q = memchr(ptr, '=', top - ptr)))
       break;
-    if(!(k->name = decode(ptr, q - ptr))) break;
+    if(!(k->name = decode(a, ptr, q - ptr))) break;
     if((r = memchr(ptr, '&', top - ptr)))
       next = r + 1;
     else
       next = r = top;
     if(r < q)
       break;
-    if(!(k->value = decode(q + 1, r - (q + 1)))) break;
+    if(!(k->value = decode(a, q + 1, r - (q + 1)))) break;
     kk = &k->next;
     ptr = next;
   }
@@ -112,6 +130,31 @@ struct kvp *kvp_urldecode(const char *ptr, size_t n) {
   return kvp;
 }
 
+/** @brief Decode a URL-decoded key-value pair list
+ * @param ptr Start of input string
+ * @param n Length of input string
+ * @return @ref kvp of values from input
+ *
+ * The KVP is in the same order as the original input.
+ *
+ * If the original input contains duplicates names, so will the KVP.
+ */
+struct kvp *kvp_urldecode(const char *ptr, size_t n) {
+  return urldecode_kvp(0, ptr, n);
+}
+
+/** @brief Decode a URL-decoded key-value pair list into an arena
+ * @param a Arena to allocate from
+ * @param ptr Start of input string
+ * @param n Length of input string
+ * @return @ref kvp of values from input
+ *
+ * As kvp_urldecode() but the result only lasts until @p a is released.
+ */
+struct kvp *kvp_urldecode_arena(struct arena *a, const char *ptr, size_t n) {
+  return urldecode_kvp(a, ptr, n);
+}
+
 /** @brief URL-encode a string to a sink
  * @param sink Where to send output
  * @param s String to encode
@@ -46,6 +46,10 @@ struct kvp {
 struct kvp *kvp_urldecode(const char *ptr, size_t n);
 /* url-decode [ptr,ptr+n) */
 
+struct arena;
+struct kvp *kvp_urldecode_arena(struct arena *a, const char *ptr, size_t n);
+/* url-decode [ptr,ptr+n) into arena @a@ */
+
 char *kvp_urlencode(const struct kvp *kvp, size_t *np);
 /* url-encode @kvp@ into a null-terminated string.  If @np@ is not
  * null return the length thru it. */
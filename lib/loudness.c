@@ -0,0 +1,480 @@
+/*
+ * This file is part of DisOrder
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/loudness.c
+ * @brief Loudness measurement and gain
+ *
+ * Loudness is measured as described in <a
+ * href="https://www.itu.int/rec/R-REC-BS.1770">ITU-R BS.1770</a> and <a
+ * href="https://tech.ebu.ch/publications/r128">EBU R128</a>: the audio is
+ * K-weighted, its mean square is taken over 400ms blocks overlapping by 75%,
+ * and the integrated loudness is the mean over the blocks that pass an
+ * absolute gate at -70LUFS and a relative gate 10LU below the mean of the
+ * blocks that pass the first.  The sample peak is reported too, so that a gain
+ * can be chosen that won't cause clipping.
+ *
+ * disorder-rescan does this once for each track (see @ref server/rescan.c)
+ * and the speaker applies the resulting gain with gain16_buffer() as it plays
+ * the track.
+ *
+ * All channels are weighted equally, which is what BS.1770 says for mono and
+ * stereo.
+ */
+#include "common.h"
+
+#include <math.h>
+#include <assert.h>
+
+#if __SSE2__
+# include <emmintrin.h>
+#elif __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+#include "loudness.h"
+#include "byte-order.h"
+#include "mem.h"
+
+/** @brief Maximum number of channels */
+#define LOUDNESS_CHANNELS 8
+
+/** @brief Absolute gate in LUFS
+ *
+ * Also reported as the loudness of silence.
+ */
+#define LOUDNESS_GATE -70.0
+
+/** @brief Relative gate in LU */
+#define LOUDNESS_RELATIVE_GATE -10.0
+
+/** @brief Peak reported for silence, in dBFS */
+#define LOUDNESS_SILENT_PEAK -120.0
+
+/** @brief A biquad filter, with @c a0 normalized to 1 */
+struct biquad {
+  double b0, b1, b2, a1, a2;
+};
+
+/** @brief State of a loudness measurement */
+struct loudness {
+  /** @brief Current sample rate, or 0 before any data */
+  unsigned rate;
+
+  /** @brief Current number of channels */
+  unsigned channels;
+
+  /** @brief Current bits per sample */
+  unsigned bits;
+
+  /** @brief Current endianness */
+  int endian;
+
+  /** @brief Pre-filter (high shelf) */
+  struct biquad shelf;
+
+  /** @brief RLB filter (high pass) */
+  struct biquad highpass;
+
+  /** @brief Filter state for each channel
+   *
+   * Two words each for @ref shelf and @ref highpass, which are implemented in
+   * transposed direct form II.
+   */
+  double state[LOUDNESS_CHANNELS][4];
+
+  /** @brief Frames in each 100ms sub-block */
+  unsigned long subframes;
+
+  /** @brief Frames so far in the current sub-block */
+  unsigned long nframes;
+
+  /** @brief Sum of squares so far in the current sub-block */
+  double sum;
+
+  /** @brief Mean square of each complete sub-block */
+  double *powers;
+
+  /** @brief Number of complete sub-blocks */
+  size_t npowers;
+
+  /** @brief Size of @ref powers */
+  size_t nslots;
+
+  /** @brief Largest sample magnitude, as a fraction of full scale */
+  double peak;
+
+  /** @brief Total frames seen */
+  unsigned long long total;
+
+  /** @brief Partial frame left over from the last loudness_feed() */
+  unsigned char partial[LOUDNESS_CHANNELS * 4];
+
+  /** @brief Bytes in @ref partial */
+  size_t npartial;
+};
+
+/** @brief Create a loudness measurement
+ * @return New measurement, to be freed with loudness_free()
+ */
+struct loudness *loudness_new(void) {
+  struct loudness *l = xmalloc(sizeof *l);
+
+  memset(l, 0, sizeof *l);
+  return l;
+}
+
+/** @brief Free a loudness measurement
+ * @param l Measurement to free
+ */
+void loudness_free(struct loudness *l) {
+  if(l) {
+    xfree(l->powers);
+    xfree(l);
+  }
+}
+
+/** @brief Switch format
+ * @param l Measurement
+ * @param rate Sample rate
+ * @param channels Number of channels
+ * @param bits Bits per sample
+ * @param endian Endianness
+ *
+ * The K-weighting filters are computed for @p rate, following the derivation
+ * in libebur128 so that they match the coefficients given in BS.1770 at
+ * 48kHz.  Any partial frame and sub-block are discarded.
+ */
+static void loudness_format(struct loudness *l, unsigned rate,
+                            unsigned channels, unsigned bits, int endian) {
+  double f0, q, k, vh, vb, a0;
+
+  assert(channels >= 1 && channels <= LOUDNESS_CHANNELS);
+  assert(bits >= 8 && bits <= 32 && bits % 8 == 0);
+  assert(rate >= 100);
+  if(rate != l->rate) {
+    f0 = 1681.974450955533;
+    q = 0.7071752369554196;
+    k = tan(M_PI * f0 / rate);
+    vh = pow(10.0, 3.999843853973347 / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / q + k * k;
+    l->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    l->shelf.b1 = 2.0 * (k * k - vh) / a0;
+    l->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    l->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    l->shelf.a2 = (1.0 - k / q + k * k) / a0;
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+    l->highpass.b0 = 1.0;
+    l->highpass.b1 = -2.0;
+    l->highpass.b2 = 1.0;
+    l->highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    l->highpass.a2 = (1.0 - k / q + k * k) / a0;
+    l->subframes = rate / 10;
+  }
+  l->rate = rate;
+  l->channels = channels;
+  l->bits = bits;
+  l->endian = endian;
+  memset(l->state, 0, sizeof l->state);
+  l->nframes = 0;
+  l->sum = 0;
+  l->npartial = 0;
+}
+
+/** @brief Convert one sample to floating point
+ * @param p Sample
+ * @param bytes Bytes per sample
+ * @param endian Endianness
+ * @return Sample value, between -1 and 1
+ */
+static inline double loudness_sample(const unsigned char *p, unsigned bytes,
+                                     int endian) {
+  uint32_t u = 0;
+  unsigned n;
+
+  if(endian == ENDIAN_BIG)
+    for(n = 0; n < bytes; ++n)
+      u = (u << 8) | p[n];
+  else
+    for(n = bytes; n > 0; --n)
+      u = (u << 8) | p[n - 1];
+  u <<= 32 - 8 * bytes;
+  return (int32_t)u / 2147483648.0;
+}
+
+/** @brief Apply a biquad filter to one sample
+ * @param f Filter
+ * @param s Filter state (two words)
+ * @param x Input sample
+ * @return Output sample
+ */
+static inline double biquad(const struct biquad *f, double *s, double x) {
+  const double y = f->b0 * x + s[0];
+
+  s[0] = f->b1 * x - f->a1 * y + s[1];
+  s[1] = f->b2 * x - f->a2 * y;
+  return y;
+}
+
+/** @brief Process one frame
+ * @param l Measurement
+ * @param p Frame in the current format
+ */
+static void loudness_frame(struct loudness *l, const unsigned char *p) {
+  const unsigned bytes = l->bits / 8;
+  unsigned c;
+  double x, z;
+
+  for(c = 0; c < l->channels; ++c, p += bytes) {
+    x = loudness_sample(p, bytes, l->endian);
+    if(fabs(x) > l->peak)
+      l->peak = fabs(x);
+    z = biquad(&l->highpass, l->state[c] + 2,
+               biquad(&l->shelf, l->state[c], x));
+    l->sum += z * z;
+  }
+  ++l->total;
+  if(++l->nframes == l->subframes) {
+    if(l->npowers >= l->nslots) {
+      l->nslots = l->nslots ? 2 * l->nslots : 3000;
+      l->powers = xrealloc_noptr(l->powers, l->nslots * sizeof *l->powers);
+    }
+    l->powers[l->npowers++] = l->sum / l->subframes;
+    l->nframes = 0;
+    l->sum = 0;
+  }
+}
+
+/** @brief Add audio to a loudness measurement
+ * @param l Measurement
+ * @param data Signed PCM samples
+ * @param nbytes Number of bytes at @p data
+ * @param rate Sample rate
+ * @param channels Number of channels (at most 8)
+ * @param bits Bits per sample (8, 16, 24 or 32)
+ * @param endian Endianness (@c ENDIAN_BIG or @c ENDIAN_LITTLE)
+ *
+ * @p nbytes need not be a whole number of frames; any left over are kept
+ * until the next call.  If the format changes, the measurement carries on
+ * from the next 100ms boundary.
+ */
+void loudness_feed(struct loudness *l, const void *data, size_t nbytes,
+                   unsigned rate, unsigned channels, unsigned bits,
+                   int endian) {
+  const unsigned char *p = data;
+  const size_t frame = bits / 8 * channels;
+  size_t n;
+
+  if(rate != l->rate || channels != l->channels || bits != l->bits
+     || endian != l->endian)
+    loudness_format(l, rate, channels, bits, endian);
+  /* Complete any frame left over from last time */
+  if(l->npartial) {
+    n = frame - l->npartial;
+    if(n > nbytes)
+      n = nbytes;
+    memcpy(l->partial + l->npartial, p, n);
+    l->npartial += n;
+    p += n;
+    nbytes -= n;
+    if(l->npartial < frame)
+      return;
+    loudness_frame(l, l->partial);
+    l->npartial = 0;
+  }
+  for(; nbytes >= frame; nbytes -= frame, p += frame)
+    loudness_frame(l, p);
+  memcpy(l->partial, p, nbytes);
+  l->npartial = nbytes;
+}
+
+/** @brief Return the mean square of a 400ms block
+ * @param l Measurement
+ * @param n Index of block
+ * @return Mean square
+ *
+ * Tracks shorter than 400ms are treated as a single short block.
+ */
+static double loudness_block(const struct loudness *l, size_t n) {
+  size_t i, count = l->npowers < 4 ? l->npowers : 4;
+  double sum = 0;
+
+  for(i = 0; i < count; ++i)
+    sum += l->powers[n + i];
+  return sum / count;
+}
+
+/** @brief Convert a mean square to loudness
+ * @param power Mean square
+ * @return Loudness in LUFS
+ */
+static double power_to_lufs(double power) {
+  return -0.691 + 10.0 * log10(power);
+}
+
+/** @brief Get the result of a loudness measurement
+ * @param l Measurement
+ * @param lufsp Where to store the integrated loudness in LUFS
+ * @param peakp Where to store the sample peak in dBFS
+ * @return 0 on success, -1 if no audio was supplied
+ *
+ * Silence (or audio so quiet that all of it is gated out) is reported as
+ * -70LUFS with a peak of at most -120dBFS.
+ */
+int loudness_result(struct loudness *l, double *lufsp, double *peakp) {
+  const double absolute = pow(10.0, (LOUDNESS_GATE + 0.691) / 10.0);
+  size_t n, nblocks, count;
+  double power, sum, relative;
+
+  if(!l->total)
+    return -1;
+  /* If there's not even 100ms then count what we have as one sub-block */
+  if(!l->npowers && l->nframes) {
+    l->powers = xrealloc_noptr(l->powers, sizeof *l->powers);
+    l->nslots = 1;
+    l->powers[l->npowers++] = l->sum / l->nframes;
+    l->nframes = 0;
+    l->sum = 0;
+  }
+  nblocks = l->npowers >= 4 ? l->npowers - 3 : !!l->npowers;
+  /* Absolute gate */
+  sum = 0;
+  count = 0;
+  for(n = 0; n < nblocks; ++n)
+    if((power = loudness_block(l, n)) > absolute) {
+      sum += power;
+      ++count;
+    }
+  *lufsp = LOUDNESS_GATE;
+  if(count) {
+    /* Relative gate */
+    relative = sum / count * pow(10.0, LOUDNESS_RELATIVE_GATE / 10.0);
+    if(relative < absolute)
+      relative = absolute;
+    sum = 0;
+    count = 0;
+    for(n = 0; n < nblocks; ++n)
+      if((power = loudness_block(l, n)) > relative) {
+        sum += power;
+        ++count;
+      }
+    if(count)
+      *lufsp = power_to_lufs(sum / count);
+  }
+  *peakp = LOUDNESS_SILENT_PEAK;
+  if(l->peak > 0 && 20.0 * log10(l->peak) > LOUDNESS_SILENT_PEAK)
+    *peakp = 20.0 * log10(l->peak);
+  return 0;
+}
+
+/** @brief Choose a gain factor
+ * @param lufs Integrated loudness of track in LUFS
+ * @param peak Sample peak of track in dBFS
+ * @param target Desired loudness in LUFS
+ * @return Gain factor for gain16_buffer()
+ *
+ * The gain is reduced if necessary so that the peak will not exceed full
+ * scale, and limited to @ref LOUDNESS_MAX.
+ */
+int loudness_gain(double lufs, double peak, double target) {
+  double db = target - lufs, factor;
+
+  if(db > -peak)
+    db = -peak;
+  factor = LOUDNESS_UNITY * pow(10.0, db / 20.0);
+  if(factor >= LOUDNESS_MAX)
+    return LOUDNESS_MAX;
+  if(factor < 1)
+    return 1;
+  return (int)(factor + 0.5);
+}
+
+/** @brief Apply a gain to 16-bit samples
+ * @param buffer Native-endian signed samples
+ * @param n Number of samples
+ * @param gain Gain factor
+ *
+ * Portable version of gain16_buffer().
+ */
+void gain16_buffer_portable(void *buffer, size_t n, int gain) {
+  unsigned char *p = buffer;
+  int16_t s;
+  int32_t v;
+
+  for(; n > 0; --n, p += 2) {
+    memcpy(&s, p, 2);
+    v = ((int32_t)s * gain) >> LOUDNESS_SHIFT;
+    if(v > INT16_MAX)
+      v = INT16_MAX;
+    else if(v < INT16_MIN)
+      v = INT16_MIN;
+    s = v;
+    memcpy(p, &s, 2);
+  }
+}
+
+/** @brief Apply a gain to 16-bit samples
+ * @param buffer Native-endian signed samples
+ * @param n Number of samples
+ * @param gain Gain factor
+ *
+ * Each sample is multiplied by @p gain / @ref LOUDNESS_UNITY, rounding down,
+ * and saturated to the 16-bit range.  @p gain must be between 0 and @ref
+ * LOUDNESS_MAX.  @p buffer need not be aligned beyond 2 bytes.
+ */
+void gain16_buffer(void *buffer, size_t n, int gain) {
+#if __SSE2__
+  unsigned char *p = buffer;
+  const __m128i g = _mm_set1_epi16(gain);
+
+  for(; n >= 8; n -= 8, p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    const __m128i lo = _mm_mullo_epi16(v, g), hi = _mm_mulhi_epi16(v, g);
+    const __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi),
+                                     LOUDNESS_SHIFT);
+    const __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi),
+                                     LOUDNESS_SHIFT);
+    _mm_storeu_si128((__m128i *)p, _mm_packs_epi32(a, b));
+  }
+  gain16_buffer_portable(p, n, gain);
+#elif __ARM_NEON
+  int16_t *p = buffer;
+
+  for(; n >= 8; n -= 8, p += 8) {
+    const int16x8_t v = vld1q_s16(p);
+    const int32x4_t a = vmull_n_s16(vget_low_s16(v), gain);
+    const int32x4_t b = vmull_n_s16(vget_high_s16(v), gain);
+    vst1q_s16(p, vcombine_s16(vqshrn_n_s32(a, LOUDNESS_SHIFT),
+                              vqshrn_n_s32(b, LOUDNESS_SHIFT)));
+  }
+  gain16_buffer_portable(p, n, gain);
+#else
+  gain16_buffer_portable(buffer, n, gain);
+#endif
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,61 @@
+/*
+ * This file is part of DisOrder
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/loudness.h
+ * @brief Loudness measurement and gain
+ */
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+
+/** @brief Number of fractional bits in a gain factor
+ *
+ * See gain16_buffer().
+ */
+#define LOUDNESS_SHIFT 12
+
+/** @brief Gain factor that leaves samples unchanged */
+#define LOUDNESS_UNITY (1 << LOUDNESS_SHIFT)
+
+/** @brief Largest gain factor (a little over +18dB) */
+#define LOUDNESS_MAX 32767
+
+struct loudness;
+
+struct loudness *loudness_new(void);
+void loudness_feed(struct loudness *l, const void *data, size_t nbytes,
+                   unsigned rate, unsigned channels, unsigned bits,
+                   int endian);
+int loudness_result(struct loudness *l, double *lufsp, double *peakp);
+void loudness_free(struct loudness *l);
+
+int loudness_gain(double lufs, double peak, double target);
+
+void gain16_buffer(void *buffer, size_t n, int gain);
+void gain16_buffer_portable(void *buffer, size_t n, int gain);
+
+#endif /* LOUDNESS_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -25,12 +25,47 @@
 #include <gc.h>
 #endif
 #include <errno.h>
+#include <time.h>
 
 #include "mem.h"
 #include "log.h"
 #include "printf.h"
 
 #include "disorder.h"
+#include "syscalls.h"
+
+/** @brief Bytes requested since startup
+ *
+ * Reallocations only count the growth of the block; see realloc_growth().
+ * Allocations may happen on any thread, so this is only accessed atomically.
+ */
+static unsigned long long mem_allocated;
+
+#if GC && HAVE_GC_SET_ON_COLLECTION_EVENT
+/** @brief Time the current collection started */
+static struct timespec gc_started;
+
+/** @brief Total time spent in collections */
+static double gc_seconds;
+
+/** @brief Called by the collector at the start and end of each collection */
+static void gc_event(GC_EventType event) {
+  struct timespec now;
+
+  switch(event) {
+  case GC_EVENT_START:
+    xgettime(CLOCK_MONOTONIC, &gc_started);
+    break;
+  case GC_EVENT_END:
+    xgettime(CLOCK_MONOTONIC, &now);
+    gc_seconds += (now.tv_sec - gc_started.tv_sec)
+      + (now.tv_nsec - gc_started.tv_nsec) / 1000000000.0;
+    break;
+  default:
+    break;
+  }
+}
+#endif
 
 /** @brief Allocate and zero out
  * @param n Number of bytes to allocate
@@ -76,11 +111,35 @@ void mem_init(void) {
     assert(GC_get_all_interior_pointers());
 #else
     assert(GC_all_interior_pointers);
+#endif
+#ifdef HAVE_GC_SET_ON_COLLECTION_EVENT
+    GC_set_on_collection_event(gc_event);
 #endif
   }
 #endif
 }
 
+/** @brief Return the number of bytes by which a reallocation grows a block
+ * @param ptr Existing block or 0
+ * @param n New size
+ * @return Growth in bytes
+ *
+ * The old size is only known when the collector is in use; otherwise the
+ * whole of @p n is counted.
+ */
+static size_t realloc_growth(void *ptr, size_t n) {
+#if GC
+  size_t old;
+
+  if(ptr && do_realloc == GC_realloc) {
+    old = GC_size(ptr);
+    return n > old ? n - old : 0;
+  }
+#endif
+  (void)ptr;
+  return n;
+}
+
 /** @brief Allocate memory
  * @param n Bytes to allocate
  * @return Pointer to allocated memory
@@ -93,6 +152,7 @@ void *xmalloc(size_t n) {
 
   if(!(ptr = do_malloc(n)) && n)
     disorder_fatal(errno, "error allocating memory");
+  __atomic_fetch_add(&mem_allocated, n, __ATOMIC_RELAXED);
   return ptr;
 }
 
@@ -105,8 +165,11 @@ void *xmalloc(size_t n) {
  * additional memory allocated is 0-filled.
  */
 void *xrealloc(void *ptr, size_t n) {
+  const size_t growth = realloc_growth(ptr, n);
+
   if(!(ptr = do_realloc(ptr, n)) && n)
     disorder_fatal(errno, "error allocating memory");
+  __atomic_fetch_add(&mem_allocated, growth, __ATOMIC_RELAXED);
   return ptr;
 }
 
@@ -137,6 +200,7 @@ void *xmalloc_noptr(size_t n) {
 
   if(!(ptr = do_malloc_atomic(n)) && n)
     disorder_fatal(errno, "error allocating memory");
+  __atomic_fetch_add(&mem_allocated, n, __ATOMIC_RELAXED);
   return ptr;
 }
 
@@ -164,10 +228,14 @@ void *xcalloc_noptr(size_t count, size_t size) {
  * allocated with xmalloc_noptr() (or xrealloc_noptr()) initially.
  */
 void *xrealloc_noptr(void *ptr, size_t n) {
+  size_t growth;
+
   if(ptr == 0)
     return xmalloc_noptr(n);
+  growth = realloc_growth(ptr, n);
   if(!(ptr = do_realloc(ptr, n)) && n)
     disorder_fatal(errno, "error allocating memory");
+  __atomic_fetch_add(&mem_allocated, growth, __ATOMIC_RELAXED);
   return ptr;
 }
 
@@ -178,11 +246,13 @@ void *xrealloc_noptr(void *ptr, size_t n) {
  * This uses the equivalent of xmalloc_noptr() to allocate the new string.
  */
 char *xstrdup(const char *s) {
+  const size_t n = strlen(s) + 1;
   char *t;
 
-  if(!(t = do_malloc_atomic(strlen(s) + 1)))
+  if(!(t = do_malloc_atomic(n)))
     disorder_fatal(errno, "error allocating memory");
-  return strcpy(t, s);
+  __atomic_fetch_add(&mem_allocated, n, __ATOMIC_RELAXED);
+  return memcpy(t, s, n);
 }
 
 /** @brief Duplicate a prefix of a string
@@ -198,6 +268,7 @@ char *xstrndup(const char *s, size_t n) {
 
   if(!(t = do_malloc_atomic(n + 1)))
     disorder_fatal(errno, "error allocating memory");
+  __atomic_fetch_add(&mem_allocated, n + 1, __ATOMIC_RELAXED);
   memcpy(t, s, n);
   t[n] = 0;
   return t;
@@ -210,6 +281,25 @@ void xfree(void *ptr) {
   do_free(ptr);
 }
 
+/** @brief Report memory management statistics
+ * @param ms Where to store statistics
+ *
+ * Collection counts and times are only available when the garbage collector
+ * is in use (and, for times, supports collection event callbacks).
+ */
+void mem_stats(struct mem_stats *ms) {
+  memset(ms, 0, sizeof *ms);
+  ms->allocated = __atomic_load_n(&mem_allocated, __ATOMIC_RELAXED);
+#if GC
+  if(do_malloc == GC_malloc) {
+    ms->collections = GC_get_gc_no();
+#ifdef HAVE_GC_SET_ON_COLLECTION_EVENT
+    ms->gc_seconds = gc_seconds;
+#endif
+  }
+#endif
+}
+
 /*
 Local Variables:
 c-basic-offset:2
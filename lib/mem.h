@@ -56,6 +56,24 @@ char *xstrndup(const char *, size_t);
 void xfree(void *ptr);
 /* As free, but calls GC_free instead if gc is enabled */
 
+/** @brief Memory management statistics */
+struct mem_stats {
+  /** @brief Total bytes requested
+   *
+   * Reallocations count only the growth of the block, where it is known.
+   */
+  unsigned long long allocated;
+
+  /** @brief Number of garbage collections */
+  unsigned long collections;
+
+  /** @brief Total time spent in garbage collection (seconds) */
+  double gc_seconds;
+};
+
+void mem_stats(struct mem_stats *ms);
+/* Get memory management statistics */
+
 #endif /* MEM_H */
 
 /*
@@ -226,6 +226,13 @@ struct queue_entry {
    * Used to supress 'terminated' messages.
    */
   int killed;
+
+  /** @brief Cache key if the track was prepared from the PCM cache, or NULL
+   *
+   * See @ref server/pcmcache.c.  For tracks prepared by a decoder this is
+   * always NULL.
+   */
+  char *cachekey;
 };
 
 void queue_insert_entry(struct queue_entry *b, struct queue_entry *n);
@@ -63,6 +63,23 @@ struct attribute((packed)) rtp_header {
   uint32_t ssrc;
 };
 
+/** @brief Payload type for Opus
+ *
+ * Opus (<a href="http://www.ietf.org/rfc/rfc7587.txt">RFC7587</a>) has no
+ * static payload type, so we use the first dynamic one.
+ */
+#define RTP_PAYLOAD_OPUS 96
+
+/** @brief RTP clock rate for Opus
+ *
+ * RFC7587 s4.1 fixes this at 48kHz, whatever the actual sample rate.
+ * Timestamps count frames, not samples.
+ */
+#define RTP_OPUS_RATE 48000
+
+/** @brief Number of frames in each Opus packet (20ms) */
+#define RTP_OPUS_FRAME 960
+
 /** @brief RTP packet header format
  *
  * See <a href="http://www.ietf.org/rfc/rfc1889.txt">RFC1889</a> (now obsoleted
@@ -78,6 +95,52 @@ struct attribute((packed)) rtp_extension {
   uint16_t length;
 };
 
+/** @brief Extension type for FEC packets */
+#define RTP_EXTENSION_FEC 0x4446
+
+/** @brief Forward error correction data
+ *
+ * An FEC packet protects a group of consecutive L16 packets, after the manner
+ * of <a href="http://www.ietf.org/rfc/rfc5109.txt">RFC5109</a>.  Its payload
+ * is the XOR of the payloads of the packets in the group, each padded with
+ * zeros to the length of the longest.  Any one packet of the group can then be
+ * reconstructed from the others.
+ *
+ * FEC packets have the extension bit set in their RTP header, which is
+ * followed by an @ref rtp_extension of type @ref RTP_EXTENSION_FEC and then
+ * this structure.  Receivers that don't understand them ignore them.  They
+ * don't use up any sequence numbers; the @c seq field in the RTP header is
+ * that of the last packet of the group.
+ *
+ * All values in this structure are big-endian.
+ */
+struct attribute((packed)) rtp_fec {
+  /** @brief Sequence number of first packet of group */
+  uint16_t seq;
+
+  /** @brief Number of packets in group */
+  uint8_t count;
+
+  /** @brief XOR of marker and payload type of each packet */
+  uint8_t mpt;
+
+  /** @brief XOR of timestamp of each packet */
+  uint32_t timestamp;
+
+  /** @brief XOR of payload length of each packet */
+  uint16_t length;
+
+  /** @brief Reserved, always 0 */
+  uint16_t reserved;
+};
+
+/** @brief Bytes used by FEC information in addition to the RTP header */
+#define RTP_FEC_OVERHEAD (sizeof (struct rtp_extension) \
+                          + sizeof (struct rtp_fec))
+
+/** @brief Largest FEC group */
+#define RTP_FEC_MAX_GROUP 32
+
 #endif /* RTP_H */
 
 /*
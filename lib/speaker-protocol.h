@@ -30,6 +30,65 @@
 # include <netinet/in.h>
 #endif
 
+/** @brief Number of buckets in @ref speaker_telemetry::callback_us */
+#define SPEAKER_CALLBACK_BUCKETS 12
+
+/** @brief Speaker health information
+ *
+ * Sent from the speaker in @ref SM_TELEMETRY messages.  The cumulative
+ * counters cover the whole life of the speaker process; the rest describe
+ * track @c id.  Durations are in milliseconds except where noted, and buffer
+ * occupancy is expressed as milliseconds of audio.
+ *
+ * This must fit inside a @c struct @c sockaddr_storage.
+ */
+struct speaker_telemetry {
+  /** @brief Track ID (including 0 terminator), or empty string */
+  char id[24];
+
+  /** @brief Time from @ref SM_PLAY to the first sample being played */
+  uint32_t start_ms;
+
+  /** @brief Smallest buffer occupancy seen while playing */
+  uint32_t buffer_min_ms;
+
+  /** @brief Average buffer occupancy while playing */
+  uint32_t buffer_avg_ms;
+
+  /** @brief Decoding speed as a percentage of real time
+   *
+   * Measured from the decoder connecting until the track's buffer first fills
+   * up (or the decoder finishes, if sooner).  0 if not known yet.
+   */
+  uint32_t decode_percent;
+
+  /** @brief Number of underruns while playing this track */
+  uint32_t track_underruns;
+
+  /** @brief Total number of underruns
+   *
+   * An underrun is when the audio API wants sample data for a track that
+   * isn't finished, but none is available, so silence is played instead.
+   */
+  uint32_t underruns;
+
+  /** @brief Total duration of underruns */
+  uint32_t underrun_ms;
+
+  /** @brief Duration of longest underrun */
+  uint32_t longest_underrun_ms;
+
+  /** @brief Longest audio callback execution time in microseconds */
+  uint32_t callback_max_us;
+
+  /** @brief Histogram of audio callback execution times
+   *
+   * Bucket 0 counts callbacks taking under 2us; bucket @c n counts callbacks
+   * taking from 2^n to 2^(n+1)-1us; the last bucket counts all longer ones.
+   */
+  uint32_t callback_us[SPEAKER_CALLBACK_BUCKETS];
+};
+
 /** @brief A message from the main server to the speaker, or vica versa */
 struct speaker_message {
   /** @brief Message type
@@ -42,6 +101,7 @@ struct speaker_message {
    * - @ref SM_RELOAD
    * - @ref SM_RTP_REQUEST
    * - @ref SM_RTP_CANCEL
+   * - @ref SM_CACHED
    *
    * Messages from the speaker:
    * - @ref SM_PAUSED
@@ -49,6 +109,8 @@ struct speaker_message {
    * - @ref SM_PLAYING
    * - @ref SM_UNKNOWN
    * - @ref SM_ARRIVED
+   * - @ref SM_CACHE_MISS
+   * - @ref SM_TELEMETRY
    */
   int type;
 
@@ -61,6 +123,18 @@ struct speaker_message {
 
     /** @brief An IP address (for @ref SM_RTP_REQUEST and @ref SM_RTP_CANCEL) */
     struct sockaddr_storage address;
+
+    /** @brief A track to play from the PCM cache (for @ref SM_CACHED) */
+    struct {
+      /** @brief Track ID (including 0 terminator) */
+      char id[24];
+
+      /** @brief Cache key (including 0 terminator) */
+      char key[48];
+    } cached;
+
+    /** @brief Health information (for @ref SM_TELEMETRY) */
+    struct speaker_telemetry telemetry;
   } u;
 };
 
@@ -68,7 +142,8 @@ struct speaker_message {
 
 /** @brief Play track @c id
  *
- * The track must already have been prepared.
+ * The track must already have been prepared.  @c data is the gain to apply,
+ * as a multiple of @ref LOUDNESS_UNITY, or 0 to play the track as it is.
  */
 #define SM_PLAY 1
 
@@ -90,6 +165,13 @@ struct speaker_message {
 /** @brief Reload configuration */
 #define SM_RTP_CANCEL 7
 
+/** @brief Prepare track @c cached.id from cache entry @c cached.key
+ *
+ * The speaker replies with @ref SM_ARRIVED if it can use the cache entry and
+ * @ref SM_CACHE_MISS if not.
+ */
+#define SM_CACHED 8
+
 /* messages from the speaker */
 /** @brief Paused track @c id, @c data seconds in
  *
@@ -122,6 +204,17 @@ struct speaker_message {
 /** @brief A connection for track @c id arrived */
 #define SM_ARRIVED 134
 
+/** @brief The cache entry for track @c id could not be used */
+#define SM_CACHE_MISS 135
+
+/** @brief Health information in @c telemetry
+ *
+ * This is sent from time to time while playing.  @c data is nonzero if this
+ * is the final report for track @c telemetry.id, which has just stopped
+ * playing.
+ */
+#define SM_TELEMETRY 136
+
 void speaker_send(int fd, const struct speaker_message *sm);
 /* Send a message. */
 
@@ -147,6 +240,19 @@ struct stream_header {
   uint8_t endian;
 } attribute((packed));
 
+/** @brief Test for an end-of-track marker
+ * @param h Header
+ * @return Non-0 if @p h marks the end of the track
+ *
+ * Decoders send a header with @c nbytes and @c rate both 0 after the last
+ * chunk of a track that they decoded completely.  If it is missing, for
+ * instance because the decoder died, disorder-normalize knows that the audio
+ * is incomplete and does not add it to the PCM cache.
+ */
+static inline int stream_header_is_end(const struct stream_header *h) {
+  return h->nbytes == 0 && h->rate == 0;
+}
+
 static inline int formats_equal(const struct stream_header *a,
                                 const struct stream_header *b) {
   return (a->rate == b->rate
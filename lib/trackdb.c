@@ -60,6 +60,7 @@
 #include "base64.h"
 #include "sendmail.h"
 #include "validity.h"
+#include "arena.h"
 
 #define RESCAN "disorder-rescan"
 #define DEADLOCK "disorder-deadlock"
@@ -75,7 +76,20 @@ static char **trackdb_new_tid(int *ntracksp,
 static int trackdb_expire_noticed_tid(time_t earliest, DB_TXN *tid);
 static char *normalize_tag(const char *s, size_t ns);
 
-const struct cache_type cache_files_type = { 86400 };
+/** @brief Approximate size of a cached listing
+ * @param value Null-terminated list of strings
+ * @return Size in bytes
+ */
+static size_t cache_files_size(const void *value) {
+  const char *const *vec = value;
+  size_t size = sizeof *vec;
+
+  for(; *vec; ++vec)
+    size += sizeof *vec + strlen(*vec) + 1;
+  return size;
+}
+
+const struct cache_type cache_files_type = { 86400, cache_files_size };
 unsigned long cache_files_hits, cache_files_misses;
 
 /** @brief Set by trackdb_open() */
@@ -779,6 +793,36 @@ int trackdb_delkeydata(DB *db,
   return err;
 }
 
+/** @brief Transaction statistics */
+static struct trackdb_transaction_stats txn_stats;
+
+/** @brief Number of transactions currently open */
+static int txn_depth;
+
+/** @brief When the outermost open transaction started */
+static struct timespec txn_started;
+
+/** @brief Note the end of a transaction */
+static void txn_finished(void) {
+  struct timespec now;
+
+  if(!--txn_depth) {
+    xgettime(CLOCK_MONOTONIC, &now);
+    txn_stats.seconds += (now.tv_sec - txn_started.tv_sec)
+      + (now.tv_nsec - txn_started.tv_nsec) / 1000000000.0;
+  }
+}
+
+/** @brief Get transaction statistics
+ * @param stats Where to store statistics
+ *
+ * Time is counted while any transaction is open, so nested transactions are
+ * not double-counted.  Nearly all aborts are retries after a deadlock.
+ */
+void trackdb_transaction_stats(struct trackdb_transaction_stats *stats) {
+  *stats = txn_stats;
+}
+
 /** @brief Start a transaction
  * @return Transaction
  */
@@ -788,6 +832,9 @@ DB_TXN *trackdb_begin_transaction(void) {
 
   if((err = trackdb_env->txn_begin(trackdb_env, 0, &tid, 0)))
     disorder_fatal(0, "trackdb_env->txn_begin: %s", db_strerror(err));
+  if(!txn_depth++)
+    xgettime(CLOCK_MONOTONIC, &txn_started);
+  ++txn_stats.begun;
   return tid;
 }
 
@@ -799,9 +846,12 @@ DB_TXN *trackdb_begin_transaction(void) {
 void trackdb_abort_transaction(DB_TXN *tid) {
   int err;
 
-  if(tid)
+  if(tid) {
     if((err = tid->abort(tid)))
       disorder_fatal(0, "tid->abort: %s", db_strerror(err));
+    ++txn_stats.aborted;
+    txn_finished();
+  }
 }
 
 /** @brief Commit transaction
@@ -812,6 +862,8 @@ void trackdb_commit_transaction(DB_TXN *tid) {
 
   if((err = tid->commit(tid, 0)))
     disorder_fatal(0, "tid->commit: %s", db_strerror(err));
+  ++txn_stats.committed;
+  txn_finished();
 }
 
 /* search/tags shared code ***************************************************/
@@ -908,22 +960,6 @@ static int tailor_underscore_Word_Break_Other(uint32_t c) {
   }
 }
 
-/** @brief Remove all combining characters in-place
- * @param s Pointer to start of string
- * @param ns Length of string
- * @return New, possiblby reduced, length
- */
-static size_t remove_combining_chars(uint32_t *s, size_t ns) {
-  uint32_t *start = s, *t = s, *end = s + ns;
-
-  while(s < end) {
-    const uint32_t c = *s++;
-    if(!utf32_combining_class(c))
-      *t++ = c;
-  }
-  return t - start;
-}
-
 /** @brief Normalize and split a string using a given tailoring
  * @param v Where to store words from string
  * @param s Input string
@@ -935,28 +971,20 @@ static size_t remove_combining_chars(uint32_t *s, size_t ns) {
  * - not include any word break code points (as tailored)
  *
  * Used by track_to_words(), with @p pt set to @ref
- * tailor_underscore_Word_Break_Other, and by normalize_tag() with no
- * tailoring.
+ * tailor_underscore_Word_Break_Other for the track name and with no tailoring
+ * for display preferences.
  */
 static void word_split(struct vector *v,
                        const char *s,
                        unicode_property_tailor *pt) {
-  size_t nw, nt32, i;
-  uint32_t *t32, **w32;
+  size_t nw, i;
+  char **w;
 
-  /* Convert to UTF-32 */
-  if(!(t32 = utf8_to_utf32(s, strlen(s), &nt32)))
-    return;
-  /* Erase case distinctions */
-  if(!(t32 = utf32_casefold_compat(t32, nt32, &nt32)))
+  /* Case-fold, drop combining characters and split into words */
+  if(!(w = utf8_fold_words(s, strlen(s), &nw, pt)))
     return;
-  /* Drop combining characters */
-  nt32 = remove_combining_chars(t32, nt32);
-  /* Split into words, treating _ as a space */
-  w32 = utf32_word_split(t32, nt32, &nw, pt);
-  /* Convert words back to UTF-8 and append to result */
   for(i = 0; i < nw; ++i)
-    vector_append(v, utf32_to_utf8(w32[i], utf32_len(w32[i]), 0));
+    vector_append(v, w[i]);
 }
 
 /** @brief Normalize a tag
@@ -971,23 +999,19 @@ static void word_split(struct vector *v,
  * - all spacing between words will be a single U+0020 SPACE
  */
 static char *normalize_tag(const char *s, size_t ns) {
-  uint32_t *s32, **w32;
-  size_t ns32, nw32, i;
+  char **w;
+  size_t nw, i;
   struct dynstr d[1];
 
-  if(!(s32 = utf8_to_utf32(s, ns, &ns32)))
-    return 0;
-  if(!(s32 = utf32_casefold_compat(s32, ns32, &ns32))) /* ->NFKD */
-    return 0;
-  ns32 = remove_combining_chars(s32, ns32);
   /* Split into words, no Word_Break tailoring */
-  w32 = utf32_word_split(s32, ns32, &nw32, 0);
+  if(!(w = utf8_fold_words(s, ns, &nw, 0)))
+    return 0;
   /* Compose back into a string */
   dynstr_init(d);
-  for(i = 0; i < nw32; ++i) {
+  for(i = 0; i < nw; ++i) {
     if(i)
       dynstr_append(d, ' ');
-    dynstr_append_string(d, utf32_to_utf8(w32[i], utf32_len(w32[i]), 0));
+    dynstr_append_string(d, w[i]);
   }
   dynstr_terminate(d);
   return d->vec;
@@ -1020,12 +1044,17 @@ static char **track_to_words(const char *track,
  * @return Non-zero if @p word is a stopword
  */
 static int stopword(const char *word) {
+  static hash *stopwords;
   int n;
 
-  for(n = 0; n < config->stopword.n
-        && strcmp(word, config->stopword.s[n]); ++n)
-    ;
-  return n < config->stopword.n;
+  /* Stopwords can't be changed without a restart, so we only need to build
+   * the table once */
+  if(!stopwords) {
+    stopwords = hash_new(1);
+    for(n = 0; n < config->stopword.n; ++n)
+      hash_add(stopwords, config->stopword.s[n], "", HASH_INSERT_OR_REPLACE);
+  }
+  return hash_find(stopwords, word) != 0;
 }
 
 /** @brief Register a search term
@@ -1611,16 +1640,26 @@ struct stats_details {
  * process has terminated and the output is complete.
  */
 static void stats_complete(struct stats_details *d) {
+  struct cache_stats cs;
   char *s;
 
   if(!(d->exited && d->closed))
     return;
+  cache_stats(&cache_files_type, &cs);
   byte_xasprintf(&s, "\n"
                  "Server stats:\n"
                  "track lookup cache hits: %lu\n"
-                 "track lookup cache misses: %lu\n",
+                 "track lookup cache misses: %lu\n"
+                 "track lookup cache entries: %lu\n"
+                 "track lookup cache bytes: %lu\n"
+                 "track lookup cache expiries: %lu\n"
+                 "track lookup cache evictions: %lu\n",
                  cache_files_hits,
-                 cache_files_misses);
+                 cache_files_misses,
+                 (unsigned long)cs.count,
+                 (unsigned long)cs.bytes,
+                 cs.expiries,
+                 cs.evictions);
   dynstr_append_string(d->data, s);
   dynstr_terminate(d->data);
   d->done(d->data->vec, d->u);
@@ -1879,6 +1918,9 @@ fail:
     trackdb_abort_transaction(tid);
   }
   trackdb_commit_transaction(tid);
+  /* Tell clients so they can discard any cached names for this track */
+  if(!err && name[0] != '_')
+    eventlog("track_changed", track, name, (char *)0);
   return err == 0 ? 0 : -1;
 }
 
@@ -2152,9 +2194,13 @@ static const char *getpart(const char *track,
                            const struct kvp *p,
                            int *used_db) {
   const char *result;
-  char *pref;
+  char buffer[128], *pref = buffer;
 
-  byte_xasprintf(&pref, "trackname_%s_%s", context, part);
+  /* This is called for every part of every track during a rescan, so avoid
+   * allocating the preference name unless it is unusually long */
+  if((size_t)snprintf(buffer, sizeof buffer, "trackname_%s_%s",
+                      context, part) >= sizeof buffer)
+    byte_xasprintf(&pref, "trackname_%s_%s", context, part);
   if((result = kvp_get(p, pref)))
     *used_db = 1;
   else
@@ -2263,11 +2309,15 @@ static int track_matches(size_t dl, const char *track, size_t tl,
  * @param dir Directory to list
  * @param what Bitmap of objects to return
  * @param re Regexp to filter matches (or NULL to accept all)
+ * @param a Arena for temporary allocations
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Candidates that are not returned are only ever allocated from @p a.
  */
 static int do_list(struct vector *v, const char *dir,
-                   enum trackdb_listable what, const regexp *re, DB_TXN *tid) {
+                   enum trackdb_listable what, const regexp *re,
+                   struct arena *a, DB_TXN *tid) {
   DBC *cursor;
   DBT k, d;
   size_t dl;
@@ -2275,7 +2325,6 @@ static int do_list(struct vector *v, const char *dir,
   int err;
   size_t l, last_dir_len = 0;
   char *last_dir = 0, *track;
-  struct kvp *p;
 
   dl = strlen(dir);
   cursor = trackdb_opencursor(trackdb_tracksdb, tid);
@@ -2296,17 +2345,14 @@ static int do_list(struct vector *v, const char *dir,
 	if(!(last_dir
 	     && l == last_dir_len
 	     && !memcmp(last_dir, k.data, l))) {
-	  last_dir = xstrndup(k.data, last_dir_len = l);
+	  last_dir = arena_strndup(a, k.data, last_dir_len = l);
 	  if(track_matches(dl, k.data, l, re))
-	    vector_append(v, last_dir);
+	    vector_append(v, xstrdup(last_dir));
 	}
     } else {
       /* found a plain file */
       if((what & trackdb_files)) {
-	track = xstrndup(k.data, k.size);
-        if((err = trackdb_getdata(trackdb_prefsdb,
-                                  track, &p, tid)) == DB_LOCK_DEADLOCK)
-          goto deadlocked;
+	track = arena_strndup(a, k.data, k.size);
         /* There's an awkward question here...
          *
          * If a track shares a directory with its alias then we could
@@ -2320,18 +2366,22 @@ static int do_list(struct vector *v, const char *dir,
 #if 1
         /* If this file is an alias for a track in the same directory then we
          * skip it */
-        struct kvp *t = kvp_urldecode(d.data, d.size);
+        struct kvp *t = kvp_urldecode_arena(a, d.data, d.size);
         const char *alias_target = kvp_get(t, "_alias_for");
         if(!(alias_target
              && !strcmp(d_dirname(alias_target),
                         d_dirname(track))))
 	  if(track_matches(dl, k.data, k.size, re))
-	    vector_append(v, track);
+	    vector_append(v, xstrdup(track));
 #else
 	/* if this file has an alias in the same directory then we skip it */
-           char *alias;
+        struct kvp *p;
+        char *alias;
+        if((err = trackdb_getdata(trackdb_prefsdb,
+                                  track, &p, tid)) == DB_LOCK_DEADLOCK)
+          break;
         if((err = compute_alias(&alias, track, p, tid)))
-          goto deadlocked;
+          break;
         if(!(alias && !strcmp(d_dirname(alias), d_dirname(track))))
 	  if(track_matches(dl, k.data, k.size, re))
 	    vector_append(v, track);
@@ -2352,7 +2402,6 @@ static int do_list(struct vector *v, const char *dir,
   default:
     disorder_fatal(0, "error querying database: %s", db_strerror(err));
   }
-deadlocked:
   if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
   return err;
 }
@@ -2369,24 +2418,27 @@ char **trackdb_list(const char *dir, int *np, enum trackdb_listable what,
   DB_TXN *tid;
   int n;
   struct vector v;
+  struct arena *a = arena_new();
 
   vector_init(&v);
   for(;;) {
     tid = trackdb_begin_transaction();
     v.nvec = 0;
     if(dir) {
-      if(do_list(&v, dir, what, re, tid))
+      if(do_list(&v, dir, what, re, a, tid))
         goto fail;
     } else {
       for(n = 0; n < config->collection.n; ++n)
-        if(do_list(&v, config->collection.s[n].root, what, re, tid))
+        if(do_list(&v, config->collection.s[n].root, what, re, a, tid))
           goto fail;
     }
     break;
 fail:
     trackdb_abort_transaction(tid);
+    arena_release(a);
   }
   trackdb_commit_transaction(tid);
+  arena_release(a);
   vector_terminate(&v);
   if(np)
     *np = v.nvec;
@@ -2421,6 +2473,7 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
   int ntags = 0;
   DB *db;
   const char *dbname;
+  struct arena *a;
 
   *ntracks = 0;				/* for early returns */
   /* normalize all the words */
@@ -2440,7 +2493,7 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
       /* Normalize the search term by removing combining characters */
       if(!(w32 = utf8_to_utf32(w[n], strlen(w[n]), &nw32)))
         return 0;
-      nw32 = remove_combining_chars(w32, nw32);
+      nw32 = utf32_remove_combining(w32, nw32);
       if(!(w[n] = utf32_to_utf8(w32, nw32, 0)))
         return 0;
       istag[n] = 0;
@@ -2470,6 +2523,8 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
   }
   vector_init(&u);
   vector_init(&v);
+  /* Candidates that don't match are only allocated from this */
+  a = arena_new();
   for(;;) {
     tid = trackdb_begin_transaction();
     /* find all the tracks that have that word */
@@ -2479,7 +2534,7 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
     v.nvec = 0;
     cursor = trackdb_opencursor(db, tid);
     while(!(err = cursor->c_get(cursor, &k, &d, what))) {
-      vector_append(&v, xstrndup(d.data, d.size));
+      vector_append(&v, arena_strndup(a, d.data, d.size));
       what = DB_NEXT_DUP;
     }
     switch(err) {
@@ -2526,16 +2581,18 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
         }
       }
       if(i >= nwordlist)                /* all words found */
-        vector_append(&u, v.vec[n]);
+        vector_append(&u, xstrdup(v.vec[n]));
     }
     break;
   fail:
     trackdb_closecursor(cursor);
     cursor = 0;
     trackdb_abort_transaction(tid);
+    arena_release(a);
     disorder_info("retrying search");
   }
   trackdb_commit_transaction(tid);
+  arena_release(a);
   vector_terminate(&u);
   if(ntracks)
     *ntracks = u.nvec;
@@ -2554,6 +2611,10 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
  * Visits every track and calls @p callback.  @p callback will get the track
  * data and preferences and should return 0 to continue scanning or EINTR to
  * stop.
+ *
+ * The track name may be kept but the data and preferences only last until
+ * @p callback returns: they are decoded into an arena that is released after
+ * each track.
  */
 int trackdb_scan(const char *root,
                  int (*callback)(const char *track,
@@ -2569,6 +2630,7 @@ int trackdb_scan(const char *root,
   int err, cberr;
   struct kvp *data, *prefs;
   const char *track;
+  struct arena *a = arena_new();
 
   cursor = trackdb_opencursor(trackdb_tracksdb, tid);
   if(root)
@@ -2584,7 +2646,8 @@ int trackdb_scan(const char *root,
        || (k.size > root_len
            && !strncmp(k.data, root, root_len)
            && ((char *)k.data)[root_len] == '/')) {
-      data = kvp_urldecode(d.data, d.size);
+      arena_release(a);
+      data = kvp_urldecode_arena(a, d.data, d.size);
       if(kvp_get(data, "_path")) {
         track = xstrndup(k.data, k.size);
         /* TODO: trackdb_prefsdb is currently a DB_HASH.  This means we have to
@@ -2598,7 +2661,7 @@ int trackdb_scan(const char *root,
         switch(err = trackdb_prefsdb->get(trackdb_prefsdb, tid, &k,
                                           prepare_data(&pd), 0)) {
         case 0:
-          prefs = kvp_urldecode(pd.data, pd.size);
+          prefs = kvp_urldecode_arena(a, pd.data, pd.size);
           break;
         case DB_NOTFOUND:
           prefs = 0;
@@ -2606,6 +2669,7 @@ int trackdb_scan(const char *root,
         case DB_LOCK_DEADLOCK:
           disorder_error(0, "getting prefs: %s", db_strerror(err));
           trackdb_closecursor(cursor);
+          arena_release(a);
           return err;
         default:
           disorder_fatal(0, "getting prefs: %s", db_strerror(err));
@@ -2623,6 +2687,7 @@ int trackdb_scan(const char *root,
       break;
   }
   trackdb_closecursor(cursor);
+  arena_release(a);
   switch(err) {
   case EINTR:
     return err;
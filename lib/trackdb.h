@@ -29,6 +29,23 @@ extern const struct cache_type cache_files_type;
 extern unsigned long cache_files_hits, cache_files_misses;
 /* Cache entry type and tracking for regexp-based lookups */
 
+/** @brief Database transaction statistics */
+struct trackdb_transaction_stats {
+  /** @brief Number of transactions started */
+  unsigned long begun;
+
+  /** @brief Number of transactions committed */
+  unsigned long committed;
+
+  /** @brief Number of transactions aborted */
+  unsigned long aborted;
+
+  /** @brief Total time with a transaction open (seconds) */
+  double seconds;
+};
+
+void trackdb_transaction_stats(struct trackdb_transaction_stats *stats);
+
 /** @brief Do not attempt database recovery (trackdb_init()) */
 #define TRACKDB_NO_RECOVER 0x0000
 
@@ -72,11 +72,19 @@ struct tracksort_data {
   const char *sort;
   /** @brief Display key */
   const char *display;
+  /** @brief Case-folded sort key */
+  const char *sort_folded;
+  /** @brief Case-folded display key */
+  const char *display_folded;
 };
 
 struct tracksort_data *tracksort_init(int nvec,
                                       char **vec,
                                       const char *type);
+void tracksort_prepare(struct tracksort_data *td,
+                       const char *track,
+                       const char *type);
+void tracksort_sort(struct tracksort_data *td, int ntracks);
 
 #endif /* TRACKNAME_H */
 
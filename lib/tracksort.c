@@ -22,14 +22,52 @@
 
 #include "trackname.h"
 #include "mem.h"
+#include "unicode.h"
 
-/** @brief Compare two @ref entry objects */
+/** @brief Compare two @ref tracksort_data objects
+ *
+ * This gives the same order as compare_tracks() but uses the case-folded keys
+ * computed by tracksort_prepare(), rather than folding them again for every
+ * comparison.
+ */
 static int tracksort_compare(const void *a, const void *b) {
   const struct tracksort_data *ea = a, *eb = b;
+  int c;
+
+  if((c = strcmp(ea->sort_folded, eb->sort_folded))) return c;
+  if((c = strcmp(ea->sort, eb->sort))) return c;
+  if((c = strcmp(ea->display_folded, eb->display_folded))) return c;
+  if((c = strcmp(ea->display, eb->display))) return c;
+  return compare_path(ea->track, eb->track);
+}
+
+/** @brief Fill in one entry of a track list
+ * @param td Entry to fill in
+ * @param track Track name
+ * @param type Comparison type
+ *
+ * This computes the sort key and display string and their case-folded
+ * forms, which is most of the work of sorting.  tracksort_init() calls it for
+ * every track; callers that want to spread the work out can call it
+ * themselves and then call tracksort_sort().
+ */
+void tracksort_prepare(struct tracksort_data *td,
+                       const char *track,
+                       const char *type) {
+  td->track = track;
+  td->sort = trackname_transform(type, track, "sort");
+  td->display = trackname_transform(type, track, "display");
+  td->sort_folded = utf8_casefold_canon(td->sort, strlen(td->sort), 0);
+  td->display_folded = utf8_casefold_canon(td->display, strlen(td->display),
+                                           0);
+}
 
-  return compare_tracks(ea->sort, eb->sort,
-			ea->display, eb->display,
-			ea->track, eb->track);
+/** @brief Sort a prepared track list
+ * @param td Track data, each filled in by tracksort_prepare()
+ * @param ntracks Number of tracks
+ */
+void tracksort_sort(struct tracksort_data *td, int ntracks) {
+  qsort(td, ntracks, sizeof *td, tracksort_compare);
 }
 
 /** @brief Sort tracks
@@ -46,12 +84,9 @@ struct tracksort_data *tracksort_init(int ntracks,
                                       char **tracks,
                                       const char *type) {
   struct tracksort_data *td = xcalloc(ntracks, sizeof *td);
-  for(int n = 0; n < ntracks; ++n) {
-    td[n].track = tracks[n];
-    td[n].sort = trackname_transform(type, tracks[n], "sort");
-    td[n].display = trackname_transform(type, tracks[n], "display");
-  }
-  qsort(td, ntracks, sizeof *td, tracksort_compare);
+  for(int n = 0; n < ntracks; ++n)
+    tracksort_prepare(&td[n], tracks[n], type);
+  tracksort_sort(td, ntracks);
   return td;
 }
 
@@ -16,25 +16,91 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 /** @file lib/uaudio-alsa.c
- * @brief Support for ALSA backend */
+ * @brief Support for ALSA backend
+ *
+ * There are two ways of getting audio to the device.
+ *
+ * By default we use uaudio_thread_start(), and alsa_play() writes each chunk
+ * with snd_pcm_writei().  This works with any device but the audio passes
+ * through both uaudio-thread.c's buffers and the device's.
+ *
+ * If the @c alsa-mmap option is set then instead alsa_mmap_thread() asks the
+ * callback to write straight into the device's buffer a period at a time,
+ * waking up when the device has room.  With small periods and buffers (see
+ * the @c alsa-period and @c alsa-buffer options) this keeps the amount of
+ * audio in flight to a few milliseconds.
+ *
+ * Either way, alsa_flush() discards everything buffered, so that pauses and
+ * scratches take effect at once.
+ */
 #include "common.h"
 
 #if HAVE_ALSA_ASOUNDLIB_H
 
 #include <alsa/asoundlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "mem.h"
 #include "log.h"
 #include "uaudio.h"
 #include "configuration.h"
+#include "syscalls.h"
 
 /** @brief The current PCM handle */
 static snd_pcm_t *alsa_pcm;
 
+/** @brief Period size in frames */
+static snd_pcm_uframes_t alsa_period_size;
+
+/** @brief Buffer size in frames */
+static snd_pcm_uframes_t alsa_buffer_size;
+
+/** @brief Set when using mmap transfer */
+static int alsa_mmap;
+
+/** @brief Callback used with mmap transfer */
+static uaudio_callback *alsa_mmap_callback;
+
+/** @brief Passed to @ref alsa_mmap_callback */
+static void *alsa_mmap_userdata;
+
+/** @brief mmap transfer thread ID */
+static pthread_t alsa_mmap_thread_id;
+
+/** @brief Lock protecting mmap transfer state */
+static pthread_mutex_t alsa_mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Condition variable signalled when mmap transfer state changes */
+static pthread_cond_t alsa_mmap_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Set while the mmap transfer thread should keep running */
+static int alsa_mmap_started;
+
+/** @brief Set while the mmap transfer thread should play */
+static int alsa_mmap_activated;
+
+/** @brief Set while the mmap transfer thread is playing */
+static int alsa_mmap_playing;
+
+/** @brief Pipe used to wake the mmap transfer thread */
+static int alsa_mmap_wake[2] = { -1, -1 };
+
+/** @brief Set if the device supports snd_pcm_pause() */
+static int alsa_can_pause;
+
+/** @brief Set while the device is paused by alsa_deactivate() */
+static int alsa_mmap_paused;
+
 static const char *const alsa_options[] = {
   "device",
   "mixer-control",
   "mixer-channel",
+  "alsa-mmap",
+  "alsa-period",
+  "alsa-buffer",
   NULL
 };
 
@@ -111,7 +177,9 @@ static void alsa_open(void) {
   if((err = snd_pcm_hw_params_any(alsa_pcm, hwparams)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_any: %d", err);
   if((err = snd_pcm_hw_params_set_access(alsa_pcm, hwparams,
-                                         SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+                                         alsa_mmap
+                                         ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+                                         : SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_set_access: %d", err);
   int sample_format;
   if(uaudio_bits == 16)
@@ -130,41 +198,314 @@ static void alsa_open(void) {
                                            uaudio_channels)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_set_channels (%d): %d",
           uaudio_channels, err);
+  /* The period has to be set before the buffer, since the buffer must hold
+   * at least two periods */
+  alsa_period_size = atol(uaudio_get("alsa-period", "0"));
+  if(alsa_period_size
+     && (err = snd_pcm_hw_params_set_period_size_near(alsa_pcm, hwparams,
+                                                      &alsa_period_size,
+                                                      0)) < 0)
+    disorder_fatal(0, "error from snd_pcm_hw_params_set_period_size_near"
+                   " (%lu): %d", (unsigned long)alsa_period_size, err);
+  alsa_buffer_size = atol(uaudio_get("alsa-buffer", "0"));
+  if(alsa_buffer_size
+     && (err = snd_pcm_hw_params_set_buffer_size_near(alsa_pcm, hwparams,
+                                                      &alsa_buffer_size)) < 0)
+    disorder_fatal(0, "error from snd_pcm_hw_params_set_buffer_size_near"
+                   " (%lu): %d", (unsigned long)alsa_buffer_size, err);
   if((err = snd_pcm_hw_params(alsa_pcm, hwparams)) < 0)
     disorder_fatal(0, "error calling snd_pcm_hw_params: %d", err);
+  alsa_can_pause = snd_pcm_hw_params_can_pause(hwparams);
+  if((err = snd_pcm_hw_params_get_period_size(hwparams, &alsa_period_size,
+                                              0)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_hw_params_get_period_size: %d",
+                   err);
+  if((err = snd_pcm_hw_params_get_buffer_size(hwparams,
+                                              &alsa_buffer_size)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_hw_params_get_buffer_size: %d",
+                   err);
+  disorder_info("ALSA period %lu frames, buffer %lu frames%s",
+                (unsigned long)alsa_period_size,
+                (unsigned long)alsa_buffer_size,
+                alsa_mmap ? ", using mmap" : "");
   /* Software parameters */
   snd_pcm_sw_params_t *swparams;
   snd_pcm_sw_params_alloca(&swparams);
   if((err = snd_pcm_sw_params_current(alsa_pcm, swparams)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params_current");
-  /* Bump the start threshold a bit since Pulseaudio sulks with the defaults */
-  if((err = snd_pcm_sw_params_set_start_threshold(alsa_pcm, swparams, 1024)) < 0)
+  /* Bump the start threshold a bit since Pulseaudio sulks with the defaults.
+   * With mmap transfer we always fill the whole buffer before starting
+   * anyway.  A threshold bigger than the buffer would stop the device ever
+   * starting. */
+  snd_pcm_uframes_t threshold = alsa_mmap ? alsa_buffer_size : 1024;
+  if(threshold > alsa_buffer_size)
+    threshold = alsa_buffer_size;
+  if((err = snd_pcm_sw_params_set_start_threshold(alsa_pcm, swparams,
+                                                  threshold)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params_set_start_threshold");
+  /* Wake up when there's at least a period of space */
+  if((err = snd_pcm_sw_params_set_avail_min(alsa_pcm, swparams,
+                                            alsa_period_size)) < 0)
+    disorder_fatal(-err, "error calling snd_pcm_sw_params_set_avail_min");
   if((err = snd_pcm_sw_params(alsa_pcm, swparams)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params");
 }
 
+/** @brief Recover from an error during mmap transfer
+ * @param err Error code
+ * @param what Function that failed
+ */
+static void alsa_mmap_recover(int err, const char *what) {
+  if((err = snd_pcm_recover(alsa_pcm, err, 0)) < 0)
+    disorder_fatal(0, "error calling %s: %s", what, snd_strerror(err));
+}
+
+/** @brief Wait until the device has room for a period, or we're woken
+ *
+ * Called without @ref alsa_mmap_lock held.
+ */
+static void alsa_mmap_wait(void) {
+  const int n = snd_pcm_poll_descriptors_count(alsa_pcm);
+  struct pollfd fds[n > 0 ? n + 1 : 1];
+  unsigned short revents;
+  char discard[64];
+  int err;
+
+  if(n <= 0)
+    disorder_fatal(0, "error calling snd_pcm_poll_descriptors_count: %d", n);
+  fds[0].fd = alsa_mmap_wake[0];
+  fds[0].events = POLLIN;
+  if((err = snd_pcm_poll_descriptors(alsa_pcm, fds + 1, n)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_poll_descriptors: %s",
+                   snd_strerror(err));
+  if(poll(fds, n + 1, -1) < 0) {
+    if(errno == EINTR)
+      return;
+    disorder_fatal(errno, "error calling poll");
+  }
+  if(fds[0].revents & POLLIN)
+    while(read(alsa_mmap_wake[0], discard, sizeof discard) > 0)
+      ;
+  if((err = snd_pcm_poll_descriptors_revents(alsa_pcm, fds + 1, n,
+                                             &revents)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_poll_descriptors_revents: %s",
+                   snd_strerror(err));
+  if(revents & POLLERR)
+    alsa_mmap_recover(snd_pcm_state(alsa_pcm) == SND_PCM_STATE_SUSPENDED
+                      ? -ESTRPIPE : -EPIPE,
+                      "poll");
+}
+
+/** @brief Fill whatever space there is in the device's buffer
+ *
+ * Called without @ref alsa_mmap_lock held.
+ */
+static void alsa_mmap_fill(void) {
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t offset, frames;
+  snd_pcm_sframes_t avail, committed;
+  size_t samples, got;
+  char *ptr;
+  int err;
+
+  if((avail = snd_pcm_avail_update(alsa_pcm)) < 0) {
+    alsa_mmap_recover(avail, "snd_pcm_avail_update");
+    return;
+  }
+  if((snd_pcm_uframes_t)avail < alsa_period_size) {
+    alsa_mmap_wait();
+    return;
+  }
+  while(avail > 0) {
+    frames = avail;
+    if((err = snd_pcm_mmap_begin(alsa_pcm, &areas, &offset, &frames)) < 0) {
+      alsa_mmap_recover(err, "snd_pcm_mmap_begin");
+      return;
+    }
+    /* With interleaved access all channels share one area */
+    ptr = (char *)areas[0].addr + (areas[0].first
+                                   + offset * areas[0].step) / 8;
+    samples = frames * uaudio_channels;
+    for(got = 0; got < samples;)
+      got += alsa_mmap_callback(ptr + got * uaudio_sample_size,
+                                samples - got,
+                                alsa_mmap_userdata);
+    committed = snd_pcm_mmap_commit(alsa_pcm, offset, frames);
+    if(committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+      alsa_mmap_recover(committed < 0 ? committed : -EPIPE,
+                        "snd_pcm_mmap_commit");
+      return;
+    }
+    avail -= frames;
+  }
+}
+
+/** @brief Background thread for mmap transfer
+ *
+ * While activated, keeps the device's buffer full from the callback.  On
+ * deactivation it stops filling the buffer; alsa_deactivate() waits for that
+ * to happen and then stops the device.
+ */
+static void *alsa_mmap_thread(void attribute((unused)) *arg) {
+  pthread_mutex_lock(&alsa_mmap_lock);
+  while(alsa_mmap_started) {
+    if(!alsa_mmap_activated) {
+      if(alsa_mmap_playing) {
+        alsa_mmap_playing = 0;
+        pthread_cond_broadcast(&alsa_mmap_cond);
+      }
+      pthread_cond_wait(&alsa_mmap_cond, &alsa_mmap_lock);
+      continue;
+    }
+    alsa_mmap_playing = 1;
+    pthread_mutex_unlock(&alsa_mmap_lock);
+    alsa_mmap_fill();
+    pthread_mutex_lock(&alsa_mmap_lock);
+  }
+  pthread_mutex_unlock(&alsa_mmap_lock);
+  return NULL;
+}
+
+/** @brief Wake up the mmap transfer thread
+ *
+ * Called with @ref alsa_mmap_lock held.
+ */
+static void alsa_mmap_poke(void) {
+  pthread_cond_broadcast(&alsa_mmap_cond);
+  if(write(alsa_mmap_wake[1], "", 1) < 0 && errno != EAGAIN)
+    disorder_error(errno, "error writing to wakeup pipe");
+}
+
 static void alsa_start(uaudio_callback *callback,
                        void *userdata) {
+  int e;
+
   if(uaudio_channels != 1 && uaudio_channels != 2)
     disorder_fatal(0, "asked for %d channels but only support 1 or 2",
           uaudio_channels); 
   if(uaudio_bits != 8 && uaudio_bits != 16)
     disorder_fatal(0, "asked for %d bits/channel but only support 8 or 16",
           uaudio_bits); 
+  alsa_mmap = !strcmp(uaudio_get("alsa-mmap", "no"), "yes");
   alsa_open();
-  uaudio_thread_start(callback, userdata, alsa_play,
-                      32 / uaudio_sample_size,
-                      4096 / uaudio_sample_size,
-                      0);
+  if(alsa_mmap) {
+    alsa_mmap_callback = callback;
+    alsa_mmap_userdata = userdata;
+    alsa_mmap_started = 1;
+    alsa_mmap_activated = 0;
+    alsa_mmap_playing = 0;
+    xpipe(alsa_mmap_wake);
+    nonblock(alsa_mmap_wake[0]);
+    nonblock(alsa_mmap_wake[1]);
+    cloexec(alsa_mmap_wake[0]);
+    cloexec(alsa_mmap_wake[1]);
+    if((e = pthread_create(&alsa_mmap_thread_id, NULL, alsa_mmap_thread,
+                           NULL)))
+      disorder_fatal(e, "pthread_create");
+  } else
+    uaudio_thread_start(callback, userdata, alsa_play,
+                        32 / uaudio_sample_size,
+                        4096 / uaudio_sample_size,
+                        0);
 }
 
 static void alsa_stop(void) {
-  uaudio_thread_stop();
+  void *result;
+
+  if(alsa_mmap) {
+    pthread_mutex_lock(&alsa_mmap_lock);
+    alsa_mmap_started = 0;
+    alsa_mmap_activated = 0;
+    alsa_mmap_poke();
+    pthread_mutex_unlock(&alsa_mmap_lock);
+    pthread_join(alsa_mmap_thread_id, &result);
+    xclose(alsa_mmap_wake[0]);
+    xclose(alsa_mmap_wake[1]);
+    alsa_mmap_wake[0] = alsa_mmap_wake[1] = -1;
+  } else
+    uaudio_thread_stop();
   snd_pcm_close(alsa_pcm);
   alsa_pcm = 0;
 }
 
+static void alsa_activate(void) {
+  int err;
+
+  if(alsa_mmap) {
+    pthread_mutex_lock(&alsa_mmap_lock);
+    /* Restart the device where alsa_deactivate() stopped it */
+    if(alsa_mmap_paused) {
+      alsa_mmap_paused = 0;
+      if((err = snd_pcm_pause(alsa_pcm, 0)) < 0) {
+        disorder_error(0, "error calling snd_pcm_pause: %s",
+                       snd_strerror(err));
+        snd_pcm_drop(alsa_pcm);
+      }
+    }
+    if(snd_pcm_state(alsa_pcm) == SND_PCM_STATE_SETUP
+       && (err = snd_pcm_prepare(alsa_pcm)) < 0)
+      disorder_fatal(0, "error calling snd_pcm_prepare: %s",
+                     snd_strerror(err));
+    alsa_mmap_activated = 1;
+    alsa_mmap_poke();
+    pthread_mutex_unlock(&alsa_mmap_lock);
+  } else
+    uaudio_thread_activate();
+}
+
+static void alsa_deactivate(void) {
+  int err;
+
+  if(alsa_mmap) {
+    pthread_mutex_lock(&alsa_mmap_lock);
+    alsa_mmap_activated = 0;
+    alsa_mmap_poke();
+    while(alsa_mmap_playing)
+      pthread_cond_wait(&alsa_mmap_cond, &alsa_mmap_lock);
+    /* Nothing is refilling the device's buffer now, so if it were left
+     * running it would underrun.  Pause it if possible, so that whatever is
+     * buffered plays on activation; otherwise discard it. */
+    if(snd_pcm_state(alsa_pcm) == SND_PCM_STATE_RUNNING) {
+      if(alsa_can_pause && !snd_pcm_pause(alsa_pcm, 1))
+        alsa_mmap_paused = 1;
+      else if((err = snd_pcm_drop(alsa_pcm)) < 0)
+        disorder_error(0, "error calling snd_pcm_drop: %s",
+                       snd_strerror(err));
+    }
+    pthread_mutex_unlock(&alsa_mmap_lock);
+  } else
+    uaudio_thread_deactivate();
+}
+
+/** @brief Discard buffered audio
+ * @return Number of samples discarded
+ *
+ * Only called while deactivated, so neither alsa_play() nor the mmap transfer
+ * thread is using the device.
+ */
+static size_t alsa_flush(void) {
+  snd_pcm_sframes_t delay;
+  size_t discarded = 0;
+  int err;
+
+  if(alsa_mmap)
+    pthread_mutex_lock(&alsa_mmap_lock);
+  else
+    discarded = uaudio_thread_flush();
+  /* The device's buffer holds older samples than uaudio-thread.c's, so the
+   * two can just be added together. */
+  if(snd_pcm_delay(alsa_pcm, &delay) == 0 && delay > 0)
+    discarded += delay * uaudio_channels;
+  if((err = snd_pcm_drop(alsa_pcm)) < 0)
+    disorder_error(0, "error calling snd_pcm_drop: %s", snd_strerror(err));
+  if((err = snd_pcm_prepare(alsa_pcm)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_prepare: %s", snd_strerror(err));
+  alsa_mmap_paused = 0;
+  if(alsa_mmap)
+    pthread_mutex_unlock(&alsa_mmap_lock);
+  return discarded;
+}
+
 /** @brief Convert a level to a percentage */
 static int to_percent(long n) {
   return (n - alsa_mixer_min) * 100 / (alsa_mixer_max - alsa_mixer_min);
@@ -272,9 +613,16 @@ static void alsa_set_volume(int *left, int *right) {
 }
 
 static void alsa_configure(void) {
+  char buffer[64];
+
   uaudio_set("device", config->device);
   uaudio_set("mixer-control", config->mixer);
   uaudio_set("mixer-channel", config->channel);
+  uaudio_set("alsa-mmap", config->alsa_mmap ? "yes" : "no");
+  snprintf(buffer, sizeof buffer, "%ld", config->alsa_period);
+  uaudio_set("alsa-period", buffer);
+  snprintf(buffer, sizeof buffer, "%ld", config->alsa_buffer);
+  uaudio_set("alsa-buffer", buffer);
 }
 
 const struct uaudio uaudio_alsa = {
@@ -282,8 +630,9 @@ const struct uaudio uaudio_alsa = {
   .options = alsa_options,
   .start = alsa_start,
   .stop = alsa_stop,
-  .activate = uaudio_thread_activate,
-  .deactivate = uaudio_thread_deactivate,
+  .activate = alsa_activate,
+  .deactivate = alsa_deactivate,
+  .flush = alsa_flush,
   .open_mixer = alsa_open_mixer,
   .close_mixer = alsa_close_mixer,
   .get_volume = alsa_get_volume,
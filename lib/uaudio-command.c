@@ -162,6 +162,7 @@ const struct uaudio uaudio_command = {
   .stop = command_stop,
   .activate = uaudio_thread_activate,
   .deactivate = uaudio_thread_deactivate,
+  .flush = uaudio_thread_flush,
   .configure = command_configure,
   .flags = UAUDIO_API_CLIENT | UAUDIO_API_SERVER,
 };
@@ -227,6 +227,7 @@ const struct uaudio uaudio_oss = {
   .stop = oss_stop,
   .activate = uaudio_thread_activate,
   .deactivate = uaudio_thread_deactivate,
+  .flush = uaudio_thread_flush,
   .open_mixer = oss_open_mixer,
   .close_mixer = oss_close_mixer,
   .get_volume = oss_get_volume,
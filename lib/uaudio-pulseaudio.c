@@ -92,6 +92,14 @@ static void cb_success(attribute((unused)) pa_context *xctx,
   sop->donep = 1; pa_threaded_mainloop_signal(loop, 0);
 }
 
+/** @brief Callback: wake up main loop when a stream operation completes. */
+static void cb_strsuccess(attribute((unused)) pa_stream *xstr,
+                          int winp, void *p) {
+  struct simpleop *sop = p;
+  if(!winp) disorder_fatal(0, "%s failed: %s", sop->what, PAERRSTR);
+  sop->donep = 1; pa_threaded_mainloop_signal(loop, 0);
+}
+
 /** @brief Open the PulseAudio sound device */
 static void pulseaudio_open() {
   /* Much of the following is cribbed from the PulseAudio `simple' source. */
@@ -193,6 +201,37 @@ static void pulseaudio_stop(void) {
   pulseaudio_close();
 }
 
+/** @brief Discard buffered audio
+ * @return Number of samples discarded
+ *
+ * Flushes our own buffers and then the stream's buffer on the server.  Audio
+ * that the server has already passed to the sink can't be recalled.
+ */
+static size_t pulseaudio_flush(void) {
+  const pa_timing_info *ti;
+  pa_operation *op;
+  struct simpleop sop;
+  size_t discarded = uaudio_thread_flush();
+
+  pa_threaded_mainloop_lock(loop);
+  /* Find out how much is waiting in the stream's buffer */
+  sop.what = "update pulseaudio timing info"; sop.donep = 0;
+  op = pa_stream_update_timing_info(str, cb_strsuccess, &sop);
+  while(!sop.donep) pa_threaded_mainloop_wait(loop);
+  pa_operation_unref(op);
+  ti = pa_stream_get_timing_info(str);
+  if(ti && !ti->write_index_corrupt && !ti->read_index_corrupt
+     && ti->write_index > ti->read_index)
+    discarded += (ti->write_index - ti->read_index) / uaudio_sample_size;
+  /* Throw it away */
+  sop.what = "flush pulseaudio stream"; sop.donep = 0;
+  op = pa_stream_flush(str, cb_strsuccess, &sop);
+  while(!sop.donep) pa_threaded_mainloop_wait(loop);
+  pa_operation_unref(op);
+  pa_threaded_mainloop_unlock(loop);
+  return discarded;
+}
+
 static void pulseaudio_open_mixer(void) {
   if(!str)
     disorder_fatal(0, "won't open pulseaudio mixer with no stream open");
@@ -289,6 +328,7 @@ const struct uaudio uaudio_pulseaudio = {
   .stop = pulseaudio_stop,
   .activate = uaudio_thread_activate,
   .deactivate = uaudio_thread_deactivate,
+  .flush = pulseaudio_flush,
   .open_mixer = pulseaudio_open_mixer,
   .close_mixer = pulseaudio_close_mixer,
   .get_volume = pulseaudio_get_volume,
@@ -30,6 +30,9 @@
 #include <time.h>
 #include <sys/uio.h>
 #include <pthread.h>
+#if HAVE_OPUS
+#include <opus.h>
+#endif
 
 #include "uaudio.h"
 #include "mem.h"
@@ -40,6 +43,9 @@
 #include "ifreq.h"
 #include "timeval.h"
 #include "configuration.h"
+#include "byte-order.h"
+#include "varispeed.h"
+#include "resample.h"
 
 /** @brief Bytes to send per network packet */
 static int rtp_max_payload;
@@ -65,6 +71,36 @@ static uint32_t rtp_base;
 /** @brief RTP sequence number */
 static uint16_t rtp_sequence;
 
+/** @brief Number of packets protected by each FEC packet, or 0 */
+static int rtp_fec;
+
+/** @brief FEC state
+ *
+ * Only used by the audio thread.  See @ref rtp_fec.
+ */
+static struct {
+  /** @brief Sequence number of first packet of group */
+  uint16_t seq;
+
+  /** @brief Number of packets in group so far */
+  int count;
+
+  /** @brief XOR of marker and payload type of each packet */
+  uint8_t mpt;
+
+  /** @brief XOR of timestamp of each packet */
+  uint32_t timestamp;
+
+  /** @brief XOR of payload length of each packet */
+  uint16_t length;
+
+  /** @brief XOR of payload of each packet */
+  uint8_t *parity;
+
+  /** @brief Bytes of @c parity in use */
+  size_t size;
+} rtp_fec_group;
+
 /** @brief Network error count
  *
  * If too many errors occur in too short a time, we give up.
@@ -84,11 +120,109 @@ static int rtp_mode;
 struct rtp_recipient {
   struct rtp_recipient *next;
   struct sockaddr_storage sa;
+
+  /** @brief Number of packets sent to this client */
+  unsigned long sent;
+
+  /** @brief Number of packets that could not be sent to this client */
+  unsigned long errors;
+
+  /** @brief @c errno value for the most recent error */
+  int last_error;
 };
 
 /** @brief List of unicast clients */
 static struct rtp_recipient *rtp_recipient_list;
 
+#if HAVE_SENDMMSG
+/** @brief One message for sendmmsg() */
+typedef struct mmsghdr rtp_message;
+#else
+/** @brief One message for the sendmsg() fallback */
+typedef struct {
+  struct msghdr msg_hdr;
+} rtp_message;
+#endif
+
+/** @brief Messages for the unicast clients of one address family
+ *
+ * Each packet is sent to all the clients in one sendmmsg() call, where
+ * available.
+ */
+struct rtp_batch {
+  /** @brief One message per client */
+  rtp_message *msgs;
+
+  /** @brief Client for each message */
+  struct rtp_recipient **recipients;
+
+  /** @brief Number of clients */
+  size_t n;
+
+  /** @brief Size of @c msgs and @c recipients */
+  size_t size;
+};
+
+/** @brief Unicast client messages for IPv4 (0) and IPv6 (1) */
+static struct rtp_batch rtp_batches[2];
+
+/** @brief Set when @ref rtp_batches must be rebuilt */
+static int rtp_batches_stale;
+
+/** @brief Packet contents
+ *
+ * All the messages in @ref rtp_batches refer to this.
+ */
+static struct iovec rtp_iov[2];
+
+#if HAVE_OPUS
+/** @brief Opus encoding state
+ *
+ * Only used by the audio thread.
+ */
+static struct {
+  /** @brief Encoder, or NULL if sending L16 */
+  OpusEncoder *encoder;
+
+#if HAVE_SAMPLERATE_H
+  /** @brief Converts input to @ref RTP_OPUS_RATE, if @c resampling is set */
+  struct resampler rs;
+
+  /** @brief Set if the input must be resampled */
+  int resampling;
+#endif
+
+  /** @brief Converts input to @ref RTP_OPUS_RATE without libsamplerate
+   *
+   * This is only meant for ratios near 1, but it is used for 44.1KHz input
+   * if libsamplerate isn't available.  Upsampling doesn't alias, and the
+   * interpolation images above 22.05KHz are mostly removed by the encoder's
+   * own band limit of 20KHz, so the result is acceptable. */
+  struct varispeed vs;
+
+  /** @brief Ratio of @ref RTP_OPUS_RATE to input rate */
+  double ratio;
+
+  /** @brief Samples waiting to be encoded */
+  int16_t pcm[RTP_OPUS_FRAME * 2];
+
+  /** @brief Number of frames in @c pcm */
+  size_t fill;
+
+  /** @brief Number of input frames so far, including while paused */
+  uint64_t frames;
+
+  /** @brief RTP timestamp of @c pcm[0] */
+  uint32_t timestamp;
+
+  /** @brief Set if @c timestamp must be recomputed from @c frames */
+  int resync;
+
+  /** @brief Set if the next packet should have the marker bit set */
+  int marker;
+} rtp_opus;
+#endif
+
 /** @brief Mutex protecting data structures */
 static pthread_mutex_t rtp_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -102,6 +236,9 @@ static const char *const rtp_options[] = {
   "rtp-mode",
   "rtp-max-payload",
   "rtp-mtu-discovery",
+  "rtp-payload",
+  "rtp-opus-bitrate",
+  "rtp-fec",
   NULL
 };
 
@@ -149,9 +286,335 @@ static void rtp_set_netconfig(const char *af,
   }
 }
 
+/** @brief Rebuild @ref rtp_batches from @ref rtp_recipient_list
+ *
+ * Must be called with @ref rtp_lock held.
+ */
+static void rtp_rebuild_batches(void) {
+  struct rtp_recipient *r;
+  struct rtp_batch *b;
+
+  rtp_batches[0].n = rtp_batches[1].n = 0;
+  for(r = rtp_recipient_list; r; r = r->next) {
+    b = &rtp_batches[r->sa.ss_family == AF_INET ? 0 : 1];
+    if(b->n >= b->size) {
+      b->size = b->size ? 2 * b->size : 16;
+      b->msgs = xrealloc(b->msgs, b->size * sizeof *b->msgs);
+      b->recipients = xrealloc(b->recipients,
+                               b->size * sizeof *b->recipients);
+    }
+    struct msghdr *const m = &b->msgs[b->n].msg_hdr;
+    memset(m, 0, sizeof *m);
+    m->msg_name = &r->sa;
+    m->msg_namelen = r->sa.ss_family == AF_INET ?
+      sizeof(struct sockaddr_in) : sizeof (struct sockaddr_in6);
+    m->msg_iov = rtp_iov;
+    m->msg_iovlen = 2;
+    b->recipients[b->n++] = r;
+  }
+  rtp_batches_stale = 0;
+}
+
+/** @brief Record a failure to send to a unicast client
+ * @param r Client
+ * @param errno_value Error code
+ *
+ * Errors are logged when they first happen, when they change, and then
+ * occasionally while they persist.
+ */
+static void rtp_recipient_error(struct rtp_recipient *r, int errno_value) {
+  ++r->errors;
+  if(errno_value != r->last_error || !(r->errors & 1023)) {
+    char *name = format_sockaddr((struct sockaddr *)&r->sa);
+    disorder_error(errno_value, "RTP: error transmitting to %s (%lu/%lu failed)",
+                   name, r->errors, r->errors + r->sent);
+    xfree(name);
+  }
+  r->last_error = errno_value;
+}
+
+/** @brief Send the current packet to a batch of unicast clients
+ * @param fd Socket to send on
+ * @param b Batch of clients
+ *
+ * Must be called with @ref rtp_lock held.  A client that can't be sent to
+ * doesn't stop the packet going to the rest.
+ */
+static void rtp_send_batch(int fd, struct rtp_batch *b) {
+  size_t done = 0;
+  int sent;
+
+  while(done < b->n) {
+#if HAVE_SENDMMSG
+    sent = sendmmsg(fd, b->msgs + done, b->n - done,
+                    MSG_DONTWAIT|MSG_NOSIGNAL);
+#else
+    sent = sendmsg(fd, &b->msgs[done].msg_hdr,
+                   MSG_DONTWAIT|MSG_NOSIGNAL) < 0 ? -1 : 1;
+#endif
+    if(sent < 0) {
+      if(errno == EINTR)
+        continue;
+      /* The first unsent message failed; skip it */
+      rtp_recipient_error(b->recipients[done++], errno);
+    } else
+      while(sent-- > 0)
+        ++b->recipients[done++]->sent;
+  }
+}
+
+/** @brief Send the packet in @ref rtp_iov to all destinations
+ * @return 0 on success, -1 on error
+ */
+static int rtp_transmit(void) {
+  /* Send stuff to explicitly registerd unicast addresses unconditionally */
+  pthread_mutex_lock(&rtp_lock);
+  if(rtp_batches_stale)
+    rtp_rebuild_batches();
+  rtp_send_batch(rtp_fd4, &rtp_batches[0]);
+  rtp_send_batch(rtp_fd6, &rtp_batches[1]);
+  pthread_mutex_unlock(&rtp_lock);
+  if(rtp_mode != RTP_REQUEST) {
+    int written_bytes;
+    do {
+      written_bytes = writev(rtp_fd, rtp_iov, 2);
+    } while(written_bytes < 0 && errno == EINTR);
+    if(written_bytes < 0) {
+      disorder_error(errno, "error transmitting audio data");
+      ++rtp_errors;
+      if(rtp_errors == 10)
+        disorder_fatal(0, "too many audio transmission errors");
+      return -1;
+    } else
+      rtp_errors /= 2;                    /* gradual decay */
+  }
+  /* TODO what can we sensibly do about short writes here?  Really that's just
+   * an error and we ought to be using smaller packets. */
+  return 0;
+}
+
+/** @brief Send an FEC packet for the current group */
+static void rtp_fec_send(void) {
+  struct attribute((packed)) {
+    struct rtp_header header;
+    struct rtp_extension extension;
+    struct rtp_fec fec;
+  } packet;
+
+  packet.header.vpxcc = (2 << 6) | 0x10; /* V=2, P=0, X=1, CC=0 */
+  packet.header.mpt = rtp_payload;
+  packet.header.seq = htons(rtp_fec_group.seq + rtp_fec_group.count - 1);
+  packet.header.timestamp = ((struct rtp_header *)rtp_iov[0].iov_base)->timestamp;
+  packet.header.ssrc = rtp_id;
+  packet.extension.type = htons(RTP_EXTENSION_FEC);
+  packet.extension.length = htons(sizeof packet.fec / 4);
+  packet.fec.seq = htons(rtp_fec_group.seq);
+  packet.fec.count = rtp_fec_group.count;
+  packet.fec.mpt = rtp_fec_group.mpt;
+  packet.fec.timestamp = rtp_fec_group.timestamp;
+  packet.fec.length = rtp_fec_group.length;
+  packet.fec.reserved = 0;
+  rtp_iov[0].iov_base = (void *)&packet;
+  rtp_iov[0].iov_len = sizeof packet;
+  rtp_iov[1].iov_base = rtp_fec_group.parity;
+  rtp_iov[1].iov_len = rtp_fec_group.size;
+  rtp_transmit();
+}
+
+/** @brief Add the packet in @ref rtp_iov to the current FEC group
+ *
+ * When the group is complete, its FEC packet is sent.  A gap in the sequence
+ * numbers (for instance while paused) starts a new group.
+ */
+static void rtp_fec_add(void) {
+  const struct rtp_header *header = rtp_iov[0].iov_base;
+  const uint8_t *payload = rtp_iov[1].iov_base;
+  const size_t length = rtp_iov[1].iov_len;
+  const uint16_t seq = ntohs(header->seq);
+  size_t n;
+
+  if(rtp_fec_group.count
+     && seq != (uint16_t)(rtp_fec_group.seq + rtp_fec_group.count))
+    rtp_fec_group.count = 0;
+  if(!rtp_fec_group.count) {
+    rtp_fec_group.seq = seq;
+    rtp_fec_group.mpt = 0;
+    rtp_fec_group.timestamp = 0;
+    rtp_fec_group.length = 0;
+    rtp_fec_group.size = 0;
+  }
+  rtp_fec_group.mpt ^= header->mpt;
+  rtp_fec_group.timestamp ^= header->timestamp;
+  rtp_fec_group.length ^= htons(length);
+  if(length > rtp_fec_group.size) {
+    memset(rtp_fec_group.parity + rtp_fec_group.size, 0,
+           length - rtp_fec_group.size);
+    rtp_fec_group.size = length;
+  }
+  for(n = 0; n < length; ++n)
+    rtp_fec_group.parity[n] ^= payload[n];
+  if(++rtp_fec_group.count == rtp_fec) {
+    rtp_fec_send();
+    rtp_fec_group.count = 0;
+  }
+}
+
+/** @brief Send the packet in @ref rtp_iov, and maybe an FEC packet
+ * @return 0 on success, -1 on error
+ *
+ * @ref rtp_iov is modified.
+ */
+static int rtp_send(void) {
+  if(rtp_transmit())
+    return -1;
+  if(rtp_fec)
+    rtp_fec_add();
+  return 0;
+}
+
+#if HAVE_OPUS
+/** @brief Encode and send the frame in @c rtp_opus.pcm */
+static void rtp_send_opus(void) {
+  struct rtp_header header;
+  unsigned char data[1500];
+  size_t max_data = rtp_max_payload - sizeof header;
+  opus_int32 nbytes;
+
+  if(max_data > sizeof data)
+    max_data = sizeof data;
+  nbytes = opus_encode(rtp_opus.encoder, rtp_opus.pcm, RTP_OPUS_FRAME,
+                       data, max_data);
+  if(nbytes < 0)
+    disorder_fatal(0, "error encoding Opus: %s", opus_strerror(nbytes));
+  header.vpxcc = 2 << 6;                /* V=2, P=0, X=0, CC=0 */
+  header.seq = htons(rtp_sequence++);
+  header.ssrc = rtp_id;
+  header.mpt = RTP_PAYLOAD_OPUS | (rtp_opus.marker ? 0x80 : 0);
+  header.timestamp = htonl(rtp_opus.timestamp);
+  rtp_iov[0].iov_base = (void *)&header;
+  rtp_iov[0].iov_len = sizeof header;
+  rtp_iov[1].iov_base = data;
+  rtp_iov[1].iov_len = nbytes;
+  rtp_send();
+  rtp_opus.marker = 0;
+  rtp_opus.timestamp += RTP_OPUS_FRAME;
+  rtp_opus.fill = 0;
+}
+
+#if HAVE_SAMPLERATE_H
+/** @brief Called with resampled audio
+ * @param bytes Native-endian 16-bit samples at @ref RTP_OPUS_RATE
+ * @param nbytes Number of bytes
+ * @param cd Not used
+ *
+ * Samples are added to @c rtp_opus.pcm, sending each frame as it fills.
+ */
+static void rtp_opus_converted(uint8_t *bytes, size_t nbytes,
+                               void attribute((unused)) *cd) {
+  const size_t bpf = uaudio_channels * sizeof (int16_t);
+  size_t nframes = nbytes / bpf, n;
+
+  while(nframes > 0) {
+    n = RTP_OPUS_FRAME - rtp_opus.fill;
+    if(n > nframes)
+      n = nframes;
+    memcpy(rtp_opus.pcm + rtp_opus.fill * uaudio_channels, bytes, n * bpf);
+    bytes += n * bpf;
+    nframes -= n;
+    rtp_opus.fill += n;
+    if(rtp_opus.fill == RTP_OPUS_FRAME)
+      rtp_send_opus();
+  }
+}
+#endif
+
+/** @brief Encode and send samples as Opus
+ * @param buffer Samples, in native byte order
+ * @param nsamples Number of samples
+ * @param flags Flags from uaudio_thread_start()
+ * @return Number of samples consumed
+ *
+ * Samples are converted to @ref RTP_OPUS_RATE and collected into frames of
+ * @ref RTP_OPUS_FRAME, each of which is encoded and sent as one packet.  While
+ * paused nothing is sent and any partial frame is discarded.
+ *
+ * 44.1KHz input is converted with libsamplerate if it is available, and by
+ * the rate adjuster otherwise.
+ */
+static size_t rtp_play_opus(void *buffer, size_t nsamples, unsigned flags) {
+  const int16_t *input = buffer;
+  size_t nframes = nsamples / uaudio_channels, ninput, produced;
+
+  if(flags & UAUDIO_RESUME)
+    rtp_opus.marker = 1;
+  uaudio_schedule_sync();
+  if(flags & UAUDIO_PAUSED) {
+    rtp_opus.frames += nframes;
+    rtp_opus.fill = 0;
+    rtp_opus.resync = 1;
+    uaudio_schedule_sent(nsamples);
+    return nsamples;
+  }
+  while(nframes > 0) {
+    if(rtp_opus.resync) {
+      /* Pick up the RTP clock from the input position, and forget the
+       * converter's history */
+#if HAVE_SAMPLERATE_H
+      if(rtp_opus.resampling) {
+        resample_close(&rtp_opus.rs);
+        resample_init(&rtp_opus.rs,
+                      16, uaudio_channels, uaudio_rate, 1, ENDIAN_NATIVE,
+                      16, uaudio_channels, RTP_OPUS_RATE, 1, ENDIAN_NATIVE);
+      }
+#endif
+      varispeed_init(&rtp_opus.vs, uaudio_channels);
+      rtp_opus.timestamp = rtp_base + (uint32_t)(rtp_opus.frames
+                                                 * RTP_OPUS_RATE
+                                                 / uaudio_rate);
+      rtp_opus.resync = 0;
+    }
+#if HAVE_SAMPLERATE_H
+    if(rtp_opus.resampling) {
+      ninput = resample_convert(&rtp_opus.rs, (const uint8_t *)input,
+                                nframes * uaudio_channels * sizeof *input, 0,
+                                rtp_opus_converted, 0)
+        / (uaudio_channels * sizeof *input);
+      if(!ninput)
+        break;                          /* offer the rest again later */
+      input += ninput * uaudio_channels;
+      nframes -= ninput;
+      rtp_opus.frames += ninput;
+      continue;
+    }
+#endif
+    ninput = nframes;
+    produced = varispeed_convert(&rtp_opus.vs, rtp_opus.ratio,
+                                 input, &ninput,
+                                 rtp_opus.pcm + rtp_opus.fill * uaudio_channels,
+                                 RTP_OPUS_FRAME - rtp_opus.fill);
+    input += ninput * uaudio_channels;
+    nframes -= ninput;
+    rtp_opus.frames += ninput;
+    rtp_opus.fill += produced;
+    /* If the frame isn't complete then all the input has been used */
+    if(rtp_opus.fill < RTP_OPUS_FRAME)
+      break;
+    rtp_send_opus();
+  }
+  nsamples -= nframes * uaudio_channels;
+  uaudio_schedule_sent(nsamples);
+  return nsamples;
+}
+#endif
+
 static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
   struct rtp_header header;
-  struct iovec vec[2];
+  struct iovec *const vec = rtp_iov;
+
+#if HAVE_OPUS
+  if(rtp_opus.encoder)
+    return rtp_play_opus(buffer, nsamples, flags);
+#endif
 
 #if 0
   if(flags & (UAUDIO_PAUSE|UAUDIO_RESUME))
@@ -171,14 +634,8 @@ static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
   /* If we've come out of a pause, set the marker bit */
   if(flags & UAUDIO_RESUME)
     header.mpt |= 0x80;
-#if !WORDS_BIGENDIAN
   /* Convert samples to network byte order */
-  uint16_t *u = buffer, *const limit = u + nsamples;
-  while(u < limit) {
-    *u = htons(*u);
-    ++u;
-  }
-#endif
+  net16_from_native(buffer, nsamples);
   vec[0].iov_base = (void *)&header;
   vec[0].iov_len = sizeof header;
   vec[1].iov_base = buffer;
@@ -204,38 +661,8 @@ static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
     uaudio_schedule_sent(nsamples);
     return nsamples;
   }
-  /* Send stuff to explicitly registerd unicast addresses unconditionally */
-  struct rtp_recipient *r;
-  struct msghdr m;
-  memset(&m, 0, sizeof m);
-  m.msg_iov = vec;
-  m.msg_iovlen = 2;
-  pthread_mutex_lock(&rtp_lock);
-  for(r = rtp_recipient_list; r; r = r->next) {
-    m.msg_name = &r->sa;
-    m.msg_namelen = r->sa.ss_family == AF_INET ? 
-      sizeof(struct sockaddr_in) : sizeof (struct sockaddr_in6);
-    sendmsg(r->sa.ss_family == AF_INET ? rtp_fd4 : rtp_fd6,
-            &m, MSG_DONTWAIT|MSG_NOSIGNAL);
-    // TODO similar error handling to other case?
-  }
-  pthread_mutex_unlock(&rtp_lock);
-  if(rtp_mode != RTP_REQUEST) {
-    int written_bytes;
-    do {
-      written_bytes = writev(rtp_fd, vec, 2);
-    } while(written_bytes < 0 && errno == EINTR);
-    if(written_bytes < 0) {
-      disorder_error(errno, "error transmitting audio data");
-      ++rtp_errors;
-      if(rtp_errors == 10)
-        disorder_fatal(0, "too many audio transmission errors");
-      return 0;
-    } else
-      rtp_errors /= 2;                    /* gradual decay */
-  }
-  /* TODO what can we sensibly do about short writes here?  Really that's just
-   * an error and we ought to be using smaller packets. */
+  if(rtp_send())
+    return 0;
   uaudio_schedule_sent(nsamples);
   return nsamples;
 }
@@ -419,10 +846,53 @@ static void rtp_open(void) {
     disorder_info("RTP: prepared socket");
 }
 
+#if HAVE_OPUS
+/** @brief Set up the Opus encoder */
+static void rtp_start_opus(void) {
+  const int bitrate = atoi(uaudio_get("rtp-opus-bitrate", "96000"));
+  int err;
+
+  /* Only the standard CD and Opus rates are supported, so that without
+   * libsamplerate the rate adjuster is never asked to do much */
+  if(uaudio_bits != 16
+     || (uaudio_channels != 1 && uaudio_channels != 2)
+     || (uaudio_rate != 44100 && uaudio_rate != RTP_OPUS_RATE))
+    disorder_fatal(0, "asked for %d/%d/%d, Opus needs 16/44100 or 16/48000"
+                   " with 1 or 2 channels",
+                   uaudio_bits, uaudio_rate, uaudio_channels);
+  rtp_opus.encoder = opus_encoder_create(RTP_OPUS_RATE, uaudio_channels,
+                                         OPUS_APPLICATION_AUDIO, &err);
+  if(!rtp_opus.encoder)
+    disorder_fatal(0, "error creating Opus encoder: %s", opus_strerror(err));
+  if((err = opus_encoder_ctl(rtp_opus.encoder, OPUS_SET_BITRATE(bitrate)))
+     != OPUS_OK)
+    disorder_fatal(0, "error setting Opus bit rate to %d: %s",
+                   bitrate, opus_strerror(err));
+  opus_encoder_ctl(rtp_opus.encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC));
+  rtp_opus.ratio = (double)RTP_OPUS_RATE / uaudio_rate;
+#if HAVE_SAMPLERATE_H
+  rtp_opus.resampling = uaudio_rate != RTP_OPUS_RATE;
+#endif
+  rtp_opus.fill = 0;
+  rtp_opus.frames = 0;
+  rtp_opus.resync = 1;
+  rtp_opus.marker = 0;
+  rtp_payload = RTP_PAYLOAD_OPUS;
+}
+#endif
+
 static void rtp_start(uaudio_callback *callback,
                       void *userdata) {
-  /* We only support L16 (but we do stereo and mono and will convert sign) */
-  if(uaudio_channels == 2
+  if(!strcmp(uaudio_get("rtp-payload", "l16"), "opus")) {
+#if HAVE_OPUS
+    rtp_start_opus();
+#else
+    disorder_fatal(0, "Opus RTP payload requested but not supported");
+#endif
+  }
+  /* Otherwise we send L16 (in stereo or mono, and will convert sign),
+   * perhaps with FEC */
+  else if(uaudio_channels == 2
      && uaudio_bits == 16
      && uaudio_rate == 44100)
     rtp_payload = 10;
@@ -446,6 +916,18 @@ static void rtp_start(uaudio_callback *callback,
     disorder_info("RTP: id %08"PRIx32" base %08"PRIx32" initial seq %08"PRIx16,
                   rtp_id, rtp_base, rtp_sequence);
   rtp_open();
+  /* Opus has its own loss concealment, and the receiver couldn't use FEC on
+   * packets it has already decoded */
+  rtp_fec = 0;
+  if(rtp_payload != RTP_PAYLOAD_OPUS) {
+    rtp_fec = atoi(uaudio_get("rtp-fec", "0"));
+    if(rtp_fec < 0 || rtp_fec > RTP_FEC_MAX_GROUP)
+      disorder_fatal(0, "FEC group size %d out of range", rtp_fec);
+    if(rtp_fec) {
+      rtp_fec_group.parity = xmalloc_noptr(rtp_max_payload);
+      rtp_fec_group.count = 0;
+    }
+  }
   uaudio_schedule_init();
   if(config->rtp_verbose)
     disorder_info("RTP: initialized schedule");
@@ -453,7 +935,8 @@ static void rtp_start(uaudio_callback *callback,
                       userdata,
                       rtp_play,
                       256 / uaudio_sample_size,
-                      (rtp_max_payload - sizeof(struct rtp_header))
+                      (rtp_max_payload - sizeof(struct rtp_header)
+                       - (rtp_fec ? RTP_FEC_OVERHEAD : 0))
                       / uaudio_sample_size,
                       0);
   if(config->rtp_verbose)
@@ -462,6 +945,14 @@ static void rtp_start(uaudio_callback *callback,
 
 static void rtp_stop(void) {
   uaudio_thread_stop();
+#if HAVE_OPUS
+  if(rtp_opus.encoder) {
+    opus_encoder_destroy(rtp_opus.encoder);
+    rtp_opus.encoder = NULL;
+  }
+#endif
+  xfree(rtp_fec_group.parity);
+  rtp_fec_group.parity = NULL;
   if(rtp_fd >= 0) { close(rtp_fd); rtp_fd = -1; }
   if(rtp_fd4 >= 0) { close(rtp_fd4); rtp_fd4 = -1; }
   if(rtp_fd6 >= 0) { close(rtp_fd6); rtp_fd6 = -1; }
@@ -483,6 +974,11 @@ static void rtp_configure(void) {
   snprintf(buffer, sizeof buffer, "%ld", config->rtp_max_payload);
   uaudio_set("rtp-max-payload", buffer);
   uaudio_set("rtp-mtu-discovery", config->rtp_mtu_discovery);
+  uaudio_set("rtp-payload", config->rtp_payload);
+  snprintf(buffer, sizeof buffer, "%ld", config->rtp_opus_bitrate);
+  uaudio_set("rtp-opus-bitrate", buffer);
+  snprintf(buffer, sizeof buffer, "%ld", config->rtp_fec);
+  uaudio_set("rtp-fec", buffer);
   if(config->rtp_verbose)
     disorder_info("RTP: configured");
 }
@@ -507,6 +1003,7 @@ int rtp_add_recipient(const struct sockaddr_storage *sa) {
     memcpy(&r->sa, sa, sizeof *sa);
     r->next = rtp_recipient_list;
     rtp_recipient_list = r;
+    rtp_batches_stale = 1;
     rc = 0;
   }
   pthread_mutex_unlock(&rtp_lock);
@@ -528,7 +1025,14 @@ int rtp_remove_recipient(const struct sockaddr_storage *sa) {
     ;
   if(r) {
     *rr = r->next;
+    if(r->errors || config->rtp_verbose) {
+      char *name = format_sockaddr((struct sockaddr *)&r->sa);
+      disorder_info("RTP: removed %s: %lu packets sent, %lu failed",
+                    name, r->sent, r->errors);
+      xfree(name);
+    }
     xfree(r);
+    rtp_batches_stale = 1;
     rc = 0;
   } else {
     disorder_error(0, "bogus rtp_remove_recipient");
@@ -545,6 +1049,7 @@ const struct uaudio uaudio_rtp = {
   .stop = rtp_stop,
   .activate = uaudio_thread_activate,
   .deactivate = uaudio_thread_deactivate,
+  .flush = uaudio_thread_flush,
   .configure = rtp_configure,
   .flags = UAUDIO_API_SERVER,
 };
@@ -90,6 +90,9 @@ static size_t uaudio_thread_max;
 /** @brief Set when activated, clear when paused */
 static int uaudio_thread_activated;
 
+/** @brief Set while the play thread is playing from a buffer */
+static int uaudio_thread_playing;
+
 /** @brief Return number of buffers currently in use */
 static int uaudio_buffers_used(void) {
   return (uaudio_collect_buffer - uaudio_play_buffer) % UAUDIO_THREAD_BUFFERS;
@@ -187,8 +190,10 @@ static size_t uaudio_play_samples(void *buffer, size_t samples, unsigned flags)
 
 /** @brief Background thread for audio playing 
  *
- * This thread plays data as long as there is something to play.  So the
- * buffers will drain to empty before deactivation completes.
+ * While activated, this thread plays data as long as there is something to
+ * play.  When deactivated it finishes the buffer it is playing (if any) and
+ * then plays silence; anything else buffered is held until the next
+ * activation, unless uaudio_thread_flush() discards it.
  */
 static void *uaudio_play_thread_fn(void attribute((unused)) *arg) {
   int resync = 1;
@@ -219,6 +224,7 @@ static void *uaudio_play_thread_fn(void attribute((unused)) *arg) {
       /* At least one buffer is filled.  We release the lock while playing so
        * that more collection can go on. */
       struct uaudio_buffer *const b = &uaudio_buffers[uaudio_play_buffer];
+      uaudio_thread_playing = 1;
       pthread_mutex_unlock(&uaudio_thread_lock);
       //fprintf(stderr, "P%d.", uaudio_play_buffer);
       size_t played = 0;
@@ -234,7 +240,8 @@ static void *uaudio_play_thread_fn(void attribute((unused)) *arg) {
       pthread_mutex_lock(&uaudio_thread_lock);
       /* Move to next buffer */
       uaudio_play_buffer = (1 + uaudio_play_buffer) % UAUDIO_THREAD_BUFFERS;
-      /* Awaken collector */
+      uaudio_thread_playing = 0;
+      /* Awaken collector (and uaudio_thread_flush()) */
       pthread_cond_broadcast(&uaudio_thread_cond);
       resync = 0;
     } else {
@@ -323,6 +330,33 @@ void uaudio_thread_deactivate(void) {
   pthread_mutex_unlock(&uaudio_thread_lock);
 }
 
+/** @brief Discard buffered audio
+ * @return Number of samples discarded
+ *
+ * Must only be called while deactivated.  Waits for the collection thread to
+ * finish any chunk it's working on and for the play thread to finish the
+ * buffer it's playing, then empties the buffers.  Returns the number of
+ * samples thrown away, which are the most recent ones collected.
+ *
+ * Suitable for use as the @c flush member of @ref uaudio.  Backends with
+ * buffering of their own should call this first, and then discard their own
+ * buffers, adding the two counts together.
+ */
+size_t uaudio_thread_flush(void) {
+  size_t discarded = 0;
+
+  pthread_mutex_lock(&uaudio_thread_lock);
+  while(uaudio_thread_collecting || uaudio_thread_playing)
+    pthread_cond_wait(&uaudio_thread_cond, &uaudio_thread_lock);
+  while(uaudio_buffers_used() > 0) {
+    discarded += uaudio_buffers[uaudio_play_buffer].nsamples;
+    uaudio_play_buffer = (1 + uaudio_play_buffer) % UAUDIO_THREAD_BUFFERS;
+  }
+  pthread_cond_broadcast(&uaudio_thread_cond);
+  pthread_mutex_unlock(&uaudio_thread_lock);
+  return discarded;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -124,6 +124,20 @@ struct uaudio {
    */
   void (*deactivate)(void);
 
+  /** @brief Discard buffered output
+   * @return Number of samples discarded
+   *
+   * Only called while deactivated.  Any audio data obtained from @c callback
+   * but not yet played is thrown away, and the number of samples discarded is
+   * returned.  These are always the last samples that @c callback supplied, so
+   * the caller can supply them again after the next @c activate if it wants
+   * play to resume exactly where it left off.
+   *
+   * May be NULL, in which case buffered output will be played after the next
+   * @c activate.
+   */
+  size_t (*flush)(void);
+
   /** @brief Open mixer device */
   void (*open_mixer)(void);
 
@@ -175,6 +189,7 @@ void uaudio_thread_start(uaudio_callback *callback,
 void uaudio_thread_stop(void);
 void uaudio_thread_activate(void);
 void uaudio_thread_deactivate(void);
+size_t uaudio_thread_flush(void);
 uint32_t uaudio_schedule_sync(void);
 void uaudio_schedule_sent(size_t nsamples_sent);
 void uaudio_schedule_init(void);
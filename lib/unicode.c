@@ -1408,6 +1408,22 @@ error:
   return 0;
 }
 
+/** @brief Remove all combining characters in-place
+ * @param s Pointer to start of string
+ * @param ns Length of string
+ * @return New, possibly reduced, length
+ */
+size_t utf32_remove_combining(uint32_t *s, size_t ns) {
+  uint32_t *start = s, *t = s, *end = s + ns;
+
+  while(s < end) {
+    const uint32_t c = *s++;
+    if(!utf32__combining_class(c))
+      *t++ = c;
+  }
+  return t - start;
+}
+
 /** @brief Order a pair of UTF-32 strings
  * @param a First 0-terminated string
  * @param b Second 0-terminated string
@@ -1464,25 +1480,35 @@ int utf32_is_word_boundary(const uint32_t *s, size_t ns, size_t n) {
   return utf32_iterator_word_boundary(it);
 }
 
-/** @brief Split [s,ns) into multiple words
+/** @brief Append a word to a list
+ * @param v32 List of words
+ * @param s Start of word
+ * @param len Length of word
+ */
+static void utf32__word_append(struct vector32 *v32,
+                               const uint32_t *s, size_t len) {
+  uint32_t *const w = xcalloc_noptr(len + 1, sizeof(uint32_t));
+
+  memcpy(w, s, len * sizeof (uint32_t));
+  w[len] = 0;
+  vector32_append(v32, w);
+}
+
+/** @brief Split [s,ns) into words using an iterator
+ * @param v32 Where to append words
  * @param s Pointer to start of string
  * @param ns Length of string
- * @param nwp Where to store word count, or NULL
  * @param wbreak Word_Break property tailor, or NULL
- * @return Pointer to array of pointers to words
  *
- * The returned array is terminated by a NULL pointer and individual
- * strings are 0-terminated.
+ * This works for any string.
  */
-uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
-                            unicode_property_tailor *wbreak) {
+static void utf32__word_split_iterator(struct vector32 *v32,
+                                       const uint32_t *s, size_t ns,
+                                       unicode_property_tailor *wbreak) {
   struct utf32_iterator_data it[1];
   size_t b1 = 0, b2 = 0 ,i;
   int isword;
-  struct vector32 v32[1];
-  uint32_t *w;
 
-  vector32_init(v32);
   utf32__iterator_init(it, s, ns, 0);
   it->word_break = wbreak;
   /* Work our way through the string stopping at each word break. */
@@ -1495,7 +1521,7 @@ uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
       /* Inspect the characters between the boundary and form an opinion as to
        * whether they are a word or not */
       isword = 0;
-      for(i = b1; i < b2; ++i) {
+      for(i = b1; i < b2 && !isword; ++i) {
         switch(utf32__iterator_word_break(it, it->s[i])) {
         case unicode_Word_Break_ALetter:
         case unicode_Word_Break_Numeric:
@@ -1507,15 +1533,132 @@ uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
         }
       }
       /* If it's a word add it to the list of results */
-      if(isword) {
-        const size_t len = b2 - b1;
-        w = xcalloc_noptr(len + 1, sizeof(uint32_t));
-        memcpy(w, it->s + b1, len * sizeof (uint32_t));
-        w[len] = 0;
-        vector32_append(v32, w);
-      }
+      if(isword)
+        utf32__word_append(v32, it->s + b1, b2 - b1);
     }
   } while(!utf32_iterator_advance(it, 1));
+}
+
+/** @brief Return true if @p wb can be part of a word
+ * @param wb Word break property value
+ * @return non-0 for letters, digits, Katakana and connectors
+ */
+static inline int utf32__word_char(enum unicode_Word_Break wb) {
+  switch(wb) {
+  case unicode_Word_Break_ALetter:
+  case unicode_Word_Break_Numeric:
+  case unicode_Word_Break_Katakana:
+  case unicode_Word_Break_ExtendNumLet:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/** @brief Split [s,ns) into words given their Word_Break properties
+ * @param v32 Where to append words
+ * @param s Pointer to start of string
+ * @param ns Length of string
+ * @param wb Word_Break property of each code point
+ *
+ * Only valid if there are no Extend or Format code points in the string.
+ * Then WB4 never applies, the only rules that prevent a boundary are WB5-WB13b
+ * and they only need the properties of the code points either side of each
+ * boundary (plus one more for WB6, WB7, WB11 and WB12).  So a single pass,
+ * looking up each property once, finds the same words as
+ * utf32__word_split_iterator().
+ */
+static void utf32__word_split_simple(struct vector32 *v32,
+                                     const uint32_t *s, size_t ns,
+                                     const unsigned char *wb) {
+  size_t i = 0, start;
+  int isword;
+
+  while(i < ns) {
+    if(!utf32__word_char(wb[i])) {
+      ++i;
+      continue;
+    }
+    start = i;
+    isword = 0;
+    for(;;) {
+      if(wb[i] != unicode_Word_Break_ExtendNumLet)
+        isword = 1;
+      if(i + 1 >= ns)
+        break;
+      /* WB5, WB8-WB10, WB13-WB13b: everything joins except Katakana with
+       * letters or digits */
+      if(utf32__word_char(wb[i + 1])
+         && ((wb[i] == unicode_Word_Break_Katakana)
+             == (wb[i + 1] == unicode_Word_Break_Katakana)
+             || wb[i] == unicode_Word_Break_ExtendNumLet
+             || wb[i + 1] == unicode_Word_Break_ExtendNumLet)) {
+        ++i;
+        continue;
+      }
+      if(i + 2 >= ns || wb[i + 2] != wb[i])
+        break;
+      /* WB6 and WB7 */
+      if(wb[i] == unicode_Word_Break_ALetter
+         && (wb[i + 1] == unicode_Word_Break_MidLetter
+             || wb[i + 1] == unicode_Word_Break_MidNumLet)) {
+        i += 2;
+        continue;
+      }
+      /* WB11 and WB12 */
+      if(wb[i] == unicode_Word_Break_Numeric
+         && (wb[i + 1] == unicode_Word_Break_MidNum
+             || wb[i + 1] == unicode_Word_Break_MidNumLet)) {
+        i += 2;
+        continue;
+      }
+      break;
+    }
+    ++i;
+    if(isword)
+      utf32__word_append(v32, s + start, i - start);
+  }
+}
+
+/** @brief Split [s,ns) into multiple words
+ * @param s Pointer to start of string
+ * @param ns Length of string
+ * @param nwp Where to store word count, or NULL
+ * @param wbreak Word_Break property tailor, or NULL
+ * @return Pointer to array of pointers to words
+ *
+ * The returned array is terminated by a NULL pointer and individual
+ * strings are 0-terminated.
+ *
+ * Strings without any Extend or Format code points (which is nearly all of
+ * them) are split in a single pass over a table of their Word_Break
+ * properties; others are split with an iterator.  Not reentrant, since the
+ * table is reused between calls.
+ */
+uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
+                            unicode_property_tailor *wbreak) {
+  static unsigned char *wb;
+  static size_t nwb;
+  struct vector32 v32[1];
+  size_t n;
+  int t;
+
+  vector32_init(v32);
+  if(ns > nwb) {
+    nwb = ns > 256 ? ns : 256;
+    wb = xrealloc_noptr(wb, nwb);
+  }
+  for(n = 0; n < ns; ++n) {
+    if(!wbreak || (t = wbreak(s[n])) < 0)
+      t = utf32__word_break(s[n]);
+    if(utf32__boundary_ignorable(t))
+      break;
+    wb[n] = t;
+  }
+  if(n < ns)
+    utf32__word_split_iterator(v32, s, ns, wbreak);
+  else
+    utf32__word_split_simple(v32, s, ns, wb);
   vector32_terminate(v32);
   if(nwp)
     *nwp = v32->nvec;
@@ -1703,6 +1846,119 @@ error:
 }
 
 
+/** @brief Compatibility case-folding of each Latin-1 code point
+ *
+ * Each entry is what utf32_casefold_compat() followed by
+ * utf32_remove_combining() makes of a single code point, or has @c n set to
+ * @c UCHAR_MAX if that is too long to fit.
+ */
+static struct {
+  /** @brief Length of folded form */
+  unsigned char n;
+  /** @brief Folded form */
+  uint32_t c[4];
+} utf8__latin1_fold[256];
+
+/** @brief Fill in @ref utf8__latin1_fold if not done already */
+static void utf8__latin1_fold_init(void) {
+  static int initialized;
+  uint32_t c, *f;
+  size_t nf;
+
+  if(initialized)
+    return;
+  for(c = 0; c < 256; ++c) {
+    f = utf32_casefold_compat(&c, 1, &nf);
+    nf = utf32_remove_combining(f, nf);
+    if(nf <= sizeof utf8__latin1_fold[c].c / sizeof (uint32_t)) {
+      memcpy(utf8__latin1_fold[c].c, f, nf * sizeof (uint32_t));
+      utf8__latin1_fold[c].n = nf;
+    } else
+      utf8__latin1_fold[c].n = UCHAR_MAX;
+    xfree(f);
+  }
+  initialized = 1;
+}
+
+/** @brief Convert Latin-1 UTF-8 to folded UTF-32 by table lookup
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @param d Where to store result (at least 4 * @p ns code points)
+ * @return Length of result, or (size_t)-1 if @p s isn't all Latin-1
+ */
+static size_t utf8__fold_latin1(const char *s, size_t ns, uint32_t *d) {
+  const unsigned char *ptr = (const unsigned char *)s;
+  const unsigned char *const end = ptr + ns;
+  uint32_t *const start = d;
+  unsigned c, n;
+
+  while(ptr < end) {
+    c = *ptr++;
+    if(c >= 0x80) {
+      /* Only two-byte sequences for U+0080 to U+00FF */
+      if((c != 0xC2 && c != 0xC3) || ptr >= end || (*ptr & 0xC0) != 0x80)
+        return (size_t)-1;
+      c = ((c & 0x1F) << 6) | (*ptr++ & 0x3F);
+    }
+    if((n = utf8__latin1_fold[c].n) == UCHAR_MAX)
+      return (size_t)-1;
+    memcpy(d, utf8__latin1_fold[c].c, n * sizeof (uint32_t));
+    d += n;
+  }
+  return d - start;
+}
+
+/** @brief Case-fold [s,ns) and split it into words
+ * @param s Pointer to start of string
+ * @param ns Length of string
+ * @param nwp Where to store word count, or NULL
+ * @param wbreak Word_Break property tailor, or NULL
+ * @return Pointer to array of pointers to words, or NULL on error
+ *
+ * The words are compatibility case-folded (see utf32_casefold_compat()), have
+ * their combining characters removed and are split as by utf32_word_split().
+ * This is how words are indexed for searching.
+ *
+ * Strings consisting only of Latin-1 characters (which is most track names)
+ * are folded a code point at a time by table lookup, which gives the same
+ * result but is much faster.  Not reentrant, since buffers are reused between
+ * calls.
+ */
+char **utf8_fold_words(const char *s, size_t ns, size_t *nwp,
+                       unicode_property_tailor *wbreak) {
+  static uint32_t *buffer;
+  static size_t nbuffer;
+  uint32_t *to32 = 0, *folded = 0, **v32;
+  size_t nfolded, nv, n;
+  char **v8;
+
+  utf8__latin1_fold_init();
+  if(4 * ns > nbuffer) {
+    nbuffer = 4 * ns > 1024 ? 4 * ns : 1024;
+    buffer = xrealloc_noptr(buffer, nbuffer * sizeof (uint32_t));
+  }
+  if((nfolded = utf8__fold_latin1(s, ns, buffer)) == (size_t)-1) {
+    if(!(to32 = utf8_to_utf32(s, ns, &n)))
+      return 0;
+    folded = utf32_casefold_compat(to32, n, &nfolded);
+    xfree(to32);
+    if(!folded)
+      return 0;
+    nfolded = utf32_remove_combining(folded, nfolded);
+  }
+  v32 = utf32_word_split(folded ? folded : buffer, nfolded, &nv, wbreak);
+  xfree(folded);
+  v8 = xcalloc(sizeof (char *), nv + 1);
+  for(n = 0; n < nv; ++n) {
+    v8[n] = utf32_to_utf8(v32[n], utf32_len(v32[n]), 0);
+    xfree(v32[n]);
+  }
+  xfree(v32);
+  if(nwp)
+    *nwp = nv;
+  return v8;
+}
+
 /*@}*/
 
 /** @brief Return the length of a 0-terminated UTF-16 string
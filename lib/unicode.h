@@ -72,6 +72,8 @@ char *utf8_casefold_canon(const char *s, size_t ns, size_t *ndp);
 uint32_t *utf32_casefold_compat(const uint32_t *s, size_t ns, size_t *ndp);
 char *utf8_casefold_compat(const char *s, size_t ns, size_t *ndp);
 
+size_t utf32_remove_combining(uint32_t *s, size_t ns);
+
 int utf32_is_grapheme_boundary(const uint32_t *s, size_t ns, size_t n);
 int utf32_is_word_boundary(const uint32_t *s, size_t ns, size_t n);
 
@@ -91,6 +93,8 @@ uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
                             unicode_property_tailor *wbreak);
 char **utf8_word_split(const char *s, size_t ns, size_t *nwp,
                             unicode_property_tailor *wbreak);
+char **utf8_fold_words(const char *s, size_t ns, size_t *nwp,
+                       unicode_property_tailor *wbreak);
 
 /** @brief Convert 0-terminated UTF-32 to UTF-8
  * @param s 0-terminated UTF-32 string
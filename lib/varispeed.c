@@ -0,0 +1,111 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/varispeed.c
+ * @brief Fine-grained audio rate adjustment
+ *
+ * This is much simpler than the general converter in lib/resample.c and
+ * doesn't need libsamplerate, but it is only suitable for ratios near 1.
+ */
+
+#include "common.h"
+#include "varispeed.h"
+
+/** @brief Initialize a rate adjuster
+ * @param vs Rate adjuster
+ * @param channels Number of channels
+ *
+ * The output starts with two frames of silence.
+ */
+void varispeed_init(struct varispeed *vs, int channels) {
+  assert(channels > 0 && channels <= VARISPEED_MAX_CHANNELS);
+  memset(vs, 0, sizeof *vs);
+  vs->channels = channels;
+  vs->position = 1;
+}
+
+/** @brief Adjust the rate of some samples
+ * @param vs Rate adjuster
+ * @param ratio Ratio of output frames to input frames
+ * @param input Input samples
+ * @param ninput Number of input frames available; updated to number used
+ * @param output Where to put output samples
+ * @param noutput Maximum number of output frames
+ * @return Number of output frames generated
+ *
+ * @p ratio should be close to 1 (and must be more than 0.5).  Output frames are
+ * computed by 4-point Hermite interpolation, which is cheap enough to do in an
+ * audio callback and has a flat enough response for small ratios.
+ *
+ * Any input frames not used must be supplied again on the next call.
+ */
+size_t varispeed_convert(struct varispeed *vs, double ratio,
+                         const int16_t *input, size_t *ninput,
+                         int16_t *output, size_t noutput) {
+  const int channels = vs->channels;
+  const size_t n = *ninput;
+  const double step = 1 / ratio;
+  double p = vs->position;
+  size_t i, produced = 0, shift;
+  int c;
+
+  assert(ratio > 0.5);
+  /* Frame k of the virtual input is history[k] for k < 3 and input[k - 3]
+   * after that. */
+#define FRAME(k) ((k) < 3 ? vs->history[k] : input + ((k) - 3) * channels)
+  while(produced < noutput) {
+    i = (size_t)p;
+    if(i + 2 >= n + 3)
+      break;
+    const double t = p - i;
+    const int16_t *const x0 = FRAME(i - 1), *const x1 = FRAME(i);
+    const int16_t *const x2 = FRAME(i + 1), *const x3 = FRAME(i + 2);
+    for(c = 0; c < channels; ++c) {
+      const double c0 = x1[c];
+      const double c1 = 0.5 * (x2[c] - x0[c]);
+      const double c2 = x0[c] - 2.5 * x1[c] + 2 * x2[c] - 0.5 * x3[c];
+      const double c3 = 0.5 * (x3[c] - x0[c]) + 1.5 * (x1[c] - x2[c]);
+      const double v = ((c3 * t + c2) * t + c1) * t + c0;
+      *output++ = (v >= 32767 ? 32767
+                   : v <= -32768 ? -32768
+                   : (int)(v + (v >= 0 ? 0.5 : -0.5)));
+    }
+    ++produced;
+    p += step;
+  }
+  /* Keep the three frames before the next output position */
+  shift = (size_t)p - 1;
+  if(shift > n)
+    shift = n;
+  int16_t history[3][VARISPEED_MAX_CHANNELS];
+  for(i = 0; i < 3; ++i)
+    memcpy(history[i], FRAME(shift + i), channels * sizeof (int16_t));
+#undef FRAME
+  memcpy(vs->history, history, sizeof history);
+  vs->position = p - shift;
+  *ninput = shift;
+  return produced;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,67 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** @file lib/varispeed.h
+ * @brief Fine-grained audio rate adjustment
+ */
+
+#ifndef VARISPEED_H
+#define VARISPEED_H
+
+/** @brief Maximum number of channels supported by @ref varispeed */
+#define VARISPEED_MAX_CHANNELS 8
+
+/** @brief A fine-grained rate adjuster
+ *
+ * This changes the rate of a stream of native-endian signed 16-bit samples by
+ * a ratio close to 1, which may vary from call to call.  It's intended for
+ * compensating for the clock drift between a sender and receiver, not for
+ * general sample rate conversion.
+ *
+ * The one exception is conversion between 44.1KHz and 48KHz for Opus.
+ * Opus audio is band-limited to 20KHz, so converting it down to 44.1KHz
+ * doesn't alias, and disorder-playrtp does that here along with its drift
+ * correction.  The RTP sender uses lib/resample.c to convert up to 48KHz,
+ * and only falls back to this if libsamplerate isn't available.
+ */
+struct varispeed {
+  /** @brief Number of channels */
+  int channels;
+
+  /** @brief Position of the next output frame relative to @c history */
+  double position;
+
+  /** @brief Last three input frames */
+  int16_t history[3][VARISPEED_MAX_CHANNELS];
+};
+
+void varispeed_init(struct varispeed *vs, int channels);
+size_t varispeed_convert(struct varispeed *vs, double ratio,
+                         const int16_t *input, size_t *ninput,
+                         int16_t *output, size_t noutput);
+
+#endif /* VARISPEED_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,82 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "arena.h"
+
+static void test_arena(void) {
+  struct arena *a = arena_new();
+  struct mem_stats before, after;
+  const struct kvp *k1, *k2;
+  char *s, *big, *p[1000];
+  double *d;
+  int n;
+
+  /* Allocations are aligned, zeroed and don't overlap */
+  s = arena_strndup(a, "spong", 3);
+  check_string(s, "spo");
+  d = arena_alloc(a, 3 * sizeof *d);
+  insist((uintptr_t)d % sizeof (double) == 0);
+  insist(d[0] == 0 && d[1] == 0 && d[2] == 0);
+  d[2] = 1.5;
+  check_string(arena_strdup(a, "wibble"), "wibble");
+  check_string(s, "spo");
+  insist(arena_used(a) >= 3 * sizeof *d + 4 + 7);
+
+  /* Large and many small allocations, spanning several chunks */
+  big = arena_alloc(a, 100000);
+  memset(big, 'x', 100000);
+  for(n = 0; n < 1000; ++n)
+    p[n] = arena_strdup(a, do_printf("%0200d", n));
+  for(n = 0; n < 1000; ++n)
+    check_string(p[n], do_printf("%0200d", n));
+  insist(big[0] == 'x' && big[99999] == 'x');
+  insist(d[2] == 1.5);
+
+  /* Released arenas are reusable */
+  arena_release(a);
+  check_integer(arena_used(a), 0);
+  check_string(arena_strdup(a, "blat"), "blat");
+  arena_release(a);
+
+  /* Decoding into an arena matches decoding normally */
+  k1 = kvp_urldecode("one=1&two=%32&three=+3", 22);
+  k2 = kvp_urldecode_arena(a, "one=1&two=%32&three=+3", 22);
+  for(; k1 && k2; k1 = k1->next, k2 = k2->next) {
+    check_string(k1->name, k2->name);
+    check_string(k1->value, k2->value);
+  }
+  insist(!k1 && !k2);
+  arena_release(a);
+
+  /* Allocations are counted */
+  mem_stats(&before);
+  xfree(xmalloc(1000));
+  mem_stats(&after);
+  insist(after.allocated - before.allocated >= 1000);
+}
+
+TEST(arena);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,125 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "byte-order.h"
+
+/** @brief Size of benchmark buffer in 16-bit words */
+#define BENCH_WORDS 1024
+
+/** @brief Number of passes over benchmark buffer */
+#define BENCH_PASSES 20000
+
+/** @brief Report the throughput of a swap function */
+static void bench_swap(const char *name,
+                       void (*fn)(void *, const void *, size_t)) {
+  static uint16_t src[BENCH_WORDS], dst[BENCH_WORDS];
+  double started;
+  int n;
+
+  started = bench_now();
+  for(n = 0; n < BENCH_PASSES; ++n) {
+    fn(dst, src, BENCH_WORDS);
+    src[n % BENCH_WORDS] = dst[0];      /* defeat optimization */
+  }
+  bench_report(name, started, (double)BENCH_PASSES * sizeof src / 1e6, "MB");
+}
+
+/** @brief Report the throughput of a zero-detection function */
+static void bench_zero(const char *name, int (*fn)(const void *, size_t)) {
+  static uint16_t buffer[BENCH_WORDS];
+  double started;
+  int n, count = 0;
+
+  started = bench_now();
+  for(n = 0; n < BENCH_PASSES; ++n)
+    count += fn(buffer, BENCH_WORDS);
+  bench_report(name, started, (double)BENCH_PASSES * sizeof buffer / 1e6,
+               "MB");
+  insist(count == BENCH_PASSES);
+}
+
+static void test_byte_order(void) {
+  unsigned char src[128], dst[128], expect[128];
+  size_t offset, n, i;
+
+  for(i = 0; i < sizeof src; ++i)
+    src[i] = i * 7 + 1;
+  /* Try every length and alignment, so that both the vector loops and the
+   * tails get exercised */
+  for(offset = 0; offset < 4; ++offset)
+    for(n = 0; 2 * n + offset + 2 <= sizeof src; ++n) {
+      memset(dst, 0xAA, sizeof dst);
+      memcpy(expect, dst, sizeof expect);
+      for(i = 0; i < n; ++i) {
+        expect[offset + 2 * i] = src[offset + 2 * i + 1];
+        expect[offset + 2 * i + 1] = src[offset + 2 * i];
+      }
+      swap16_copy(dst + offset, src + offset, n);
+      insist(!memcmp(dst, expect, sizeof dst));
+      memset(dst, 0xAA, sizeof dst);
+      swap16_copy_portable(dst + offset, src + offset, n);
+      insist(!memcmp(dst, expect, sizeof dst));
+      /* In place */
+      memcpy(dst, src, sizeof dst);
+      swap16_buffer(dst + offset, n);
+      insist(!memcmp(dst + offset, expect + offset, 2 * n));
+    }
+  /* Network order really is big-endian */
+  {
+    const uint16_t native[2] = { 0x1234, 0xABCD };
+    unsigned char net[4];
+
+    net16_from_native_copy(net, native, 2);
+    check_integer(net[0], 0x12);
+    check_integer(net[1], 0x34);
+    check_integer(net[2], 0xAB);
+    check_integer(net[3], 0xCD);
+  }
+  /* Silence detection must notice a single nonzero byte anywhere */
+  memset(src, 0, sizeof src);
+  for(offset = 0; offset < 4; ++offset)
+    for(n = 0; 2 * n + offset <= sizeof src; ++n) {
+      insist(zero16_buffer(src + offset, n));
+      insist(zero16_buffer_portable(src + offset, n));
+      for(i = 0; i < 2 * n; ++i) {
+        src[offset + i] = 1;
+        insist(!zero16_buffer(src + offset, n));
+        insist(!zero16_buffer_portable(src + offset, n));
+        src[offset + i] = 0;
+      }
+    }
+  /* With --verbose, compare the throughput of the (possibly) vectorized and
+   * portable versions */
+  if(verbose) {
+    bench_swap("swap16_copy", swap16_copy);
+    bench_swap("swap16_copy_portable", swap16_copy_portable);
+    bench_zero("zero16_buffer", zero16_buffer);
+    bench_zero("zero16_buffer_portable", zero16_buffer_portable);
+  }
+}
+
+TEST(byte_order);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -17,8 +17,60 @@
  */
 #include "test.h"
 
+static size_t string_size(const void *value) {
+  return strlen(value) + 1;
+}
+
+static void test_cache_limit(void) {
+  const struct cache_type t = { 3600, string_size };
+  struct cache_stats cs;
+  const char a[] = "alpha", b[] = "bravo", c[] = "charlie";
+  size_t one;
+
+  cache_put(&t, "a", a);
+  cache_stats(&t, &cs);
+  check_integer(cs.count, 1);
+  one = cs.bytes;
+  insist(one > sizeof a);
+  /* Allow room for about two entries */
+  cache_limit(&t, 2 * one + 4);
+  cache_put(&t, "b", b);
+  check_integer(cache_count(), 2);
+  /* Touch "a" so that "b" is least recently used */
+  insist(cache_get(&t, "a") == a);
+  cache_put(&t, "c", c);
+  check_integer(cache_count(), 2);
+  insist(cache_get(&t, "b") == 0);
+  insist(cache_get(&t, "a") == a);
+  insist(cache_get(&t, "c") == c);
+  cache_stats(&t, &cs);
+  check_integer(cs.count, 2);
+  check_integer(cs.hits, 3);
+  check_integer(cs.misses, 1);
+  check_integer(cs.evictions, 1);
+  check_integer(cs.expiries, 0);
+  insist(cs.bytes <= 2 * one + 4);
+  /* Replacing a key does not leak its size */
+  cache_put(&t, "c", c);
+  cache_stats(&t, &cs);
+  check_integer(cs.count, 2);
+  insist(cs.bytes <= 2 * one + 4);
+  /* Shrinking the budget evicts at once */
+  cache_limit(&t, 1);
+  check_integer(cache_count(), 0);
+  cache_stats(&t, &cs);
+  check_integer(cs.evictions, 3);
+  check_integer(cs.bytes, 0);
+  cache_limit(&t, 0);
+  cache_put(&t, "a", a);
+  cache_clean(&t);
+  cache_stats(&t, &cs);
+  check_integer(cs.count, 0);
+  check_integer(cs.bytes, 0);
+}
+
 static void test_cache(void) {
-  const struct cache_type t1 = { 1 }, t2 = { 10 };
+  const struct cache_type t1 = { 1, 0 }, t2 = { 10, 0 };
   const char v11[] = "spong", v12[] = "wibble", v2[] = "blat";
 
   cache_put(&t1, "1_1", v11);
@@ -43,6 +95,7 @@ static void test_cache(void) {
   cache_clean(0);
   insist(cache_count() == 0);
   insist(cache_get(&t2, "2") == 0); 
+  test_cache_limit();
 }
 
 TEST(cache);
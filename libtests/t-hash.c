@@ -19,6 +19,148 @@
 
 static int count;
 
+/** @brief Entry in the chained reference table
+ *
+ * This is how lib/hash.c used to work, kept here so that the benchmark has
+ * something to compare against.
+ */
+struct chain {
+  struct chain *next;
+  size_t h;
+  const char *key;
+  void *value;
+};
+
+/** @brief Chained reference table */
+struct chained {
+  size_t nslots, nitems, valuesize;
+  struct chain **slots;
+};
+
+static size_t chained_hashfn(const char *key) {
+  size_t i = 0;
+
+  while(*key)
+    i = 33 * i + (unsigned char)*key++;
+  return i;
+}
+
+static struct chained *chained_new(size_t valuesize) {
+  struct chained *h = xmalloc(sizeof *h);
+
+  h->nslots = 256;
+  h->nitems = 0;
+  h->valuesize = valuesize;
+  h->slots = xcalloc(h->nslots, sizeof (struct chain *));
+  return h;
+}
+
+static void chained_add(struct chained *h, const char *key,
+                        const void *value) {
+  size_t n = chained_hashfn(key), m;
+  struct chain *e, *f, **newslots;
+
+  if(h->nitems >= h->nslots) {
+    newslots = xcalloc(2 * h->nslots, sizeof (struct chain *));
+    for(m = 0; m < h->nslots; ++m)
+      for(e = h->slots[m]; e; e = f) {
+        f = e->next;
+        e->next = newslots[e->h & (2 * h->nslots - 1)];
+        newslots[e->h & (2 * h->nslots - 1)] = e;
+      }
+    h->slots = newslots;
+    h->nslots *= 2;
+  }
+  e = xmalloc(sizeof *e);
+  e->h = n;
+  e->key = xstrdup(key);
+  e->value = xmalloc(h->valuesize);
+  memcpy(e->value, value, h->valuesize);
+  e->next = h->slots[n & (h->nslots - 1)];
+  h->slots[n & (h->nslots - 1)] = e;
+  ++h->nitems;
+}
+
+static void *chained_find(struct chained *h, const char *key) {
+  size_t n = chained_hashfn(key);
+  struct chain *e;
+
+  for(e = h->slots[n & (h->nslots - 1)]; e; e = e->next)
+    if(e->h == n && !strcmp(e->key, key))
+      return e->value;
+  return 0;
+}
+
+/** @brief Compare insert and lookup throughput against the chained table
+ * @param nkeys Number of keys
+ * @param passes Number of lookups of each key
+ *
+ * Lookups are made in a shuffled order, so that consecutive lookups do not
+ * hit consecutively allocated memory.
+ */
+static void bench_hash(int nkeys, int passes) {
+  char **keys = xcalloc(nkeys, sizeof (char *)), **order, *t;
+  struct chained *c;
+  double started;
+  hash *h;
+  int i, j, pass, found;
+
+  for(i = 0; i < nkeys; ++i)
+    keys[i] = xstrdup(do_printf("/srv/music/Artist %d/Album/%02d:Track.ogg",
+                                i / 12, i % 12));
+  order = xcalloc(nkeys, sizeof (char *));
+  memcpy(order, keys, nkeys * sizeof (char *));
+  srand(1);
+  for(i = nkeys - 1; i > 0; --i) {
+    j = rand() % (i + 1);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  fprintf(stderr, "%d keys:\n", nkeys);
+
+  started = bench_now();
+  for(pass = 0; pass < passes; ++pass) {
+    h = hash_new(sizeof(int));
+    for(i = 0; i < nkeys; ++i)
+      hash_add(h, keys[i], &i, HASH_INSERT);
+  }
+  bench_report("  hash_add", started, (double)passes * nkeys, "inserts");
+  started = bench_now();
+  found = 0;
+  for(pass = 0; pass < passes; ++pass)
+    for(i = 0; i < nkeys; ++i)
+      found += hash_find(h, order[i]) != 0;
+  bench_report("  hash_find", started, (double)passes * nkeys, "lookups");
+  check_integer(found, passes * nkeys);
+
+  started = bench_now();
+  for(pass = 0; pass < passes; ++pass) {
+    c = chained_new(sizeof(int));
+    for(i = 0; i < nkeys; ++i)
+      chained_add(c, keys[i], &i);
+  }
+  bench_report("  chained insert", started, (double)passes * nkeys,
+               "inserts");
+  started = bench_now();
+  found = 0;
+  for(pass = 0; pass < passes; ++pass)
+    for(i = 0; i < nkeys; ++i)
+      found += chained_find(c, order[i]) != 0;
+  bench_report("  chained lookup", started, (double)passes * nkeys,
+               "lookups");
+  check_integer(found, passes * nkeys);
+}
+
+/** @brief Callback that removes every visited item */
+static int test_hash_remove_callback(const char *key,
+                                     void attribute((unused)) *value,
+                                     void *u) {
+  ++count;
+  insist(hash_remove(u, key) == 0);
+  return 0;
+}
+
 static int test_hash_callback(const char attribute((unused)) *key,
                               void attribute((unused)) *value,
                               void attribute((unused)) *u) {
@@ -63,6 +205,43 @@ static void test_hash(void) {
   for(i = 0; i < 10000; ++i)
     insist(hash_remove(h, do_printf("%d", i)) == 0);
   check_integer(hash_count(h), 0);
+  insist(hash_find(h, "0") == 0);
+  insist(hash_remove(h, "0") == -1);
+
+  /* Removed slots are reused and cleaned out without losing anything */
+  for(i = 0; i < 100000; ++i) {
+    insist(hash_add(h, do_printf("%d", i), &i, HASH_INSERT) == 0);
+    if(i >= 10)
+      insist(hash_remove(h, do_printf("%d", i - 10)) == 0);
+  }
+  check_integer(hash_count(h), 10);
+  for(i = 100000 - 10; i < 100000; ++i) {
+    insist((ip = hash_find(h, do_printf("%d", i))) != 0);
+    if(ip)
+      check_integer(*ip, i);
+  }
+  insist(hash_add(h, "99999", &i, HASH_INSERT) == -1);
+  insist(hash_add(h, "-1", &i, HASH_REPLACE) == -1);
+
+  /* Empty and long keys */
+  insist(hash_add(h, "", &i, HASH_INSERT) == 0);
+  insist(hash_find(h, "") != 0);
+  insist(hash_add(h, "a key that is longer than eight bytes", &i,
+                  HASH_INSERT) == 0);
+  insist(hash_find(h, "a key that is longer than eight bytes") != 0);
+  insist(hash_find(h, "a key that is longer than eight byte") == 0);
+
+  /* Removing every item from inside hash_foreach visits each one once */
+  count = 0;
+  check_integer(hash_foreach(h, test_hash_remove_callback, h), 0);
+  check_integer(count, 12);
+  check_integer(hash_count(h), 0);
+
+  /* With --verbose, compare against the old chained implementation */
+  if(verbose) {
+    bench_hash(1000, 1000);
+    bench_hash(200000, 5);
+  }
 }
 
 TEST(hash);
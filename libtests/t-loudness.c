@@ -0,0 +1,147 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "loudness.h"
+#include "byte-order.h"
+#include <math.h>
+
+/** @brief Feed a stereo 997Hz sine wave to a loudness measurement
+ * @param l Measurement
+ * @param rate Sample rate
+ * @param bits Bits per sample
+ * @param endian Endianness
+ * @param dbfs Level in dBFS
+ * @param seconds Duration
+ *
+ * The data is supplied in awkwardly sized pieces so that frames get split.
+ */
+static void sine(struct loudness *l, unsigned rate, unsigned bits, int endian,
+                 double dbfs, double seconds) {
+  const double amplitude = pow(10.0, dbfs / 20.0) * (pow(2.0, bits - 1) - 1);
+  const unsigned long frames = rate * seconds;
+  const unsigned bytes = bits / 8;
+  unsigned char buffer[4099];
+  unsigned long f;
+  size_t used = 0;
+  unsigned b, c;
+
+  for(f = 0; f < frames; ++f) {
+    const int32_t v = lrint(amplitude * sin(2 * M_PI * 997.0 * f / rate));
+    for(c = 0; c < 2; ++c)
+      for(b = 0; b < bytes; ++b) {
+        const unsigned shift = (endian == ENDIAN_BIG
+                                ? 8 * (bytes - 1 - b) : 8 * b);
+        buffer[used++] = (uint32_t)v >> shift;
+        if(used == sizeof buffer) {
+          loudness_feed(l, buffer, used, rate, 2, bits, endian);
+          used = 0;
+        }
+      }
+  }
+  loudness_feed(l, buffer, used, rate, 2, bits, endian);
+}
+
+/** @brief Check that two values are within some tolerance */
+#define check_near(GOT, WANT, TOLERANCE) do {                   \
+  const double got = (GOT), want = (WANT);                      \
+  ++tests;                                                      \
+  if(fabs(got - want) > (TOLERANCE)) {                          \
+    fprintf(stderr, "%s:%d: %s returned %g, expected %g\n",     \
+            __FILE__, __LINE__, #GOT, got, want);               \
+    count_error();                                              \
+  }                                                             \
+} while(0)
+
+static void test_loudness(void) {
+  struct loudness *l;
+  double lufs, peak;
+  int16_t src[67], dst[67], expect[67];
+  size_t n, i;
+  int gain;
+
+  /* EBU Tech 3341 test cases 1 and 2: a -23dBFS sine is -23LUFS at any rate
+   * and in any format */
+  l = loudness_new();
+  insist(loudness_result(l, &lufs, &peak) == -1);
+  sine(l, 48000, 16, ENDIAN_LITTLE, -23.0, 5);
+  insist(loudness_result(l, &lufs, &peak) == 0);
+  check_near(lufs, -23.0, 0.1);
+  check_near(peak, -23.0, 0.05);
+  loudness_free(l);
+  l = loudness_new();
+  sine(l, 44100, 24, ENDIAN_BIG, -33.0, 5);
+  insist(loudness_result(l, &lufs, &peak) == 0);
+  check_near(lufs, -33.0, 0.1);
+  check_near(peak, -33.0, 0.05);
+  loudness_free(l);
+  /* Test case 3: quiet passages are gated out */
+  l = loudness_new();
+  sine(l, 48000, 16, ENDIAN_LITTLE, -36.0, 2);
+  sine(l, 48000, 16, ENDIAN_LITTLE, -23.0, 20);
+  sine(l, 48000, 16, ENDIAN_LITTLE, -36.0, 2);
+  insist(loudness_result(l, &lufs, &peak) == 0);
+  check_near(lufs, -23.0, 0.1);
+  loudness_free(l);
+  /* Silence */
+  l = loudness_new();
+  sine(l, 44100, 16, ENDIAN_LITTLE, -200.0, 1);
+  insist(loudness_result(l, &lufs, &peak) == 0);
+  check_near(lufs, -70.0, 0.001);
+  check_near(peak, -120.0, 0.001);
+  loudness_free(l);
+
+  /* Gain is limited by the peak and by LOUDNESS_MAX */
+  check_integer(loudness_gain(-18.0, -1.0, -18.0), LOUDNESS_UNITY);
+  check_integer(loudness_gain(-12.0, -1.0, -18.0), 2053);
+  check_integer(loudness_gain(-23.0, -10.0, -18.0), 7284);
+  check_integer(loudness_gain(-23.0, -3.0, -18.0), 5786);
+  check_integer(loudness_gain(-70.0, -120.0, -18.0), LOUDNESS_MAX);
+
+  /* The vector and portable gain functions agree, at every length */
+  for(i = 0; i < sizeof src / sizeof *src; ++i)
+    src[i] = (int16_t)(i * 7919 - 30000);
+  for(gain = 0; gain <= LOUDNESS_MAX; gain += 1021)
+    for(n = 0; n <= sizeof src / sizeof *src; ++n) {
+      memcpy(dst, src, sizeof src);
+      memcpy(expect, src, sizeof src);
+      for(i = 0; i < n; ++i) {
+        const int32_t v = ((int32_t)src[i] * gain) >> LOUDNESS_SHIFT;
+        expect[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+      }
+      gain16_buffer(dst, n, gain);
+      insist(!memcmp(dst, expect, sizeof dst));
+      memcpy(dst, src, sizeof src);
+      gain16_buffer_portable(dst, n, gain);
+      insist(!memcmp(dst, expect, sizeof dst));
+    }
+  /* Unity gain leaves samples alone */
+  memcpy(dst, src, sizeof src);
+  gain16_buffer(dst, sizeof dst / sizeof *dst, LOUDNESS_UNITY);
+  insist(!memcmp(dst, src, sizeof dst));
+}
+
+TEST(loudness);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
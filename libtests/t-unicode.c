@@ -41,6 +41,32 @@ static void close_unicode_test(const char *path, FILE *fp)
     disorder_fatal(0, "decompressing %s: %s", path, wstat(w));
 }
 
+/** @brief Check that utf32_word_split() takes the iterator path correctly
+ *
+ * Appending a space and U+200D ZERO WIDTH JOINER can't change the words of
+ * a string, but since U+200D is ignorable for word breaking it forces
+ * utf32_word_split() to use an iterator rather than a single pass.
+ */
+static void check_word_split(const uint32_t *s, size_t ns,
+                             const char *path, int lineno) {
+  uint32_t buffer[1026], **w1, **w2;
+  size_t nw1, nw2, n;
+
+  memcpy(buffer, s, ns * sizeof *s);
+  buffer[ns] = 0x0020;
+  buffer[ns + 1] = 0x200D;
+  w1 = utf32_word_split(s, ns, &nw1, 0);
+  w2 = utf32_word_split(buffer, ns + 2, &nw2, 0);
+  ++tests;
+  for(n = 0; n < nw1 && n < nw2 && !utf32_cmp(w1[n], w2[n]); ++n)
+    ;
+  if(n < nw1 || n < nw2) {
+    fprintf(stderr, "%s:%d: word split mismatch at word %zu\n",
+            path, lineno, n);
+    count_error();
+  }
+}
+
 /** @brief Run breaking tests for utf32_grapheme_boundary() etc */
 static void breaktest(const char *path,
                       int (*breakfn)(const uint32_t *, size_t, size_t)) {
@@ -92,6 +118,8 @@ static void breaktest(const char *path,
       }
       ++tests;
     }
+    if(breakfn == utf32_is_word_boundary)
+      check_word_split(buffer, bn, path, lineno);
     xfree(l);
   }
   close_unicode_test(path, fp);
@@ -0,0 +1,81 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "varispeed.h"
+
+static void test_varispeed(void) {
+  struct varispeed vs[1];
+  int16_t input[2000], output[4200];
+  size_t n, ninput, noutput, total;
+
+  for(n = 0; n < 2000; ++n)
+    input[n] = 16 * n - 16000;
+  /* At ratio 1 the output is the input delayed by two frames */
+  varispeed_init(vs, 2);
+  ninput = 1000;
+  noutput = varispeed_convert(vs, 1.0, input, &ninput, output, 2100);
+  check_integer(noutput, 1000);
+  check_integer(ninput, 1000);
+  check_integer(output[0], 0);
+  check_integer(output[3], 0);
+  for(n = 4; n < 2 * noutput; ++n)
+    if(output[n] != input[n - 4]) {
+      fprintf(stderr, "varispeed ratio 1: output[%zu]=%d expected %d\n",
+              n, output[n], input[n - 4]);
+      ++errors;
+      break;
+    }
+  ++tests;
+  /* A ramp interpolates exactly, whatever the ratio */
+  varispeed_init(vs, 1);
+  ninput = 2000;
+  noutput = varispeed_convert(vs, 2.0, input, &ninput, output, 4200);
+  check_integer(ninput, 2000);
+  insist(noutput >= 3997 && noutput <= 4000);
+  for(n = 6; n < noutput; ++n)
+    if(output[n] != (input[n / 2 - 2] + input[n / 2 - 1]) / 2
+       && output[n] != input[n / 2 - 2]) {
+      fprintf(stderr, "varispeed ratio 2: output[%zu]=%d\n", n, output[n]);
+      ++errors;
+      break;
+    }
+  ++tests;
+  /* Input is consumed at the right rate when output is limited, and a
+   * partial call picks up where it left off */
+  varispeed_init(vs, 1);
+  total = 0;
+  for(n = 0; n < 2000; n += ninput) {
+    ninput = 2000 - n;
+    noutput = varispeed_convert(vs, 1.001, input + n, &ninput, output, 100);
+    total += noutput;
+    if(!noutput)
+      break;
+  }
+  insist(total >= 2000 && total <= 2003);
+}
+
+TEST(varispeed);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "test.h"
+#include "unidata.h"
 
 struct {
   const char *in;
@@ -47,7 +48,7 @@ struct {
 };
 #define NWTEST (sizeof wtest / sizeof *wtest)
 
-static void test_words(void) {
+static void test_word_split(void) {
   size_t t, nexpect, ngot, i;
   int right;
   
@@ -80,6 +81,159 @@ static void test_words(void) {
   }
 }
 
+struct {
+  const char *in;
+  const char *expect[10];
+} ftest[] = {
+  /* Case folding */
+  { "Wibble SPONG", { "wibble", "spong", 0 } },
+  /* Accents are removed, whether precomposed or not */
+  { "Caf\xC3\xA9 Cafe\xCC\x81", { "cafe", "cafe", 0 } },
+  { "\xC3\x9C" "BER", { "uber", 0 } },
+  /* Compatibility decompositions */
+  { "Stra\xC3\x9F" "e", { "strasse", 0 } },
+  { "\xC2\xBD \xC2\xB2", { "1\xE2\x81\x84" "2", "2", 0 } },
+  /* Digits and punctuation */
+  { "01:First track", { "01", "first", "track", 0 } },
+  { "Vol. 1.5, 2", { "vol", "1.5", "2", 0 } },
+  { "don't_stop", { "don't_stop", 0 } },
+  /* Non-Latin-1 */
+  { "\xCE\xA3\xCE\xBF\xCF\x86\xCE\xAF\xCE\xB1 \xE2\x82\xAC",
+    { "\xCF\x83\xCE\xBF\xCF\x86\xCE\xB9\xCE\xB1", 0 } },
+};
+#define NFTEST (sizeof ftest / sizeof *ftest)
+
+/** @brief Word_Break tailor that treats underscores as spaces */
+static int tailor_underscore(uint32_t c) {
+  return c == 0x005F ? unicode_Word_Break_Other : -1;
+}
+
+/** @brief Check that the Latin-1 fast path of utf8_fold_words() is right
+ * @param s String
+ * @param pt Word_Break property tailor, or NULL
+ *
+ * Appending a space and U+200D ZERO WIDTH JOINER can't change the words of
+ * @p s, but forces utf8_fold_words() to take its slow path.
+ */
+static void check_fold_words(const char *s, unicode_property_tailor *pt) {
+  char **w1, **w2, *slow;
+  size_t nw1, nw2, n;
+
+  byte_xasprintf(&slow, "%s \xE2\x80\x8D", s);
+  w1 = utf8_fold_words(s, strlen(s), &nw1, pt);
+  w2 = utf8_fold_words(slow, strlen(slow), &nw2, pt);
+  insist(w1 != NULL);
+  insist(w2 != NULL);
+  ++tests;
+  for(n = 0; n < nw1 && n < nw2 && !strcmp(w1[n], w2[n]); ++n)
+    ;
+  if(n < nw1 || n < nw2) {
+    fprintf(stderr, "fold words mismatch at word %zu\ninput: %s\n", n, s);
+    count_error();
+  }
+}
+
+/** @brief Realistic track names for check_fold_words() and bench_words() */
+static const char *const names[] = {
+  "Joe Bloggs/First Album/01:F\xC3\x8Crst track",
+  "Joe Bloggs/First Album/03:ThI\xCC\x81rd track",
+  "Various/Greatest Hits/01:Jim Whatever - Spong",
+  "Bj\xC3\xB6rk/Debut/02:Crying",
+  "Sigur R\xC3\xB3s/( )/04:Untitled #4",
+  "Mot\xC3\xB6rhead/Ace of Spades/01:Ace of Spades",
+  "Ma\xC3\xAEtre Gims/Subliminal/07:Bella",
+  "Caf\xC3\xA9 Tacvba/Re/05:La ingrata",
+  "Beyonc\xC3\xA9/4/12:Run the World (Girls)",
+  "The Beatles/Abbey Road/07:Here Comes the Sun",
+  "AC_DC/Back in Black/06:Back_In_Black",
+  "Led Zeppelin/IV/04:Stairway to Heaven",
+  "Various Artists/Now That's What I Call Music! 47/2-11:Don't Stop",
+  "R.E.M./Automatic for the People/08:Nightswimming",
+  "Guns N' Roses/Appetite for Destruction/01:Welcome to the Jungle",
+  "Mot\xC3\xB6rhead/1916/10:1916",
+  "Bach/Goldberg Variations, BWV 988/01:Aria",
+  "Dvo\xC5\x99\xC3\xA1k/Symphony No. 9/04:Allegro con fuoco",
+  "\xE5\x9D\x82\xE6\x9C\xAC\xE9\xBE\x8D\xE4\xB8\x80/Async/01:andata",
+};
+#define NNAMES (sizeof names / sizeof *names)
+
+/** @brief Measure utf8_fold_words() throughput over realistic track names
+ * @param passes Number of passes over the names
+ *
+ * The slow path is measured by adding a non-Latin-1 ignorable code point to
+ * each name.
+ */
+static void bench_words(int passes) {
+  char *slow[NNAMES];
+  double started;
+  size_t n, nw, words;
+  int pass;
+
+  for(n = 0; n < NNAMES; ++n)
+    byte_xasprintf(&slow[n], "%s \xE2\x80\x8D", names[n]);
+  words = 0;
+  started = bench_now();
+  for(pass = 0; pass < passes; ++pass)
+    for(n = 0; n < NNAMES; ++n) {
+      utf8_fold_words(names[n], strlen(names[n]), &nw, tailor_underscore);
+      words += nw;
+    }
+  bench_report("utf8_fold_words", started, words, "words");
+  words = 0;
+  started = bench_now();
+  for(pass = 0; pass < passes; ++pass)
+    for(n = 0; n < NNAMES; ++n) {
+      utf8_fold_words(slow[n], strlen(slow[n]), &nw, tailor_underscore);
+      words += nw;
+    }
+  bench_report("utf8_fold_words (slow)", started, words, "words");
+}
+
+static void test_fold_words(void) {
+  size_t t, n, ngot, i;
+  char **w, buffer[64];
+
+  for(t = 0; t < NFTEST; ++t) {
+    w = utf8_fold_words(ftest[t].in, strlen(ftest[t].in), &ngot, 0);
+    insist(w != NULL);
+    for(i = 0; i < ngot && ftest[t].expect[i]; ++i)
+      check_string(w[i], ftest[t].expect[i]);
+    check_integer(ngot, i);
+    insist(ftest[t].expect[i] == NULL);
+  }
+  insist(utf8_fold_words("\xC3", 1, &ngot, 0) == NULL);
+  for(t = 0; t < NWTEST; ++t)
+    check_fold_words(wtest[t].in, 0);
+  for(t = 0; t < NFTEST; ++t) {
+    check_fold_words(ftest[t].in, 0);
+    check_fold_words(ftest[t].in, tailor_underscore);
+  }
+  for(n = 0; n < NNAMES; ++n)
+    check_fold_words(names[n], tailor_underscore);
+  /* Every Latin-1 character, in awkward company */
+  for(n = 1; n < 256; ++n) {
+    const char *const around[] = { "a", "1", "_", ".", ":", " " };
+
+    for(i = 0; i < sizeof around / sizeof *around; ++i) {
+      if(n < 0x80)
+        snprintf(buffer, sizeof buffer, "%s%c%s1a", around[i], (int)n,
+                 around[i]);
+      else
+        snprintf(buffer, sizeof buffer, "%s%c%c%s1a", around[i],
+                 (int)(0xC0 | (n >> 6)), (int)(0x80 | (n & 0x3F)), around[i]);
+      check_fold_words(buffer, 0);
+      check_fold_words(buffer, tailor_underscore);
+    }
+  }
+  if(verbose)
+    bench_words(20000);
+}
+
+static void test_words(void) {
+  test_fold_words();
+  test_word_split();
+}
+
 TEST(words);
 
 /*
@@ -20,6 +20,7 @@
 #include "test.h"
 #include "version.h"
 #include <getopt.h>
+#include <sys/time.h>
 
 /** @brief Count of tests */
 long long tests;
@@ -128,6 +129,29 @@ const char *do_printf(const char *fmt, ...) {
   return s;
 }
 
+/** @brief Return the time in seconds, for benchmarks */
+double bench_now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/** @brief Report the result of a benchmark
+ * @param name Name of what was measured
+ * @param started Start time from bench_now()
+ * @param count Number of units processed
+ * @param unit Name of the unit
+ *
+ * Benchmarks are only run with --verbose, and report on stderr.
+ */
+void bench_report(const char *name, double started, double count,
+                  const char *unit) {
+  const double elapsed = bench_now() - started;
+
+  fprintf(stderr, "%-24s %10.0f %s/s\n", name, count / elapsed, unit);
+}
+
 /** @brief Jump buffer for exitfn() testing */
 jmp_buf fatal_env;
 
@@ -174,6 +174,9 @@ const char *format(const char *s);
 const char *format_utf32(const uint32_t *s);
 uint32_t *ucs4parse(const char *s);
 const char *do_printf(const char *fmt, ...);
+double bench_now(void);
+void bench_report(const char *name, double started, double count,
+                  const char *unit);
 void test_init(int argc, char **argv);
 
 extern jmp_buf fatal_env;
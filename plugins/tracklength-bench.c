@@ -0,0 +1,144 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file plugins/tracklength-bench.c
+ * @brief Benchmark and cross-check track length computation
+ *
+ * Usage: tracklength-bench [--check] [--iterations N] FILE...
+ *
+ * For each file, computes the length both from its headers and by scanning it
+ * (as disorder-rescan would have to if the headers were no use), and reports
+ * both answers and the average time for each.  With @c --check, the exit
+ * status is nonzero if any file can't be measured from its headers or if the
+ * two answers differ by more than a second.
+ *
+ * Point it at a directory of real-world files to get representative numbers;
+ * "make check" runs it over the sample files in sounds/.
+ */
+#include "tracklength.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/** @brief Length functions for one format */
+struct tl_format {
+  /** @brief Filename extension */
+  const char *ext;
+
+  /** @brief Compute length from headers */
+  long (*headers)(const char *path);
+
+  /** @brief Compute length by scanning */
+  long (*scan)(const char *path);
+};
+
+/** @brief Known formats
+ *
+ * WAV files are always measured from their headers.
+ */
+static const struct tl_format formats[] = {
+  { ".flac", tl_flac_headers, tl_flac_scan },
+  { ".mp3", tl_mp3_headers, tl_mp3_scan },
+  { ".ogg", tl_ogg_headers, tl_ogg_scan },
+  { ".wav", tl_wav, tl_wav },
+};
+
+#define NFORMATS (sizeof formats / sizeof *formats)
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "check", no_argument, 0, 'c' },
+  { "iterations", required_argument, 0, 'n' },
+  { 0, 0, 0, 0 }
+};
+
+/** @brief Time one length function
+ * @param fn Function to time
+ * @param path File to measure
+ * @param iterations Number of times to call @p fn
+ * @param usp Where to store average time per call in microseconds
+ * @return Length reported by @p fn
+ */
+static long timed(long (*fn)(const char *), const char *path,
+                  int iterations, double *usp) {
+  struct timeval before, after;
+  long length = -1;
+  int n;
+
+  gettimeofday(&before, 0);
+  for(n = 0; n < iterations; ++n)
+    length = fn(path);
+  gettimeofday(&after, 0);
+  *usp = ((after.tv_sec - before.tv_sec) * 1000000.0
+          + (after.tv_usec - before.tv_usec)) / iterations;
+  return length;
+}
+
+int main(int argc, char **argv) {
+  int n, iterations = 100, check = 0, failed = 0;
+  size_t f;
+  long lh, ls;
+  double uh, us, total_h = 0, total_s = 0;
+
+  while((n = getopt_long(argc, argv, "hcn:", options, 0)) >= 0) {
+    switch(n) {
+    case 'h':
+      printf("Usage:\n"
+             "  tracklength-bench [OPTIONS] FILE...\n"
+             "Options:\n"
+             "  --help, -h              Display usage message\n"
+             "  --check, -c             Fail if methods disagree\n"
+             "  --iterations N, -n N    Repeat each measurement N times\n");
+      return 0;
+    case 'c': check = 1; break;
+    case 'n': iterations = atoi(optarg); break;
+    default: return 1;
+    }
+  }
+  if(iterations < 1)
+    iterations = 1;
+  printf("%-40s %8s %10s %8s %10s\n",
+         "file", "headers", "us/call", "scan", "us/call");
+  for(n = optind; n < argc; ++n) {
+    const char *ext = strrchr(argv[n], '.');
+    for(f = 0; f < NFORMATS && !(ext && !strcasecmp(ext, formats[f].ext)); ++f)
+      ;
+    if(f >= NFORMATS)
+      continue;
+    lh = timed(formats[f].headers, argv[n], iterations, &uh);
+    ls = timed(formats[f].scan, argv[n], iterations, &us);
+    total_h += uh;
+    total_s += us;
+    printf("%-40s %8ld %10.1f %8ld %10.1f\n", argv[n], lh, uh, ls, us);
+    if(check && (lh < 0 || ls < 0 || labs(lh - ls) > 1)) {
+      fprintf(stderr, "%s: headers say %ld, scan says %ld\n",
+              argv[n], lh, ls);
+      failed = 1;
+    }
+  }
+  printf("%-40s %8s %10.1f %8s %10.1f\n", "total", "", total_h, "", total_s);
+  return failed;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -17,6 +17,10 @@
  */
 /** @file plugins/tracklength-flac.c
  * @brief Compute track lengths for FLAC files
+ *
+ * The length is in the STREAMINFO block, which is always the first metadata
+ * block, so normally we need only read a few dozen bytes.  libFLAC is used as
+ * a fallback if the file doesn't look as expected.
  */
 #include "tracklength.h"
 #include <FLAC/stream_decoder.h>
@@ -68,7 +72,47 @@ static FLAC__StreamDecoderWriteStatus flac_write
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
-long tl_flac(const char *path) {
+/** @brief Compute the length of a FLAC file from its STREAMINFO block
+ * @param path Path to file
+ * @return Length in seconds, or -1 if it cannot be determined this way
+ */
+long tl_flac_headers(const char *path) {
+  unsigned char h[42];
+  unsigned long rate;
+  unsigned long long samples;
+  off_t start;
+  int fd;
+  long duration = -1;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;                          /* tl_flac_scan() will report it */
+  /* There might be an ID3v2 tag before the FLAC stream */
+  if((start = tl_skip_id3v2(fd, path)) < 0)
+    goto done;
+  /* "fLaC", then a STREAMINFO metadata block header (type 0, length 34) */
+  if(tl_read(fd, h, sizeof h, start, path) != sizeof h
+     || memcmp(h, "fLaC", 4)
+     || (h[4] & 0x7F) != 0
+     || h[5] != 0 || h[6] != 0 || h[7] != 34)
+    goto done;
+  /* 20 bits of sample rate, 3 of channels, 5 of sample size, then 36 bits of
+   * total samples */
+  rate = ((unsigned long)h[18] << 12) + (h[19] << 4) + (h[20] >> 4);
+  samples = ((unsigned long long)(h[21] & 15) << 32)
+    + ((unsigned long)h[22] << 24) + (h[23] << 16) + (h[24] << 8) + h[25];
+  if(rate)
+    /* FLAC uses 0 to mean unknown and conveniently so do we */
+    duration = (samples + rate - 1) / rate;
+done:
+  close(fd);
+  return duration;
+}
+
+/** @brief Compute the length of a FLAC file using libFLAC
+ * @param path Path to file
+ * @return Length in seconds or -1 on error
+ */
+long tl_flac_scan(const char *path) {
   FLAC__StreamDecoder *sd = 0;
   FLAC__StreamDecoderInitStatus is;
   struct flac_state state[1];
@@ -92,6 +136,14 @@ fail:
   return state->duration;
 }
 
+long tl_flac(const char *path) {
+  long duration;
+
+  if((duration = tl_flac_headers(path)) >= 0)
+    return duration;
+  return tl_flac_scan(path);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
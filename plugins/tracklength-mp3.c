@@ -17,11 +17,222 @@
  */
 /** @file plugins/tracklength-mp3.c
  * @brief Compute track lengths for MP3 files
+ *
+ * Most MP3 files can be measured from their first few frames:
+ * - VBR files usually start with a Xing (or VBRI) frame giving the number of
+ *   frames.  The LAME extension to the Xing frame also gives the encoder
+ *   padding, which we subtract.
+ * - LAME writes an equivalent "Info" frame into CBR files.
+ * - Otherwise, if the first few frames all have the same bit rate we assume
+ *   the file is CBR and estimate its length from its size.
+ *
+ * Only if none of these work do we fall back to scan_mp3(), which may need to
+ * read the whole file.
  */
 #include "tracklength.h"
 #include <mad.h>
 #include "madshim.h"
 
+/** @brief Maximum amount of data to read from the start of the file
+ *
+ * This is enough for @ref MP3_CBR_FRAMES frames at any bit rate.
+ */
+#define MP3_HEAD_SIZE 65536
+
+/** @brief Number of frames with the same bit rate needed to assume CBR */
+#define MP3_CBR_FRAMES 20
+
+/** @brief Xing header flag: frame count present */
+#define XING_FRAMES 0x0001
+
+/** @brief Xing header flag: byte count present */
+#define XING_BYTES 0x0002
+
+/** @brief Xing header flag: seek table present */
+#define XING_TOC 0x0004
+
+/** @brief Xing header flag: quality indicator present */
+#define XING_SCALE 0x0008
+
+/** @brief A decoded MPEG audio frame header */
+struct mp3_frame {
+  /** @brief Layer (1-3) */
+  int layer;
+
+  /** @brief Nonzero for MPEG-2 and MPEG-2.5 */
+  int lsf;
+
+  /** @brief Nonzero for single-channel frames */
+  int mono;
+
+  /** @brief Bit rate in bits/second */
+  long bitrate;
+
+  /** @brief Sample rate in Hz */
+  long rate;
+
+  /** @brief Samples per channel per frame */
+  long samples;
+
+  /** @brief Frame length in bytes, including the header */
+  size_t length;
+};
+
+/** @brief Decode an MPEG audio frame header
+ * @param p Pointer to 4 bytes of header
+ * @param f Where to store decoded header
+ * @return 0 on success, -1 if not a valid header
+ *
+ * Free-format frames are rejected, since their length can't be determined
+ * from the header.
+ */
+static int mp3_frame(const unsigned char *p, struct mp3_frame *f) {
+  /* Bit rates in kbit/s, indexed by lsf, layer-1 and bit rate index */
+  static const short bitrates[2][3][15] = {
+    {
+      { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+      { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+      { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    },
+    {
+      { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+      { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+      { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+    },
+  };
+  /* Sample rates indexed by version and sample rate index */
+  static const long rates[4][3] = {
+    { 11025, 12000, 8000 },             /* MPEG-2.5 */
+    { 0, 0, 0 },                        /* reserved */
+    { 22050, 24000, 16000 },            /* MPEG-2 */
+    { 44100, 48000, 32000 },            /* MPEG-1 */
+  };
+  const int version = (p[1] >> 3) & 3;
+  const int layer = 4 - ((p[1] >> 1) & 3);
+  const int bitrate_index = p[2] >> 4;
+  const int rate_index = (p[2] >> 2) & 3;
+  const int padding = (p[2] >> 1) & 1;
+
+  if(p[0] != 0xFF || (p[1] & 0xE0) != 0xE0
+     || version == 1 || layer == 4
+     || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3)
+    return -1;
+  f->layer = layer;
+  f->lsf = version != 3;
+  f->mono = (p[3] >> 6) == 3;
+  f->bitrate = 1000L * bitrates[f->lsf][layer - 1][bitrate_index];
+  f->rate = rates[version][rate_index];
+  if(layer == 1) {
+    f->samples = 384;
+    f->length = (12 * f->bitrate / f->rate + padding) * 4;
+  } else {
+    f->samples = (layer == 3 && f->lsf) ? 576 : 1152;
+    f->length = f->samples / 8 * f->bitrate / f->rate + padding;
+  }
+  return 0;
+}
+
+/** @brief Read a big-endian 32-bit value */
+static unsigned long get32(const unsigned char *p) {
+  return ((unsigned long)p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+/** @brief Compute the length of an MP3 file from its headers
+ * @param path Path to file
+ * @return Length in seconds, or -1 if it cannot be determined this way
+ */
+long tl_mp3_headers(const char *path) {
+  static unsigned char head[MP3_HEAD_SIZE];
+  struct mp3_frame f, g;
+  struct stat sb;
+  off_t start, end;
+  ssize_t got;
+  size_t n, pos, x;
+  int fd, nframes;
+  long duration = -1;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;                          /* tl_mp3_scan() will report it */
+  if(fstat(fd, &sb) < 0) {
+    disorder_error(errno, "error calling stat on %s", path);
+    goto done;
+  }
+  /* Find the extent of the audio data, excluding any ID3 tags */
+  if((start = tl_skip_id3v2(fd, path)) < 0)
+    goto done;
+  end = sb.st_size;
+  if(end - start >= 128) {
+    if((got = tl_read(fd, head, 3, end - 128, path)) < 0)
+      goto done;
+    if(got == 3 && !memcmp(head, "TAG", 3))
+      end -= 128;
+  }
+  if(start >= end)
+    goto done;
+  if((got = tl_read(fd, head, sizeof head, start, path)) < 0)
+    goto done;
+  n = (off_t)got < end - start ? (size_t)got : (size_t)(end - start);
+  /* Find the first frame.  To avoid being fooled by stray sync bits we insist
+   * that it is followed by another frame of the same kind. */
+  for(pos = 0; pos + 4 <= n; ++pos)
+    if(!mp3_frame(head + pos, &f)
+       && (pos + f.length + 4 > n
+           || (!mp3_frame(head + pos + f.length, &g)
+               && g.layer == f.layer
+               && g.rate == f.rate)))
+      break;
+  if(pos + 4 > n)
+    goto done;
+  /* Look for a Xing or Info frame.  It follows the side information. */
+  x = pos + 4;
+  if(f.layer == 3)
+    x += f.lsf ? (f.mono ? 9 : 17) : (f.mono ? 17 : 32);
+  if(f.layer == 3 && x + 12 <= n
+     && (!memcmp(head + x, "Xing", 4) || !memcmp(head + x, "Info", 4))) {
+    const unsigned long flags = get32(head + x + 4);
+    if(flags & XING_FRAMES) {
+      unsigned long long samples
+        = (unsigned long long)get32(head + x + 8) * f.samples;
+      /* Skip the remaining Xing fields to find the LAME extension */
+      x += 12;
+      if(flags & XING_BYTES)
+        x += 4;
+      if(flags & XING_TOC)
+        x += 100;
+      if(flags & XING_SCALE)
+        x += 4;
+      if(x + 24 <= n && !memcmp(head + x, "LAME", 4)) {
+        /* Encoder delay and padding, 12 bits each */
+        const unsigned long skip = ((head[x + 21] << 4) + (head[x + 22] >> 4)
+                                    + ((head[x + 22] & 15) << 8)
+                                    + head[x + 23]);
+        if(skip < samples)
+          samples -= skip;
+      }
+      duration = (samples + f.rate - 1) / f.rate;
+      goto done;
+    }
+  }
+  /* Look for a VBRI frame, which is at a fixed offset */
+  x = pos + 4 + 32;
+  if(f.layer == 3 && x + 18 <= n && !memcmp(head + x, "VBRI", 4)) {
+    const unsigned long long samples
+      = (unsigned long long)get32(head + x + 14) * f.samples;
+    duration = (samples + f.rate - 1) / f.rate;
+    goto done;
+  }
+  /* See if the file looks like CBR */
+  for(x = pos, nframes = 0; nframes < MP3_CBR_FRAMES && x + 4 <= n;
+      x += g.length, ++nframes)
+    if(mp3_frame(head + x, &g) || g.bitrate != f.bitrate)
+      goto done;                        /* Junk or VBR */
+  duration = ((unsigned long long)(end - start - pos) * 8 + f.bitrate - 1)
+    / f.bitrate;
+done:
+  close(fd);
+  return duration;
+}
+
 static void *mmap_file(const char *path, size_t *lengthp) {
   int fd;
   void *base;
@@ -50,7 +261,11 @@ error:
   return 0;
 }
 
-long tl_mp3(const char *path) {
+/** @brief Compute the length of an MP3 file by scanning it
+ * @param path Path to file
+ * @return Length in seconds or -1 on error
+ */
+long tl_mp3_scan(const char *path) {
   size_t length;
   void *base;
   buffer b;
@@ -62,6 +277,14 @@ long tl_mp3(const char *path) {
   return b.duration.seconds + !!b.duration.fraction;
 }
 
+long tl_mp3(const char *path) {
+  long duration;
+
+  if((duration = tl_mp3_headers(path)) >= 0)
+    return duration;
+  return tl_mp3_scan(path);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -17,11 +17,133 @@
  */
 /** @file plugins/tracklength-ogg.c
  * @brief Compute track lengths for OGG files
+ *
+ * For the common case of a file containing a single Vorbis stream, the length
+ * is the granule position (i.e. sample count) of the last page divided by the
+ * sample rate from the identification header.  So we need only read the first
+ * page and the last few kilobytes of the file.
+ *
+ * Anything more complicated, such as chained or multiplexed streams, is left
+ * to libvorbisfile.
  */
 #include "tracklength.h"
 #include <vorbis/vorbisfile.h>
 
-long tl_ogg(const char *path) {
+/** @brief Amount of the end of the file to search for the last page
+ *
+ * This is enough for the largest possible OGG page.
+ */
+#define OGG_TAIL_SIZE 65536
+
+/** @brief Size of the fixed part of an OGG page header */
+#define OGG_HEADER_SIZE 27
+
+/** @brief Read a little-endian 32-bit value */
+static unsigned long get32le(const unsigned char *p) {
+  return ((unsigned long)p[3] << 24) + (p[2] << 16) + (p[1] << 8) + p[0];
+}
+
+/** @brief Return the length of the OGG page at @p p, or 0
+ * @param p Possible start of page
+ * @param n Bytes available at @p p
+ * @return Page length, or 0 if there is no complete page at @p p
+ */
+static size_t ogg_page(const unsigned char *p, size_t n) {
+  size_t len, i;
+
+  if(n < OGG_HEADER_SIZE || memcmp(p, "OggS", 4) || p[4] != 0)
+    return 0;
+  len = OGG_HEADER_SIZE + p[26];
+  if(len > n)
+    return 0;
+  for(i = 0; i < p[26]; ++i)
+    len += p[OGG_HEADER_SIZE + i];
+  return len <= n ? len : 0;
+}
+
+/** @brief Return value from ogg_last_page() when no page found */
+#define NO_PAGE ((size_t)-1)
+
+/** @brief Follow a sequence of OGG pages to the end of a buffer
+ * @param buffer Buffer containing the end of the file
+ * @param n Size of buffer
+ * @param pos Offset to start at
+ * @return Offset of the last page in the buffer, or @ref NO_PAGE
+ */
+static size_t ogg_last_page(const unsigned char *buffer, size_t n,
+                            size_t pos) {
+  size_t len;
+
+  while((len = ogg_page(buffer + pos, n - pos))) {
+    if(pos + len == n)
+      return pos;
+    pos += len;
+  }
+  return NO_PAGE;
+}
+
+/** @brief Compute the length of an OGG file from its first and last pages
+ * @param path Path to file
+ * @return Length in seconds, or -1 if it cannot be determined this way
+ */
+long tl_ogg_headers(const char *path) {
+  static unsigned char buffer[OGG_TAIL_SIZE];
+  struct stat sb;
+  unsigned long serial, rate;
+  unsigned long long granule;
+  size_t n, pos, len, data, last = NO_PAGE;
+  ssize_t got;
+  off_t offset;
+  int fd;
+  long duration = -1;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;                          /* tl_ogg_scan() will report it */
+  if(fstat(fd, &sb) < 0) {
+    disorder_error(errno, "error calling stat on %s", path);
+    goto done;
+  }
+  /* The first page must start a Vorbis stream, with the identification
+   * header packet */
+  if((got = tl_read(fd, buffer, 512, 0, path)) < 0)
+    goto done;
+  n = got;
+  if(!(len = ogg_page(buffer, n)) || !(buffer[5] & 2))
+    goto done;
+  data = OGG_HEADER_SIZE + buffer[26];
+  if(data + 16 > len || memcmp(buffer + data, "\x01vorbis", 7))
+    goto done;
+  serial = get32le(buffer + 14);
+  if(!(rate = get32le(buffer + data + 12)))
+    goto done;
+  /* Find the last page.  We look for a sequence of pages running right up to
+   * the end of the file, so that stray "OggS" strings in the audio data
+   * don't fool us. */
+  offset = sb.st_size > OGG_TAIL_SIZE ? sb.st_size - OGG_TAIL_SIZE : 0;
+  if((got = tl_read(fd, buffer, sb.st_size - offset, offset, path)) < 0)
+    goto done;
+  n = got;
+  for(pos = 0; pos + OGG_HEADER_SIZE <= n; ++pos)
+    if((last = ogg_last_page(buffer, n, pos)) != NO_PAGE)
+      break;
+  /* The last page must belong to the same stream as the first one, otherwise
+   * the file is chained */
+  if(last == NO_PAGE || get32le(buffer + last + 14) != serial)
+    goto done;
+  granule = ((unsigned long long)get32le(buffer + last + 10) << 32
+             | get32le(buffer + last + 6));
+  if(granule != ~0ULL)                  /* -1 means no packet ends here */
+    duration = (granule + rate - 1) / rate;
+done:
+  close(fd);
+  return duration;
+}
+
+/** @brief Compute the length of an OGG file using libvorbisfile
+ * @param path Path to file
+ * @return Length in seconds or -1 on error
+ */
+long tl_ogg_scan(const char *path) {
   OggVorbis_File vf;
   FILE *fp = 0;
   double length;
@@ -38,6 +160,14 @@ error:
   return -1;
 }
 
+long tl_ogg(const char *path) {
+  long duration;
+
+  if((duration = tl_ogg_headers(path)) >= 0)
+    return duration;
+  return tl_ogg_scan(path);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -37,6 +37,57 @@ static const struct {
 };
 #define N_FILE_FORMATS (int)(sizeof file_formats / sizeof *file_formats)
 
+/** @brief Read part of a file
+ * @param fd File to read
+ * @param buffer Where to put data
+ * @param n Number of bytes to read
+ * @param offset Offset in file to read from
+ * @param path Filename for error messages
+ * @return Number of bytes read, which is less than @p n at EOF, or -1 on error
+ */
+ssize_t tl_read(int fd, void *buffer, size_t n, off_t offset,
+                const char *path) {
+  size_t got = 0;
+  ssize_t r;
+
+  while(got < n) {
+    r = pread(fd, (char *)buffer + got, n - got, offset + got);
+    if(r < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_error(errno, "error reading %s", path);
+      return -1;
+    }
+    if(r == 0)
+      break;
+    got += r;
+  }
+  return got;
+}
+
+/** @brief Find the end of any ID3v2 tag at the start of a file
+ * @param fd File to read
+ * @param path Filename for error messages
+ * @return Offset of first byte after the tag (0 if none), or -1 on error
+ *
+ * ID3v2 tags are found at the start of MP3 files and sometimes FLAC files.
+ * They can be large, for instance if they include cover art.
+ */
+off_t tl_skip_id3v2(int fd, const char *path) {
+  unsigned char h[10];
+  ssize_t n;
+
+  if((n = tl_read(fd, h, sizeof h, 0, path)) < 0)
+    return -1;
+  if(n < (ssize_t)sizeof h || memcmp(h, "ID3", 3) || h[3] == 0xFF
+     || ((h[6] | h[7] | h[8] | h[9]) & 0x80))
+    return 0;
+  /* Size is 'syncsafe' i.e. 7 bits per byte, and excludes the header and
+   * footer */
+  return 10 + ((off_t)h[6] << 21) + (h[7] << 14) + (h[8] << 7) + h[9]
+    + (h[5] & 0x10 ? 10 : 0);
+}
+
 long disorder_tracklength(const char attribute((unused)) *track,
 			  const char *path) {
   const char *ext = strrchr(path, '.');
@@ -41,6 +41,21 @@ long tl_wav(const char *path);
 long tl_mp3(const char *path);
 long tl_flac(const char *path);
 
+/* The tl_FORMAT() functions above first try to find the length by reading
+ * only the file's headers (and for OGG its last page).  The _headers variants
+ * return -1 if this isn't possible, and the _scan variants are the fallback
+ * which may read much more of the file. */
+long tl_ogg_headers(const char *path);
+long tl_ogg_scan(const char *path);
+long tl_mp3_headers(const char *path);
+long tl_mp3_scan(const char *path);
+long tl_flac_headers(const char *path);
+long tl_flac_scan(const char *path);
+
+ssize_t tl_read(int fd, void *buffer, size_t n, off_t offset,
+                const char *path);
+off_t tl_skip_id3v2(int fd, const char *path);
+
 #endif /* TRACKLENGTH_H */
 
 /*
@@ -32,7 +32,7 @@ complete -o default \
              tags new rtp-address adduser users edituser deluser userinfo
              setup-guest schedule-del schedule-list
              schedule-set-global schedule-unset-global schedule-play
-             adopt
+             adopt speaker-stats metrics
              playlist-del playlist-get playlist-set playlists
              -h --help -H --help-commands --version -V --config -c
              --length --debug -d" \
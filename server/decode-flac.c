@@ -44,24 +44,11 @@ static FLAC__StreamDecoderWriteStatus flac_write
      const FLAC__Frame *frame,
      const FLAC__int32 *const buffer[],
      void attribute((unused)) *client_data) {
-  size_t n, c;
-
-  output_header(frame->header.sample_rate,
+  output_planar(frame->header.sample_rate,
                 frame->header.channels,
                 frame->header.bits_per_sample,
-                (frame->header.channels * frame->header.blocksize
-                 * frame->header.bits_per_sample) / 8,
-                ENDIAN_BIG);
-  for(n = 0; n < frame->header.blocksize; ++n) {
-    for(c = 0; c < frame->header.channels; ++c) {
-      switch(frame->header.bits_per_sample) {
-      case 8: output_8(buffer[c][n]); break;
-      case 16: output_16(buffer[c][n]); break;
-      case 24: output_24(buffer[c][n]); break;
-      case 32: output_32(buffer[c][n]); break;
-      }
-    }
-  }
+                buffer,
+                frame->header.blocksize);
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -39,7 +39,7 @@ static inline unsigned long prng(unsigned long state)
 
 /** @brief Generic linear sample quantize and dither routine
  * Filched from mpg321, which credits it to Robert Leslie */
-static long audio_linear_dither(mad_fixed_t sample,
+static inline long audio_linear_dither(mad_fixed_t sample,
 				struct audio_dither *dither) {
   unsigned int scalebits;
   mad_fixed_t output, mask, rnd;
@@ -92,31 +92,43 @@ static long audio_linear_dither(mad_fixed_t sample,
   return output >> scalebits;
 }
 
+/** @brief Quantize and dither a block of samples for one channel
+ * @param out Where to put first 16-bit sample
+ * @param stride Distance between output samples (i.e. channel count)
+ * @param in Input samples
+ * @param n Number of samples
+ * @param dither Dithering state for this channel
+ *
+ * The noise shaping feeds each sample's error into the next, so a channel
+ * has to be done in order; but doing a whole channel at once keeps the state
+ * in registers and the output goes straight into the block to be written.
+ */
+static void dither_block(int16_t *out, size_t stride,
+                         const mad_fixed_t *in, size_t n,
+                         struct audio_dither *dither) {
+  struct audio_dither d = *dither;
+
+  while(n--) {
+    *out = audio_linear_dither(*in++, &d);
+    out += stride;
+  }
+  *dither = d;
+}
+
 /** @brief MP3 output callback */
 static enum mad_flow mp3_output(void attribute((unused)) *data,
 				struct mad_header const *header,
 				struct mad_pcm *pcm) {
-  size_t n = pcm->length;
-  const mad_fixed_t *l = pcm->samples[0], *r = pcm->samples[1];
-  static struct audio_dither ld[1], rd[1];
-
-  output_header(header->samplerate,
-		pcm->channels,
-		16,
-                2 * pcm->channels * pcm->length,
-                ENDIAN_BIG);
-  switch(pcm->channels) {
-  case 1:
-    while(n--)
-      output_16(audio_linear_dither(*l++, ld));
-    break;
-  case 2:
-    while(n--) {
-      output_16(audio_linear_dither(*l++, ld));
-      output_16(audio_linear_dither(*r++, rd));
-    }
-    break;
-  }
+  static struct audio_dither dither[2];
+  const size_t nbytes = 2 * pcm->channels * pcm->length;
+  int16_t *const buffer = output_buffer(nbytes);
+  unsigned c;
+
+  for(c = 0; c < pcm->channels && c < 2; ++c)
+    dither_block(buffer + c, pcm->channels, pcm->samples[c], pcm->length,
+                 &dither[c]);
+  output_block(header->samplerate, pcm->channels, 16, ENDIAN_NATIVE,
+               buffer, nbytes);
   return MAD_FLOW_CONTINUE;
 }
 
@@ -70,15 +70,15 @@ void decode_ogg(void) {
     disorder_fatal(0, "ov_open_callbacks %s: %d", path, err);
   if(!(vi = ov_info(vf, 0/*link*/)))
     disorder_fatal(0, "ov_info %s: failed", path);
-  while((n = ov_read(vf, input_buffer, sizeof input_buffer, 1/*bigendianp*/,
+  while((n = ov_read(vf, input_buffer, sizeof input_buffer,
+                     ENDIAN_NATIVE == ENDIAN_BIG/*bigendianp*/,
                      2/*bytes/word*/, 1/*signed*/, &bitstream))) {
     if(n < 0)
       disorder_fatal(0, "ov_read %s: %ld", path, n);
     if(bitstream > 0)
       disorder_fatal(0, "only single-bitstream ogg files are supported");
-    output_header(vi->rate, vi->channels, 16/*bits*/, n, ENDIAN_BIG);
-    if(fwrite(input_buffer, 1, n, outputfp) < (size_t)n)
-      disorder_fatal(errno, "decoding %s: writing sample data", path);
+    output_block(vi->rate, vi->channels, 16/*bits*/, ENDIAN_NATIVE,
+                 input_buffer, n);
   }
 }
 
@@ -26,8 +26,7 @@ static int wav_write(struct wavfile attribute((unused)) *f,
                      const char *data,
                      size_t nbytes,
                      void attribute((unused)) *u) {
-  if(fwrite(data, 1, nbytes, outputfp) < nbytes)
-    disorder_fatal(errno, "decoding %s: writing sample data", path);
+  output_data(data, nbytes);
   return 0;
 }
 
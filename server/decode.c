@@ -27,6 +27,8 @@
 
 #include "wav.h"
 
+#include <sys/uio.h>
+
 
 /** @brief Encoding lookup table type */
 struct decoder {
@@ -36,12 +38,38 @@ struct decoder {
   void (*decode)(void);
 };
 
-FILE *outputfp;
+int outputfd;
 const char *path;
 char input_buffer[INPUT_BUFFER_SIZE];
 int input_count;
 
-/** @brief Write a block header
+/** @brief Write everything described by an iovec array
+ * @param iov Array of buffers (modified)
+ * @param n Number of elements in @p iov
+ */
+static void output_iov(struct iovec *iov, int n) {
+  ssize_t written;
+
+  while(n > 0) {
+    if((written = writev(outputfd, iov, n)) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "decoding %s: output error", path);
+    }
+    while(n > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --n;
+    }
+    if(n > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
+/** @brief Fill in a block header
+ * @param header Where to store header
  * @param rate Sample rate in Hz
  * @param channels Channel count (currently only 1 or 2 supported)
  * @param bits Bits per sample (must be a multiple of 8, no more than 64)
@@ -51,13 +79,12 @@ int input_count;
  * Checks that the sample format is a supported one (so other calls do not have
  * to) and calls disorder_fatal() on error.
  */
-void output_header(int rate,
-                   int channels,
-                   int bits,
-                   int nbytes,
-                   int endian) {
-  struct stream_header header;
-
+static void make_header(struct stream_header *header,
+                        int rate,
+                        int channels,
+                        int bits,
+                        size_t nbytes,
+                        int endian) {
   if(bits <= 0 || bits % 8 || bits > 64)
     disorder_fatal(0, "decoding %s: unsupported sample size %d bits",
                    path, bits);
@@ -66,13 +93,173 @@ void output_header(int rate,
                    path, channels);
   if(rate <= 0)
     disorder_fatal(0, "decoding %s: nonsensical sample rate %dHz", path, rate);
-  header.rate = rate;
-  header.bits = bits;
-  header.channels = channels;
-  header.endian = endian;
-  header.nbytes = nbytes;
-  if(fwrite(&header, sizeof header, 1, outputfp) < 1)
-    disorder_fatal(errno, "decoding %s: writing format header", path);
+  header->rate = rate;
+  header->bits = bits;
+  header->channels = channels;
+  header->endian = endian;
+  header->nbytes = nbytes;
+}
+
+/** @brief Write a block header
+ * @param rate Sample rate in Hz
+ * @param channels Channel count (currently only 1 or 2 supported)
+ * @param bits Bits per sample (must be a multiple of 8, no more than 64)
+ * @param nbytes Total number of data bytes
+ * @param endian @ref ENDIAN_BIG or @ref ENDIAN_LITTLE
+ *
+ * The data must follow with output_data().  Where the data is all to hand
+ * at once, output_block() is better.
+ */
+void output_header(int rate,
+                   int channels,
+                   int bits,
+                   int nbytes,
+                   int endian) {
+  struct stream_header header;
+  struct iovec iov[1];
+
+  make_header(&header, rate, channels, bits, nbytes, endian);
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof header;
+  output_iov(iov, 1);
+}
+
+/** @brief Write an end-of-track marker
+ *
+ * Called after the whole track has been decoded.  See
+ * stream_header_is_end().
+ */
+static void output_end(void) {
+  struct stream_header header;
+  struct iovec iov[1];
+
+  memset(&header, 0, sizeof header);
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof header;
+  output_iov(iov, 1);
+}
+
+/** @brief Write sample data
+ * @param data Sample data
+ * @param nbytes Number of bytes to write
+ */
+void output_data(const void *data, size_t nbytes) {
+  struct iovec iov[1];
+
+  iov[0].iov_base = (void *)data;
+  iov[0].iov_len = nbytes;
+  output_iov(iov, 1);
+}
+
+/** @brief Write a block header and its sample data
+ * @param rate Sample rate in Hz
+ * @param channels Channel count (currently only 1 or 2 supported)
+ * @param bits Bits per sample (must be a multiple of 8, no more than 64)
+ * @param endian @ref ENDIAN_BIG or @ref ENDIAN_LITTLE
+ * @param data Sample data
+ * @param nbytes Number of bytes of sample data
+ *
+ * The header and data are written with a single system call (unless the
+ * output is full).
+ */
+void output_block(int rate,
+                  int channels,
+                  int bits,
+                  int endian,
+                  const void *data,
+                  size_t nbytes) {
+  struct stream_header header;
+  struct iovec iov[2];
+
+  make_header(&header, rate, channels, bits, nbytes, endian);
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof header;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = nbytes;
+  output_iov(iov, 2);
+}
+
+/** @brief Return a buffer to build a block of output in
+ * @param nbytes Minimum size of buffer
+ * @return Pointer to buffer
+ *
+ * The same buffer is returned each time (though it may move as it grows), so
+ * its contents must be written before the next call.
+ */
+void *output_buffer(size_t nbytes) {
+  static void *buffer;
+  static size_t size;
+
+  if(nbytes > size) {
+    buffer = xrealloc_noptr(buffer, nbytes);
+    size = nbytes;
+  }
+  return buffer;
+}
+
+/** @brief Interleave and write planar sample data
+ * @param rate Sample rate in Hz
+ * @param channels Channel count (currently only 1 or 2 supported)
+ * @param bits Bits per sample (8, 16, 24 or 32)
+ * @param planes Samples for each channel
+ * @param frames Number of samples in each channel
+ *
+ * The samples are written as one block, in native byte order, so that
+ * disorder-normalize can usually pass them straight through.
+ */
+void output_planar(int rate,
+                   int channels,
+                   int bits,
+                   const int32_t *const *planes,
+                   size_t frames) {
+  const size_t nbytes = frames * channels * (bits / 8);
+  void *const buffer = output_buffer(nbytes);
+  size_t n;
+  int c;
+
+  for(c = 0; c < channels; ++c) {
+    const int32_t *const p = planes[c];
+    switch(bits) {
+    case 8: {
+      int8_t *const o = (int8_t *)buffer + c;
+      for(n = 0; n < frames; ++n)
+        o[n * channels] = p[n];
+      break;
+    }
+    case 16: {
+      int16_t *const o = (int16_t *)buffer + c;
+      for(n = 0; n < frames; ++n)
+        o[n * channels] = p[n];
+      break;
+    }
+    case 24: {
+      uint8_t *const o = (uint8_t *)buffer + 3 * c;
+      for(n = 0; n < frames; ++n) {
+        const uint32_t v = p[n];
+#if ENDIAN_NATIVE == ENDIAN_BIG
+        o[3 * n * channels] = v >> 16;
+        o[3 * n * channels + 1] = v >> 8;
+        o[3 * n * channels + 2] = v;
+#else
+        o[3 * n * channels] = v;
+        o[3 * n * channels + 1] = v >> 8;
+        o[3 * n * channels + 2] = v >> 16;
+#endif
+      }
+      break;
+    }
+    case 32: {
+      int32_t *const o = (int32_t *)buffer + c;
+      for(n = 0; n < frames; ++n)
+        o[n * channels] = p[n];
+      break;
+    }
+    default:
+      disorder_fatal(0, "decoding %s: unsupported sample size %d bits",
+                     path, bits);
+    }
+  }
+  output_block(rate, channels, bits, ENDIAN_NATIVE, buffer, nbytes);
 }
 
 /** @brief Lookup table of decoders */
@@ -125,11 +312,10 @@ int main(int argc, char **argv) {
     disorder_fatal(0, "missing filename");
   if(optind + 1 < argc)
     disorder_fatal(0, "excess arguments");
-  if((e = getenv("DISORDER_RAW_FD"))) {
-    if(!(outputfp = fdopen(atoi(e), "wb")))
-      disorder_fatal(errno, "fdopen");
-  } else
-    outputfp = stdout;
+  if((e = getenv("DISORDER_RAW_FD")))
+    outputfd = atoi(e);
+  else
+    outputfd = 1;
   path = argv[optind];
   for(n = 0;
       decoders[n].pattern
@@ -139,7 +325,9 @@ int main(int argc, char **argv) {
   if(!decoders[n].pattern)
     disorder_fatal(0, "cannot determine file type for %s", path);
   decoders[n].decode();
-  xfclose(outputfp);
+  output_end();
+  if(close(outputfd) < 0)
+    disorder_fatal(errno, "decoding %s: output error", path);
   return 0;
 }
 
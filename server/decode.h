@@ -27,8 +27,8 @@
 
 #define INPUT_BUFFER_SIZE 1048576
   
-/** @brief Output file */
-extern FILE *outputfp;
+/** @brief Output file descriptor */
+extern int outputfd;
 
 /** @brief Input filename */
 extern const char *path;
@@ -39,41 +39,24 @@ extern char input_buffer[INPUT_BUFFER_SIZE];
 /** @brief Number of bytes read into buffer */
 extern int input_count;
 
-/** @brief Write an 8-bit word */
-static inline void output_8(int n) {
-  if(putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
-}
-
-/** @brief Write a 16-bit word in bigendian format */
-static inline void output_16(uint16_t n) {
-  if(putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
-}
-
-/** @brief Write a 24-bit word in bigendian format */
-static inline void output_24(uint32_t n) {
-  if(putc(n >> 16, outputfp) < 0
-     || putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
-}
-
-/** @brief Write a 32-bit word in bigendian format */
-static inline void output_32(uint32_t n) {
-  if(putc(n >> 24, outputfp) < 0
-     || putc(n >> 16, outputfp) < 0
-     || putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
-}
-
 void output_header(int rate,
                    int channels,
                    int bits,
                    int nbytes,
                    int endian);
+void output_data(const void *data, size_t nbytes);
+void output_block(int rate,
+                  int channels,
+                  int bits,
+                  int endian,
+                  const void *data,
+                  size_t nbytes);
+void output_planar(int rate,
+                   int channels,
+                   int bits,
+                   const int32_t *const *planes,
+                   size_t frames);
+void *output_buffer(size_t nbytes);
 
 void decode_mp3(void);
 void decode_ogg(void);
@@ -64,6 +64,7 @@
 #include "kvp.h"
 #include "log.h"
 #include "logfd.h"
+#include "loudness.h"
 #include "mem.h"
 #include "mime.h"
 #include "printf.h"
@@ -164,6 +165,13 @@ void queue_moveafter(struct queue_entry *target,
 void queue_fix_sofar(struct queue_entry *q);
 /* Fix up the sofar field for standalone players */
 
+void queue_diff_insert(const struct queue_entry *q);
+void queue_diff_remove(const struct queue_entry *q);
+/* Report an incremental change to the queue to the event log */
+
+char **queue_resume(const char *generation, const char *serial);
+/* Return the queue changes a log client missed, or a queue_reset line */
+
 void schedule_init(ev_source *ev);
 const char *schedule_add(ev_source *ev,
 			 struct kvp *actiondata);
@@ -178,6 +186,10 @@ void play(ev_source *ev);
 /* try to play something, if playing is enabled and nothing is playing
  * already */
 
+void play_soon(ev_source *ev);
+/* arrange for play(), add_random_track() and prepare_lookahead() to be called
+ * on the next event loop iteration */
+
 /** @brief Return true if @p represents a true flag */
 int flag_enabled(const char *s);
 
@@ -213,6 +225,10 @@ void speaker_setup(ev_source *ev);
 void speaker_reload(void);
 /* Tell the speaker process to reload its configuration. */
 
+char **speaker_stats(void);
+/* Return the speaker's health information as a NULL-terminated list of
+ * lines. */
+
 int pause_playing(const char *who);
 /* Pause the current track.  Return 0 on success, -1 on error.  WHO
  * can be 0. */
@@ -228,6 +244,10 @@ void abandon(ev_source *ev,
 	     struct queue_entry *q);
 /* Abandon a possibly-prepared track. */
 
+void prepare_lookahead(ev_source *ev);
+/* Prepare the tracks at the head of the queue and abandon prepared tracks
+ * that have moved a long way from it. */
+
 void add_random_track(ev_source *ev);
 /* If random play is enabled then try to add a track to the queue. */
 
@@ -376,6 +396,14 @@ int play_background(ev_source *ev,
 #define START_HARDFAIL 1   /**< @brief Track is broken. */
 #define START_SOFTFAIL 2   /**< @brief Track OK, system (temporarily?) broken */
 
+char *pcmcache_key(const char *track);
+char *pcmcache_path(const char *key);
+int pcmcache_lookup(const char *key);
+void pcmcache_discard(const char *key);
+int pcmcache_create(const char *key, char **tmpp);
+void pcmcache_commit(const char *key, const char *tmp);
+void pcmcache_expire(void);
+
 void periodic_mount_check(ev_source *ev_);
 
 /** @brief How often to check for new (or old) filesystems */
@@ -149,14 +149,6 @@ static void periodic_volume_check(ev_source attribute((unused)) *ev_) {
   }
 }
 
-static void periodic_play_check(ev_source *ev_) {
-  play(ev_);
-}
-
-static void periodic_add_random(ev_source *ev_) {
-  add_random_track(ev_);
-}
-
 /* We fix the path to include the bindir and sbindir we were installed into */
 static void fix_path(void) {
   char *path = getenv("PATH");
@@ -329,10 +321,10 @@ int main(int argc, char **argv) {
   create_periodic(ev, periodic_database_gc, 60, 0);
   /* Check the volume immediately and then once a minute */
   create_periodic(ev, periodic_volume_check, 60, 1);
-  /* Check for a playable track once a second */
-  create_periodic(ev, periodic_play_check, 1, 0);
-  /* Try adding a random track immediately and once every two seconds */
-  create_periodic(ev, periodic_add_random, 2, 1);
+  /* Start playing (and pick a random track if necessary) as soon as the event
+   * loop is running.  After that play.c reacts to events rather than
+   * polling. */
+  play_soon(ev);
   /* Issue a rescan when devices are mounted or unmouted */
   create_periodic(ev, periodic_mount_check, MOUNT_CHECK_INTERVAL, 1);
   /* enter the event loop */
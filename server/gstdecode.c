@@ -23,6 +23,8 @@
 
 #include "speaker-protocol.h"
 
+#include <sys/uio.h>
+
 /* Ugh.  It turns out that libxml tries to define a function called
  * `attribute', and it's included by GStreamer for some unimaginable reason.
  * So undefine it here.  We'll want GCC attributes for special effects, but
@@ -48,7 +50,7 @@
 #define END ((void *)0)
 #define N(v) (sizeof(v)/sizeof(*(v)))
 
-static FILE *fp;
+static int outfd;
 static const char *file;
 static GstAppSink *appsink;
 static GstElement *pipeline;
@@ -86,6 +88,69 @@ static gdouble fallback = 0.0;
 
 static struct stream_header hdr;
 
+/* GStreamer tends to deliver audio in rather small buffers -- typically a
+ * few kilobytes -- and writing each one as a separate frame costs a system
+ * call and a trip round disorder-normalize's read loop apiece.  So we gather
+ * small buffers up here and send them on as one frame.  Buffers which won't
+ * fit are sent straight from GStreamer's memory, together with anything
+ * already gathered, without copying.
+ */
+#define OUTBUF_SIZE 65536
+static char outbuf[OUTBUF_SIZE];
+static size_t outlen = 0;
+
+/* Write everything described by the IOV vector, which has N elements.  The
+ * vector is modified.
+ */
+static void writev_all(struct iovec *iov, int n)
+{
+  ssize_t w;
+
+  while(n) {
+    if((w = writev(outfd, iov, n)) < 0) {
+      if(errno == EINTR) continue;
+      disorder_fatal(errno, "output");
+    }
+    while(n && (size_t)w >= iov->iov_len) { w -= iov->iov_len; iov++; n--; }
+    if(n) { iov->iov_base = (char *)iov->iov_base + w; iov->iov_len -= w; }
+  }
+}
+
+/* Write a single frame consisting of the gathered data in `outbuf'
+ * followed by N bytes at P, preceded by a header unless we're streaming.
+ * This is a single system call in the usual case.
+ */
+static void write_frame(const void *p, size_t n)
+{
+  struct stream_header h = hdr;
+  struct iovec iov[3];
+  int i = 0;
+
+  h.nbytes = outlen + n;
+  if(!h.nbytes) return;
+  if(!(flags&f_stream))
+    { iov[i].iov_base = &h; iov[i].iov_len = sizeof(h); i++; }
+  if(outlen) { iov[i].iov_base = outbuf; iov[i].iov_len = outlen; i++; }
+  if(n) { iov[i].iov_base = (void *)p; iov[i].iov_len = n; i++; }
+  writev_all(iov, i);
+  outlen = 0;
+}
+
+/* Send on any gathered data. */
+static void flush_output(void) { write_frame(0, 0); }
+
+/* Output N bytes of sample data from P. */
+static void output(const void *p, size_t n)
+{
+  if(outlen + n > OUTBUF_SIZE)
+    write_frame(p, n);
+  else {
+    memcpy(outbuf + outlen, p, n);
+    outlen += n;
+    if(outlen == OUTBUF_SIZE) flush_output();
+  }
+}
+
 /* Report the pads of an element ELT, as iterated by IT; WHAT is an adjective
  * phrase describing the pads for use in the output.
  */
@@ -353,6 +418,9 @@ static GstFlowReturn cb_preroll(GstAppSink *sink, gpointer UNUSED u)
   GstCaps *caps = gst_sample_get_caps(samp);
 #endif
 
+  /* Anything we've gathered must go out in the old format. */
+  flush_output();
+
 #ifdef HAVE_GST_AUDIO_INFO_FROM_CAPS
 
   /* Parse the audio format information out of the caps.  There's a handy
@@ -425,21 +493,15 @@ static GstFlowReturn cb_buffer(GstAppSink *sink, gpointer UNUSED u)
   /* Make sure we actually have a grip on the sample format here. */
   if(!hdr.rate) disorder_fatal(0, "format unset");
 
-  /* Write out a frame of audio data. */
+  /* Pass on the audio data. */
 #ifdef HAVE_GSTREAMER_0_10
-  hdr.nbytes = GST_BUFFER_SIZE(buf);
-  if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
-     fwrite(GST_BUFFER_DATA(buf), 1, hdr.nbytes, fp) != hdr.nbytes)
-    disorder_fatal(errno, "output");
+  output(GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
 #else
   for(i = 0, n = gst_buffer_n_memory(buf); i < n; i++) {
     mem = gst_buffer_peek_memory(buf, i);
     if(!gst_memory_map(mem, &map, GST_MAP_READ))
       disorder_fatal(0, "failed to map sample buffer");
-    hdr.nbytes = map.size;
-    if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
-       fwrite(map.data, 1, map.size, fp) != map.size)
-      disorder_fatal(errno, "output");
+    output(map.data, map.size);
     gst_memory_unmap(mem, &map);
   }
 #endif
@@ -594,16 +656,24 @@ int main(int argc, char *argv[])
   prepare_pipeline();
 
   /* Set up the output file. */
-  if((e = getenv("DISORDER_RAW_FD")) != 0) {
-    if((fp = fdopen(atoi(e), "wb")) == 0) disorder_fatal(errno, "fdopen");
-  } else
-    fp = stdout;
+  if((e = getenv("DISORDER_RAW_FD")) != 0) outfd = atoi(e);
+  else outfd = 1;
 
   /* Let's go. */
   decode();
 
-  /* And now we're done. */
-  xfclose(fp);
+  /* And now we're done.  Tell disorder-normalize that the track is
+   * complete. */
+  flush_output();
+  if(!(flags&f_stream)) {
+    struct stream_header h;
+    struct iovec iov[1];
+
+    memset(&h, 0, sizeof(h));
+    iov[0].iov_base = &h; iov[0].iov_len = sizeof(h);
+    writev_all(iov, 1);
+  }
+  if(close(outfd)) disorder_fatal(errno, "output");
   return (0);
 }
 
@@ -28,6 +28,15 @@
 
 static char buffer[1024 * 1024];
 
+/** @brief File descriptor for the PCM cache entry being written, or -1 */
+static int cachefd = -1;
+
+/** @brief Temporary path of the PCM cache entry being written */
+static char *cachetmp;
+
+/** @brief Number of bytes written to the PCM cache entry */
+static uintmax_t cachebytes;
+
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -36,6 +45,7 @@ static const struct option options[] = {
   { "no-debug", no_argument, 0, 'D' },
   { "syslog", no_argument, 0, 's' },
   { "no-syslog", no_argument, 0, 'S' },
+  { "cache", required_argument, 0, 'C' },
   { 0, 0, 0, 0 }
 };
 
@@ -49,6 +59,7 @@ static void attribute((noreturn)) help(void) {
 	  "  --config PATH, -c PATH  Set configuration file\n"
 	  "  --debug, -d             Turn on debugging\n"
           "  --[no-]syslog           Force logging\n"
+          "  --cache KEY             Write output to the PCM cache\n"
           "\n"
           "Audio format normalizer for DisOrder.  Not intended to be run\n"
           "directly.\n");
@@ -56,6 +67,38 @@ static void attribute((noreturn)) help(void) {
   exit(0);
 }
 
+/** @brief Give up on the PCM cache entry being written, if any */
+static void cache_abandon(void) {
+  if(cachefd != -1) {
+    close(cachefd);
+    cachefd = -1;
+    unlink(cachetmp);
+  }
+}
+
+/** @brief Add output to the PCM cache entry being written, if any
+ * @param ptr Output data
+ * @param n Number of bytes
+ *
+ * Errors writing to the cache are logged but otherwise don't affect playing
+ * the track.
+ */
+static void cache_write(const void *ptr, size_t n) {
+  while(cachefd != -1 && n > 0) {
+    const ssize_t w = write(cachefd, ptr, n);
+    if(w < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_error(errno, "writing %s", cachetmp);
+      cache_abandon();
+    } else {
+      ptr = (const char *)ptr + w;
+      n -= w;
+      cachebytes += w;
+    }
+  }
+}
+
 /** @brief Copy bytes from one file descriptor to another
  * @param infd File descriptor read from
  * @param outfd File descriptor to write to
@@ -83,6 +126,7 @@ static void copy(int infd, int outfd, size_t n) {
 	disorder_fatal(errno, "write error");
       written += w;
     }
+    cache_write(buffer, readden);
   }
 }
 
@@ -132,6 +176,7 @@ static void converted(uint8_t *bytes,
          bytes[1],
          bytes[2],
          bytes[3]);*/
+  cache_write(bytes, nbytes);
   while(nbytes > 0) {
     ssize_t n = write(1, bytes, nbytes);
     if(n < 0)
@@ -144,14 +189,16 @@ static void converted(uint8_t *bytes,
 
 int main(int argc, char attribute((unused)) **argv) {
   struct stream_header header, latest_format;
+  int complete = 0;
   int n, outfd = -1, logsyslog = !isatty(2), rs_in_use = 0;
   pid_t pid = -1;
   struct resampler rs[1];
+  const char *cachekey = NULL;
 
   set_progname(argv);
   if(!setlocale(LC_CTYPE, ""))
     disorder_fatal(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "hVc:dDSs", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "hVc:dDSsC:", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'V': version("disorder-normalize");
@@ -160,6 +207,7 @@ int main(int argc, char attribute((unused)) **argv) {
     case 'D': debugging = 0; break;
     case 'S': logsyslog = 0; break;
     case 's': logsyslog = 1; break;
+    case 'C': cachekey = optarg; break;
     default: disorder_fatal(0, "invalid option");
     }
   }
@@ -170,6 +218,17 @@ int main(int argc, char attribute((unused)) **argv) {
     openlog(progname, LOG_PID, LOG_DAEMON);
     log_default = &log_syslog;
   }
+#if HAVE_SAMPLERATE_H
+  /* Keep a copy of the output in the PCM cache.  Without libsamplerate, sox
+   * writes directly to our output and we never see it, so we don't bother. */
+  if(cachekey && config->pcm_cache) {
+    cachefd = pcmcache_create(cachekey, &cachetmp);
+    /* If we fail part way through then the partial cache entry must not be
+     * left lying around.  If we're killed then pcmcache_expire() will
+     * eventually tidy up. */
+    atexit(cache_abandon);
+  }
+#endif
   memset(&latest_format, 0, sizeof latest_format);
   for(;;) {
     /* Read one header */
@@ -189,6 +248,10 @@ int main(int argc, char attribute((unused)) **argv) {
     }
     if(!n)
       break;
+    if(stream_header_is_end(&header)) {
+      complete = 1;
+      continue;
+    }
     D(("NEW HEADER: %"PRIu32" bytes %"PRIu32"Hz %"PRIu8" channels %"PRIu8" bits %"PRIu8" endian",
        header.nbytes, header.rate, header.channels, header.bits, header.endian));
     /* Sanity check the header */
@@ -341,6 +404,18 @@ int main(int argc, char attribute((unused)) **argv) {
   }
   if(rs_in_use)
     resample_close(rs);
+  /* The cache entry is only usable if the decoder said that it decoded the
+   * whole track; EOF alone might mean that it died part way through */
+  if(cachefd != -1 && !complete)
+    cache_abandon();
+  if(cachefd != -1 && cachebytes) {
+    if(close(cachefd) < 0) {
+      disorder_error(errno, "closing %s", cachetmp);
+      unlink(cachetmp);
+    } else
+      pcmcache_commit(cachekey, cachetmp);
+    cachefd = -1;
+  }
   return 0;
 }
 
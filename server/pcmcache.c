@@ -0,0 +1,266 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2026 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/pcmcache.c
+ * @brief Cache of decoded audio
+ *
+ * If @c pcm_cache is set then disorder-normalize keeps a copy of the audio it
+ * sends to the speaker, and when the same track is prepared again the speaker
+ * maps the copy into memory instead of a decoder being run.
+ *
+ * Entries are named after a hash of the track name, the file's size and
+ * modification time, and the sample format.  So changing a file, or changing
+ * the sample format, just leads to a cache miss; the stale entry eventually
+ * drops out of the cache.
+ *
+ * An entry's modification time is updated whenever it is used, and when the
+ * cache grows beyond @c pcm_cache_size the least recently used entries are
+ * removed.
+ *
+ * Entries are written under a temporary name and renamed into place when the
+ * decoder reaches the end of the track, so a partial entry is never used.
+ * Temporary files left behind by writers that were killed (which is how
+ * scratched and removed tracks are stopped) are removed once they have not
+ * been written to for @ref PCMCACHE_STALE seconds.
+ */
+#include "disorder-server.h"
+#include <dirent.h>
+
+/** @brief Age at which abandoned temporary files are removed */
+#define PCMCACHE_STALE 3600
+
+/** @brief Suffix for complete cache entries */
+#define PCMCACHE_SUFFIX ".pcm"
+
+/** @brief Suffix for cache entries being written */
+#define PCMCACHE_TMP_SUFFIX ".tmp"
+
+/** @brief Compute the cache key for a track
+ * @param track Track name
+ * @return Cache key, or NULL if the track cannot be cached
+ *
+ * The key is a string of 40 hex digits, so it fits in @ref SM_CACHED
+ * messages.  Only tracks that are plain files can be cached.
+ */
+char *pcmcache_key(const char *track) {
+  struct stat sb;
+  char *s;
+  unsigned char digest[20];
+
+  if(!config->pcm_cache)
+    return NULL;
+  if(stat(track, &sb) < 0 || !S_ISREG(sb.st_mode))
+    return NULL;
+  byte_xasprintf(&s, "%s\n%jd\n%jd\n%lu/%u/%u/%u",
+                 track,
+                 (intmax_t)sb.st_size,
+                 (intmax_t)sb.st_mtime,
+                 (unsigned long)config->sample_format.rate,
+                 (unsigned)config->sample_format.channels,
+                 (unsigned)config->sample_format.bits,
+                 (unsigned)config->sample_format.endian);
+  gcry_md_hash_buffer(GCRY_MD_SHA1, digest, s, strlen(s));
+  return hex(digest, sizeof digest);
+}
+
+/** @brief Return the path of a cache entry
+ * @param key Cache key
+ * @return Path to cache entry
+ */
+char *pcmcache_path(const char *key) {
+  char *path;
+
+  byte_xasprintf(&path, "%s/%s" PCMCACHE_SUFFIX, config->pcm_cache, key);
+  return path;
+}
+
+/** @brief Look up a cache entry
+ * @param key Cache key
+ * @return 1 if the entry exists, else 0
+ *
+ * If the entry exists it is marked as recently used.
+ */
+int pcmcache_lookup(const char *key) {
+  const char *path = pcmcache_path(key);
+  struct stat sb;
+
+  if(stat(path, &sb) < 0) {
+    if(errno != ENOENT)
+      disorder_error(errno, "checking %s", path);
+    return 0;
+  }
+  if(!S_ISREG(sb.st_mode) || !sb.st_size)
+    return 0;
+  if(utimes(path, NULL) < 0)
+    disorder_error(errno, "touching %s", path);
+  return 1;
+}
+
+/** @brief Remove a cache entry
+ * @param key Cache key
+ */
+void pcmcache_discard(const char *key) {
+  const char *path = pcmcache_path(key);
+
+  if(unlink(path) < 0 && errno != ENOENT)
+    disorder_error(errno, "removing %s", path);
+}
+
+/** @brief Create a new cache entry
+ * @param key Cache key
+ * @param tmpp Where to store the path of the temporary file
+ * @return File descriptor to write the entry to, or -1 on error
+ *
+ * Write the audio data to the returned file descriptor, and then either
+ * call pcmcache_commit() if it is complete or remove @p *tmpp if not.
+ */
+int pcmcache_create(const char *key, char **tmpp) {
+  int fd;
+
+  byte_xasprintf(tmpp, "%s/%s.%lu" PCMCACHE_TMP_SUFFIX,
+                 config->pcm_cache, key, (unsigned long)getpid());
+  if((fd = open(*tmpp, O_WRONLY|O_CREAT|O_EXCL, 0666)) < 0)
+    disorder_error(errno, "creating %s", *tmpp);
+  return fd;
+}
+
+/** @brief Complete a new cache entry
+ * @param key Cache key
+ * @param tmp Path of the temporary file from pcmcache_create()
+ *
+ * The caller should already have closed the file descriptor.  If the cache is
+ * now too big, old entries are removed.
+ */
+void pcmcache_commit(const char *key, const char *tmp) {
+  const char *path = pcmcache_path(key);
+
+  if(rename(tmp, path) < 0) {
+    disorder_error(errno, "renaming %s to %s", tmp, path);
+    unlink(tmp);
+    return;
+  }
+  pcmcache_expire();
+}
+
+/** @brief One file found in the cache directory */
+struct pcmcache_file {
+  /** @brief Path to file */
+  char *path;
+
+  /** @brief Last use */
+  time_t mtime;
+
+  /** @brief Size in bytes */
+  off_t size;
+};
+
+/** @brief Order cache entries by last use */
+static int pcmcache_compare(const void *av, const void *bv) {
+  const struct pcmcache_file *a = av, *b = bv;
+
+  if(a->mtime < b->mtime)
+    return -1;
+  if(a->mtime > b->mtime)
+    return 1;
+  return strcmp(a->path, b->path);
+}
+
+/** @brief Return nonzero if @p name ends with @p suffix */
+static int has_suffix(const char *name, const char *suffix) {
+  const size_t nl = strlen(name), sl = strlen(suffix);
+
+  return nl > sl && !strcmp(name + nl - sl, suffix);
+}
+
+/** @brief Enforce the cache size limit
+ *
+ * Removes the least recently used entries until the total size of the
+ * remainder is no more than @c pcm_cache_size, and removes stale temporary
+ * files.
+ */
+void pcmcache_expire(void) {
+  DIR *dp;
+  struct dirent *de;
+  struct stat sb;
+  struct pcmcache_file *files = NULL;
+  size_t nfiles = 0, nslots = 0, n;
+  uintmax_t total = 0;
+  char *path;
+  const time_t now = xtime(0);
+
+  if(!config->pcm_cache)
+    return;
+  if(!(dp = opendir(config->pcm_cache))) {
+    disorder_error(errno, "opening directory %s", config->pcm_cache);
+    return;
+  }
+  while((errno = 0, de = readdir(dp))) {
+    const int entry = has_suffix(de->d_name, PCMCACHE_SUFFIX);
+    if(!entry && !has_suffix(de->d_name, PCMCACHE_TMP_SUFFIX))
+      continue;
+    byte_xasprintf(&path, "%s/%s", config->pcm_cache, de->d_name);
+    if(stat(path, &sb) < 0) {
+      /* We raced with another expiry */
+      xfree(path);
+      continue;
+    }
+    if(!entry) {
+      /* Temporary file, maybe abandoned */
+      if(now - sb.st_mtime > PCMCACHE_STALE && unlink(path) < 0
+         && errno != ENOENT)
+        disorder_error(errno, "removing %s", path);
+      xfree(path);
+      continue;
+    }
+    if(nfiles >= nslots) {
+      nslots = nslots ? 2 * nslots : 64;
+      files = xrealloc(files, nslots * sizeof *files);
+    }
+    files[nfiles].path = path;
+    files[nfiles].mtime = sb.st_mtime;
+    files[nfiles].size = sb.st_size;
+    total += sb.st_size;
+    ++nfiles;
+  }
+  if(errno)
+    disorder_error(errno, "reading directory %s", config->pcm_cache);
+  closedir(dp);
+  if(total > (uintmax_t)config->pcm_cache_size) {
+    qsort(files, nfiles, sizeof *files, pcmcache_compare);
+    for(n = 0;
+        n < nfiles && total > (uintmax_t)config->pcm_cache_size;
+        ++n) {
+      D(("expiring %s", files[n].path));
+      if(unlink(files[n].path) < 0 && errno != ENOENT)
+        disorder_error(errno, "removing %s", files[n].path);
+      else
+        total -= files[n].size;
+    }
+  }
+  for(n = 0; n < nfiles; ++n)
+    xfree(files[n].path);
+  xfree(files);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -22,9 +22,22 @@
  */
 
 #include "disorder-server.h"
+#include "timeval.h"
 
 #define SPEAKER "disorder-speaker"
 
+/** @brief Initial delay before retrying a soft failure to start, in ms */
+#define PLAY_RETRY_MIN 100
+
+/** @brief Maximum delay before retrying a soft failure to start, in ms */
+#define PLAY_RETRY_MAX 5000
+
+/** @brief Initial delay before retrying a failed random choice, in ms */
+#define RANDOM_RETRY_MIN 2000
+
+/** @brief Maximum delay before retrying a failed random choice, in ms */
+#define RANDOM_RETRY_MAX 60000
+
 /** @brief The current playing track or NULL */
 struct queue_entry *playing;
 
@@ -37,7 +50,7 @@ static int start_child(struct queue_entry *q,
                        void attribute((unused)) *bgdata);
 static int prepare_child(struct queue_entry *q, 
                          const struct pbgc_params *params,
-                         void attribute((unused)) *bgdata);
+                         void *bgdata);
 static void ensure_next_scratch(ev_source *ev);
 
 /** @brief File descriptor of our end of the socket to the speaker */
@@ -62,6 +75,110 @@ static int speaker_terminated(ev_source attribute((unused)) *ev,
   disorder_fatal(0, "speaker subprocess %s", wstat(status));
 }
 
+/** @brief Latest health information from the speaker */
+static struct speaker_telemetry speaker_telemetry;
+
+/** @brief Set if @ref speaker_telemetry was a track's final report */
+static int speaker_telemetry_final;
+
+/** @brief Final health information for the most recent track to stop */
+static struct speaker_telemetry speaker_telemetry_last;
+
+/** @brief Act on health information from the speaker
+ * @param st Health information
+ * @param final Nonzero if this is the final report for @c st->id
+ *
+ * Underruns are logged and reported in the event log as soon as we hear
+ * about them.  Each track's final report goes to the event log too.
+ */
+static void speaker_health(const struct speaker_telemetry *st, int final) {
+  char a[16], b[16], c[16], d[16], e[16];
+
+  if(st->underruns != speaker_telemetry.underruns
+     || st->underrun_ms != speaker_telemetry.underrun_ms) {
+    snprintf(a, sizeof a, "%"PRIu32,
+             st->underruns - speaker_telemetry.underruns);
+    snprintf(b, sizeof b, "%"PRIu32,
+             st->underrun_ms - speaker_telemetry.underrun_ms);
+    disorder_info("speaker underrun playing %s: %s new, %sms silence",
+                  st->id, a, b);
+    eventlog("underrun", st->id, a, b, (char *)0);
+  }
+  if(final) {
+    snprintf(a, sizeof a, "%"PRIu32, st->start_ms);
+    snprintf(b, sizeof b, "%"PRIu32, st->buffer_min_ms);
+    snprintf(c, sizeof c, "%"PRIu32, st->buffer_avg_ms);
+    snprintf(d, sizeof d, "%"PRIu32, st->decode_percent);
+    snprintf(e, sizeof e, "%"PRIu32, st->track_underruns);
+    eventlog("playback_stats", st->id,
+             "start_ms", a,
+             "buffer_min_ms", b,
+             "buffer_avg_ms", c,
+             "decode_percent", d,
+             "underruns", e,
+             (char *)0);
+    speaker_telemetry_last = *st;
+  }
+  speaker_telemetry = *st;
+  speaker_telemetry_final = final;
+}
+
+/** @brief Append a track's health information to a list
+ * @param v List to append to
+ * @param what Label for the line
+ * @param st Health information
+ */
+static void speaker_stats_track(struct vector *v, const char *what,
+                                const struct speaker_telemetry *st) {
+  char *s;
+
+  byte_xasprintf(&s, "%s %s start_ms %"PRIu32" buffer_min_ms %"PRIu32
+                 " buffer_avg_ms %"PRIu32" decode_percent %"PRIu32
+                 " underruns %"PRIu32,
+                 what, st->id, st->start_ms, st->buffer_min_ms,
+                 st->buffer_avg_ms, st->decode_percent, st->track_underruns);
+  vector_append(v, s);
+}
+
+/** @brief Return the speaker's health information
+ * @return NULL-terminated list of lines
+ *
+ * Used by the @c speaker-stats command.
+ */
+char **speaker_stats(void) {
+  const struct speaker_telemetry *const st = &speaker_telemetry;
+  struct vector v[1];
+  char *s;
+  int n;
+
+  vector_init(v);
+  byte_xasprintf(&s, "underruns %"PRIu32, st->underruns);
+  vector_append(v, s);
+  byte_xasprintf(&s, "underrun_ms %"PRIu32, st->underrun_ms);
+  vector_append(v, s);
+  byte_xasprintf(&s, "longest_underrun_ms %"PRIu32, st->longest_underrun_ms);
+  vector_append(v, s);
+  byte_xasprintf(&s, "callback_max_us %"PRIu32, st->callback_max_us);
+  vector_append(v, s);
+  for(n = 0; n < SPEAKER_CALLBACK_BUCKETS; ++n) {
+    if(n == 0)
+      byte_xasprintf(&s, "callback_us 0-1 %"PRIu32, st->callback_us[n]);
+    else if(n < SPEAKER_CALLBACK_BUCKETS - 1)
+      byte_xasprintf(&s, "callback_us %d-%d %"PRIu32,
+                     1 << n, (2 << n) - 1, st->callback_us[n]);
+    else
+      byte_xasprintf(&s, "callback_us %d+ %"PRIu32,
+                     1 << n, st->callback_us[n]);
+    vector_append(v, s);
+  }
+  if(*st->id && !speaker_telemetry_final)
+    speaker_stats_track(v, "playing", st);
+  if(*speaker_telemetry_last.id)
+    speaker_stats_track(v, "last", &speaker_telemetry_last);
+  vector_terminate(v);
+  return v->vec;
+}
+
 /** @brief Called when we get a message from the speaker process */
 static int speaker_readable(ev_source *ev, int fd,
 			    void attribute((unused)) *u) {
@@ -105,9 +222,29 @@ static int speaker_readable(ev_source *ev, int fd,
       q->prepared = 1;
       /* We might be waiting to play the now-prepared track */
       play(ev);
+      /* The track might have been moved out of the look-ahead window while
+       * its decoder was starting up */
+      prepare_lookahead(ev);
     }
     break;
   }
+  case SM_CACHE_MISS: {
+    /* The speaker couldn't use the cached audio for track ID.  Forget the
+     * cache entry and prepare the track again, this time with a decoder. */
+    struct queue_entry *q;
+    for(q = qhead.next; q != &qhead && strcmp(q->id, sm.u.id); q = q->next)
+      ;
+    if(q != &qhead && q->preparing && q->cachekey) {
+      pcmcache_discard(q->cachekey);
+      q->cachekey = NULL;
+      q->preparing = 0;
+      play_soon(ev);
+    }
+    break;
+  }
+  case SM_TELEMETRY:
+    speaker_health(&sm.u.telemetry, sm.data);
+    break;
   default:
     disorder_error(0, "unknown speaker message type %d", sm.type);
   }
@@ -264,6 +401,11 @@ static int player_finished(ev_source *ev,
   if(q == playing
      && (q->type & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
     finished(ev);
+  else if(q != playing)
+    /* A decoder went away before its track started.  We might have been
+     * waiting for it, or it might have been abandoned and need preparing
+     * again, so reconsider now rather than leaving the speaker idle. */
+    play_soon(ev);
   return 0;
 }
 
@@ -282,6 +424,24 @@ static const struct stringlist *find_player(const struct queue_entry *q) {
     return &config->player.s[n];
 }
 
+/** @brief Return the gain the speaker should apply to a track
+ * @param track Track name
+ * @return Gain factor for gain16_buffer(), or 0 for none
+ *
+ * The loudness and peak are measured by disorder-rescan.  Tracks it hasn't
+ * got round to yet are played as they are.
+ */
+static long track_gain(const char *track) {
+  const char *lufs, *peak;
+
+  if(!config->loudness
+     || !(lufs = trackdb_get(track, "_loudness"))
+     || !(peak = trackdb_get(track, "_peak")))
+    return 0;
+  return loudness_gain(strtod(lufs, NULL), strtod(peak, NULL),
+                       config->loudness_target);
+}
+
 /** @brief Start to play @p q
  * @param ev Event loop
  * @param q Track to play/prepare
@@ -318,6 +478,7 @@ static int start(ev_source *ev,
     memset(sm, 0, sizeof sm);
     strcpy(sm->u.id, q->id);
     sm->type = SM_PLAY;
+    sm->data = track_gain(q->track);
     speaker_send(speaker_fd, sm);
     D(("sent SM_PLAY for %s", sm->u.id));
     /* Our caller will set playing and playing->state = playing_started */
@@ -355,14 +516,19 @@ static int start_child(struct queue_entry *q,
  *
  * Only applies to raw-format (i.e. speaker-using) players; everything else
  * gets @c START_OK.
+ *
+ * If the track's decoded audio is in the PCM cache then no decoder is run;
+ * instead the speaker is told to use the cached copy.  See @ref
+ * server/pcmcache.c.
  */
 int prepare(ev_source *ev,
 	    struct queue_entry *q) {
   const struct stringlist *player;
 
-  /* If there's a decoder (or player!) going we do nothing */
+  /* If there's a decoder (or player!) going we do nothing, unless it is on
+   * its way out, in which case we must wait for it to go */
   if(q->pid >= 0)
-    return START_OK;
+    return q->killed ? START_SOFTFAIL : START_OK;
   /* If the track is already prepared, do nothing */
   if(q->prepared || q->preparing)
     return START_OK;
@@ -373,7 +539,24 @@ int prepare(ev_source *ev,
   q->type = play_get_type(q->pl);
   if((q->type & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
     return START_OK;                    /* Not a raw player */
-  int rc = play_background(ev, player, q, prepare_child, NULL);
+  /* If we have already decoded this track then the speaker can use that */
+  char *key = pcmcache_key(q->track);
+  if(key && pcmcache_lookup(key)) {
+    struct speaker_message sm;
+    memset(&sm, 0, sizeof sm);
+    sm.type = SM_CACHED;
+    strcpy(sm.u.cached.id, q->id);
+    strcpy(sm.u.cached.key, key);
+    speaker_send(speaker_fd, &sm);
+    D(("sent SM_CACHED for %s", q->id));
+    q->cachekey = key;
+    q->preparing = 1;
+    /* The track is "in flight" until the speaker answers */
+    return START_SOFTFAIL;
+  }
+  q->cachekey = NULL;
+  q->killed = 0;
+  int rc = play_background(ev, player, q, prepare_child, key);
   if(rc == START_OK) {
     ev_child(ev, q->pid, 0, player_finished, q);
     q->preparing = 1;
@@ -394,7 +577,9 @@ int prepare(ev_source *ev,
  */
 static int prepare_child(struct queue_entry *q, 
                          const struct pbgc_params *params,
-                         void attribute((unused)) *bgdata) {
+                         void *bgdata) {
+  /* bgdata is the PCM cache key, if the output should be cached */
+  const char *key = bgdata;
   /* np will be the pipe to disorder-normalize */
   int np[2];
   if(socketpair(PF_UNIX, SOCK_STREAM, 0, np) < 0)
@@ -444,6 +629,7 @@ static int prepare_child(struct queue_entry *q,
       execlp("disorder-normalize", "disorder-normalize",
              log_default == &log_syslog ? "--syslog" : "--no-syslog",
              "--config", configfile,
+             key ? "--cache" : (char *)0, key,
              (char *)0);
       disorder_fatal(errno, "executing disorder-normalize");
       /* End of the great-grandchild of disorderd */
@@ -484,45 +670,200 @@ static void kill_player(struct queue_entry *q) {
 
 /** @brief Abandon a queue entry
  *
- * Called from c_remove() (but NOT when scratching a track).  Only does
- * anything to raw-format tracks.  Terminates the background decoder and tells
- * the speaker process to cancel the track.
+ * Called from c_remove() (but NOT when scratching a track) and when a
+ * prepared track falls out of the look-ahead window.  Only does anything to
+ * raw-format tracks.  Terminates the background decoder, if it is still
+ * running, and tells the speaker process to cancel the track.
+ *
+ * If the track remains in the queue it will be prepared again from scratch
+ * when it is next needed.
  */
 void abandon(ev_source attribute((unused)) *ev,
 	     struct queue_entry *q) {
   struct speaker_message sm;
 
-  if(q->pid < 0)
+  if(q->pid < 0 && !q->prepared && !q->cachekey)
     return;                             /* Not prepared. */
   if((q->type & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
     return;				/* Not a raw player. */
   /* Terminate the player. */
-  kill_player(q);
+  if(q->pid >= 0)
+    kill_player(q);
   /* Cancel the track. */
   memset(&sm, 0, sizeof sm);
   sm.type = SM_CANCEL;
   strcpy(sm.u.id, q->id);
   speaker_send(speaker_fd, &sm);
+  q->preparing = 0;
+  q->prepared = 0;
+  q->cachekey = NULL;
+}
+
+/** @brief Prepare the tracks at the head of the queue
+ * @param ev Event loop
+ *
+ * The first @c lookahead tracks in the queue are prepared, so that their
+ * decoders have a head start and the speaker has audio buffered for them well
+ * before they are needed.  This hides slow decoders and slow storage at track
+ * boundaries.
+ *
+ * Tracks that have been prepared but which are now at least twice that
+ * distance from the head of the queue are abandoned, releasing their decoders
+ * and speaker buffer space.  The gap between the two limits means that small
+ * rearrangements of the queue don't throw away decoded audio.  Tracks whose
+ * decoders are still starting up are left alone until the speaker reports
+ * that they have arrived, since there is nothing to cancel until then.
+ */
+void prepare_lookahead(ev_source *ev) {
+  struct queue_entry *q;
+  long n;
+
+  if(shutting_down)
+    return;
+  for(q = qhead.next, n = 0; q != &qhead; q = q->next, ++n) {
+    if(n < config->lookahead)
+      prepare(ev, q);
+    else if(n >= 2 * config->lookahead && q->prepared)
+      abandon(ev, q);
+  }
+}
+
+/* Scheduling --------------------------------------------------------------- */
+
+/* Nothing polls for a playable track.  Instead every event that might make it
+ * possible to play something (the speaker reporting a finished or arrived
+ * track, a decoder exiting, a queue edit, a random choice completing) calls
+ * play() or play_soon(), and timers are only armed to retry after a
+ * failure. */
+
+/** @brief Pending wakeup of the play scheduler, or NULL */
+static ev_timeout_handle play_wakeup;
+
+/** @brief When @ref play_wakeup is due */
+static struct timeval play_wakeup_when;
+
+/** @brief Delay before the next retry of a soft failure in ms, or 0 */
+static long play_retry_delay;
+
+/** @brief Return the time @p ms milliseconds from now */
+static struct timeval ms_from_now(long ms) {
+  struct timeval now, delta;
+
+  xgettimeofday(&now, NULL);
+  delta.tv_sec = ms / 1000;
+  delta.tv_usec = ms % 1000 * 1000;
+  return tvadd(now, delta);
+}
+
+/** @brief Called when the play scheduler wakes up */
+static int play_wakeup_fired(ev_source *ev,
+                             const struct timeval attribute((unused)) *now,
+                             void attribute((unused)) *u) {
+  play_wakeup = 0;
+  play(ev);
+  add_random_track(ev);
+  prepare_lookahead(ev);
+  return 0;
+}
+
+/** @brief Arrange for play() to be called after @p ms milliseconds
+ * @param ev Event loop
+ * @param ms Delay in milliseconds
+ *
+ * If a wakeup is already due no later than this then nothing is changed.
+ */
+static void play_after(ev_source *ev, long ms) {
+  struct timeval when = ms_from_now(ms);
+
+  if(play_wakeup) {
+    if(tvle(&play_wakeup_when, &when))
+      return;
+    ev_timeout_cancel(ev, play_wakeup);
+  }
+  play_wakeup_when = when;
+  ev_timeout(ev, &play_wakeup, &when, play_wakeup_fired, 0);
+}
+
+/** @brief Arrange for play() to be called on the next event loop iteration
+ * @param ev Event loop
+ *
+ * Use this rather than play() where the caller is in the middle of changing
+ * state that play() depends on.  Multiple calls before the event loop gets
+ * round to it are coalesced.
+ */
+void play_soon(ev_source *ev) {
+  play_after(ev, 0);
 }
 
 /* Random tracks ------------------------------------------------------------ */
 
+/** @brief Pending retry of a failed random choice, or NULL */
+static ev_timeout_handle random_retry;
+
+/** @brief Delay before the next random choice retry in ms, or 0 */
+static long random_retry_delay;
+
+/** @brief Set while waiting for a rescan to retry a random choice */
+static int random_awaiting_rescan;
+
+/** @brief Called when it's time to retry a failed random choice */
+static int random_retry_fired(ev_source *ev,
+                              const struct timeval attribute((unused)) *now,
+                              void attribute((unused)) *u) {
+  random_retry = 0;
+  add_random_track(ev);
+  return 0;
+}
+
+/** @brief Called when a rescan completes after a failed random choice */
+static void random_rescanned(void *ru) {
+  ev_source *const ev = ru;
+
+  random_awaiting_rescan = 0;
+  random_retry_delay = 0;
+  add_random_track(ev);
+}
+
 /** @brief Called with a new random track
  * @param ev Event loop
  * @param track Track name
+ *
+ * If the choice failed (for instance because there are no tracks yet) then
+ * another attempt is made when the rescan in progress completes or, if
+ * there isn't one, after an exponentially increasing delay.  Otherwise the
+ * queue is topped up to @c queue_pad without waiting.
  */
 static void chosen_random_track(ev_source *ev,
 				const char *track) {
   struct queue_entry *q;
 
-  if(!track)
+  if(!track) {
+    if(trackdb_rescan_underway()) {
+      if(!random_awaiting_rescan) {
+        random_awaiting_rescan = 1;
+        trackdb_add_rescanned(random_rescanned, ev);
+      }
+    } else if(!random_retry) {
+      struct timeval when;
+
+      if(random_retry_delay < RANDOM_RETRY_MIN)
+        random_retry_delay = RANDOM_RETRY_MIN;
+      else if((random_retry_delay *= 2) > RANDOM_RETRY_MAX)
+        random_retry_delay = RANDOM_RETRY_MAX;
+      when = ms_from_now(random_retry_delay);
+      ev_timeout(ev, &random_retry, &when, random_retry_fired, 0);
+    }
     return;
+  }
+  random_retry_delay = 0;
   /* Add the track to the queue */
   q = queue_add(track, 0, WHERE_END, NULL, origin_random);
   D(("picked %p (%s) at random", (void *)q, q->track));
   queue_write();
   /* Maybe a track can now be played */
   play(ev);
+  /* The queue might still be short */
+  add_random_track(ev);
 }
 
 /** @brief Maybe add a randomly chosen track
@@ -563,9 +904,8 @@ void play(ev_source *ev) {
   if(shutting_down || playing || !playing_is_enabled()) return;
   /* See if there's anything to play */
   if(qhead.next == &qhead) {
-    /* Queue is empty.  We could just wait around since there are periodic
-     * attempts to add a random track anyway.  However they are rarer than
-     * attempts to force a track so we initiate one now. */
+    /* Queue is empty.  Nothing else is going to fill it so we initiate a
+     * random choice now. */
     add_random_track(ev);
     /* chosen_random_track() will call play() when a new random track has been
      * added to the queue. */
@@ -591,9 +931,21 @@ void play(ev_source *ev) {
     play(ev);
     break;
   case START_SOFTFAIL:
-    /* We'll try the same track again shortly. */
+    if(q->preparing)
+      /* The decoder is starting up, or the speaker is opening the cached
+       * audio.  We'll be called again when the speaker reports that the track
+       * has arrived or if the decoder exits. */
+      break;
+    /* Something went wrong that might come right by itself.  Try the same
+     * track again shortly, backing off if it keeps happening. */
+    if(play_retry_delay < PLAY_RETRY_MIN)
+      play_retry_delay = PLAY_RETRY_MIN;
+    else if((play_retry_delay *= 2) > PLAY_RETRY_MAX)
+      play_retry_delay = PLAY_RETRY_MAX;
+    play_after(ev, play_retry_delay);
     break;
   case START_OK:
+    play_retry_delay = 0;
     /* Remove from the queue */
     if(q == qhead.next) {
       queue_remove(q, 0);
@@ -609,10 +961,9 @@ void play(ev_source *ev) {
 	     (const char *)0);
     /* Maybe add a random track. */
     add_random_track(ev);
-    /* If there is another track in the queue prepare it now.  This could
-     * potentially be a just-added random track. */
-    if(qhead.next != &qhead)
-      prepare(ev, qhead.next);
+    /* Prepare the tracks that will play next.  This could potentially include
+     * a just-added random track. */
+    prepare_lookahead(ev);
     /* Make sure there is a prepared scratch */
     ensure_next_scratch(ev);
     break;
@@ -723,6 +1074,7 @@ void scratch(const char *who, const char *id) {
         next_scratch->submitter = who;
         queue_insert_entry(&qhead, next_scratch);
         eventlog_raw("queue", queue_marshall(next_scratch), (const char *)0);
+        queue_diff_insert(next_scratch);
         next_scratch = NULL;
       }
     }
@@ -739,6 +1091,8 @@ void quitting(ev_source *ev) {
 
   /* Don't start anything new */
   shutting_down = 1;
+  ev_timeout_cancel(ev, play_wakeup);
+  ev_timeout_cancel(ev, random_retry);
   /* Shut down the current player */
   if(playing) {
     kill_player(playing);
@@ -20,6 +20,99 @@
  */
 #include "disorder-server.h"
 
+/** @brief Number of queue changes remembered for resuming log clients */
+#define QUEUE_HISTORY 256
+
+/** @brief Serial number of the most recent queue change */
+static unsigned long queue_serial;
+
+/** @brief Identifies this server instance's queue serial numbers
+ *
+ * Serial numbers restart when the server does, so resume tokens carry this
+ * too.
+ */
+static const char *queue_generation;
+
+/** @brief Recent queue changes, indexed by serial number modulo @ref
+ * QUEUE_HISTORY */
+static char *queue_history[QUEUE_HISTORY];
+
+/** @brief Report an incremental queue change
+ * @param keyword Event keyword
+ * @param raw Event arguments, after the serial number, already quoted
+ *
+ * The event is sent to the event log and remembered in @ref queue_history.
+ */
+static void queue_diff(const char *keyword, const char *raw) {
+  char *args;
+
+  if(!queue_generation)
+    queue_generation = random_id();
+  byte_xasprintf(&args, "%lu %s", ++queue_serial, raw);
+  byte_xasprintf(&queue_history[queue_serial % QUEUE_HISTORY],
+                 "%s %s", keyword, args);
+  eventlog_raw(keyword, args, (char *)0);
+}
+
+/** @brief Report that @p q has been inserted into the queue */
+void queue_diff_insert(const struct queue_entry *q) {
+  char *raw;
+
+  byte_xasprintf(&raw, "%s %s",
+                 quoteutf8(q->prev == &qhead ? "" : q->prev->id),
+                 queue_marshall(q));
+  queue_diff("queue_insert", raw);
+}
+
+/** @brief Report that @p q has been moved within the queue */
+static void queue_diff_move(const struct queue_entry *q) {
+  char *raw;
+
+  byte_xasprintf(&raw, "%s %s",
+                 quoteutf8(q->prev == &qhead ? "" : q->prev->id),
+                 quoteutf8(q->id));
+  queue_diff("queue_move", raw);
+}
+
+/** @brief Report that @p q is about to be removed from the queue */
+void queue_diff_remove(const struct queue_entry *q) {
+  queue_diff("queue_remove", quoteutf8(q->id));
+}
+
+/** @brief Find the queue changes that a log client missed
+ * @param generation Generation from the client's resume token, or NULL
+ * @param serial Serial number from the client's resume token, or NULL
+ * @return Null-terminated list of event log messages
+ *
+ * If the changes since @p serial are still known then they are returned.
+ * Otherwise a @c queue_reset message with a fresh resume token is returned, and
+ * the client must fetch the whole queue again.
+ */
+char **queue_resume(const char *generation, const char *serial) {
+  struct vector v[1];
+  long from;
+  char *reset;
+
+  if(!queue_generation)
+    queue_generation = random_id();
+  vector_init(v);
+  if(generation && serial
+     && !strcmp(generation, queue_generation)
+     && !xstrtol(&from, serial, 0, 10)
+     && from >= 0
+     && (unsigned long)from <= queue_serial
+     && queue_serial - from <= QUEUE_HISTORY) {
+    while((unsigned long)from < queue_serial)
+      vector_append(v, queue_history[++from % QUEUE_HISTORY]);
+  } else {
+    byte_xasprintf(&reset, "queue_reset %s %lu",
+                   quoteutf8(queue_generation), queue_serial);
+    vector_append(v, reset);
+  }
+  vector_terminate(v);
+  return v->vec;
+}
+
 static int find_in_list(struct queue_entry *needle,
 			int nqs, struct queue_entry **qs) {
   int n;
@@ -111,6 +204,7 @@ struct queue_entry *queue_add(const char *track, const char *submitter,
   if(submitter)
     notify_queue(track, submitter);
   eventlog_raw("queue", queue_marshall(q), (const char *)0);
+  queue_diff_insert(q);
   return q;
 }
 
@@ -160,6 +254,7 @@ int queue_move(struct queue_entry *q, int delta, const char *who) {
     notify_queue_move(q->track, who);
     sprintf(buffer, "%d", moved);
     eventlog("moved", who, (char *)0);
+    queue_diff_move(q);
   }
   
   return delta;
@@ -186,6 +281,7 @@ void queue_moveafter(struct queue_entry *target,
     /* Log the individual tracks */
     disorder_info("user %s moved %s", who, q->id);
     notify_queue_move(q->track, who);
+    queue_diff_move(q);
   }
   /* Report that the queue changed to the event log */
   eventlog("moved", who, (char *)0);
@@ -197,6 +293,7 @@ void queue_remove(struct queue_entry *which, const char *who) {
     notify_queue_move(which->track, who);
   }
   eventlog("removed", which->id, who, (const char *)0);
+  queue_diff_remove(which);
   queue_delete_entry(which);
 }
 
@@ -178,6 +178,16 @@ struct recheck_state {
   /** @brief Number of lengths computed */
   long nlength;
 
+  /** @brief Number of loudness measurements made */
+  long nloudness;
+
+  /** @brief Player for a track whose loudness is to be measured, or NULL
+   *
+   * Set by recheck_track_tid().  The measurement is done outside the
+   * transaction, since it involves decoding the whole track.
+   */
+  const struct stringlist *measure;
+
   /** @brief Linked list of tracks to recheck */
   struct recheck_track *tracks;
 };
@@ -218,6 +228,7 @@ static int recheck_track_tid(struct recheck_state *cs,
   int err, n;
   long length;
   struct kvp *data;
+  const struct stringlist *player;
 
   if((err = trackdb_getdata(trackdb_tracksdb, t->track, &data, tid)))
     return err;
@@ -244,6 +255,7 @@ static int recheck_track_tid(struct recheck_state *cs,
     ++cs->nobsolete;
     return 0;
   }
+  player = &config->player.s[n];
   /* make sure we know the length */
   if(!kvp_get(data, "_length")) {
     D(("recalculating length of %s", t->track));
@@ -263,14 +275,193 @@ static int recheck_track_tid(struct recheck_state *cs,
       }
     }
   }
+  /* see if we need to measure its loudness */
+  if(config->loudness && !kvp_get(data, "_loudness")
+     && !kvp_get(data, "_loudness_failed"))
+    cs->measure = player;
+  return 0;
+}
+
+/** @brief Read exactly @p n bytes, if possible
+ * @param fd File descriptor
+ * @param buffer Where to put data
+ * @param n Number of bytes to read
+ * @return Number of bytes read, less than @p n only at EOF; or -1 on error
+ */
+static ssize_t read_full(int fd, void *buffer, size_t n) {
+  size_t got = 0;
+  ssize_t r;
+
+  while(got < n) {
+    r = read(fd, (char *)buffer + got, n - got);
+    if(r < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_error(errno, "error reading from decoder");
+      return -1;
+    }
+    if(r == 0)
+      break;
+    got += r;
+  }
+  return got;
+}
+
+/** @brief Measure the loudness of a track
+ * @param track Track name
+ * @param player Player configuration for @p track
+ * @param lufsp Where to store integrated loudness in LUFS
+ * @param peakp Where to store sample peak in dBFS
+ * @return 0 on success, -1 on error, -2 if the measurement was cancelled
+ *
+ * Runs the track's decoder just as the server does to play it (see
+ * prepare_child() in @ref server/play.c), but reads the decoded audio itself
+ * instead of passing it on to @c disorder-normalize.  Only raw-format players
+ * can be measured.
+ */
+static int measure_loudness(const char *track,
+                            const struct stringlist *player,
+                            double *lufsp, double *peakp) {
+  const struct plugin *pl;
+  const char *rawpath;
+  const char *const *argv = (const char **)&player->s[2];
+  int argc = player->n - 2, p[2], w, ret = -1;
+  struct stream_header header;
+  struct loudness *l;
+  char buffer[65536];
+  ssize_t n = -1;
+  pid_t pid, r;
+
+  if(!(pl = open_plugin(player->s[1], 0)))
+    return -1;
+  if((play_get_type(pl) & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
+    return -1;
+  if(!(rawpath = trackdb_rawpath(track)))
+    return -1;
+  if(argc > 0 && !strcmp(argv[0], "--")) {
+    ++argv;
+    --argc;
+  }
+  D(("measuring loudness of %s", track));
+  xpipe(p);
+  if(!(pid = xfork())) {
+    exitfn = _exit;
+    xclose(p[0]);
+    snprintf(buffer, sizeof buffer, "DISORDER_RAW_FD=%d", p[1]);
+    if(putenv(buffer) < 0)
+      disorder_fatal(errno, "error calling putenv");
+    play_track(pl, argv, argc, rawpath, track);
+    _exit(0);
+  }
+  xclose(p[1]);
+  l = loudness_new();
+  while(!aborted()) {
+    if((n = read_full(p[0], &header, sizeof header)) <= 0)
+      break;
+    if((size_t)n == sizeof header && stream_header_is_end(&header))
+      continue;
+    if((size_t)n < sizeof header
+       || header.rate < 100
+       || header.channels < 1 || header.channels > 2
+       || header.bits % 8 || !header.bits || header.bits > 32
+       || (header.endian != ENDIAN_BIG && header.endian != ENDIAN_LITTLE)) {
+      disorder_error(0, "%s: unsupported or corrupt decoder output", track);
+      n = -1;
+      break;
+    }
+    while(header.nbytes > 0) {
+      n = read_full(p[0], buffer,
+                    header.nbytes < sizeof buffer
+                      ? header.nbytes : sizeof buffer);
+      if(n <= 0)
+        break;
+      loudness_feed(l, buffer, n, header.rate, header.channels, header.bits,
+                    header.endian);
+      header.nbytes -= n;
+    }
+    if(header.nbytes) {
+      n = -1;
+      break;
+    }
+  }
+  xclose(p[0]);
+  if(aborted())
+    kill(pid, SIGTERM);
+  while((r = waitpid(pid, &w, 0)) == -1 && errno == EINTR)
+    ;
+  if(r < 0) disorder_fatal(errno, "error calling waitpid");
+  /* A decoder killed by SIGTERM was stopped along with the rescan, if not by
+   * us above, and that says nothing about the track */
+  if(aborted() || (WIFSIGNALED(w) && WTERMSIG(w) == SIGTERM))
+    ret = -2;
+  else if(w)
+    disorder_error(0, "%s: decoder %s", track, wstat(w));
+  else if(!n && !loudness_result(l, lufsp, peakp))
+    ret = 0;
+  loudness_free(l);
+  return ret;
+}
+
+/** @brief Record a track's loudness
+ * @param cs Recheck state
+ * @param t Track
+ * @param lufs Integrated loudness in LUFS
+ * @param peak Sample peak in dBFS
+ * @param tid Transaction ID
+ * @return 0 or a Berkeley DB error code
+ */
+static int store_loudness(struct recheck_state *cs,
+                          const struct recheck_track *t,
+                          double lufs, double peak,
+                          DB_TXN *tid) {
+  struct kvp *data;
+  char buffer[32];
+  int err;
+
+  if((err = trackdb_getdata(trackdb_tracksdb, t->track, &data, tid)))
+    return err;
+  snprintf(buffer, sizeof buffer, "%.2f", lufs);
+  kvp_set(&data, "_loudness", buffer);
+  snprintf(buffer, sizeof buffer, "%.2f", peak);
+  kvp_set(&data, "_peak", buffer);
+  if((err = trackdb_putdata(trackdb_tracksdb, t->track, data, tid, 0)))
+    return err;
+  ++cs->nloudness;
   return 0;
 }
 
+/** @brief Record that a track's loudness can't be measured
+ * @param t Track
+ * @param tid Transaction ID
+ * @return 0 or a Berkeley DB error code
+ *
+ * This stops it being measured again on every rescan.
+ */
+static int store_loudness_failed(const struct recheck_track *t,
+                                 DB_TXN *tid) {
+  struct kvp *data;
+  int err;
+
+  if((err = trackdb_getdata(trackdb_tracksdb, t->track, &data, tid)))
+    return err;
+  kvp_set(&data, "_loudness_failed", "1");
+  return trackdb_putdata(trackdb_tracksdb, t->track, data, tid, 0);
+}
+
 static int recheck_track(struct recheck_state *cs,
                          const struct recheck_track *t) {
-  int e;
+  double lufs, peak;
+  int e, rc;
 
+  cs->measure = 0;
   WITH_TRANSACTION(recheck_track_tid(cs, t, tid));
+  if(!e && cs->measure) {
+    rc = measure_loudness(t->track, cs->measure, &lufs, &peak);
+    if(!rc)
+      WITH_TRANSACTION(store_loudness(cs, t, lufs, peak, tid));
+    else if(rc == -1)
+      WITH_TRANSACTION(store_loudness_failed(t, tid));
+  }
   return e;
 }
 
@@ -331,11 +522,11 @@ static void recheck_collection(const struct collection *c) {
     }
   }
   if(c)
-    disorder_info("rechecked %s, %ld obsoleted, %ld lengths calculated",
-                  c->root, cs.nobsolete, cs.nlength);
+    disorder_info("rechecked %s, %ld obsoleted, %ld lengths calculated, %ld loudness measured",
+                  c->root, cs.nobsolete, cs.nlength, cs.nloudness);
   else
-    disorder_info("rechecked all tracks, %ld no collection, %ld obsoleted, %ld lengths calculated",
-         cs.nnocollection, cs.nobsolete, cs.nlength);
+    disorder_info("rechecked all tracks, %ld no collection, %ld obsoleted, %ld lengths calculated, %ld loudness measured",
+         cs.nnocollection, cs.nobsolete, cs.nlength, cs.nloudness);
 }
 
 /* rescan/recheck a collection by name */
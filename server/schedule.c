@@ -360,7 +360,6 @@ static void schedule_play(ev_source *ev,
 			  struct kvp *actiondata) {
   const char *track = kvp_get(actiondata, "track");
   const char *rtrack = 0;
-  struct queue_entry *q;
 
   /* This stuff has rather a lot in common with c_play() */
   if(!track) {
@@ -376,10 +375,10 @@ static void schedule_play(ev_source *ev,
     return;
   }
   disorder_info("scheduled event %s: %s play %s", id,  who, rtrack);
-  q = queue_add(rtrack, who, WHERE_START, NULL, origin_scheduled);
+  queue_add(rtrack, who, WHERE_START, NULL, origin_scheduled);
   queue_write();
-  if(q == qhead.next && playing)
-    prepare(ev, q);
+  if(playing)
+    prepare_lookahead(ev);
   play(ev);
 }
 
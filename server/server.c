@@ -124,6 +124,12 @@ struct conn {
 
   /** @brief RTP destination (if @ref rtp_requested is nonzero) */
   struct sockaddr_storage rtp_destination;
+
+  /** @brief Number of commands executed */
+  unsigned long commands;
+
+  /** @brief Time spent executing commands (seconds) */
+  double busy;
 };
 
 /** @brief Linked list of connections */
@@ -144,6 +150,8 @@ static int fetch_body(struct conn *c,
                       void *u);
 static int body_line(struct conn *c, char *line);
 static int command(struct conn *c, char *line);
+static char *command_stats_report(void);
+static char **metrics_report(struct conn *c, int help);
 
 static const char *noyes[] = { "no", "yes" };
 
@@ -260,11 +268,10 @@ static int c_play(struct conn *c, char **vec,
   q = queue_add(track, c->who, WHERE_BEFORE_RANDOM, NULL, origin_picked);
   queue_write();
   sink_printf(ev_writer_sink(c->w), "252 %s\n", q->id);
-  /* We make sure the track at the head of the queue is prepared, just in case
-   * we added it.  We could be more subtle but prepare() will ensure we don't
-   * prepare the same track twice so there's no point. */
-  if(qhead.next != &qhead)
-    prepare(c->ev, qhead.next);
+  /* We make sure the tracks at the head of the queue are prepared, just in
+   * case we added one of them.  We could be more subtle but prepare() will
+   * ensure we don't prepare the same track twice so there's no point. */
+  prepare_lookahead(c->ev);
   /* If the queue was empty but we are for some reason paused then
    * unpause. */
   if(!playing) resume_playing(0);
@@ -297,13 +304,10 @@ static int c_playafter(struct conn *c, char **vec,
   }
   queue_write();
   sink_printf(ev_writer_sink(c->w), "252 OK\n");
-  /* We make sure the track at the head of the queue is prepared, just in case
-   * we added it.  We could be more subtle but prepare() will ensure we don't
-   * prepare the same track twice so there's no point. */
-  if(qhead.next != &qhead) {
-    prepare(c->ev, qhead.next);
-    disorder_info("prepared %s", qhead.next->id);
-  }
+  /* We make sure the tracks at the head of the queue are prepared, just in
+   * case we added one of them.  We could be more subtle but prepare() will
+   * ensure we don't prepare the same track twice so there's no point. */
+  prepare_lookahead(c->ev);
   /* If the queue was empty but we are for some reason paused then
    * unpause. */
   if(!playing)
@@ -329,12 +333,11 @@ static int c_remove(struct conn *c, char **vec,
   queue_remove(q, c->who);
   /* De-prepare the track. */
   abandon(c->ev, q);
-  /* See about adding a new random track */
-  add_random_track(c->ev);
-  /* Prepare whatever the next head track is. */
-  if(qhead.next != &qhead)
-    prepare(c->ev, qhead.next);
+  /* Prepare whatever has moved up into the look-ahead window. */
+  prepare_lookahead(c->ev);
   queue_write();
+  /* The new head might be playable and the queue might need topping up */
+  play_soon(c->ev);
   sink_writes(ev_writer_sink(c->w), "250 removed\n");
   return 1;			/* completed */
 }
@@ -741,9 +744,11 @@ static int files_dirs(struct conn *c,
     else
       fvec = trackdb_list(0, 0, what, rec);
   }
-  if(key)
+  if(key) {
     /* Put the answer in the cache */
+    cache_limit(&cache_files_type, config->list_cache_size);
     cache_put(&cache_files_type, key, fvec);
+  }
   sink_writes(ev_writer_sink(c->w), "253 Listing follow\n");
   return output_list(c, fvec);
 }
@@ -897,7 +902,8 @@ static int c_random_enabled(struct conn *c,
 static void got_stats(char *stats, void *u) {
   struct conn *const c = u;
 
-  sink_printf(ev_writer_sink(c->w), "253 stats\n%s\n.\n", stats);
+  sink_printf(ev_writer_sink(c->w), "253 stats\n%s%s\n.\n",
+              stats, command_stats_report());
   /* Now we can start processing commands again */
   ev_reader_enable(c->r);
 }
@@ -1007,10 +1013,15 @@ static void logclient(const char *msg, void *user) {
 }
 
 static int c_log(struct conn *c,
-		 char attribute((unused)) **vec,
-		 int attribute((unused)) nvec) {
+		 char **vec,
+		 int nvec) {
   time_t now;
+  char **changes;
 
+  if(nvec == 1) {
+    sink_writes(ev_writer_sink(c->w), "550 invalid resume token\n");
+    return 1;
+  }
   sink_writes(ev_writer_sink(c->w), "254 OK\n");
   /* pump out initial state */
   xtime(&now);
@@ -1029,6 +1040,12 @@ static int c_log(struct conn *c,
   /* Initial volume */
   sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" volume %d %d\n",
 	      (uintmax_t)now, volume_left, volume_right);
+  /* Queue changes the client missed, or a reset if we don't know */
+  for(changes = queue_resume(nvec ? vec[0] : 0, nvec ? vec[1] : 0);
+      *changes;
+      ++changes)
+    sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" %s\n",
+                (uintmax_t)now, *changes);
   c->lo = xmalloc(sizeof *c->lo);
   c->lo->fn = logclient;
   c->lo->user = c;
@@ -1071,9 +1088,11 @@ static int c_move(struct conn *c,
   }
   n = queue_move(q, atoi(vec[1]), c->who);
   sink_printf(ev_writer_sink(c->w), "252 %d\n", n);
-  /* If we've moved to the head of the queue then prepare the track. */
-  if(q == qhead.next)
-    prepare(c->ev, q);
+  /* Prepare whatever has moved into the look-ahead window and abandon
+   * whatever has moved a long way out of it. */
+  prepare_lookahead(c->ev);
+  /* The new head might be playable when the old one wasn't */
+  play_soon(c->ev);
   return 1;
 }
 
@@ -1107,9 +1126,11 @@ static int c_moveafter(struct conn *c,
   }
   queue_moveafter(q, nvec, qs, c->who);
   sink_printf(ev_writer_sink(c->w), "250 Moved tracks\n");
-  /* If we've moved to the head of the queue then prepare the track. */
-  if(q == qhead.next)
-    prepare(c->ev, q);
+  /* Prepare whatever has moved into the look-ahead window and abandon
+   * whatever has moved a long way out of it. */
+  prepare_lookahead(c->ev);
+  /* The new head might be playable when the old one wasn't */
+  play_soon(c->ev);
   return 1;
 }
 
@@ -1159,6 +1180,27 @@ static int c_tags(struct conn *c,
   return list_response(c, "Tag list follows", trackdb_alltags());
 }
 
+static int c_speaker_stats(struct conn *c,
+                           char attribute((unused)) **vec,
+                           int attribute((unused)) nvec) {
+  return list_response(c, "speaker stats", speaker_stats());
+}
+
+static int c_metrics(struct conn *c,
+                     char **vec,
+                     int nvec) {
+  int help = 0;
+
+  if(nvec > 0) {
+    if(strcmp(vec[0], "prometheus")) {
+      sink_writes(ev_writer_sink(c->w), "550 unknown metrics format\n");
+      return 1;
+    }
+    help = 1;
+  }
+  return list_response(c, "metrics", metrics_report(c, help));
+}
+
 static int c_set_global(struct conn *c,
 			char **vec,
 			int attribute((unused)) nvec) {
@@ -1230,14 +1272,20 @@ static int c_rtp_address(struct conn *c,
 			 int attribute((unused)) nvec) {
   if(api == &uaudio_rtp) {
     char **addr;
+    /* The payload format is only mentioned if it's not the default, since
+     * older clients insist on exactly two fields */
+    const char *payload = strcmp(config->rtp_payload, "l16")
+      ? config->rtp_payload : NULL;
 
     if(!strcmp(config->rtp_mode, "request"))
-      sink_printf(ev_writer_sink(c->w), "252 - -\n");
+      sink_printf(ev_writer_sink(c->w), "252 - -%s%s\n",
+                  payload ? " " : "", payload ? payload : "");
     else {
       netaddress_format(&config->broadcast, NULL, &addr);
-      sink_printf(ev_writer_sink(c->w), "252 %s %s\n",
+      sink_printf(ev_writer_sink(c->w), "252 %s %s%s%s\n",
                   quoteutf8(addr[1]),
-                  quoteutf8(addr[2]));
+                  quoteutf8(addr[2]),
+                  payload ? " " : "", payload ? payload : "");
     }
   } else
     sink_writes(ev_writer_sink(c->w), "550 No RTP\n");
@@ -1760,6 +1808,9 @@ static int c_adopt(struct conn *c,
   q->origin = origin_adopted;
   q->submitter = xstrdup(c->who);
   eventlog("adopted", q->id, q->submitter, (char *)0);
+  /* The entry has changed, so replace it in place */
+  queue_diff_remove(q);
+  queue_diff_insert(q);
   queue_write();
   sink_writes(ev_writer_sink(c->w), "250 OK\n");
   return 1;
@@ -1948,8 +1999,9 @@ static const struct server_command {
   { "get",            2, 2,       c_get,            RIGHT_READ },
   { "get-global",     1, 1,       c_get_global,     RIGHT_READ },
   { "length",         1, 1,       c_length,         RIGHT_READ },
-  { "log",            0, 0,       c_log,            RIGHT_READ },
+  { "log",            0, 2,       c_log,            RIGHT_READ },
   { "make-cookie",    0, 0,       c_make_cookie,    RIGHT_READ },
+  { "metrics",        0, 1,       c_metrics,        RIGHT_ADMIN },
   { "move",           2, 2,       c_move,           RIGHT_MOVE__MASK },
   { "moveafter",      1, INT_MAX, c_moveafter,      RIGHT_MOVE__MASK },
   { "new",            0, 1,       c_new,            RIGHT_READ },
@@ -1993,6 +2045,7 @@ static const struct server_command {
   { "set",            3, 3,       c_set,            RIGHT_PREFS, },
   { "set-global",     2, 2,       c_set_global,     RIGHT_GLOBAL_PREFS },
   { "shutdown",       0, 0,       c_shutdown,       RIGHT_ADMIN },
+  { "speaker-stats",  0, 0,       c_speaker_stats,  RIGHT_READ },
   { "stats",          0, 0,       c_stats,          RIGHT_READ },
   { "tags",           0, 0,       c_tags,           RIGHT_READ },
   { "unset",          2, 2,       c_set,            RIGHT_PREFS },
@@ -2004,6 +2057,282 @@ static const struct server_command {
   { "volume",         0, 2,       c_volume,         RIGHT_READ|RIGHT_VOLUME }
 };
 
+/** @brief Upper bounds of command latency histogram buckets (seconds) */
+static const double latency_buckets[] = {
+  0.0001, 0.001, 0.01, 0.1, 1, 10
+};
+
+/** @brief Number of command latency histogram buckets */
+#define NLATENCY_BUCKETS (sizeof latency_buckets / sizeof *latency_buckets)
+
+/** @brief Usage statistics for a command */
+struct command_stats {
+  /** @brief Number of times the command was executed */
+  unsigned long calls;
+
+  /** @brief Total bytes allocated */
+  unsigned long long allocated;
+
+  /** @brief Total number of garbage collections */
+  unsigned long collections;
+
+  /** @brief Total time spent in garbage collection (seconds) */
+  double gc_seconds;
+
+  /** @brief Total time spent executing the command (seconds) */
+  double seconds;
+
+  /** @brief Longest single execution (seconds) */
+  double max_seconds;
+
+  /** @brief Latency histogram
+   *
+   * @c latency[n] counts executions that took no longer than @c
+   * latency_buckets[n] but longer than any smaller bucket; the final element
+   * counts everything slower than the largest bucket.
+   */
+  unsigned long latency[NLATENCY_BUCKETS + 1];
+};
+
+/** @brief Usage statistics for each command
+ *
+ * Indexed in the same way as @ref commands.  Only the synchronous part of
+ * each command is counted; work done later in callbacks is not.
+ */
+static struct command_stats command_stats[sizeof commands / sizeof *commands];
+
+/** @brief Format per-command statistics
+ * @return Report, one line per command that has been used
+ */
+static char *command_stats_report(void) {
+  struct dynstr d[1];
+  char *line;
+  size_t n;
+
+  dynstr_init(d);
+  dynstr_append_string(d, "\nCommand stats:\n");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n) {
+    const struct command_stats *const cs = &command_stats[n];
+
+    if(!cs->calls)
+      continue;
+    byte_xasprintf(&line,
+                   "%s: %lu calls, %llu bytes allocated, %lu collections,"
+                   " %lums collecting\n",
+                   commands[n].name, cs->calls, cs->allocated,
+                   cs->collections, (unsigned long)(cs->gc_seconds * 1000));
+    dynstr_append_string(d, line);
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Quote a Prometheus label value
+ * @param s Value
+ * @return Value with backslashes, quotes and newlines escaped
+ */
+static char *metric_quote(const char *s) {
+  struct dynstr d[1];
+
+  dynstr_init(d);
+  for(; *s; ++s) {
+    switch(*s) {
+    case '\\': dynstr_append_string(d, "\\\\"); break;
+    case '"': dynstr_append_string(d, "\\\""); break;
+    case '\n': dynstr_append_string(d, "\\n"); break;
+    default: dynstr_append(d, *s); break;
+    }
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Add the description of a metric to a report
+ * @param v Report
+ * @param help Nonzero to include descriptions
+ * @param name Metric name (without prefix)
+ * @param type Prometheus metric type
+ * @param what Description
+ */
+static void metric_describe(struct vector *v, int help, const char *name,
+                            const char *type, const char *what) {
+  char *line;
+
+  if(!help)
+    return;
+  byte_xasprintf(&line, "# HELP disorder_%s %s", name, what);
+  vector_append(v, line);
+  byte_xasprintf(&line, "# TYPE disorder_%s %s", name, type);
+  vector_append(v, line);
+}
+
+/** @brief Add a sample to a report
+ * @param v Report
+ * @param name Metric name (without prefix)
+ * @param labels Label list (without braces) or NULL
+ * @param value Value
+ */
+static void metric_sample(struct vector *v, const char *name,
+                          const char *labels, double value) {
+  char buffer[64], *line;
+
+  /* byte_xasprintf() does not support floating point */
+  snprintf(buffer, sizeof buffer, "%.9g", value);
+  if(labels)
+    byte_xasprintf(&line, "disorder_%s{%s} %s", name, labels, buffer);
+  else
+    byte_xasprintf(&line, "disorder_%s %s", name, buffer);
+  vector_append(v, line);
+}
+
+/** @brief Return the Prometheus labels for a connection
+ * @param c Connection
+ * @return Label list (without braces)
+ */
+static char *connection_labels(const struct conn *c) {
+  char *labels;
+
+  byte_xasprintf(&labels, "connection=\"S%x\",user=\"%s\"", c->tag,
+                 metric_quote(c->who ? c->who : ""));
+  return labels;
+}
+
+/** @brief Format server metrics
+ * @param c Connection (for the event loop)
+ * @param help Nonzero to include @c HELP and @c TYPE lines
+ * @return NULL-terminated list of lines in Prometheus text format
+ */
+static char **metrics_report(struct conn *c, int help) {
+  struct vector v[1];
+  struct trackdb_transaction_stats ts;
+  struct cache_stats cst;
+  struct ev_stats es;
+  const struct conn *d;
+  char *labels, lb[32];
+  unsigned long cumulative;
+  size_t n, bucket;
+
+  vector_init(v);
+  /* Commands */
+  metric_describe(v, help, "command_calls_total", "counter",
+                  "Commands executed");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n)
+    if(command_stats[n].calls) {
+      byte_xasprintf(&labels, "command=\"%s\"", commands[n].name);
+      metric_sample(v, "command_calls_total", labels, command_stats[n].calls);
+    }
+  metric_describe(v, help, "command_duration_seconds", "histogram",
+                  "Time spent executing commands");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n) {
+    const struct command_stats *const cs = &command_stats[n];
+
+    if(!cs->calls)
+      continue;
+    cumulative = 0;
+    for(bucket = 0; bucket <= NLATENCY_BUCKETS; ++bucket) {
+      cumulative += cs->latency[bucket];
+      if(bucket < NLATENCY_BUCKETS)
+        snprintf(lb, sizeof lb, "%g", latency_buckets[bucket]);
+      else
+        strcpy(lb, "+Inf");
+      byte_xasprintf(&labels, "command=\"%s\",le=\"%s\"",
+                     commands[n].name, lb);
+      metric_sample(v, "command_duration_seconds_bucket", labels, cumulative);
+    }
+    byte_xasprintf(&labels, "command=\"%s\"", commands[n].name);
+    metric_sample(v, "command_duration_seconds_sum", labels, cs->seconds);
+    metric_sample(v, "command_duration_seconds_count", labels, cs->calls);
+  }
+  metric_describe(v, help, "command_duration_seconds_max", "gauge",
+                  "Longest single command execution");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n)
+    if(command_stats[n].calls) {
+      byte_xasprintf(&labels, "command=\"%s\"", commands[n].name);
+      metric_sample(v, "command_duration_seconds_max", labels,
+                    command_stats[n].max_seconds);
+    }
+  metric_describe(v, help, "command_allocated_bytes_total", "counter",
+                  "Memory allocated by commands");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n)
+    if(command_stats[n].calls) {
+      byte_xasprintf(&labels, "command=\"%s\"", commands[n].name);
+      metric_sample(v, "command_allocated_bytes_total", labels,
+                    command_stats[n].allocated);
+    }
+  metric_describe(v, help, "command_gc_seconds_total", "counter",
+                  "Time spent collecting garbage during commands");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n)
+    if(command_stats[n].calls) {
+      byte_xasprintf(&labels, "command=\"%s\"", commands[n].name);
+      metric_sample(v, "command_gc_seconds_total", labels,
+                    command_stats[n].gc_seconds);
+    }
+  /* Database */
+  trackdb_transaction_stats(&ts);
+  metric_describe(v, help, "transactions_total", "counter",
+                  "Database transactions by outcome");
+  metric_sample(v, "transactions_total", "outcome=\"committed\"",
+                ts.committed);
+  metric_sample(v, "transactions_total", "outcome=\"aborted\"", ts.aborted);
+  metric_describe(v, help, "transactions_open", "gauge",
+                  "Database transactions currently open");
+  metric_sample(v, "transactions_open", NULL,
+                ts.begun - ts.committed - ts.aborted);
+  metric_describe(v, help, "transaction_seconds_total", "counter",
+                  "Time spent with a database transaction open");
+  metric_sample(v, "transaction_seconds_total", NULL, ts.seconds);
+  /* Listing cache */
+  cache_stats(&cache_files_type, &cst);
+  metric_describe(v, help, "list_cache_lookups_total", "counter",
+                  "Directory listing cache lookups by result");
+  metric_sample(v, "list_cache_lookups_total", "result=\"hit\"",
+                cache_files_hits);
+  metric_sample(v, "list_cache_lookups_total", "result=\"miss\"",
+                cache_files_misses);
+  metric_describe(v, help, "list_cache_entries", "gauge",
+                  "Directory listings in the cache");
+  metric_sample(v, "list_cache_entries", NULL, cst.count);
+  metric_describe(v, help, "list_cache_bytes", "gauge",
+                  "Size of directory listings in the cache");
+  metric_sample(v, "list_cache_bytes", NULL, cst.bytes);
+  metric_describe(v, help, "list_cache_removals_total", "counter",
+                  "Directory listings removed from the cache by reason");
+  metric_sample(v, "list_cache_removals_total", "reason=\"expired\"",
+                cst.expiries);
+  metric_sample(v, "list_cache_removals_total", "reason=\"evicted\"",
+                cst.evictions);
+  /* Event loop */
+  ev_stats(c->ev, &es);
+  metric_describe(v, help, "event_timeouts_total", "counter",
+                  "Timeouts run by the event loop");
+  metric_sample(v, "event_timeouts_total", NULL, es.timeouts);
+  metric_describe(v, help, "event_lag_seconds_total", "counter",
+                  "Total lateness of timeouts");
+  metric_sample(v, "event_lag_seconds_total", NULL, es.lag);
+  metric_describe(v, help, "event_lag_seconds_max", "gauge",
+                  "Greatest lateness of any timeout");
+  metric_sample(v, "event_lag_seconds_max", NULL, es.max_lag);
+  /* Connections; each family must be contiguous */
+  metric_describe(v, help, "connection_commands_total", "counter",
+                  "Commands executed by each open connection");
+  for(d = connections; d; d = d->next)
+    metric_sample(v, "connection_commands_total", connection_labels(d),
+                  d->commands);
+  metric_describe(v, help, "connection_busy_seconds_total", "counter",
+                  "Time spent executing commands for each open connection");
+  for(d = connections; d; d = d->next)
+    metric_sample(v, "connection_busy_seconds_total", connection_labels(d),
+                  d->busy);
+  metric_describe(v, help, "connection_written_bytes_total", "counter",
+                  "Bytes written to each open connection");
+  for(d = connections; d; d = d->next)
+    if(d->w)
+      metric_sample(v, "connection_written_bytes_total", connection_labels(d),
+                    ev_writer_written(d->w));
+  vector_terminate(v);
+  return v->vec;
+}
+
 /** @brief Fetch a command body
  * @param c Connection
  * @param body_callback Called with body
@@ -2058,7 +2387,12 @@ static void command_error(const char *msg, void *u) {
  */
 static int command(struct conn *c, char *line) {
   char **vec;
-  int nvec, n;
+  int nvec, n, ret;
+  struct mem_stats before, after;
+  struct command_stats *cs;
+  struct timespec started, finished;
+  double elapsed;
+  size_t bucket;
 
   D(("server command %s", line));
   /* We force everything into NFC as early as possible */
@@ -2095,7 +2429,32 @@ static int command(struct conn *c, char *line) {
       sink_writes(ev_writer_sink(c->w), "500 too many arguments\n");
       return 1;
     }
-    return commands[n].fn(c, vec, nvec);
+    mem_stats(&before);
+    xgettime(CLOCK_MONOTONIC, &started);
+    ret = commands[n].fn(c, vec, nvec);
+    xgettime(CLOCK_MONOTONIC, &finished);
+    mem_stats(&after);
+    elapsed = (finished.tv_sec - started.tv_sec)
+      + (finished.tv_nsec - started.tv_nsec) / 1000000000.0;
+    ++c->commands;
+    c->busy += elapsed;
+    cs = &command_stats[n];
+    ++cs->calls;
+    cs->seconds += elapsed;
+    if(elapsed > cs->max_seconds)
+      cs->max_seconds = elapsed;
+    for(bucket = 0; bucket < NLATENCY_BUCKETS; ++bucket)
+      if(elapsed <= latency_buckets[bucket])
+        break;
+    ++cs->latency[bucket];
+    cs->allocated += after.allocated - before.allocated;
+    cs->collections += after.collections - before.collections;
+    cs->gc_seconds += after.gc_seconds - before.gc_seconds;
+    D(("%s allocated %llu bytes, %lu collections, %luus collecting",
+       commands[n].name, after.allocated - before.allocated,
+       after.collections - before.collections,
+       (unsigned long)((after.gc_seconds - before.gc_seconds) * 1000000)));
+    return ret;
   }
   return 1;			/* completed */
 }
@@ -32,8 +32,10 @@
  * the server.
  *
  * Data read on connections is buffered, up to a limit (currently 1Mbyte per
- * track).  No attempt is made here to limit the number of tracks, it is
- * assumed that the main server won't start outrageously many decoders.
+ * track).  The total buffered for tracks other than the playing one is limited
+ * by @c config->speaker_buffer; tracks are filled in the order they arrived,
+ * which is normally the order they will play in.  The main server decides how
+ * many tracks to prepare (see @c config->lookahead).
  *
  * Audio is supplied from this buffer to the uaudio play callback.  Playback is
  * enabled when a track is to be played and disabled when its last bytes
@@ -53,6 +55,16 @@
  * this is arranged by the @c disorder-normalize program (see @ref
  * server/normalize.c).
  *
+ * @b Caching.  Instead of a connection, a track may be supplied from the PCM
+ * cache (see @ref server/pcmcache.c), in which case the server sends @ref
+ * SM_CACHED and the cache entry is mapped into memory.  The data is copied
+ * into the track's buffer as space becomes available, just as if it had been
+ * read from a connection that never blocks.
+ *
+ * @b Loudness.  If @ref SM_PLAY carries a gain, it is applied by
+ * speaker_callback() as the samples are handed to the backend, rather than to
+ * the buffered data, so that pausing and rewinding are unaffected.
+ *
  * @b Garbage @b Collection.  This program deliberately does not use the
  * garbage collector even though it might be convenient to do so.  This is for
  * two reasons.  Firstly some sound APIs use thread threads and we do not want
@@ -82,6 +94,7 @@
 #include <poll.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <pthread.h>
 #include <sys/resource.h>
 #include <gcrypt.h>
@@ -96,6 +109,9 @@
 #include "printf.h"
 #include "version.h"
 #include "uaudio.h"
+#include "timeval.h"
+#include "loudness.h"
+#include "byte-order.h"
 
 /** @brief Maximum number of FDs to poll for */
 #define NFDS 1024
@@ -106,10 +122,29 @@
  */
 static size_t early_finish;
 
+/** @brief Set if gain16_buffer() can be used on our output
+ *
+ * Tracks are only normalized if the output is 16-bit native-endian.
+ */
+static int gain_supported;
+
+/** @brief Number of bytes at the end of each track buffer kept free
+ *
+ * When playback is paused, any audio that the backend had buffered but not yet
+ * played is discarded and the track is rewound to the first discarded sample;
+ * see speaker_rewind().  That relies on the discarded samples still being in
+ * the track's buffer, so we don't fill it right up.
+ *
+ * 128Kbyte is about 0.75s of 44100Hz 16-bit stereo, rather more than any
+ * backend will usually have buffered.
+ */
+#define REWIND_BYTES 131072
+
 /** @brief Track structure
  *
- * Known tracks are kept in a linked list.  Usually there will be at most two
- * of these but rearranging the queue can cause there to be more.
+ * Known tracks are kept in a linked list, in the order they were first heard
+ * of.  Usually there will be at most @c config->lookahead + 1 of these but
+ * rearranging the queue can cause there to be more.
  */
 struct track {
   /** @brief Next track */
@@ -118,6 +153,18 @@ struct track {
   /** @brief Input file descriptor */
   int fd;
 
+  /** @brief Mapped PCM cache entry, or NULL
+   *
+   * Exactly one of @c fd and @c map is used for a prepared track.
+   */
+  char *map;
+
+  /** @brief Size of @c map in bytes */
+  size_t maplen;
+
+  /** @brief Number of bytes of @c map copied to buffer so far */
+  size_t mappos;
+
   /** @brief Track ID */
   char id[24];
 
@@ -151,6 +198,36 @@ struct track {
    * track cannot be paused or cancelled.
    */
   int finished;
+
+  /** @brief When @ref SM_PLAY arrived */
+  struct timespec play_requested;
+
+  /** @brief When the decoder connected or the cache entry was mapped */
+  struct timespec arrived;
+
+  /** @brief Set once the first sample has been played */
+  int started;
+
+  /** @brief Time from @ref SM_PLAY to the first sample, in milliseconds */
+  uint32_t start_ms;
+
+  /** @brief Decoding speed as a percentage of real time, or 0 if not known */
+  uint32_t decode_percent;
+
+  /** @brief Smallest value of @c used seen by speaker_callback() */
+  size_t used_min;
+
+  /** @brief Sum of the values of @c used seen by speaker_callback() */
+  unsigned long long used_total;
+
+  /** @brief Number of values in @c used_total */
+  unsigned long used_count;
+
+  /** @brief Number of underruns while playing this track */
+  uint32_t underruns;
+
+  /** @brief Gain factor for gain16_buffer(), or 0 for none */
+  int gain;
   
   /** @brief Input buffer
    *
@@ -217,12 +294,36 @@ static int paused;
 /** @brief Set when back end activated */
 static int activated;
 
+/** @brief Set when the backend's buffered audio should be discarded
+ *
+ * Set on pause and when the playing track is cancelled, so they take effect
+ * immediately rather than after whatever the backend has buffered has played.
+ */
+static int flush_wanted;
+
 /** @brief Signal pipe back into the poll() loop */
 static int sigpipe[2];
 
 /** @brief Selected backend */
 static const struct uaudio *backend;
 
+/** @brief Cumulative health information
+ *
+ * Only the cumulative counters are used, and the underrun durations are kept
+ * in @ref underrun_samples and friends until they're sent.  Protected by
+ * @ref lock.
+ */
+static struct speaker_telemetry telemetry;
+
+/** @brief Number of samples of silence played in the current underrun */
+static unsigned long long underrun_samples;
+
+/** @brief Number of samples of silence played in completed underruns */
+static unsigned long long underrun_samples_total;
+
+/** @brief Number of samples of silence played in the longest underrun */
+static unsigned long long underrun_samples_longest;
+
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -257,17 +358,17 @@ static void attribute((noreturn)) help(void) {
  * @return Pointer to track structure or NULL
  */
 static struct track *findtrack(const char *id, int create) {
-  struct track *t;
+  struct track *t, **tt;
 
   D(("findtrack %s %d", id, create));
-  for(t = tracks; t && strcmp(id, t->id); t = t->next)
+  for(tt = &tracks; (t = *tt) && strcmp(id, t->id); tt = &t->next)
     ;
   if(!t && create) {
     t = xmalloc(sizeof *t);
-    t->next = tracks;
+    t->next = NULL;
     strcpy(t->id, id);
     t->fd = -1;
-    tracks = t;
+    *tt = t;
   }
   return t;
 }
@@ -294,9 +395,104 @@ static void destroy(struct track *t) {
   D(("destroy %s", t->id));
   if(t->fd != -1)
     xclose(t->fd);
+  if(t->map)
+    munmap(t->map, t->maplen);
   free(t);
 }
 
+/** @brief Attach a track to a PCM cache entry
+ * @param t Pointer to track
+ * @param key Cache key
+ * @return 0 on success, -1 on error
+ */
+static int speaker_map(struct track *t, const char *key) {
+  struct stat sb;
+  char *path;
+  void *map;
+  int fd = -1, rc = -1;
+
+  if(!config->pcm_cache) {
+    disorder_error(0, "%s: no pcm_cache configured", t->id);
+    return -1;
+  }
+  byte_xasprintf(&path, "%s/%s.pcm", config->pcm_cache, key);
+  if((fd = open(path, O_RDONLY)) < 0) {
+    disorder_error(errno, "opening %s", path);
+    goto done;
+  }
+  if(fstat(fd, &sb) < 0) {
+    disorder_error(errno, "checking %s", path);
+    goto done;
+  }
+  /* Complete cache entries are always whole frames; anything else is bad */
+  if(!sb.st_size || (uintmax_t)sb.st_size > SIZE_MAX
+     || sb.st_size % (uaudio_channels * uaudio_sample_size)) {
+    disorder_error(0, "%s: unsuitable size %jd", path, (intmax_t)sb.st_size);
+    goto done;
+  }
+  map = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED) {
+    disorder_error(errno, "mapping %s", path);
+    goto done;
+  }
+  /* We read the whole thing, in order */
+  posix_madvise(map, sb.st_size, POSIX_MADV_SEQUENTIAL);
+  t->map = map;
+  t->maplen = sb.st_size;
+  t->mappos = 0;
+  xgettime(CLOCK_MONOTONIC, &t->arrived);
+  rc = 0;
+done:
+  if(fd >= 0)
+    xclose(fd);
+  free(path);
+  return rc;
+}
+
+/** @brief Return the number of milliseconds between two times
+ * @param from Earlier time
+ * @param to Later time
+ * @return Milliseconds from @p from to @p to
+ */
+static uint32_t ms_between(const struct timespec *from,
+                           const struct timespec *to) {
+  const struct timespec d = tssub(*to, *from);
+
+  if(d.tv_sec < 0)
+    return 0;
+  return d.tv_sec * 1000 + d.tv_nsec / 1000000;
+}
+
+/** @brief Convert a number of bytes of sample data to milliseconds
+ * @param bytes Number of bytes
+ * @return Duration of @p bytes in milliseconds
+ */
+static uint32_t bytes_to_ms(unsigned long long bytes) {
+  return bytes * 1000 / ((unsigned long long)uaudio_rate * uaudio_channels
+                         * uaudio_sample_size);
+}
+
+/** @brief Record how fast a track was decoded
+ * @param t Pointer to track
+ *
+ * Called when the track first becomes playable, i.e. when its buffer first
+ * fills up or it reaches EOF, whichever is sooner.  Until then nothing has
+ * been holding the decoder back.
+ */
+static void speaker_decoded(struct track *t) {
+  struct timespec now;
+  uint32_t elapsed;
+
+  if(t->decode_percent)
+    return;
+  xgettime(CLOCK_MONOTONIC, &now);
+  elapsed = ms_between(&t->arrived, &now);
+  t->decode_percent = bytes_to_ms(t->used + t->played * uaudio_sample_size)
+    * 100ULL / (elapsed ? elapsed : 1);
+  if(!t->decode_percent)
+    t->decode_percent = 1;
+}
+
 /** @brief Read data into a sample buffer
  * @param t Pointer to track
  * @return 0 on success, -1 on EOF
@@ -305,6 +501,9 @@ static void destroy(struct track *t) {
  * main loop whenever the track's file descriptor is readable, assuming the
  * buffer has not reached the maximum allowed occupancy.
  *
+ * For tracks supplied from the PCM cache, data is copied from @c t->map
+ * instead, and this is called whenever there's buffer space.
+ *
  * Errors count as EOF.
  */
 static int speaker_fill(struct track *t) {
@@ -315,7 +514,7 @@ static int speaker_fill(struct track *t) {
      t->id, t->eof, t->used));
   if(t->eof)
     return -1;
-  if(t->used < sizeof t->buffer) {
+  if(t->used < sizeof t->buffer - REWIND_BYTES) {
     /* there is room left in the buffer */
     where = (t->start + t->used) % sizeof t->buffer;
     /* Get as much data as we can */
@@ -323,10 +522,22 @@ static int speaker_fill(struct track *t) {
       left = (sizeof t->buffer) - where;
     else
       left = t->start - where;
+    /* ...without eating into the space kept for rewinding */
+    if(left > sizeof t->buffer - REWIND_BYTES - t->used)
+      left = sizeof t->buffer - REWIND_BYTES - t->used;
     pthread_mutex_unlock(&lock);
-    do {
-      n = read(t->fd, t->buffer + where, left);
-    } while(n < 0 && errno == EINTR);
+    if(t->map) {
+      /* Copying may fault pages in from disk, so we do it unlocked too */
+      if(left > t->maplen - t->mappos)
+        left = t->maplen - t->mappos;
+      memcpy(t->buffer + where, t->map + t->mappos, left);
+      t->mappos += left;
+      n = left;
+    } else {
+      do {
+        n = read(t->fd, t->buffer + where, left);
+      } while(n < 0 && errno == EINTR);
+    }
     pthread_mutex_lock(&lock);
     if(n < 0 && errno == EAGAIN) {
       /* EAGAIN means more later */
@@ -342,15 +553,24 @@ static int speaker_fill(struct track *t) {
       /* A track always becomes playable at EOF; we're not going to see any
        * more data. */
       t->playable = 1;
+      speaker_decoded(t);
       rc = -1;
     } else {
       t->used += n;
       /* A track becomes playable when it (first) fills its buffer.  For
        * 44.1KHz 16-bit stereo this is ~6s of audio data.  The latency will
        * depend how long that takes to decode (hopefuly not very!) */
-      if(t->used == sizeof t->buffer)
+      if(t->used == sizeof t->buffer - REWIND_BYTES) {
         t->playable = 1;
+        speaker_decoded(t);
+      }
       rc = 0;
+      /* A cache entry is at EOF as soon as it is exhausted */
+      if(t->map && t->mappos == t->maplen) {
+        t->eof = 1;
+        t->playable = 1;
+        speaker_decoded(t);
+      }
     }
   } else
     rc = 0;
@@ -375,6 +595,38 @@ static int playable(void) {
          && playing->playable;
 }
 
+/** @brief Send health information to the server
+ * @param t Track to describe
+ * @param final Nonzero if @p t has just stopped playing
+ */
+static void telemetry_send(const struct track *t, int final) {
+  struct speaker_message sm;
+  struct speaker_telemetry *const st = &sm.u.telemetry;
+
+  memset(&sm, 0, sizeof sm);
+  sm.type = SM_TELEMETRY;
+  sm.data = final;
+  *st = telemetry;
+  /* Include the current underrun, if there is one */
+  st->underrun_ms = bytes_to_ms((underrun_samples_total + underrun_samples)
+                                * uaudio_sample_size);
+  if(underrun_samples > underrun_samples_longest)
+    st->longest_underrun_ms = bytes_to_ms(underrun_samples
+                                          * uaudio_sample_size);
+  else
+    st->longest_underrun_ms = bytes_to_ms(underrun_samples_longest
+                                          * uaudio_sample_size);
+  strcpy(st->id, t->id);
+  st->start_ms = t->start_ms;
+  st->decode_percent = t->decode_percent;
+  st->track_underruns = t->underruns;
+  if(t->used_count) {
+    st->buffer_min_ms = bytes_to_ms(t->used_min);
+    st->buffer_avg_ms = bytes_to_ms(t->used_total / t->used_count);
+  }
+  speaker_send(1, &sm);
+}
+
 /** @brief Notify the server what we're up to */
 static void report(void) {
   struct speaker_message sm;
@@ -389,6 +641,7 @@ static void report(void) {
     strcpy(sm.u.id, playing->id);
     sm.data = playing->played / (uaudio_rate * uaudio_channels);
     speaker_send(1, &sm);
+    telemetry_send(playing, 0);
     xtime(&last_report);
   }
 }
@@ -420,16 +673,26 @@ static size_t speaker_callback(void *buffer,
                                void attribute((unused)) *userdata) {
   size_t max_bytes = max_samples * uaudio_sample_size;
   size_t provided_samples = 0;
+  struct timespec entered, leaving, took;
+  uint32_t us;
+  int bucket;
+
+  xgettime(CLOCK_MONOTONIC, &entered);
 
   /* Be sure to keep the amount of data in a buffer a whole number of frames:
    * otherwise the playing threads can become stuck. */
   max_bytes -= max_bytes % (uaudio_sample_size * uaudio_channels);
 
   pthread_mutex_lock(&lock);
-  /* TODO perhaps we should immediately go silent if we've been asked to pause
-   * or cancel the playing track (maybe block in the cancel case and see what
-   * else turns up?) */
+  /* Pause and cancel take effect immediately: the main loop deactivates the
+   * backend, flushes anything it has buffered and (for a pause) rewinds the
+   * playing track to match.  So all we have to do here is supply data. */
   if(playing) {
+    /* Keep track of how close we come to running out */
+    if(!playing->used_count || playing->used < playing->used_min)
+      playing->used_min = playing->used;
+    playing->used_total += playing->used;
+    ++playing->used_count;
     if(playing->used > 0) {
       size_t bytes;
       /* Compute size of largest contiguous chunk.  We get called as often as
@@ -445,6 +708,8 @@ static size_t speaker_callback(void *buffer,
       bytes -= bytes % (uaudio_sample_size * uaudio_channels);
       /* Provide it */
       memcpy(buffer, playing->buffer + playing->start, bytes);
+      if(playing->gain && gain_supported)
+        gain16_buffer(buffer, bytes / 2, playing->gain);
       playing->start += bytes;
       playing->used -= bytes;
       /* Wrap around to start of buffer */
@@ -458,6 +723,10 @@ static size_t speaker_callback(void *buffer,
       }
       provided_samples = bytes / uaudio_sample_size;
       playing->played += provided_samples;
+      if(!playing->started) {
+        playing->started = 1;
+        playing->start_ms = ms_between(&playing->play_requested, &entered);
+      }
     }
   }
   /* If we couldn't provide anything at all, play dead air */
@@ -465,21 +734,71 @@ static size_t speaker_callback(void *buffer,
   if(!provided_samples) {
     memset(buffer, 0, max_bytes);
     provided_samples = max_samples;
-    if(playing)
-      disorder_info("%zu samples silence, playing->used=%zu",
-                    provided_samples, playing->used);
-    else
-      disorder_info("%zu samples silence, playing=NULL", provided_samples);
+    /* Running out part way through a track is an underrun.  The server
+     * hears about it in the next telemetry_send(). */
+    if(playing && !playing->eof) {
+      if(!underrun_samples) {
+        ++telemetry.underruns;
+        ++playing->underruns;
+      }
+      underrun_samples += provided_samples;
+    }
+  } else if(underrun_samples) {
+    /* The underrun is over */
+    underrun_samples_total += underrun_samples;
+    if(underrun_samples > underrun_samples_longest)
+      underrun_samples_longest = underrun_samples;
+    underrun_samples = 0;
   }
+  /* Record how long we took, including waiting for the lock */
+  xgettime(CLOCK_MONOTONIC, &leaving);
+  took = tssub(leaving, entered);
+  us = took.tv_sec * 1000000 + took.tv_nsec / 1000;
+  if(us > telemetry.callback_max_us)
+    telemetry.callback_max_us = us;
+  for(bucket = 0; us >= 2 && bucket < SPEAKER_CALLBACK_BUCKETS - 1; us >>= 1)
+    ++bucket;
+  ++telemetry.callback_us[bucket];
   pthread_mutex_unlock(&lock);
   return provided_samples;
 }
 
+/** @brief Rewind a track after the backend discarded some of it
+ * @param t Pointer to track
+ * @param samples Number of samples discarded
+ *
+ * The discarded samples are the last ones speaker_callback() supplied, so
+ * they are just before @c t->start in the track's buffer; put them back so
+ * they'll be played again.  Some of them may have come from the previous
+ * track, in which case they are lost.
+ */
+static void speaker_rewind(struct track *t, size_t samples) {
+  const size_t frame = uaudio_sample_size * uaudio_channels;
+  size_t bytes, room;
+
+  if(samples > t->played)
+    samples = t->played;
+  bytes = samples * uaudio_sample_size;
+  room = sizeof t->buffer - t->used;
+  if(bytes > room) {
+    /* The earliest of the discarded samples have been overwritten.  Rewind as
+     * far as we can; the rest won't be heard. */
+    disorder_error(0, "%s: can only rewind %zu of %zu bytes",
+                   t->id, room - room % frame, bytes);
+    bytes = room - room % frame;
+  }
+  t->start = (t->start + sizeof t->buffer - bytes) % sizeof t->buffer;
+  t->used += bytes;
+  t->played -= bytes / uaudio_sample_size;
+  D(("rewind %s by %zu bytes", t->id, bytes));
+}
+
 /** @brief Main event loop */
 static void mainloop(void) {
   struct track *t;
-  struct speaker_message sm;
+  struct speaker_message sm, reply;
   int n, fd, stdin_slot, timeout, listen_slot, sigpipe_slot;
+  size_t ahead;
 
   pthread_mutex_lock(&lock);
   /* Keep going while our parent process is alive */
@@ -495,27 +814,42 @@ static void mainloop(void) {
     /* Also always ready for inbound connections */
     listen_slot = addfd(listenfd, POLLIN);
     /* Try to read sample data for the currently playing track if there is
-     * buffer space. */
-    if(playing
-       && playing->fd >= 0
-       && !playing->eof
-       && playing->used < (sizeof playing->buffer))
-      playing->slot = addfd(playing->fd, POLLIN);
-    else if(playing)
+     * buffer space.  Cached tracks don't need to wait for their data. */
+    if(playing) {
       playing->slot = -1;
+      if(!playing->eof
+         && playing->used < sizeof playing->buffer - REWIND_BYTES) {
+        if(playing->map)
+          speaker_fill(playing);
+        else if(playing->fd >= 0)
+          playing->slot = addfd(playing->fd, POLLIN);
+      }
+    }
     /* Allow the poll() to be interrupted at the end of a track */
     sigpipe_slot = addfd(sigpipe[0], POLLIN);
     /* If any other tracks don't have a full buffer, try to read sample data
      * from them.  We do this last of all, so that if we run out of slots,
-     * nothing important can't be monitored. */
+     * nothing important can't be monitored.
+     *
+     * Tracks are visited in arrival order and we stop reading once the total
+     * buffered for tracks that aren't playing reaches the configured limit,
+     * so that a long look-ahead can't consume unbounded memory.  The pending
+     * playing track is exempt since it is about to become the playing
+     * track. */
+    ahead = 0;
     for(t = tracks; t; t = t->next)
       if(t != playing) {
-        if(t->fd >= 0
-           && !t->eof
-           && t->used < sizeof t->buffer) {
-          t->slot = addfd(t->fd,  POLLIN | POLLHUP);
-        } else
-          t->slot = -1;
+        ahead += t->used;
+        t->slot = -1;
+        if(!t->eof
+           && t->used < sizeof t->buffer - REWIND_BYTES
+           && (t == pending_playing
+               || ahead < (size_t)config->speaker_buffer)) {
+          if(t->map)
+            speaker_fill(t);
+          else if(t->fd >= 0)
+            t->slot = addfd(t->fd,  POLLIN | POLLHUP);
+        }
       }
     /* Wait for something interesting to happen */
     pthread_mutex_unlock(&lock);
@@ -554,12 +888,13 @@ static void mainloop(void) {
           if (write(fd, "", 1) < 0)             /* write an ack */
             disorder_error(errno, "writing ack to inbound connection for %s",
                            id);
-          if(t->fd != -1) {
+          if(t->fd != -1 || t->map) {
             disorder_error(0, "%s: already got a connection", id);
             xclose(fd);
           } else {
             nonblock(fd);
             t->fd = fd;               /* yay */
+            xgettime(CLOCK_MONOTONIC, &t->arrived);
           }
           /* Notify the server that the connection arrived */
           sm.type = SM_ARRIVED;
@@ -595,7 +930,9 @@ static void mainloop(void) {
           }
 	  t = findtrack(sm.u.id, 1);
           D(("SM_PLAY %s fd %d", t->id, t->fd));
-          if(t->fd == -1)
+          xgettime(CLOCK_MONOTONIC, &t->play_requested);
+          t->gain = sm.data;
+          if(t->fd == -1 && !t->map)
             disorder_error(0,
                            "cannot play track because no connection arrived");
           /* TODO as things stand we often report this error message but then
@@ -611,9 +948,27 @@ static void mainloop(void) {
            * track below so there's no point distinguishing the situations
            * here. */
 	  break;
+	case SM_CACHED:
+          D(("SM_CACHED %s %s", sm.u.cached.id, sm.u.cached.key));
+          t = findtrack(sm.u.cached.id, 1);
+          memset(&reply, 0, sizeof reply);
+          strcpy(reply.u.id, t->id);
+          if(t->fd != -1 || t->map) {
+            disorder_error(0, "%s: already got a connection", t->id);
+            reply.type = SM_ARRIVED;
+          } else if(speaker_map(t, sm.u.cached.key)) {
+            /* The server will have to run a decoder after all */
+            removetrack(t->id);
+            destroy(t);
+            reply.type = SM_CACHE_MISS;
+          } else
+            reply.type = SM_ARRIVED;
+          speaker_send(1, &reply);
+	  break;
 	case SM_PAUSE:
           D(("SM_PAUSE"));
 	  paused = 1;
+          flush_wanted = 1;
           force_report = 1;
           break;
 	case SM_RESUME:
@@ -630,9 +985,11 @@ static void mainloop(void) {
                * which might either be the actual playing track or a pending
                * playing track */
               sm.type = SM_FINISHED;
-              if(t == playing)
+              if(t == playing) {
+                telemetry_send(t, 1);
                 playing = 0;
-              else
+                flush_wanted = 1;
+              } else
                 pending_playing = 0;
             } else {
               /* Could be scratching the playing track before it's quite got
@@ -709,9 +1066,28 @@ static void mainloop(void) {
         disorder_fatal(0, "track finish state inconsistent");
       }
       removetrack(playing->id);
+      telemetry_send(playing, 1);
       destroy(playing);
       playing = 0;
     }
+    /* Discard anything the backend has buffered if we've just paused or
+     * cancelled the playing track.  A paused track is rewound so that it
+     * resumes from exactly the point it was heard to stop. */
+    if(flush_wanted) {
+      flush_wanted = 0;
+      if(activated && !playable()) {
+        size_t discarded = 0;
+
+        activated = 0;
+        pthread_mutex_unlock(&lock);
+        backend->deactivate();
+        if(backend->flush)
+          discarded = backend->flush();
+        pthread_mutex_lock(&lock);
+        if(playing && discarded)
+          speaker_rewind(playing, discarded);
+      }
+    }
     /* Act on the pending SM_PLAY */
     if(!playing && pending_playing) {
       playing = pending_playing;
@@ -806,6 +1182,11 @@ int main(int argc, char **argv) {
                     config->sample_format.bits,
                     config->sample_format.bits != 8);
   early_finish = uaudio_sample_size * uaudio_channels * uaudio_rate;
+  gain_supported = (config->sample_format.bits == 16
+                    && config->sample_format.endian == ENDIAN_NATIVE);
+  if(config->loudness && !gain_supported)
+    disorder_error(0, "loudness normalization needs a 16-bit native-endian "
+                   "sample_format");
   /* TODO other parameters! */
   backend = uaudio_find(config->api);
   /* backend-specific initialization */
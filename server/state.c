@@ -215,6 +215,8 @@ int reconfigure(ev_source *ev, unsigned flags) {
   if(!ret && !(flags & RECONFIGURE_FIRST)) {
     /* Open/close sockets */
     reset_sockets(ev);
+    /* queue_pad might have gone up */
+    play_soon(ev);
   }
   return ret;
 }
@@ -0,0 +1,281 @@
+#! /usr/bin/env python
+#
+# This file is part of DisOrder.
+# Copyright (C) 2026 Richard Kettlewell
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+"""Server benchmark
+
+Creates a synthetic collection, starts a daemon and drives concurrent client
+workloads against it, reporting throughput and latency for each.  Not run by
+'make check'; use 'make bench' in the tests directory.
+
+Results can be saved with --save and compared against a previous run with
+--baseline, in which case the exit status is nonzero if any workload got
+slower by more than --tolerance."""
+import dtest,disorder,sys,os,time,random,threading,optparse
+
+# Words used to make up track names.  Some have non-ASCII characters, since
+# real collections do and they take a different path through the indexer.
+words = """love night time heart day world life dream light fire blue song
+rain girl baby home road river summer sun moon star city dance gold black
+red wild little lost last first sweet broken silver crazy happy lonely
+electric midnight morning winter ocean angel devil train fever paradise
+caf\xc3\xa9 na\xc3\xafve fa\xc3\xa7ade \xc3\xbcber sch\xc3\xb6n
+m\xc3\xa4dchen ni\xc3\xb1o coraz\xc3\xb3n \xc3\xa9t\xc3\xa9 r\xc3\xaave
+""".split()
+
+def randomname(rng, minwords, maxwords):
+    """Return a random title-cased name"""
+    return " ".join([rng.choice(words).capitalize()
+                     for n in range(rng.randint(minwords, maxwords))])
+
+def collection(rng, ntracks):
+    """Create a synthetic collection of NTRACKS tracks
+
+    Tracks are hard links to one sound file (falling back to copies) so large
+    collections are cheap.  Returns the list of track names."""
+    source = "%s/sounds/long.ogg" % dtest.top_srcdir
+    created = []
+    while len(created) < ntracks:
+        artist = randomname(rng, 1, 3)
+        for album in range(rng.randint(1, 4)):
+            albumdir = "%s/%s/%s" % (dtest.tracks, artist,
+                                     randomname(rng, 1, 4))
+            if os.path.exists(albumdir):
+                continue
+            os.makedirs(albumdir)
+            for n in range(rng.randint(6, 14)):
+                track = "%s/%02d:%s.ogg" % (albumdir, n + 1,
+                                            randomname(rng, 1, 5))
+                try:
+                    os.link(source, track)
+                except OSError:
+                    dtest.copyfile(source, track)
+                created.append(track)
+    return created
+
+class workload:
+    """A workload run concurrently by several clients
+
+    Subclasses override op(), which performs one timed operation."""
+
+    def __init__(self, tracks, dirs):
+        self.tracks = tracks
+        self.dirs = dirs
+        self.latencies = []
+        self.errors = 0
+        self.lock = threading.Lock()
+
+    def setup(self, c, rng):
+        """Called once per client before timing starts"""
+        pass
+
+    def run(self, seed, deadline):
+        rng = random.Random(seed)
+        c = disorder.client()
+        self.setup(c, rng)
+        latencies = []
+        errors = 0
+        while time.time() < deadline:
+            started = time.time()
+            try:
+                self.op(c, rng)
+            except disorder.operationError:
+                errors += 1
+                continue
+            latencies.append(time.time() - started)
+        with self.lock:
+            self.latencies.extend(latencies)
+            self.errors += errors
+
+class browse(workload):
+    """List a random directory, as a browsing client does"""
+    def op(self, c, rng):
+        d = rng.choice(self.dirs)
+        c.directories(d)
+        c.files(d)
+
+class search(workload):
+    """Search for one or two random words"""
+    def op(self, c, rng):
+        c.search([rng.choice(words)
+                  for n in range(rng.randint(1, 2))])
+
+class churn(workload):
+    """Add a track to the queue, look at the queue, then remove it again"""
+    def op(self, c, rng):
+        id = c.play(rng.choice(self.tracks))
+        c.queue()
+        c.remove(id)
+
+class pick(workload):
+    """Look up details of a random track, as a client showing it would"""
+    def op(self, c, rng):
+        track = rng.choice(self.tracks)
+        c.resolve(track)
+        c.length(track)
+        c.part(track, "display", "title")
+        c.part(track, "display", "artist")
+
+class log(workload):
+    """Subscribe to the event log and wait for the first message"""
+    def setup(self, c, rng):
+        # Each subscription needs a fresh connection
+        c._disconnect()
+
+    def op(self, c, rng):
+        c = disorder.client()
+        c.log(lambda c, l: False)
+        c._disconnect()
+
+workloads = {"browse": browse,
+             "search": search,
+             "churn": churn,
+             "pick": pick,
+             "log": log}
+
+class subscriber(threading.Thread):
+    """A long-lived event log reader, adding fan-out load"""
+
+    def __init__(self):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.messages = 0
+
+    def run(self):
+        try:
+            disorder.client().log(self.message)
+        except Exception:
+            pass                        # daemon shut down
+
+    def message(self, c, l):
+        self.messages += 1
+        return True
+
+def percentile(l, p):
+    """Return the Pth percentile of sorted list L"""
+    if not l:
+        return 0
+    return l[min(len(l) - 1, int(len(l) * p / 100.0))]
+
+def summarize(w, duration):
+    l = sorted(w.latencies)
+    return {"ops": len(l),
+            "rate": len(l) / float(duration),
+            "p50": percentile(l, 50),
+            "p99": percentile(l, 99),
+            "errors": w.errors}
+
+def compare(results, baseline, tolerance):
+    """Return the number of workloads that regressed relative to BASELINE"""
+    regressions = 0
+    for name in sorted(results):
+        if name not in baseline:
+            continue
+        r, b = results[name], baseline[name]
+        worse = []
+        if b["rate"] and r["rate"] < b["rate"] * (1 - tolerance):
+            worse.append("rate %.1f -> %.1f/s" % (b["rate"], r["rate"]))
+        if b["p99"] and r["p99"] > b["p99"] * (1 + tolerance):
+            worse.append("p99 %.2f -> %.2fms"
+                         % (b["p99"] * 1000, r["p99"] * 1000))
+        if worse:
+            print " REGRESSION %s: %s" % (name, ", ".join(worse))
+            regressions += 1
+    return regressions
+
+def test():
+    """Benchmark the server under a synthetic load"""
+    rng = random.Random(options.seed)
+    print " creating %d tracks" % options.tracks
+    collection(rng, options.tracks)
+    dtest.start_daemon()
+    dtest.create_user()
+    started = time.time()
+    dtest.rescan()
+    print " rescan took %.1fs" % (time.time() - started)
+    c = disorder.client()
+    tracks = []
+    dirs = [""]
+    for d in dirs:
+        dirs.extend(c.directories(d))
+        tracks.extend(c.files(d))
+    print " %d tracks in %d directories" % (len(tracks), len(dirs))
+    subscribers = [subscriber() for n in range(options.subscribers)]
+    for s in subscribers:
+        s.start()
+    running = {}
+    threads = []
+    deadline = time.time() + options.duration
+    for name in options.workloads.split(","):
+        running[name] = workloads[name](tracks, dirs)
+        for n in range(options.clients):
+            t = threading.Thread(target=running[name].run,
+                                 args=(rng.random(), deadline))
+            t.start()
+            threads.append(t)
+    print " running %s for %ds with %d clients each" % (options.workloads,
+                                                        options.duration,
+                                                        options.clients)
+    for t in threads:
+        t.join()
+    results = {}
+    print
+    print "%-8s %8s %10s %10s %10s %6s" % ("workload", "ops", "ops/s",
+                                            "p50/ms", "p99/ms", "errors")
+    for name in sorted(running):
+        r = results[name] = summarize(running[name], options.duration)
+        print "%-8s %8d %10.1f %10.2f %10.2f %6d" % (name, r["ops"], r["rate"],
+                                                     r["p50"] * 1000,
+                                                     r["p99"] * 1000,
+                                                     r["errors"])
+    if subscribers:
+        print "%d subscribers received %d event log messages" % (
+            len(subscribers), sum([s.messages for s in subscribers]))
+    print
+    if options.save:
+        open(options.save, "w").write(repr(results) + "\n")
+    if options.baseline:
+        baseline = eval(open(options.baseline).read())
+        if compare(results, baseline, options.tolerance):
+            dtest.failures += 1
+
+parser = optparse.OptionParser(usage="%prog [OPTIONS]")
+parser.add_option("--tracks", type="int", default=2000,
+                  help="number of tracks to create (default %default)")
+parser.add_option("--clients", type="int", default=2,
+                  help="clients per workload (default %default)")
+parser.add_option("--subscribers", type="int", default=4,
+                  help="long-lived event log readers (default %default)")
+parser.add_option("--duration", type="int", default=30,
+                  help="seconds to run for (default %default)")
+parser.add_option("--workloads", default=",".join(sorted(workloads)),
+                  help="comma-separated workloads (default %default)")
+parser.add_option("--seed", type="int", default=1,
+                  help="random seed (default %default)")
+parser.add_option("--save", metavar="FILE",
+                  help="save results to FILE")
+parser.add_option("--baseline", metavar="FILE",
+                  help="compare with results saved in FILE")
+parser.add_option("--tolerance", type="float", default=0.2,
+                  help="acceptable slowdown vs baseline (default %default)")
+(options, args) = parser.parse_args()
+for name in options.workloads.split(","):
+    if name not in workloads:
+        dtest.fatal("unknown workload '%s'" % name)
+
+if __name__ == '__main__':
+    dtest.run()